@@ -22,8 +22,11 @@
 
 #cmakedefine HAVE_DTLS_SRTP 1
 #cmakedefine HAVE_CTR_DRGB_FREE 1
+#cmakedefine HAVE_CRYPTO 1
 #cmakedefine HAVE_CU_GET_SUITE 1
 #cmakedefine HAVE_CU_CURSES 1
 #cmakedefine HAVE_CU_SET_TRACE_HANDLER 1
 
 #cmakedefine HAVE_LIBRT 1
+#cmakedefine HAVE_PREADV 1
+#cmakedefine HAVE_PWRITEV 1
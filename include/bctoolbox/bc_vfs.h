@@ -35,6 +35,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef _WIN32	
@@ -70,6 +71,19 @@ extern "C"{
  */
 typedef struct bctbx_io_methods_t bctbx_io_methods_t;
 
+/**
+ * Buffer of a vectored read or write. It is a struct iovec where the system has one, so that the vectors can be
+ * given directly to preadv()/pwritev().
+ */
+#ifdef _WIN32
+typedef struct bctbx_iovec_t {
+	void *iov_base;
+	size_t iov_len;
+} bctbx_iovec_t;
+#else
+typedef struct iovec bctbx_iovec_t;
+#endif
+
 /**
  * VFS file handle.
  */
@@ -85,6 +99,11 @@ struct bctbx_vfs_file_t {
 
 
 /**
+ * The methods after pFuncSeek are optional: they may be left NULL, in which case the corresponding feature is either
+ * emulated with the mandatory methods or reported as not supported.
+ * They were appended to the structure, which changed its size: a table of methods written for a previous version
+ * must be rebuilt, and the initializer of a static table must zero-fill the slots it does not implement, which C does
+ * for the members omitted at the end of a brace initializer.
  */
 struct bctbx_io_methods_t {
 	int (*pFuncClose)(bctbx_vfs_file_t *pFile);
@@ -93,16 +112,24 @@ struct bctbx_io_methods_t {
 	int64_t (*pFuncFileSize)(bctbx_vfs_file_t *pFile);
 	int (*pFuncGetLineFromFd)(bctbx_vfs_file_t *pFile, char* s, int count);
 	off_t (*pFuncSeek)(bctbx_vfs_file_t *pFile, off_t offset, int whence);
+	int (*pFuncMapRegion)(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr);
+	ssize_t (*pFuncReadv)(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset);
+	ssize_t (*pFuncWritev)(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset);
+	int (*pFuncSync)(bctbx_vfs_file_t *pFile, bool_t data_only);
+	int (*pFuncTruncate)(bctbx_vfs_file_t *pFile, off_t size);
 };
 
 
 /**
  * VFS definition
+ * pFuncRename and pFuncDelete are optional, and must be NULL in the VFS that do not implement them.
  */
 typedef struct bctbx_vfs_t bctbx_vfs_t;
 struct bctbx_vfs_t {
 	const char *vfsName;       /* Virtual file system name */
 	int (*pFuncOpen)(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags);
+	int (*pFuncRename)(bctbx_vfs_t *pVfs, const char *oldName, const char *newName);
+	int (*pFuncDelete)(bctbx_vfs_t *pVfs, const char *fName);
 };
 
 
@@ -153,6 +180,23 @@ BCTBX_PUBLIC bctbx_vfs_file_t* bctbx_file_open(bctbx_vfs_t *pVfs, const char *fN
  */
 BCTBX_PUBLIC bctbx_vfs_file_t* bctbx_file_open2(bctbx_vfs_t *pVfs, const char *fName, const int openFlags);
 
+/**
+ * Wrapper to pFuncRename VFS method call. Rename the file oldName to newName, replacing newName if it exists.
+ * @param  pVfs     Pointer to the vfs instance in use.
+ * @param  oldName  Current path of the file.
+ * @param  newName  New path of the file.
+ * @return          BCTBX_VFS_OK on success, BCTBX_VFS_ERROR if an error occurred or the VFS has no pFuncRename.
+ */
+BCTBX_PUBLIC int bctbx_vfs_rename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName);
+
+/**
+ * Wrapper to pFuncDelete VFS method call. Delete the file fName.
+ * @param  pVfs   Pointer to the vfs instance in use.
+ * @param  fName  Path of the file.
+ * @return        BCTBX_VFS_OK on success, BCTBX_VFS_ERROR if an error occurred or the VFS has no pFuncDelete.
+ */
+BCTBX_PUBLIC int bctbx_vfs_delete(bctbx_vfs_t *pVfs, const char *fName);
+
 
 /**
  * Returns the file size.
@@ -172,6 +216,29 @@ BCTBX_PUBLIC int64_t bctbx_file_size(bctbx_vfs_file_t *pFile);
  */
 BCTBX_PUBLIC ssize_t bctbx_file_write(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset);
 
+/**
+ * Read from the file at offset into iovcnt buffers, filling each one before the next.
+ * Calls pFuncReadv, or pFuncRead for each buffer if the VFS does not provide it.
+ * @param  pFile  File handle pointer.
+ * @param  iov    Buffers to fill.
+ * @param  iovcnt Number of buffers.
+ * @param  offset Position in the file where to start reading.
+ * @return        Number of bytes read (less than the total size of the buffers at the end of the file),
+ *                BCTBX_VFS_ERROR if an error occurred.
+ */
+BCTBX_PUBLIC ssize_t bctbx_file_readv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset);
+
+/**
+ * Write the content of iovcnt buffers, one after the other, to the file at offset.
+ * Calls pFuncWritev, or pFuncWrite for each buffer if the VFS does not provide it.
+ * @param  pFile  File handle pointer.
+ * @param  iov    Buffers to write.
+ * @param  iovcnt Number of buffers.
+ * @param  offset Position in the file where to start writing.
+ * @return        Number of bytes written on success, BCTBX_VFS_ERROR if an error occurred.
+ */
+BCTBX_PUBLIC ssize_t bctbx_file_writev(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset);
+
 /**
  * Writes to file. 
  * @param  pFile  File handle pointer.
@@ -191,6 +258,48 @@ BCTBX_PUBLIC ssize_t bctbx_file_fprintf(bctbx_vfs_file_t *pFile, off_t offset, c
  */
 BCTBX_PUBLIC int bctbx_file_get_nxtline(bctbx_vfs_file_t *pFile, char *s, int maxlen);
 
+/**
+ * Implementation of pFuncGetLineFromFd for the VFS without file descriptor: reads at most maxlen - 1 bytes at
+ * pFile->offset with pFuncRead and returns the first line like the standard VFS, moving pFile->offset after its
+ * end of line.
+ * @param  pFile  File handle pointer.
+ * @param  s      Buffer where to store the line, null-terminated.
+ * @param  maxlen Size of s.
+ * @return        BCTBX_VFS_ERROR if an error occurred, the number of bytes consumed otherwise, 0 at end of file.
+ */
+BCTBX_PUBLIC int bctbx_vfs_get_line_from_read(bctbx_vfs_file_t *pFile, char *s, int maxlen);
+
+/**
+ * Buffered line reader over a file, reading the file by blocks instead of once per line.
+ */
+typedef struct _bctbx_vfs_line_reader bctbx_vfs_line_reader_t;
+
+/**
+ * Create a line reader starting at the current offset of the file (pFile->offset).
+ * The file must remain open while the reader is in use.
+ * @param  pFile       File handle pointer.
+ * @param  buffer_size Size of the blocks read from the file, 0 for the default. The buffer grows if a line is longer.
+ * @return             The line reader, to be destroyed with bctbx_vfs_line_reader_destroy().
+ */
+BCTBX_PUBLIC bctbx_vfs_line_reader_t *bctbx_vfs_line_reader_new(bctbx_vfs_file_t *pFile, size_t buffer_size);
+
+/**
+ * Get the next line of the file. Lines end with "\n", "\r\n" or "\r", the last one may have no end of line.
+ * The line is not copied: it points into the buffer of the reader and remains valid until the next call.
+ * pFile->offset is moved to the beginning of the following line.
+ * @param  reader Line reader.
+ * @param  line   Set to the start of the line, which is null-terminated in place of its end of line.
+ * @param  len    Set to the length of the line, end of line excluded.
+ * @return        1 if a line was read, 0 at the end of the file, BCTBX_VFS_ERROR or -errno on error.
+ */
+BCTBX_PUBLIC int bctbx_vfs_line_reader_next(bctbx_vfs_line_reader_t *reader, const char **line, size_t *len);
+
+/**
+ * Destroy a line reader. The file is not closed.
+ * @param reader Line reader.
+ */
+BCTBX_PUBLIC void bctbx_vfs_line_reader_destroy(bctbx_vfs_line_reader_t *reader);
+
 /**
  * Wrapper to pFuncSeek VFS method call. Set the position to offset in the file.
  * @param  pFile  File handle pointer.
@@ -200,6 +309,175 @@ BCTBX_PUBLIC int bctbx_file_get_nxtline(bctbx_vfs_file_t *pFile, char *s, int ma
  */
 BCTBX_PUBLIC off_t bctbx_file_seek(bctbx_vfs_file_t *pFile, off_t offset, int whence);
 
+/**
+ * Give a read-only pointer to count bytes of the file starting at offset, without copying them.
+ * Only supported by VFS providing pFuncMapRegion, such as the one returned by bctbx_vfs_get_mmap().
+ * @param  pFile  File handle pointer.
+ * @param  offset Start of the region in the file.
+ * @param  count  Size of the region, which must lie within the file.
+ * @param  ptr    Set to the start of the region, which remains valid until the file is closed.
+ * @return        BCTBX_VFS_OK on success, BCTBX_VFS_ERROR otherwise.
+ */
+BCTBX_PUBLIC int bctbx_file_map_region(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr);
+
+/**
+ * Wrapper to pFuncSync VFS method call. Make the data written to the file durable.
+ * @param  pFile     File handle pointer.
+ * @param  data_only If TRUE, the metadata that is not needed to read the data back (such as the modification
+ *                   time) may not be synced, like with fdatasync().
+ * @return           BCTBX_VFS_OK on success, BCTBX_VFS_ERROR if an error occurred or the VFS has no pFuncSync.
+ */
+BCTBX_PUBLIC int bctbx_file_sync(bctbx_vfs_file_t *pFile, bool_t data_only);
+
+/**
+ * Wrapper to pFuncTruncate VFS method call. Set the size of the file, the bytes added reading as zeros.
+ * The regions given by bctbx_file_map_region() past the new size must not be accessed anymore.
+ * @param  pFile  File handle pointer.
+ * @param  size   New size of the file.
+ * @return        BCTBX_VFS_OK on success, BCTBX_VFS_ERROR if an error occurred or the VFS has no pFuncTruncate.
+ */
+BCTBX_PUBLIC int bctbx_file_truncate(bctbx_vfs_file_t *pFile, off_t size);
+
+/**
+ * Writer gathering the small writes made to a file in a buffer, to write them with as few calls as possible.
+ * Writes continuing the data buffered are appended to it; the buffer is written when it is full, when a write does
+ * not continue it, and when the writer is flushed, synced or destroyed. The data buffered is not visible to the
+ * reads of the file.
+ */
+typedef struct _bctbx_vfs_buffered_writer bctbx_vfs_buffered_writer_t;
+
+/**
+ * Create a buffered writer on an open file, which must outlive it.
+ * @param  pFile        File handle pointer.
+ * @param  buffer_size  Size of the buffer, 0 for the default one.
+ */
+BCTBX_PUBLIC bctbx_vfs_buffered_writer_t *bctbx_vfs_buffered_writer_new(bctbx_vfs_file_t *pFile, size_t buffer_size);
+
+/**
+ * Write count bytes at offset, through the buffer. Writes larger than the buffer are made directly.
+ * @return count on success, BCTBX_VFS_ERROR if writing the buffer or the data failed.
+ */
+BCTBX_PUBLIC ssize_t bctbx_vfs_buffered_writer_write(bctbx_vfs_buffered_writer_t *writer, const void *buf, size_t count, off_t offset);
+
+/**
+ * Write count bytes after the last byte written through the writer, or at the end of the file for the first write.
+ */
+BCTBX_PUBLIC ssize_t bctbx_vfs_buffered_writer_append(bctbx_vfs_buffered_writer_t *writer, const void *buf, size_t count);
+
+/**
+ * Write the data buffered to the file.
+ * @return BCTBX_VFS_OK on success, BCTBX_VFS_ERROR otherwise.
+ */
+BCTBX_PUBLIC int bctbx_vfs_buffered_writer_flush(bctbx_vfs_buffered_writer_t *writer);
+
+/**
+ * Write the data buffered to the file, then make it durable with bctbx_file_sync().
+ */
+BCTBX_PUBLIC int bctbx_vfs_buffered_writer_sync(bctbx_vfs_buffered_writer_t *writer, bool_t data_only);
+
+/**
+ * Flush and destroy a buffered writer.
+ * @return the result of the flush.
+ */
+BCTBX_PUBLIC int bctbx_vfs_buffered_writer_destroy(bctbx_vfs_buffered_writer_t *writer);
+
+/**
+ * Group commit: the threads appending to a file ask for their data to be made durable with
+ * bctbx_vfs_group_commit_sync(). Instead of one sync per call, the first caller waits for the others during a short
+ * window, then syncs the file once for all the callers arrived meanwhile, or during the previous sync.
+ */
+typedef struct _bctbx_vfs_group_commit bctbx_vfs_group_commit_t;
+
+/**
+ * Create a group commit on an open file, which must outlive it.
+ * @param  pFile      File handle pointer.
+ * @param  window_ms  Time given to the other writers to join a sync, 0 to only group the calls arriving during a sync.
+ * @param  data_only  Kind of sync made, see bctbx_file_sync().
+ */
+BCTBX_PUBLIC bctbx_vfs_group_commit_t *bctbx_vfs_group_commit_new(bctbx_vfs_file_t *pFile, int window_ms, bool_t data_only);
+
+/**
+ * Destroy a group commit. No thread may be inside bctbx_vfs_group_commit_sync().
+ */
+BCTBX_PUBLIC void bctbx_vfs_group_commit_destroy(bctbx_vfs_group_commit_t *gc);
+
+/**
+ * Make durable the data written to the file before the call, by a sync shared with the other callers.
+ * Once a sync failed, the following calls fail as well: the data written before cannot be known to be durable.
+ * @return BCTBX_VFS_OK on success, BCTBX_VFS_ERROR otherwise.
+ */
+BCTBX_PUBLIC int bctbx_vfs_group_commit_sync(bctbx_vfs_group_commit_t *gc);
+
+/**
+ * Get the number of syncs actually made on the file, to be compared to the number of calls.
+ */
+BCTBX_PUBLIC uint64_t bctbx_vfs_group_commit_get_sync_count(bctbx_vfs_group_commit_t *gc);
+
+/**
+ * Asynchronous file operations.
+ * The operations are executed by a pool of worker threads, started on the first request. The operations requested
+ * on a file are executed one after the other in the order of the requests, the operations on different files run
+ * in parallel. The file and the buffers must remain valid until the completion callback is called.
+ * The callback is called with the result the synchronous function would have returned. When no completion queue is
+ * given, it is called from a worker thread, otherwise from the thread processing the queue.
+ */
+typedef void (*bctbx_file_async_cb)(bctbx_vfs_file_t *pFile, ssize_t result, void *user_data);
+
+/**
+ * Queue of completed asynchronous operations, to get their callbacks called from a chosen thread (an event loop).
+ */
+typedef struct _bctbx_vfs_completion_queue bctbx_vfs_completion_queue_t;
+
+BCTBX_PUBLIC bctbx_vfs_completion_queue_t *bctbx_vfs_completion_queue_new(void);
+
+/**
+ * Destroy a completion queue. No operation using it may be pending.
+ */
+BCTBX_PUBLIC void bctbx_vfs_completion_queue_destroy(bctbx_vfs_completion_queue_t *queue);
+
+/**
+ * Call the callbacks of the operations completed so far, without blocking.
+ * @return the number of callbacks called.
+ */
+BCTBX_PUBLIC int bctbx_vfs_completion_queue_process(bctbx_vfs_completion_queue_t *queue);
+
+/**
+ * Wait until at least one operation is completed, then call the callbacks of the operations completed so far.
+ * @return the number of callbacks called.
+ */
+BCTBX_PUBLIC int bctbx_vfs_completion_queue_wait(bctbx_vfs_completion_queue_t *queue);
+
+/**
+ * Asynchronous bctbx_file_read().
+ * @param  queue Completion queue where to report the completion, NULL to call cb from a worker thread.
+ * @return BCTBX_VFS_OK if the operation is scheduled, BCTBX_VFS_ERROR otherwise (the callback is then not called).
+ */
+BCTBX_PUBLIC int bctbx_file_read_async(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data);
+
+/**
+ * Asynchronous bctbx_file_write(). See bctbx_file_read_async().
+ */
+BCTBX_PUBLIC int bctbx_file_write_async(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data);
+
+/**
+ * Asynchronous bctbx_file_sync(), covering the writes requested before on the same file. See bctbx_file_read_async().
+ */
+BCTBX_PUBLIC int bctbx_file_fsync_async(bctbx_vfs_file_t *pFile, bool_t data_only,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data);
+
+/**
+ * Set the number of worker threads of the asynchronous operations (4 by default). Only taken into account when the
+ * workers are started, on the first request after startup or bctbx_vfs_async_shutdown().
+ */
+BCTBX_PUBLIC void bctbx_vfs_async_set_thread_count(int count);
+
+/**
+ * Execute the pending asynchronous operations and stop the worker threads.
+ */
+BCTBX_PUBLIC void bctbx_vfs_async_shutdown(void);
+
 
 /**
  * Set default VFS pointer pDefault to my_vfs.
@@ -218,10 +496,148 @@ BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_get_default(void);
 	
 /**
  * Return pointer to standard VFS impletentation.
+ * Its reads and writes are positional (pread()/pwrite()): they neither use nor move the offset of the file
+ * descriptor, and are retried until all the bytes are transferred. A single file handle can therefore serve several
+ * threads reading in parallel, each one at its own offsets.
  * @return  pointer to bcVfs
  */
 BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_get_standard(void);
 
+/**
+ * Return pointer to the memory-mapped VFS implementation.
+ * Files are opened and written as with the standard VFS, but reads are copies from a read-only mapping of the file,
+ * which is extended when the file grows. bctbx_file_map_region() gives access to the mapping without copy.
+ * The mapping extends past the end of the file and at least doubles when the file outgrows it. The mappings it
+ * replaces stay until the file is closed, since regions may still point into them: their number and size remain
+ * logarithmic in the file size, except on Windows where each growth of the file read maps it again.
+ * @return  pointer to the memory-mapped VFS
+ */
+BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_get_mmap(void);
+
+/**
+ * Counters of a caching VFS, cumulated over all its files.
+ */
+typedef struct bctbx_vfs_cache_stats_t {
+	uint64_t hits;              /* page lookups served by the cache */
+	uint64_t misses;            /* page lookups that needed a read from the wrapped VFS */
+	uint64_t readahead_pages;   /* pages read in advance because the file was read sequentially */
+	uint64_t evictions;         /* pages dropped to make room for others */
+	uint64_t writes;            /* write calls made to the wrapped VFS, each one covering a run of dirty pages */
+} bctbx_vfs_cache_stats_t;
+
+/**
+ * Create a VFS caching the files of another one in memory.
+ * Each open file has its own cache of at most capacity pages of page_size bytes, the least recently used page being
+ * replaced when it is full. Sequential reads are detected and trigger reading the next pages in advance, with a window
+ * growing up to half the capacity. Writes are kept in the cache and written back in as few calls as possible when
+ * dirty pages are evicted, when half the pages are dirty, and when the file is closed.
+ * The cache assumes that the file is not modified by other means while it is open.
+ * @param  wrapped   The VFS the files are read from and written to.
+ * @param  page_size Size of a page, in bytes.
+ * @param  capacity  Maximum number of pages kept in memory for each open file, at least 2.
+ * @return  the caching VFS, to be released with bctbx_vfs_cache_destroy() once all its files are closed.
+ */
+BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_cache_new(bctbx_vfs_t *wrapped, size_t page_size, size_t capacity);
+
+BCTBX_PUBLIC void bctbx_vfs_cache_destroy(bctbx_vfs_t *cache);
+
+/**
+ * Get the counters of a caching VFS created with bctbx_vfs_cache_new().
+ */
+BCTBX_PUBLIC void bctbx_vfs_cache_get_stats(bctbx_vfs_t *cache, bctbx_vfs_cache_stats_t *stats);
+
+BCTBX_PUBLIC void bctbx_vfs_cache_reset_stats(bctbx_vfs_t *cache);
+
+/**
+ * Create a VFS keeping its files in memory, for tests, benchmarks and temporary data.
+ * The files are identified by their name and live until they are unlinked or the VFS is destroyed, so that they can
+ * be closed and opened again. Opening follows the open() flags: O_CREAT, O_EXCL, O_TRUNC and the access mode.
+ * The content is stored in chunks allocated on first write, the parts never written reading as zeros.
+ * A region can be mapped if it lies in a single chunk of 64KB; the pointer stays valid until the file is released
+ * or truncated.
+ * The files have no file descriptor. They can be deleted with bctbx_vfs_delete() but not renamed.
+ * @param  max_size Maximum number of bytes allocated for the content of all the files, 0 for no limit.
+ *                  A write needing more memory fails with -ENOSPC.
+ * @return  the memory VFS, to be released with bctbx_vfs_memory_destroy() once all its files are closed.
+ */
+BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_memory_new(uint64_t max_size);
+
+/**
+ * Release a memory VFS and all its files.
+ */
+BCTBX_PUBLIC void bctbx_vfs_memory_destroy(bctbx_vfs_t *vfs);
+
+/**
+ * Remove a file from a memory VFS. If it is open, its content is released when it is closed.
+ * @return BCTBX_VFS_OK, or BCTBX_VFS_ERROR if there is no such file.
+ */
+BCTBX_PUBLIC int bctbx_vfs_memory_unlink(bctbx_vfs_t *vfs, const char *fName);
+
+/**
+ * Operations counted by the VFS created with bctbx_vfs_stats_new().
+ */
+typedef enum _bctbx_vfs_op {
+	BCTBX_VFS_OP_OPEN,
+	BCTBX_VFS_OP_CLOSE,
+	BCTBX_VFS_OP_READ,
+	BCTBX_VFS_OP_WRITE,
+	BCTBX_VFS_OP_FILE_SIZE,
+	BCTBX_VFS_OP_GET_LINE,
+	BCTBX_VFS_OP_SEEK,
+	BCTBX_VFS_OP_MAP_REGION,
+	BCTBX_VFS_OP_READV,
+	BCTBX_VFS_OP_WRITEV,
+	BCTBX_VFS_OP_SYNC,
+	BCTBX_VFS_OP_TRUNCATE,
+	BCTBX_VFS_OP_COUNT
+} bctbx_vfs_op_t;
+
+#define BCTBX_VFS_LATENCY_BUCKETS 32
+
+/**
+ * Counters of an operation.
+ * latency[i] counts the calls that took from 2^i to 2^(i+1) - 1 nanoseconds, the first bucket starting at 0 and the
+ * last one having no upper bound.
+ */
+typedef struct bctbx_vfs_op_stats_t {
+	uint64_t calls;
+	uint64_t errors;            /* calls that returned an error */
+	uint64_t bytes;             /* bytes read, written, or consumed by get_line */
+	uint64_t total_ns;          /* time spent in the calls */
+	uint64_t latency[BCTBX_VFS_LATENCY_BUCKETS];
+} bctbx_vfs_op_stats_t;
+
+typedef struct bctbx_vfs_stats_t {
+	bctbx_vfs_op_stats_t ops[BCTBX_VFS_OP_COUNT]; /* indexed by bctbx_vfs_op_t */
+} bctbx_vfs_stats_t;
+
+/**
+ * Create a VFS counting the operations made on the files of another one, and the time they take.
+ * The files are grouped by the longest of the given prefixes their path starts with, to get the counters of a part
+ * of the tree. Each thread updates its own counters, without lock, which are summed when they are read.
+ * @param  wrapped      The VFS the operations are forwarded to.
+ * @param  prefixes     Path prefixes whose files are counted separately, copied. May be NULL.
+ * @param  prefix_count Number of prefixes.
+ * @return  the VFS, to be released with bctbx_vfs_stats_destroy() once all its files are closed.
+ */
+BCTBX_PUBLIC bctbx_vfs_t* bctbx_vfs_stats_new(bctbx_vfs_t *wrapped, const char *const *prefixes, int prefix_count);
+
+BCTBX_PUBLIC void bctbx_vfs_stats_destroy(bctbx_vfs_t *vfs);
+
+/**
+ * Get the counters accumulated since the creation of the VFS or the last bctbx_vfs_stats_reset().
+ * @param  prefix NULL for all the files, or one of the prefixes given at creation for the files grouped under it.
+ * @return BCTBX_VFS_OK, or BCTBX_VFS_ERROR if the prefix is unknown.
+ */
+BCTBX_PUBLIC int bctbx_vfs_stats_get(bctbx_vfs_t *vfs, const char *prefix, bctbx_vfs_stats_t *stats);
+
+BCTBX_PUBLIC void bctbx_vfs_stats_reset(bctbx_vfs_t *vfs);
+
+/**
+ * Name of an operation, for reports.
+ */
+BCTBX_PUBLIC const char *bctbx_vfs_op_name(bctbx_vfs_op_t op);
+
 
 #ifdef __cplusplus
 }
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define BCTBX_CRYPTO_H
 
 #include <bctoolbox/port.h>
+#include <bctoolbox/bc_vfs.h>
 
 
 /* DHM settings defines */
@@ -697,6 +698,77 @@ BCTBX_PUBLIC int32_t bctbx_aes_gcm_process_chunk(bctbx_aes_gcm_context_t *contex
 BCTBX_PUBLIC int32_t bctbx_aes_gcm_finish(bctbx_aes_gcm_context_t *context,
 		uint8_t *tag, size_t tagLength);
 
+/**
+ * AES-GCM key context: holds the key schedule, so that encrypting many small messages with the same key does not
+ * compute it again for each of them. A key context must not be used by several threads at once.
+ */
+typedef struct bctbx_aes_gcm_key_struct bctbx_aes_gcm_key_t;
+
+/**
+ * @Brief create an AES-GCM key context
+ *
+ * @param[in]	key							encryption key
+ * @param[in]	keyLength					key buffer length, in bytes, must be 16,24 or 32
+ *
+ * @return a pointer to the created key context, to be freed using bctbx_aes_gcm_key_free(), NULL on error
+ */
+BCTBX_PUBLIC bctbx_aes_gcm_key_t *bctbx_aes_gcm_key_new(const uint8_t *key, size_t keyLength);
+
+/**
+ * @Brief AES-GCM encrypt and tag buffer, like bctbx_aes_gcm_encrypt_and_tag() but with a key context
+ *
+ * @return 0 on success, crypto library error code otherwise
+ */
+BCTBX_PUBLIC int32_t bctbx_aes_gcm_key_encrypt_and_tag(bctbx_aes_gcm_key_t *key,
+		const uint8_t *plainText, size_t plainTextLength,
+		const uint8_t *authenticatedData, size_t authenticatedDataLength,
+		const uint8_t *initializationVector, size_t initializationVectorLength,
+		uint8_t *tag, size_t tagLength,
+		uint8_t *output);
+
+/**
+ * @Brief AES-GCM decrypt and check the authentication tag, like bctbx_aes_gcm_decrypt_and_auth() but with a key context
+ *
+ * @return 0 on succes, BCTBX_ERROR_AUTHENTICATION_FAILED if tag doesn't match or crypto library error code
+ */
+BCTBX_PUBLIC int32_t bctbx_aes_gcm_key_decrypt_and_auth(bctbx_aes_gcm_key_t *key,
+		const uint8_t *cipherText, size_t cipherTextLength,
+		const uint8_t *authenticatedData, size_t authenticatedDataLength,
+		const uint8_t *initializationVector, size_t initializationVectorLength,
+		const uint8_t *tag, size_t tagLength,
+		uint8_t *output);
+
+/**
+ * @Brief free an AES-GCM key context and its key schedule
+ */
+BCTBX_PUBLIC void bctbx_aes_gcm_key_free(bctbx_aes_gcm_key_t *key);
+
+/*****************************************************************************/
+/***** Encrypted VFS                                                     *****/
+/*****************************************************************************/
+/**
+ * @Brief create a VFS encrypting the files of another VFS with AES-GCM
+ *
+ * Files are split in blocks encrypted separately, each one with a random nonce and an authentication tag, so that
+ * a read or a write only decrypts and encrypts the blocks it touches. A block failing authentication makes the read
+ * fail. The blocks are bound to their file and position, and the last one is checked when opening the file, so that
+ * blocks moved, copied from another file or removed from the end are detected. Putting back an older version of a
+ * block of the same file is not.
+ *
+ * @param[in]	wrapped		VFS storing the encrypted files
+ * @param[in]	key			encryption key, copied
+ * @param[in]	keyLength	key length in bytes, must be 16, 24 or 32
+ * @param[in]	blockSize	size of the plain text blocks of the new files, 0 for 4096. Existing files keep theirs.
+ *
+ * @return the VFS, to be destroyed with bctbx_vfs_aes_gcm_destroy() once its files are closed, NULL on error
+ */
+BCTBX_PUBLIC bctbx_vfs_t *bctbx_vfs_aes_gcm_new(bctbx_vfs_t *wrapped, const uint8_t *key, size_t keyLength, size_t blockSize);
+
+/**
+ * @Brief destroy a VFS created by bctbx_vfs_aes_gcm_new(), erasing its key
+ */
+BCTBX_PUBLIC void bctbx_vfs_aes_gcm_destroy(bctbx_vfs_t *vfs);
+
 
 /**
  * @brief Wrapper for AES-128 in CFB128 mode encryption
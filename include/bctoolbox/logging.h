@@ -56,7 +56,7 @@ BCTBX_PUBLIC BctoolboxLogFunc bctbx_get_log_handler(void);
 
 BCTBX_PUBLIC void bctbx_logv_out(const char *domain, BctbxLogLevel level, const char *fmt, va_list args);
 
-#define bctbx_log_level_enabled(domain, level)	(bctbx_get_log_level_mask(domain) & (level))
+#define bctbx_log_level_enabled(domain, level)	(bctbx_get_log_enabled_mask(domain) & (level))
 
 BCTBX_PUBLIC void bctbx_logv(const char *domain, BctbxLogLevel level, const char *fmt, va_list args);
 
@@ -71,9 +71,128 @@ BCTBX_PUBLIC void bctbx_logv_flush(void);
 **/
 BCTBX_PUBLIC void bctbx_set_log_level(const char *domain, BctbxLogLevel level);
 
+/**
+ * Set the levels enabled for a domain, or the default levels if domain is NULL.
+ * Domains are hierarchical, their name components being separated by dots: the levels set for "app.sip" also apply to
+ * "app.sip.transport" and "app.sip.dialog", unless they have levels of their own. Domains without levels set for
+ * them or for one of their parents use the default levels.
+**/
 BCTBX_PUBLIC void bctbx_set_log_level_mask(const char *domain, int levelmask);
 BCTBX_PUBLIC unsigned int bctbx_get_log_level_mask(const char *domain);
 
+/**
+ * Levels for which the messages of a domain are processed: its level mask, plus every level while the flight
+ * recorder is enabled. This is the single mask tested by bctbx_log_level_enabled().
+**/
+BCTBX_PUBLIC unsigned int bctbx_get_log_enabled_mask(const char *domain);
+
+/**
+ * Limit the number of messages output for a domain with a token bucket.
+ * Messages exceeding the limit are dropped; the number of dropped messages is reported by a
+ * "N messages suppressed by rate limiting" line before the next message of the domain that goes through.
+ * Fatal messages are never dropped.
+ * @param[in] domain The log domain, NULL for messages logged without domain.
+ * @param[in] rate The number of messages per second, 0 to remove the limit.
+ * @param[in] burst The number of messages that can be output at once after a quiet period.
+**/
+BCTBX_PUBLIC void bctbx_set_log_rate_limit(const char *domain, unsigned int rate, unsigned int burst);
+
+/**
+ * Same as bctbx_set_log_rate_limit(), but the limit applies separately to each callsite of the domain.
+ * A callsite is identified by the format string it passes to the logger.
+**/
+BCTBX_PUBLIC void bctbx_set_log_callsite_rate_limit(const char *domain, unsigned int rate, unsigned int burst);
+
+/**
+ * Only output one message out of one_in_n for a domain. Dropped messages are reported as with bctbx_set_log_rate_limit().
+ * @param[in] domain The log domain, NULL for messages logged without domain.
+ * @param[in] one_in_n The sampling period, 0 or 1 to output all messages.
+**/
+BCTBX_PUBLIC void bctbx_set_log_sampling(const char *domain, unsigned int one_in_n);
+
+/*number of log levels, the statistics of a level are at the index of its bit in BctbxLogLevel*/
+#define BCTBX_LOG_LEVEL_COUNT 6
+
+/*number of domains having their own statistics, the ones created after are accounted together*/
+#define BCTBX_LOG_STATS_MAX_DOMAINS 256
+/*name of the entry accounting the domains beyond BCTBX_LOG_STATS_MAX_DOMAINS*/
+#define BCTBX_LOG_STATS_OTHER_DOMAINS "*"
+
+typedef struct _bctbx_log_level_stats {
+	uint64_t emitted; /*messages output to the handler and the sinks*/
+	uint64_t filtered; /*messages discarded by the level mask of the domain*/
+	uint64_t dropped; /*messages discarded by rate limiting, sampling or full asynchronous sink queues*/
+	uint64_t bytes; /*bytes written by the default handler, the file sinks and the JSON sinks*/
+	uint64_t handler_time_us; /*time spent outputting the messages to the handler and the synchronous sinks*/
+} bctbx_log_level_stats_t;
+
+typedef struct _bctbx_log_domain_stats {
+	char *domain; /*NULL for messages logged without domain*/
+	bctbx_log_level_stats_t levels[BCTBX_LOG_LEVEL_COUNT];
+} bctbx_log_domain_stats_t;
+
+/**
+ * Take a snapshot of the logging statistics. The counters are updated without lock by the logging threads, so the
+ * snapshot is not atomic as a whole.
+ * @param[out] count The number of domains in the returned array, the first one being the messages without domain.
+ * If more than BCTBX_LOG_STATS_MAX_DOMAINS domains were used, the last one, named BCTBX_LOG_STATS_OTHER_DOMAINS,
+ * accounts the messages of all the domains beyond this limit.
+ * @return An array to be freed with bctbx_log_stats_free().
+**/
+BCTBX_PUBLIC bctbx_log_domain_stats_t *bctbx_log_get_stats(size_t *count);
+
+BCTBX_PUBLIC void bctbx_log_stats_free(bctbx_log_domain_stats_t *stats, size_t count);
+
+/**
+ * Reset all the logging statistics to zero.
+**/
+BCTBX_PUBLIC void bctbx_log_reset_stats(void);
+
+/**
+ * Enable the flight recorder: every message, whatever its level and the level masks, is kept in an in-memory ring
+ * owned by the thread that logs it. The rings are only written to disk by a dump, which happens when a fatal message
+ * is logged, when bctbx_log_flight_recorder_dump() is called or, if installed, from the crash signal handlers.
+ * Messages longer than about 200 characters are truncated in the rings.
+ * @param[in] ring_size The size in bytes of the ring of each thread. It is only taken into account the first time,
+ * 0 disables recording (the rings are kept).
+ * @param[in] dump_path The file written by dumps on fatal messages and signals, NULL for no such dump.
+**/
+BCTBX_PUBLIC void bctbx_log_flight_recorder_enable(size_t ring_size, const char *dump_path);
+
+BCTBX_PUBLIC bool_t bctbx_log_flight_recorder_enabled(void);
+
+/**
+ * Write the content of all the rings, ordered by time, to the given file (overwritten), or to the dump path if NULL.
+ * @return The number of messages written, -1 on error.
+**/
+BCTBX_PUBLIC int bctbx_log_flight_recorder_dump(const char *path);
+
+/**
+ * Same as bctbx_log_flight_recorder_dump() to an already open file descriptor. This function is async-signal-safe,
+ * it can be called from the signal handler of an application.
+**/
+BCTBX_PUBLIC int bctbx_log_flight_recorder_dump_fd(int fd);
+
+/**
+ * Install handlers for SIGSEGV, SIGABRT, SIGFPE, SIGILL and SIGBUS that dump the rings to the dump path before
+ * performing the default action of the signal.
+ * @return 0 on success, -1 on error.
+**/
+BCTBX_PUBLIC int bctbx_log_flight_recorder_install_signal_handlers(void);
+
+/**
+ * Coalesce consecutive identical messages (same domain, level and text).
+ * A message identical to the previous one and logged less than window_ms after the previous output line is not output.
+ * Instead a single "last message repeated N times" line is output before the next different message.
+ * @param[in] window_ms The coalescing window in milliseconds, 0 to disable coalescing (default).
+**/
+BCTBX_PUBLIC void bctbx_set_log_coalescing_window(unsigned int window_ms);
+
+/**
+ * Output the pending "last message repeated N times" line, if any.
+**/
+BCTBX_PUBLIC void bctbx_log_coalescing_flush(void);
+
 /**
  * Tell oRTP the id of the thread used to output the logs.
  * This is meant to output all the logs from the same thread to prevent deadlock problems at the application level.
@@ -81,6 +200,201 @@ BCTBX_PUBLIC unsigned int bctbx_get_log_level_mask(const char *domain);
  */
 BCTBX_PUBLIC void bctbx_set_log_thread_id(unsigned long thread_id);
 
+/**
+ * Buffered file sink.
+ * Log lines are formatted directly into a user-space buffer which is written to the file only when it is full,
+ * when a message of a level listed in the flush policy is logged, when the flush timer expires or when
+ * bctbx_log_file_sink_flush() is called. The buffer is always drained before bctoolbox aborts on a fatal message.
+**/
+typedef struct _bctbx_log_file_sink bctbx_log_file_sink_t;
+
+typedef struct _bctbx_log_flush_policy {
+	unsigned int level_mask; /*mask of levels causing an immediate flush, typically BCTBX_LOG_ERROR|BCTBX_LOG_FATAL*/
+	unsigned int interval_ms; /*if not 0, the buffer is flushed at least every interval_ms by a timer thread*/
+} bctbx_log_flush_policy_t;
+
+/**
+ * Create a buffered file sink. The file is opened in append mode through the default VFS.
+ * @param[in] path The path of the log file.
+ * @param[in] buffer_size The size of the user-space buffer in bytes, 0 to use the default size.
+ * @param[in] flush_policy The flush policy, or NULL to flush on BCTBX_LOG_ERROR and BCTBX_LOG_FATAL messages only.
+ * @return the sink, or NULL if the file could not be opened.
+**/
+BCTBX_PUBLIC bctbx_log_file_sink_t *bctbx_log_file_sink_new(const char *path, size_t buffer_size, const bctbx_log_flush_policy_t *flush_policy);
+
+/**
+ * Flush the buffer and close the file. If the sink is the one set with bctbx_set_log_file_sink(), it is unset first.
+**/
+BCTBX_PUBLIC void bctbx_log_file_sink_destroy(bctbx_log_file_sink_t *sink);
+
+/**
+ * Write the content of the buffer to the file.
+ * @return 0 on success, -1 if the data could not be written.
+**/
+BCTBX_PUBLIC int bctbx_log_file_sink_flush(bctbx_log_file_sink_t *sink);
+
+/**
+ * Format a log message and append it to the buffer of the sink, flushing it if required by the flush policy.
+**/
+BCTBX_PUBLIC void bctbx_log_file_sink_logv(bctbx_log_file_sink_t *sink, const char *domain, BctbxLogLevel lev, const char *fmt, va_list args);
+
+typedef struct _bctbx_log_rotation_policy {
+	int64_t max_size; /*size in bytes above which the file is rotated, 0 for no limit*/
+	unsigned int max_age_s; /*age in seconds above which the file is rotated, 0 for no limit*/
+	unsigned int keep_count; /*number of rotated files kept, named path.1 (most recent) to path.keep_count*/
+} bctbx_log_rotation_policy_t;
+
+/**
+ * Enable rotation of the file written by the sink. Rotation (renames and opening of the new file) is performed by
+ * a background thread, so that logging threads never wait for it: lines logged meanwhile go to the rotated file.
+ * The files are renamed and deleted through the VFS the sink was created with, which must provide pFuncRename and
+ * pFuncDelete: rotation is refused otherwise, for instance with the memory VFS.
+ * @param[in] rotation The rotation policy, NULL to disable rotation.
+ * @return 0 on success, -1 if rotation is not supported by the VFS of the sink.
+**/
+BCTBX_PUBLIC int bctbx_log_file_sink_set_rotation(bctbx_log_file_sink_t *sink, const bctbx_log_rotation_policy_t *rotation);
+
+/**
+ * Request a rotation of the file written by the sink, whatever the rotation policy. The rotation is asynchronous.
+ * @return 0 on success, -1 if rotation is not supported by the VFS of the sink.
+**/
+BCTBX_PUBLIC int bctbx_log_file_sink_rotate(bctbx_log_file_sink_t *sink);
+
+/**
+ * Use a buffered file sink as the log output, instead of the FILE set with bctbx_set_log_file().
+ * This replaces the log handler. Passing NULL restores the default handler.
+**/
+BCTBX_PUBLIC void bctbx_set_log_file_sink(bctbx_log_file_sink_t *sink);
+
+/**
+ * Log sinks receive the messages in addition to the log handler. Any number of sinks can be added, each one with its
+ * own level mask and domain filter. A message is formatted once and the same text is passed to all the sinks
+ * accepting it.
+**/
+typedef struct _bctbx_log_sink bctbx_log_sink_t;
+
+/**
+ * Function called by a sink for each message it accepts.
+ * @param[in] msg The formatted message, without the date, domain and level prefix. It is only valid during the call.
+ * @param[in] len The length of msg.
+**/
+typedef void (*bctbx_log_sink_func_t)(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, size_t len);
+
+/**
+ * Create a sink calling func. The sink accepts all levels and all domains until configured otherwise.
+**/
+BCTBX_PUBLIC bctbx_log_sink_t *bctbx_log_sink_new(bctbx_log_sink_func_t func, void *user_data);
+
+/**
+ * Remove the sink from the logger if it was added, and release it. An asynchronous sink outputs its queued messages
+ * before being destroyed.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_destroy(bctbx_log_sink_t *sink);
+
+/**
+ * Set the levels accepted by the sink, a mask of BctbxLogLevel. Messages must also be enabled for their domain with
+ * bctbx_set_log_level_mask() to reach the sinks.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_set_level_mask(bctbx_log_sink_t *sink, unsigned int levelmask);
+
+/**
+ * Only accept the messages of the given domain, or of all domains if NULL. Must be called before the sink is added.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_set_domain(bctbx_log_sink_t *sink, const char *domain);
+
+/**
+ * Make the sink asynchronous: messages are queued and passed to the sink function by a dedicated thread, so that a
+ * slow sink does not delay the logging threads. When max_queued messages are waiting, new ones are dropped.
+ * Must be called before the sink is added.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_set_async(bctbx_log_sink_t *sink, size_t max_queued);
+
+/**
+ * Function flushing the output of a sink, such as the buffer of a file.
+**/
+typedef void (*bctbx_log_sink_flush_func_t)(void *user_data);
+
+/**
+ * Set the function flushing the output of the sink, called with its user data before the process is aborted by a
+ * fatal message, once the queued messages of an asynchronous sink have been output. It is set by default for the
+ * sinks of bctbx_log_file_sink_func() and for the JSON sinks.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_set_flush_func(bctbx_log_sink_t *sink, bctbx_log_sink_flush_func_t flush_func);
+
+/**
+ * Number of messages dropped by an asynchronous sink because its queue was full.
+**/
+BCTBX_PUBLIC unsigned int bctbx_log_sink_get_dropped(const bctbx_log_sink_t *sink);
+
+/**
+ * Add the sink to the logger. It can be added and removed at any time, from any thread.
+**/
+BCTBX_PUBLIC void bctbx_log_add_sink(bctbx_log_sink_t *sink);
+
+BCTBX_PUBLIC void bctbx_log_remove_sink(bctbx_log_sink_t *sink);
+
+/**
+ * Sink function writing to a buffered file sink, to be used with bctbx_log_sink_new() and the file sink as user data.
+**/
+BCTBX_PUBLIC void bctbx_log_file_sink_func(void *file_sink, const char *domain, BctbxLogLevel lev, const char *msg, size_t len);
+
+/**
+ * Structured logging: a message comes with a list of typed key/value fields, that sinks having a key/value function
+ * receive as is. The log handler and the other sinks receive the message followed by the fields as key=value pairs.
+**/
+typedef enum _bctbx_log_kv_type {
+	BCTBX_LOG_KV_STRING, /*value is a const char *, NULL is output as null*/
+	BCTBX_LOG_KV_INT, /*value is an int*/
+	BCTBX_LOG_KV_INT64, /*value is an int64_t*/
+	BCTBX_LOG_KV_UINT64, /*value is an uint64_t*/
+	BCTBX_LOG_KV_DOUBLE, /*value is a double*/
+	BCTBX_LOG_KV_BOOL /*value is an int (a bool_t), output as true or false*/
+} bctbx_log_kv_type_t;
+
+typedef struct _bctbx_log_kv {
+	const char *key;
+	bctbx_log_kv_type_t type;
+	union {
+		const char *s;
+		int64_t i; /*for BCTBX_LOG_KV_INT, BCTBX_LOG_KV_INT64 and BCTBX_LOG_KV_BOOL*/
+		uint64_t u;
+		double d;
+	} value;
+} bctbx_log_kv_t;
+
+/**
+ * Log a structured message. The message is followed by key, type and value triplets, the type being a
+ * bctbx_log_kv_type_t, and terminated by a NULL key. At most BCTBX_LOG_KV_MAX_FIELDS fields are taken into account.
+ * Example: bctbx_log_kv("mydomain", BCTBX_LOG_MESSAGE, "call ended", "duration", BCTBX_LOG_KV_DOUBLE, 3.5, NULL);
+**/
+BCTBX_PUBLIC void bctbx_log_kv(const char *domain, BctbxLogLevel level, const char *msg, ...);
+
+#define BCTBX_LOG_KV_MAX_FIELDS 32
+
+/**
+ * Log a structured message whose fields are given as an array.
+**/
+BCTBX_PUBLIC void bctbx_log_kv_fields(const char *domain, BctbxLogLevel level, const char *msg, const bctbx_log_kv_t *fields, size_t count);
+
+/**
+ * Function called by a sink for each message it accepts, with the fields of structured messages.
+ * Plain messages are passed without fields. Fields and strings are only valid during the call.
+**/
+typedef void (*bctbx_log_sink_kv_func_t)(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, const bctbx_log_kv_t *fields, size_t count);
+
+/**
+ * Set a key/value function, that is called instead of the sink function. Must be called before the sink is added.
+**/
+BCTBX_PUBLIC void bctbx_log_sink_set_kv_func(bctbx_log_sink_t *sink, bctbx_log_sink_kv_func_t kv_func);
+
+/**
+ * Create a sink writing one JSON object per line to a buffered file sink, with the members
+ * "ts" (milliseconds since the epoch), "level", "domain", "msg" and the fields of structured messages.
+ * The lines are formatted directly into the buffer of the file sink, whose flush policy and rotation apply.
+ * The file sink must outlive the returned sink.
+**/
+BCTBX_PUBLIC bctbx_log_sink_t *bctbx_log_json_sink_new(bctbx_log_file_sink_t *file_sink);
+
 #ifdef __GNUC__
 #define CHECK_FORMAT_ARGS(m,n) __attribute__((format(printf,m,n)))
 #else
@@ -90,6 +404,7 @@ BCTBX_PUBLIC void bctbx_set_log_thread_id(unsigned long thread_id);
 /*in case of compile with -g static inline can produce this type of warning*/
 #pragma GCC diagnostic ignored "-Wunused-function"
 #endif
+
 #ifdef BCTBX_DEBUG_MODE
 static BCTBX_INLINE void CHECK_FORMAT_ARGS(1,2) bctbx_debug(const char *fmt,...)
 {
@@ -145,6 +460,29 @@ static BCTBX_INLINE void CHECK_FORMAT_ARGS(1,2) bctbx_error(const char *fmt,...)
 	va_end (args);
 }
 
+/**
+ * Minimum level of the log statements compiled in, undefined by default.
+ * When it is defined, for example to BCTBX_LOG_WARNING, before including this header, the calls to bctbx_debug(),
+ * bctbx_message(), bctbx_warning(), bctbx_error() and the BCTBX_SLOG statements of a lower level are removed at
+ * compile time, without evaluating their arguments. Fatal messages are always compiled in.
+ * The calls are wrapped by function-like macros named after the functions, which remain available: their address
+ * can still be taken, and a call with a parenthesized name such as (bctbx_message)("...") is never removed.
+**/
+#ifdef BCTBX_LOG_MIN_LEVEL
+#define BCTBX_LOG_LEVEL_COMPILED(level) ((level) >= (BCTBX_LOG_MIN_LEVEL))
+/*a macro is not expanded again in its own replacement: the functions are called*/
+#ifdef BCTBX_DEBUG_MODE
+#define bctbx_debug(...) (BCTBX_LOG_LEVEL_COMPILED(BCTBX_LOG_DEBUG) ? bctbx_debug(__VA_ARGS__) : (void)0)
+#endif
+#ifndef BCTBX_NOMESSAGE_MODE
+#define bctbx_message(...) (BCTBX_LOG_LEVEL_COMPILED(BCTBX_LOG_MESSAGE) ? bctbx_message(__VA_ARGS__) : (void)0)
+#define bctbx_warning(...) (BCTBX_LOG_LEVEL_COMPILED(BCTBX_LOG_WARNING) ? bctbx_warning(__VA_ARGS__) : (void)0)
+#endif
+#define bctbx_error(...) (BCTBX_LOG_LEVEL_COMPILED(BCTBX_LOG_ERROR) ? bctbx_error(__VA_ARGS__) : (void)0)
+#else
+#define BCTBX_LOG_LEVEL_COMPILED(level) ((level) >= BCTBX_LOG_DEBUG)
+#endif
+
 static BCTBX_INLINE void CHECK_FORMAT_ARGS(1,2) bctbx_fatal(const char *fmt,...)
 {
 	va_list args;
@@ -209,15 +547,83 @@ namespace bctoolbox {
 }
 
 #include <ostream>
+#include <streambuf>
+
+namespace bctoolbox {
+	namespace log {
+
+		/*
+		 * Stream buffer writing into a fixed size array held by the object itself. As log streams are temporaries,
+		 * the array lives on the stack of the logging thread: formatting a log line does not allocate unless
+		 * the line is longer than the array, and nested log statements (from an operator<<) do not interfere.
+		 */
+		class pumpbuf : public std::streambuf {
+		public:
+			pumpbuf() {
+				resetBuffer();
+			}
+
+			/* Null terminated content, valid until the next write. */
+			const char *c_str() {
+				if (!mOverflow.empty()) {
+					mOverflow.append(pbase(), pptr());
+					resetBuffer();
+					return mOverflow.c_str();
+				}
+				*pptr() = '\0';
+				return mBuffer;
+			}
+
+		protected:
+			virtual int_type overflow(int_type c) {
+				mOverflow.append(pbase(), pptr());
+				resetBuffer();
+				if (!traits_type::eq_int_type(c, traits_type::eof())) {
+					mOverflow.push_back(traits_type::to_char_type(c));
+				}
+				return traits_type::not_eof(c);
+			}
+
+			virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+				if (n <= epptr() - pptr()) {
+					traits_type::copy(pptr(), s, (size_t)n);
+					pbump((int)n);
+				} else {
+					mOverflow.append(pbase(), pptr());
+					mOverflow.append(s, (size_t)n);
+					resetBuffer();
+				}
+				return n;
+			}
+
+		private:
+			void resetBuffer() {
+				/* keep room for the terminating null character */
+				setp(mBuffer, mBuffer + sizeof(mBuffer) - 1);
+			}
 
-struct pumpstream : public std::ostringstream {
-	const std::string mDomain;
+			char mBuffer[512];
+			std::string mOverflow; /* content that did not fit in mBuffer, empty (hence not allocated) most of the time */
+		};
+
+		/* Holds the stream buffer so that it is constructed before the std::ostream that uses it. */
+		struct pumpbuf_holder {
+			pumpbuf mBuf;
+		};
+	}
+}
+
+struct pumpstream : private bctoolbox::log::pumpbuf_holder, public std::ostream {
+	const char *mDomain;
 	const BctbxLogLevel level;
-	pumpstream(std::string domain, BctbxLogLevel l) : mDomain(domain), level(l) {
+	pumpstream(const char *domain, BctbxLogLevel l) : std::ostream(&mBuf), mDomain(domain), level(l) {
+	}
+	/* The string must outlive the stream, which is the case of a temporary of the same full-expression. */
+	pumpstream(const std::string &domain, BctbxLogLevel l) : std::ostream(&mBuf), mDomain(domain.c_str()), level(l) {
 	}
 	
 	~pumpstream() {
-		bctbx_log(mDomain.c_str(), level, "%s", str().c_str());
+		bctbx_log(mDomain, level, "%s", mBuf.c_str());
 	}
 };
 
@@ -228,9 +634,36 @@ struct pumpstream : public std::ostringstream {
 //}
 //#endif
 
+namespace bctoolbox {
+	namespace log {
+		/* Whether log statements of this level are compiled in, see BCTBX_LOG_MIN_LEVEL. */
+#if __cplusplus >= 201103L
+		constexpr
+#endif
+		inline bool compiledIn(BctbxLogLevel level) {
+			return BCTBX_LOG_LEVEL_COMPILED(level);
+		}
+
+		/* Domain of a log statement, given as a C string or a std::string. */
+		inline const char *domainName(const char *domain) {
+			return domain;
+		}
+		inline const char *domainName(const std::string &domain) {
+			return domain.c_str();
+		}
+	}
+}
+
+#if __cplusplus >= 201703L
+#define BCTBX_LOG_IF_CONSTEXPR if constexpr
+#else
+#define BCTBX_LOG_IF_CONSTEXPR if
+#endif
+
 #define BCTBX_SLOG(domain, thelevel) \
 \
-if (bctbx_log_level_enabled((domain), (thelevel))) \
+BCTBX_LOG_IF_CONSTEXPR (!bctoolbox::log::compiledIn(thelevel)) {} else \
+if (bctbx_log_level_enabled(bctoolbox::log::domainName(domain), (thelevel))) \
 	pumpstream((domain),(thelevel))
 
 #define BCTBX_SLOGD(DOMAIN) BCTBX_SLOG(DOMAIN, BCTBX_LOG_DEBUG)
@@ -238,6 +671,85 @@ if (bctbx_log_level_enabled((domain), (thelevel))) \
 #define BCTBX_SLOGW(DOMAIN) BCTBX_SLOG(DOMAIN, BCTBX_LOG_WARNING)
 #define BCTBX_SLOGE(DOMAIN) BCTBX_SLOG(DOMAIN, BCTBX_LOG_ERROR)
 
+namespace bctoolbox {
+	namespace log {
+		/*
+		 * Builder of a structured log, output when the object is destroyed:
+		 * bctoolbox::log::kvlog("mydomain", BCTBX_LOG_MESSAGE, "call ended")("duration", 3.5)("reason", reason);
+		 * The keys and string values must remain valid until then, which is the case of temporaries of the same
+		 * full-expression. Fields beyond BCTBX_LOG_KV_MAX_FIELDS are ignored.
+		 */
+		class kvlog {
+		public:
+			kvlog(const char *domain, BctbxLogLevel level, const char *msg)
+				: mDomain(domain), mLevel(level), mMsg(msg), mCount(0), mEnabled(bctbx_log_level_enabled(domain, level) != 0) {
+			}
+
+			~kvlog() {
+				if (mEnabled) bctbx_log_kv_fields(mDomain, mLevel, mMsg, mFields, mCount);
+			}
+
+			kvlog &operator()(const char *key, const char *value) {
+				if (bctbx_log_kv_t *f = add(key, BCTBX_LOG_KV_STRING)) f->value.s = value;
+				return *this;
+			}
+			kvlog &operator()(const char *key, const std::string &value) {
+				return (*this)(key, value.c_str());
+			}
+			kvlog &operator()(const char *key, bool value) {
+				if (bctbx_log_kv_t *f = add(key, BCTBX_LOG_KV_BOOL)) f->value.i = value;
+				return *this;
+			}
+			kvlog &operator()(const char *key, int value) {
+				return addSigned(key, value);
+			}
+			kvlog &operator()(const char *key, long value) {
+				return addSigned(key, value);
+			}
+			kvlog &operator()(const char *key, long long value) {
+				return addSigned(key, value);
+			}
+			kvlog &operator()(const char *key, unsigned int value) {
+				return addUnsigned(key, value);
+			}
+			kvlog &operator()(const char *key, unsigned long value) {
+				return addUnsigned(key, value);
+			}
+			kvlog &operator()(const char *key, unsigned long long value) {
+				return addUnsigned(key, value);
+			}
+			kvlog &operator()(const char *key, double value) {
+				if (bctbx_log_kv_t *f = add(key, BCTBX_LOG_KV_DOUBLE)) f->value.d = value;
+				return *this;
+			}
+
+		private:
+			bctbx_log_kv_t *add(const char *key, bctbx_log_kv_type_t type) {
+				if (!mEnabled || mCount == BCTBX_LOG_KV_MAX_FIELDS) return NULL;
+				bctbx_log_kv_t *f = &mFields[mCount++];
+				f->key = key;
+				f->type = type;
+				return f;
+			}
+			kvlog &addSigned(const char *key, long long value) {
+				if (bctbx_log_kv_t *f = add(key, BCTBX_LOG_KV_INT64)) f->value.i = (int64_t)value;
+				return *this;
+			}
+			kvlog &addUnsigned(const char *key, unsigned long long value) {
+				if (bctbx_log_kv_t *f = add(key, BCTBX_LOG_KV_UINT64)) f->value.u = (uint64_t)value;
+				return *this;
+			}
+
+			const char *mDomain;
+			const BctbxLogLevel mLevel;
+			const char *mMsg;
+			size_t mCount;
+			const bool mEnabled;
+			bctbx_log_kv_t mFields[BCTBX_LOG_KV_MAX_FIELDS];
+		};
+	}
+}
+
 #endif
 
 #endif
@@ -340,7 +340,7 @@ typedef struct _BctoolboxMemoryFunctions{
 	void (*free_fun)(void *ptr);
 }BctoolboxMemoryFunctions;
 
-void bctbx_set_memory_functions(BctoolboxMemoryFunctions *functions);
+BCTBX_PUBLIC void bctbx_set_memory_functions(BctoolboxMemoryFunctions *functions);
 
 #define bctbx_new(type,count)	(type*)bctbx_malloc(sizeof(type)*(count))
 #define bctbx_new0(type,count)	(type*)bctbx_malloc0(sizeof(type)*(count))
@@ -355,11 +355,28 @@ BCTBX_PUBLIC char *bctbx_strcat_printf(char *dst, const char *fmt,...);
 BCTBX_PUBLIC char *bctbx_strcat_vprintf(char *dst, const char *fmt, va_list ap);
 BCTBX_PUBLIC char *bctbx_concat (const char *str, ...) ;
 
+/**
+ * Return the unique copy of str held by the global string table, adding it if needed. Two interned strings are equal
+ * if and only if their pointers are equal. Interned strings are never freed. Thread safe.
+**/
+BCTBX_PUBLIC const char *bctbx_intern(const char *str);
+
+/**
+ * Same as bctbx_intern() but without adding str to the table: returns NULL if it was never interned. Lock free.
+**/
+BCTBX_PUBLIC const char *bctbx_intern_lookup(const char *str);
+
 BCTBX_PUBLIC int bctbx_file_exist(const char *pathname);
 
 BCTBX_PUBLIC void bctbx_get_cur_time(bctoolboxTimeSpec *ret);
 void _bctbx_get_cur_time(bctoolboxTimeSpec *ret, bool_t realtime);
 BCTBX_PUBLIC uint64_t bctbx_get_cur_time_ms(void);
+/**
+ * Monotonic clock with the best resolution available, in nanoseconds from an unspecified origin. Unlike
+ * bctbx_get_cur_time(), it is not limited to milliseconds on Windows nor affected by clock changes on macOS:
+ * use it to measure durations.
+**/
+BCTBX_PUBLIC uint64_t bctbx_get_monotonic_ns(void);
 BCTBX_PUBLIC void bctbx_sleep_ms(int ms);
 BCTBX_PUBLIC void bctbx_sleep_until(const bctoolboxTimeSpec *ts);
 BCTBX_PUBLIC int bctbx_timespec_compare(const bctoolboxTimeSpec *s1, const bctoolboxTimeSpec *s2);
@@ -374,6 +391,9 @@ BCTBX_PUBLIC ssize_t bctbx_recv(bctbx_socket_t socket, void *buffer, size_t leng
 BCTBX_PUBLIC ssize_t bctbx_recvfrom(bctbx_socket_t socket, void *buffer, size_t length, int flags, struct sockaddr *address, socklen_t *address_len);
 BCTBX_PUBLIC ssize_t bctbx_read(int fd, void *buf, size_t nbytes);
 BCTBX_PUBLIC ssize_t bctbx_write(int fd, const void *buf, size_t nbytes);
+/*read and write at the given offset, without using nor moving the offset of the file descriptor*/
+BCTBX_PUBLIC ssize_t bctbx_pread(int fd, void *buf, size_t nbytes, off_t offset);
+BCTBX_PUBLIC ssize_t bctbx_pwrite(int fd, const void *buf, size_t nbytes, off_t offset);
 
 /* Portable and bug-less getaddrinfo */
 BCTBX_PUBLIC int bctbx_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
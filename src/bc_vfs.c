@@ -17,6 +17,9 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include "bctoolbox/bc_vfs.h"
 #include "bctoolbox/port.h"
 #include "bctoolbox/logging.h"
@@ -38,10 +41,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 static  int bcOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags);
 
+static int bcRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName);
+
+static int bcDelete(bctbx_vfs_t *pVfs, const char *fName);
+
 
 static bctbx_vfs_t bcVfs = {
 	"bctbx_vfs",               /* vfsName */
 	bcOpen,						/*xOpen */
+	bcRename,                  /* pFuncRename */
+	bcDelete,                  /* pFuncDelete */
 };
 
 /* Pointer to deault VFS initialized to standard VFS implemeented here.*/
@@ -86,34 +95,36 @@ static off_t bcSeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
 
 /**
  * Read count bytes from the open file given by pFile, starting at offset.
- * Sets the error errno in the argument pErrSrvd after allocating it
- * if an error occurrred.
+ * The read is positional: the offset of the file descriptor is neither used nor modified, so that several threads
+ * can read through the same file handle at once. Short reads are retried until count bytes are read or the end of
+ * the file is reached.
  * @param  pFile  File handle pointer.
  * @param  buf    buffer to write the read bytes to.
  * @param  count  number of bytes to read
  * @param  offset file offset where to start reading
- * @return -errno if erroneous read, number of bytes read (count) on success, 
- *                if the error was something else BCTBX_VFS_ERROR otherwise
+ * @return -errno if erroneous read, number of bytes read (count, less at the end of the file) on success,
+ *                BCTBX_VFS_ERROR if pFile is NULL
  */
 static ssize_t bcRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
-	ssize_t nRead;                      /* Return value from read() */
-	if (pFile) {
-		if (bctbx_file_seek(pFile, offset, SEEK_SET) == BCTBX_VFS_OK) {
-			nRead = bctbx_read(pFile->fd, buf, count);
-			/* Error while reading */
-			if (nRead < 0) {
-				if (errno) return -errno;
-			}
-			return nRead;
+	size_t nRead = 0;
+	if (pFile == NULL) return BCTBX_VFS_ERROR;
+	while (nRead < count) {
+		ssize_t ret = bctbx_pread(pFile->fd, (char *)buf + nRead, count - nRead, offset + (off_t)nRead);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			/* Error while reading: report it unless some bytes were already read */
+			if (nRead > 0) break;
+			return errno ? -errno : BCTBX_VFS_ERROR;
 		}
+		if (ret == 0) break; /* end of file */
+		nRead += (size_t)ret;
 	}
-	return BCTBX_VFS_ERROR;
+	return (ssize_t)nRead;
 }
 
 /**
  * Writes directly to the open file given through the pFile argument.
- * Sets the error errno in the argument pErrSrvd after allocating it
- * if an error occurrred.
+ * The write is positional, like bcRead(). Short writes are retried until count bytes are written.
  * @param  p       bctbx_vfs_file_t File handle pointer.
  * @param  buf     Buffer containing data to write
  * @param  count   Size of data to write in bytes
@@ -121,19 +132,150 @@ static ssize_t bcRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t of
  * @return         number of bytes written (can be 0), negative value errno if an error occurred.
  */
 static ssize_t bcWrite(bctbx_vfs_file_t *p, const void *buf, size_t count, off_t offset) {
-	ssize_t nWrite = 0;                 /* Return value from write() */
-
-	if (p) {
-		if ((bctbx_file_seek(p, offset, SEEK_SET)) == BCTBX_VFS_OK) {
-			nWrite = bctbx_write(p->fd, buf, count);
-			if (nWrite > 0) return nWrite;
-			else if (nWrite <= 0) {
-				if (errno) return -errno;
-				return 0;
-			}
+	size_t nWrite = 0;
+	if (p == NULL) return BCTBX_VFS_ERROR;
+	while (nWrite < count) {
+		ssize_t ret = bctbx_pwrite(p->fd, (const char *)buf + nWrite, count - nWrite, offset + (off_t)nWrite);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if (nWrite > 0) break;
+			return errno ? -errno : BCTBX_VFS_ERROR;
 		}
+		if (ret == 0) break;
+		nWrite += (size_t)ret;
 	}
-	return BCTBX_VFS_ERROR;
+	return (ssize_t)nWrite;
+}
+
+/**
+ * Read or write the buffers one by one with pFuncRead or pFuncWrite, stopping at the first short transfer.
+ * Used for the VFS that do not provide pFuncReadv or pFuncWritev.
+ */
+static ssize_t file_transferv_fallback(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset, bool_t is_write) {
+	size_t done = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t ret = is_write ? pFile->pMethods->pFuncWrite(pFile, iov[i].iov_base, iov[i].iov_len, offset + (off_t)done)
+			: pFile->pMethods->pFuncRead(pFile, iov[i].iov_base, iov[i].iov_len, offset + (off_t)done);
+		if (ret < 0) return done > 0 ? (ssize_t)done : ret;
+		done += (size_t)ret;
+		if ((size_t)ret < iov[i].iov_len) break;
+	}
+	return (ssize_t)done;
+}
+
+#if defined(HAVE_PREADV) && defined(HAVE_PWRITEV)
+/*number of buffers given to a single preadv()/pwritev() call, below the IOV_MAX of all systems*/
+#define BCTBX_VFS_IOV_BATCH 64
+
+/**
+ * Positional vectored read or write, retried like bcRead() and bcWrite() until all the buffers are transferred.
+ */
+static ssize_t bcTransferv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset, bool_t is_write) {
+	bctbx_iovec_t batch[BCTBX_VFS_IOV_BATCH];
+	size_t done = 0;
+	size_t skip = 0; /*bytes of iov[first] already transferred*/
+	int first = 0;
+
+	if (pFile == NULL) return BCTBX_VFS_ERROR;
+	while (first < iovcnt) {
+		int n = MIN(iovcnt - first, BCTBX_VFS_IOV_BATCH);
+		size_t total = 0;
+		size_t left;
+		ssize_t ret;
+		int i;
+
+		for (i = 0; i < n; i++) {
+			batch[i] = iov[first + i];
+			total += batch[i].iov_len;
+		}
+		batch[0].iov_base = (char *)batch[0].iov_base + skip;
+		batch[0].iov_len -= skip;
+		total -= skip;
+		if (total == 0) {
+			first += n;
+			skip = 0;
+			continue;
+		}
+		ret = is_write ? pwritev(pFile->fd, batch, n, offset + (off_t)done) : preadv(pFile->fd, batch, n, offset + (off_t)done);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if (done > 0) break;
+			return errno ? -errno : BCTBX_VFS_ERROR;
+		}
+		if (ret == 0) break; /* end of file */
+		done += (size_t)ret;
+		/*skip the buffers fully transferred*/
+		left = (size_t)ret;
+		while (first < iovcnt && left >= iov[first].iov_len - skip) {
+			left -= iov[first].iov_len - skip;
+			first++;
+			skip = 0;
+		}
+		skip += left;
+	}
+	return (ssize_t)done;
+}
+#else
+static ssize_t bcTransferv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset, bool_t is_write) {
+	if (pFile == NULL) return BCTBX_VFS_ERROR;
+	return file_transferv_fallback(pFile, iov, iovcnt, offset, is_write);
+}
+#endif
+
+/**
+ * Vectored version of bcRead(), using preadv() when available.
+ * @return -errno if erroneous read, number of bytes read on success, BCTBX_VFS_ERROR if pFile is NULL
+ */
+static ssize_t bcReadv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	return bcTransferv(pFile, iov, iovcnt, offset, FALSE);
+}
+
+/**
+ * Vectored version of bcWrite(), using pwritev() when available.
+ * @return number of bytes written, negative value errno if an error occurred.
+ */
+static ssize_t bcWritev(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	return bcTransferv(pFile, iov, iovcnt, offset, TRUE);
+}
+
+/**
+ * Flush the data of the file to the storage device.
+ * @param  pFile     File handle pointer.
+ * @param  data_only Use fdatasync() instead of fsync() where available.
+ * @return BCTBX_VFS_OK on success, -errno otherwise.
+ */
+static int bcSync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	int ret;
+#if defined(_WIN32)
+	(void)data_only;
+	ret = _commit(pFile->fd);
+#elif defined(__APPLE__)
+	/*fsync() does not flush the drive cache on Apple systems*/
+	(void)data_only;
+	ret = fcntl(pFile->fd, F_FULLFSYNC);
+	if (ret != 0) ret = fsync(pFile->fd);
+#else
+	ret = data_only ? fdatasync(pFile->fd) : fsync(pFile->fd);
+#endif
+	return ret == 0 ? BCTBX_VFS_OK : -errno;
+}
+
+/**
+ * Set the size of the file.
+ * @param  pFile  File handle pointer.
+ * @param  size   New size of the file.
+ * @return BCTBX_VFS_OK on success, -errno otherwise.
+ */
+static int bcTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+#if defined(_WIN32)
+	/*_chsize_s() returns the error code instead of setting errno*/
+	int ret = (int)_chsize_s(pFile->fd, (__int64)size);
+	return ret == 0 ? BCTBX_VFS_OK : -ret;
+#else
+	return ftruncate(pFile->fd, size) == 0 ? BCTBX_VFS_OK : -errno;
+#endif
 }
 
 /**
@@ -151,6 +293,17 @@ static int64_t bcFileSize(bctbx_vfs_file_t *pFile) {
 	return sStat.st_size;
 }
 
+/**
+ * Find the first end of line character ('\r' or '\n') in the len bytes at start.
+ * @return pointer to it, NULL if there is none.
+ */
+static const char *bctbx_vfs_find_eol(const char *start, size_t len) {
+	const char *n = (const char *)memchr(start, '\n', len);
+	/*a '\r' only matters if it comes before the first '\n'*/
+	const char *r = (const char *)memchr(start, '\r', n ? (size_t)(n - start) : len);
+	return r ? r : n;
+}
+
 /**
  * Gets a line of max_len length and stores it to the allocaed buffer s.
  * Reads at most max_len characters from the file descriptor associated with the argument pFile
@@ -164,11 +317,9 @@ static int64_t bcFileSize(bctbx_vfs_file_t *pFile) {
  * @return         size of line read, 0 if empty
  */
 static int bcGetLine(bctbx_vfs_file_t *pFile, char *s, int max_len) {
-	int64_t ret;
-	int sizeofline, isEof;
-	char *pNextLine = NULL;
-	char *pNextLineR = NULL;
-	char *pNextLineN = NULL;
+	ssize_t ret;
+	const char *pNextLine;
+	int sizeofline = 0;
 
 	if (pFile->fd == -1) {
 		return BCTBX_VFS_ERROR;
@@ -176,33 +327,25 @@ static int bcGetLine(bctbx_vfs_file_t *pFile, char *s, int max_len) {
 	if (s == NULL || max_len < 1) {
 		return BCTBX_VFS_ERROR;
 	}
-
-	sizeofline = 0;
-	isEof = 0;
-	s[max_len-1] = '\0';
+	s[0] = '\0';
 
 	/* Read returns 0 if end of file is found */
 	ret = bctbx_file_read(pFile, s, max_len - 1, pFile->offset);
 	if (ret > 0) {
-		pNextLineR = strchr(s, '\r');
-		pNextLineN = strchr(s, '\n');
-		if ((pNextLineR != NULL) && (pNextLineN != NULL)) pNextLine = MIN(pNextLineR, pNextLineN);
-		else if (pNextLineR != NULL) pNextLine = pNextLineR;
-		else if (pNextLineN != NULL) pNextLine = pNextLineN;
+		pNextLine = bctbx_vfs_find_eol(s, (size_t)ret);
 		if (pNextLine) {
 			/* Got a line! */
-			*pNextLine = '\0';
 			sizeofline = (int)(pNextLine - s + 1);
-			if (pNextLine[1] == '\n') sizeofline += 1; /*take into account the \r\n" case*/
-
-			/* offset to next beginning of line*/
-			pFile->offset += sizeofline;
+			/*take into account the \r\n" case*/
+			if (*pNextLine == '\r' && sizeofline < ret && s[sizeofline] == '\n') sizeofline += 1;
+			s[pNextLine - s] = '\0';
 		} else {
 			/*did not find end of line char, is EOF?*/
 			sizeofline = (int)ret;
-			pFile->offset += sizeofline;
 			s[ret] = '\0';
 		}
+		/* offset to next beginning of line*/
+		pFile->offset += sizeofline;
 	} else if (ret < 0) {
 		bctbx_error("bcGetLine error");
 	}
@@ -234,6 +377,11 @@ static const  bctbx_io_methods_t bcio = {
 	bcFileSize,                 /* pFuncFileSize */
 	bcGetLine,
 	bcSeek,
+	NULL,                       /* pFuncMapRegion */
+	bcReadv,                    /* pFuncReadv */
+	bcWritev,                   /* pFuncWritev */
+	bcSync,                     /* pFuncSync */
+	bcTruncate,                 /* pFuncTruncate */
 };
 
 
@@ -272,6 +420,36 @@ ssize_t bctbx_file_write(bctbx_vfs_file_t* pFile, const void *buf, size_t count,
 	return BCTBX_VFS_ERROR;
 }
 
+ssize_t bctbx_file_readv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	ssize_t ret;
+
+	if (pFile == NULL || iov == NULL || iovcnt < 0) return BCTBX_VFS_ERROR;
+	if (pFile->pMethods->pFuncReadv) ret = pFile->pMethods->pFuncReadv(pFile, iov, iovcnt, offset);
+	else ret = file_transferv_fallback(pFile, iov, iovcnt, offset, FALSE);
+	if (ret == BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_file_readv: error bctbx_vfs_file_t");
+	} else if (ret < 0) {
+		bctbx_error("bctbx_file_readv: Error read %s", strerror((int)-(ret)));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
+ssize_t bctbx_file_writev(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	ssize_t ret;
+
+	if (pFile == NULL || iov == NULL || iovcnt < 0) return BCTBX_VFS_ERROR;
+	if (pFile->pMethods->pFuncWritev) ret = pFile->pMethods->pFuncWritev(pFile, iov, iovcnt, offset);
+	else ret = file_transferv_fallback(pFile, iov, iovcnt, offset, TRUE);
+	if (ret == BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_file_writev file error");
+	} else if (ret < 0) {
+		bctbx_error("bctbx_file_writev error %s", strerror((int)-(ret)));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
 static int file_open(bctbx_vfs_t* pVfs, bctbx_vfs_file_t* pFile, const char *fName, const int oflags) {
 	int ret = BCTBX_VFS_ERROR;
 	if (pVfs && pFile ) {
@@ -294,11 +472,57 @@ bctbx_vfs_file_t* bctbx_file_open(bctbx_vfs_t *pVfs, const char *fName, const ch
 		memset(p_ret, 0, sizeof(bctbx_vfs_file_t));
 		ret = file_open(pVfs, p_ret, fName, oflags);
 		if (ret == BCTBX_VFS_OK) return p_ret;
+		bctbx_free(p_ret);
 	}
 
 	return NULL;
 }
 
+static int bcRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+#if defined(_WIN32)
+	/*rename() fails on Windows when the destination exists*/
+	return MoveFileExA(oldName, newName, MOVEFILE_REPLACE_EXISTING) ? BCTBX_VFS_OK : BCTBX_VFS_ERROR;
+#else
+	return rename(oldName, newName) == 0 ? BCTBX_VFS_OK : -errno;
+#endif
+}
+
+static int bcDelete(bctbx_vfs_t *pVfs, const char *fName) {
+	return remove(fName) == 0 ? BCTBX_VFS_OK : -errno;
+}
+
+int bctbx_vfs_rename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+	int ret;
+
+	if (pVfs == NULL || oldName == NULL || newName == NULL) return BCTBX_VFS_ERROR;
+	if (pVfs->pFuncRename == NULL) {
+		bctbx_error("bctbx_vfs_rename: not supported by this VFS");
+		return BCTBX_VFS_ERROR;
+	}
+	ret = pVfs->pFuncRename(pVfs, oldName, newName);
+	if (ret < 0 && ret != BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_vfs_rename: Error %s", strerror(-ret));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
+int bctbx_vfs_delete(bctbx_vfs_t *pVfs, const char *fName) {
+	int ret;
+
+	if (pVfs == NULL || fName == NULL) return BCTBX_VFS_ERROR;
+	if (pVfs->pFuncDelete == NULL) {
+		bctbx_error("bctbx_vfs_delete: not supported by this VFS");
+		return BCTBX_VFS_ERROR;
+	}
+	ret = pVfs->pFuncDelete(pVfs, fName);
+	if (ret < 0 && ret != BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_vfs_delete: Error %s", strerror(-ret));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
 bctbx_vfs_file_t* bctbx_file_open2(bctbx_vfs_t *pVfs, const char *fName, const int openFlags) {
 	int ret;
 	bctbx_vfs_file_t *p_ret = (bctbx_vfs_file_t *)bctbx_malloc(sizeof(bctbx_vfs_file_t));
@@ -307,6 +531,7 @@ bctbx_vfs_file_t* bctbx_file_open2(bctbx_vfs_t *pVfs, const char *fName, const i
 		memset(p_ret, 0, sizeof(bctbx_vfs_file_t));
 		ret = file_open(pVfs, p_ret, fName, openFlags);
 		if (ret == BCTBX_VFS_OK) return p_ret;
+		bctbx_free(p_ret);
 	}
 
 	return NULL;
@@ -385,11 +610,242 @@ off_t bctbx_file_seek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
 	return ret;
 }
 
+int bctbx_file_map_region(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr) {
+	int ret;
+
+	if (pFile == NULL || ptr == NULL) return BCTBX_VFS_ERROR;
+	if (pFile->pMethods->pFuncMapRegion == NULL) {
+		bctbx_error("bctbx_file_map_region: not supported by this VFS");
+		return BCTBX_VFS_ERROR;
+	}
+	ret = pFile->pMethods->pFuncMapRegion(pFile, offset, count, ptr);
+	if (ret < 0 && ret != BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_file_map_region: Error %s", strerror(-ret));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
+int bctbx_file_sync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	int ret;
+
+	if (pFile == NULL) return BCTBX_VFS_ERROR;
+	if (pFile->pMethods->pFuncSync == NULL) {
+		bctbx_error("bctbx_file_sync: not supported by this VFS");
+		return BCTBX_VFS_ERROR;
+	}
+	ret = pFile->pMethods->pFuncSync(pFile, data_only);
+	if (ret < 0 && ret != BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_file_sync: Error %s", strerror(-ret));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
+int bctbx_file_truncate(bctbx_vfs_file_t *pFile, off_t size) {
+	int ret;
+
+	if (pFile == NULL || size < 0) return BCTBX_VFS_ERROR;
+	if (pFile->pMethods->pFuncTruncate == NULL) {
+		bctbx_error("bctbx_file_truncate: not supported by this VFS");
+		return BCTBX_VFS_ERROR;
+	}
+	ret = pFile->pMethods->pFuncTruncate(pFile, size);
+	if (ret < 0 && ret != BCTBX_VFS_ERROR) {
+		bctbx_error("bctbx_file_truncate: Error %s", strerror(-ret));
+		ret = BCTBX_VFS_ERROR;
+	}
+	return ret;
+}
+
 int bctbx_file_get_nxtline(bctbx_vfs_file_t *pFile, char *s, int maxlen) {
 	if (pFile) return pFile->pMethods->pFuncGetLineFromFd(pFile, s, maxlen);
 	return BCTBX_VFS_ERROR;
 }
 
+int bctbx_vfs_get_line_from_read(bctbx_vfs_file_t *pFile, char *s, int maxlen) {
+	ssize_t ret;
+	const char *eol;
+	size_t len;
+
+	if (s == NULL || maxlen < 1) return BCTBX_VFS_ERROR;
+	ret = pFile->pMethods->pFuncRead(pFile, s, (size_t)maxlen - 1, pFile->offset);
+	if (ret <= 0) {
+		s[0] = '\0';
+		return ret < 0 ? BCTBX_VFS_ERROR : 0;
+	}
+	eol = bctbx_vfs_find_eol(s, (size_t)ret);
+	if (eol == NULL) {
+		/*no end of line found, is EOF?*/
+		s[ret] = '\0';
+		pFile->offset += ret;
+		return (int)ret;
+	}
+	len = (size_t)(eol - s) + 1;
+	/*take into account the \r\n case*/
+	if (*eol == '\r' && len < (size_t)ret && s[len] == '\n') len++;
+	s[eol - s] = '\0';
+	pFile->offset += len;
+	return (int)len;
+}
+
+#define BCTBX_VFS_LINE_READER_DEFAULT_SIZE 4096
+
+struct _bctbx_vfs_line_reader {
+	bctbx_vfs_file_t *pFile;
+	char *buf; /*one more byte than size, to null-terminate the last line*/
+	size_t size;
+	size_t start; /*beginning of the next line in buf*/
+	size_t end; /*end of the data read in buf*/
+	off_t offset; /*offset in the file of buf[end]*/
+	bool_t eof;
+};
+
+bctbx_vfs_line_reader_t *bctbx_vfs_line_reader_new(bctbx_vfs_file_t *pFile, size_t buffer_size) {
+	bctbx_vfs_line_reader_t *reader;
+
+	if (pFile == NULL) return NULL;
+	reader = bctbx_new0(bctbx_vfs_line_reader_t, 1);
+	reader->pFile = pFile;
+	reader->size = buffer_size ? buffer_size : BCTBX_VFS_LINE_READER_DEFAULT_SIZE;
+	reader->buf = (char *)bctbx_malloc(reader->size + 1);
+	reader->offset = pFile->offset;
+	return reader;
+}
+
+/*read the next block of the file after the data not consumed yet, growing the buffer if it is full*/
+static int bctbx_vfs_line_reader_fill(bctbx_vfs_line_reader_t *reader) {
+	ssize_t ret;
+
+	if (reader->start > 0) {
+		memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->end == reader->size) {
+		reader->size *= 2;
+		reader->buf = (char *)bctbx_realloc(reader->buf, reader->size + 1);
+	}
+	ret = bctbx_file_read(reader->pFile, reader->buf + reader->end, reader->size - reader->end, reader->offset);
+	if (ret < 0) return (int)ret;
+	if (ret == 0) reader->eof = TRUE;
+	reader->end += (size_t)ret;
+	reader->offset += (off_t)ret;
+	return 0;
+}
+
+int bctbx_vfs_line_reader_next(bctbx_vfs_line_reader_t *reader, const char **line, size_t *len) {
+	size_t scanned = 0; /*bytes of the pending data already known to hold no end of line*/
+
+	for (;;) {
+		char *data = reader->buf + reader->start;
+		size_t avail = reader->end - reader->start;
+		const char *eol = bctbx_vfs_find_eol(data + scanned, avail - scanned);
+		size_t consumed;
+		int ret;
+
+		/*a '\r' ending the data may be followed by a '\n' not read yet*/
+		if (eol && !(*eol == '\r' && (size_t)(eol - data) + 1 == avail && !reader->eof)) {
+			*len = (size_t)(eol - data);
+			consumed = *len + 1;
+			if (*eol == '\r' && consumed < avail && data[consumed] == '\n') consumed++;
+		} else if (eol == NULL && reader->eof) {
+			if (avail == 0) return 0;
+			*len = avail;
+			consumed = avail;
+		} else {
+			scanned = eol ? (size_t)(eol - data) : avail;
+			if ((ret = bctbx_vfs_line_reader_fill(reader)) < 0) return ret;
+			continue;
+		}
+		data[*len] = '\0';
+		*line = data;
+		reader->start += consumed;
+		reader->pFile->offset = reader->offset - (off_t)(reader->end - reader->start);
+		return 1;
+	}
+}
+
+void bctbx_vfs_line_reader_destroy(bctbx_vfs_line_reader_t *reader) {
+	if (reader == NULL) return;
+	bctbx_free(reader->buf);
+	bctbx_free(reader);
+}
+
+#define BCTBX_VFS_BUFFERED_WRITER_DEFAULT_SIZE 65536
+
+struct _bctbx_vfs_buffered_writer {
+	bctbx_vfs_file_t *pFile;
+	char *buf;
+	size_t size;
+	size_t len; /*bytes buffered*/
+	off_t start; /*offset in the file of buf[0]*/
+	off_t next; /*where the next append goes, -1 before the first write*/
+};
+
+bctbx_vfs_buffered_writer_t *bctbx_vfs_buffered_writer_new(bctbx_vfs_file_t *pFile, size_t buffer_size) {
+	bctbx_vfs_buffered_writer_t *writer;
+
+	if (pFile == NULL) return NULL;
+	writer = bctbx_new0(bctbx_vfs_buffered_writer_t, 1);
+	writer->pFile = pFile;
+	writer->size = buffer_size > 0 ? buffer_size : BCTBX_VFS_BUFFERED_WRITER_DEFAULT_SIZE;
+	writer->buf = (char *)bctbx_malloc(writer->size);
+	writer->next = -1;
+	return writer;
+}
+
+int bctbx_vfs_buffered_writer_flush(bctbx_vfs_buffered_writer_t *writer) {
+	ssize_t ret;
+
+	if (writer->len == 0) return BCTBX_VFS_OK;
+	ret = bctbx_file_write(writer->pFile, writer->buf, writer->len, writer->start);
+	/*on failure the data is kept, so that the flush can be retried*/
+	if (ret != (ssize_t)writer->len) return BCTBX_VFS_ERROR;
+	writer->len = 0;
+	return BCTBX_VFS_OK;
+}
+
+ssize_t bctbx_vfs_buffered_writer_write(bctbx_vfs_buffered_writer_t *writer, const void *buf, size_t count, off_t offset) {
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	/*only a write continuing the buffered data can be merged with it*/
+	if (writer->len > 0 && (offset != writer->start + (off_t)writer->len || writer->len + count > writer->size)) {
+		if (bctbx_vfs_buffered_writer_flush(writer) != BCTBX_VFS_OK) return BCTBX_VFS_ERROR;
+	}
+	writer->next = offset + (off_t)count;
+	if (count >= writer->size) {
+		return bctbx_file_write(writer->pFile, buf, count, offset) == (ssize_t)count ? (ssize_t)count : BCTBX_VFS_ERROR;
+	}
+	if (writer->len == 0) writer->start = offset;
+	memcpy(writer->buf + writer->len, buf, count);
+	writer->len += count;
+	return (ssize_t)count;
+}
+
+ssize_t bctbx_vfs_buffered_writer_append(bctbx_vfs_buffered_writer_t *writer, const void *buf, size_t count) {
+	if (writer->next < 0) {
+		int64_t size = bctbx_file_size(writer->pFile);
+		if (size < 0) return BCTBX_VFS_ERROR;
+		writer->next = (off_t)size;
+	}
+	return bctbx_vfs_buffered_writer_write(writer, buf, count, writer->next);
+}
+
+int bctbx_vfs_buffered_writer_sync(bctbx_vfs_buffered_writer_t *writer, bool_t data_only) {
+	if (bctbx_vfs_buffered_writer_flush(writer) != BCTBX_VFS_OK) return BCTBX_VFS_ERROR;
+	return bctbx_file_sync(writer->pFile, data_only);
+}
+
+int bctbx_vfs_buffered_writer_destroy(bctbx_vfs_buffered_writer_t *writer) {
+	int ret;
+
+	if (writer == NULL) return BCTBX_VFS_OK;
+	ret = bctbx_vfs_buffered_writer_flush(writer);
+	bctbx_free(writer->buf);
+	bctbx_free(writer);
+	return ret;
+}
+
 
 void bctbx_vfs_set_default(bctbx_vfs_t *my_vfs) {
 	pDefaultVfs = my_vfs;
@@ -1553,6 +1553,65 @@ int32_t bctbx_aes_gcm_finish(bctbx_aes_gcm_context_t *context,
 	return ret;
 }
 
+/**
+ * @Brief create an AES-GCM key context: the key schedule is computed once and reused for every message
+ *
+ * @param[in]	key							encryption key
+ * @param[in]	keyLength					key buffer length, in bytes, must be 16,24 or 32
+ *
+ * @return a pointer to the created key context, to be freed using bctbx_aes_gcm_key_free(), NULL on error
+ */
+bctbx_aes_gcm_key_t *bctbx_aes_gcm_key_new(const uint8_t *key, size_t keyLength) {
+	mbedtls_gcm_context *ctx = bctbx_malloc0(sizeof(mbedtls_gcm_context));
+
+	mbedtls_gcm_init(ctx);
+	if (mbedtls_gcm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, (unsigned int)keyLength*8) != 0) {
+		mbedtls_gcm_free(ctx);
+		bctbx_free(ctx);
+		return NULL;
+	}
+	return (bctbx_aes_gcm_key_t *)ctx;
+}
+
+/**
+ * @Brief AES-GCM encrypt and tag buffer with a key context, see bctbx_aes_gcm_encrypt_and_tag()
+ */
+int32_t bctbx_aes_gcm_key_encrypt_and_tag(bctbx_aes_gcm_key_t *key,
+		const uint8_t *plainText, size_t plainTextLength,
+		const uint8_t *authenticatedData, size_t authenticatedDataLength,
+		const uint8_t *initializationVector, size_t initializationVectorLength,
+		uint8_t *tag, size_t tagLength,
+		uint8_t *output) {
+	return mbedtls_gcm_crypt_and_tag((mbedtls_gcm_context *)key, MBEDTLS_GCM_ENCRYPT, plainTextLength, initializationVector, initializationVectorLength, authenticatedData, authenticatedDataLength, plainText, output, tagLength, tag);
+}
+
+/**
+ * @Brief AES-GCM decrypt and authenticate buffer with a key context, see bctbx_aes_gcm_decrypt_and_auth()
+ */
+int32_t bctbx_aes_gcm_key_decrypt_and_auth(bctbx_aes_gcm_key_t *key,
+		const uint8_t *cipherText, size_t cipherTextLength,
+		const uint8_t *authenticatedData, size_t authenticatedDataLength,
+		const uint8_t *initializationVector, size_t initializationVectorLength,
+		const uint8_t *tag, size_t tagLength,
+		uint8_t *output) {
+	int ret = mbedtls_gcm_auth_decrypt((mbedtls_gcm_context *)key, cipherTextLength, initializationVector, initializationVectorLength, authenticatedData, authenticatedDataLength, tag, tagLength, cipherText, output);
+
+	if (ret == MBEDTLS_ERR_GCM_AUTH_FAILED) {
+		return BCTBX_ERROR_AUTHENTICATION_FAILED;
+	}
+
+	return ret;
+}
+
+/**
+ * @Brief free an AES-GCM key context
+ */
+void bctbx_aes_gcm_key_free(bctbx_aes_gcm_key_t *key) {
+	if (key == NULL) return;
+	mbedtls_gcm_free((mbedtls_gcm_context *)key);
+	bctbx_free(key);
+}
+
 /*
  * @brief Wrapper for AES-128 in CFB128 mode encryption
  * Both key and IV must be 16 bytes long, IV is not updated
@@ -0,0 +1,346 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/logging.h"
+#include "bctoolbox/bc_vfs.h"
+#include "logging_internal.h"
+#include "utils.h"
+
+#include <stdio.h>
+
+#define BCTBX_LOG_FILE_SINK_DEFAULT_BUFFER_SIZE 65536
+/*granularity at which the worker thread checks whether it has something to do*/
+#define BCTBX_LOG_FILE_SINK_WORKER_SLICE_MS 50
+
+struct _bctbx_log_file_sink {
+	char *path;
+	bctbx_vfs_t *vfs; /*VFS in which the file and the rotated ones are opened, renamed and deleted*/
+	bctbx_vfs_file_t *file;
+	off_t offset; /*current end of file*/
+	uint64_t opened_at; /*time at which the current file was started, in ms*/
+	char *buffer;
+	size_t buffer_size;
+	size_t used;
+	bctbx_log_flush_policy_t policy;
+	bctbx_log_rotation_policy_t rotation;
+	bctbx_mutex_t lock;
+	bctbx_thread_t worker_thread;
+	int worker_running; /*accessed atomically*/
+	bool_t rotation_requested;
+	size_t appended; /*bytes appended since bctbx_log_file_sink_begin()*/
+};
+
+/*
+ * Write len bytes to the file. The methods of the VFS are used directly rather than bctbx_file_write(), because the latter
+ * logs its errors, which would re-enter the sink.
+ */
+static int file_sink_write(bctbx_log_file_sink_t *sink, const char *data, size_t len){
+	while (len > 0){
+		ssize_t ret = sink->file->pMethods->pFuncWrite(sink->file, data, len, sink->offset);
+		if (ret <= 0) return -1;
+		sink->offset += ret;
+		data += ret;
+		len -= (size_t)ret;
+	}
+	if (sink->rotation.max_size > 0 && (int64_t)sink->offset >= sink->rotation.max_size){
+		/*the worker thread will switch to a new file, in the meantime we keep appending to this one*/
+		sink->rotation_requested = TRUE;
+	}
+	return 0;
+}
+
+/*must be called with the lock held*/
+static int file_sink_flush_locked(bctbx_log_file_sink_t *sink){
+	int ret = 0;
+	if (sink->used > 0){
+		ret = file_sink_write(sink, sink->buffer, sink->used);
+		/*on error the content is dropped: retrying would only make the buffer overflow later*/
+		sink->used = 0;
+	}
+	return ret;
+}
+
+static char *rotated_file_name(const char *path, unsigned int index){
+	return bctbx_strdup_printf("%s.%u", path, index);
+}
+
+/*the rotation is refused when the VFS cannot rename and delete the files*/
+static bool_t file_sink_can_rotate(const bctbx_log_file_sink_t *sink){
+	return sink->vfs->pFuncRename != NULL && sink->vfs->pFuncDelete != NULL;
+}
+
+/*
+ * Rename path.N-1 to path.N ... path to path.1, open a fresh file and make it the current one.
+ * The methods of the VFS are called directly, as in file_sink_write(): a missing rotated file is not an error.
+ * This is executed by the worker thread: the lock is only taken to swap the files, so that loggers never wait
+ * for the renames nor the open.
+ */
+static void file_sink_rotate(bctbx_log_file_sink_t *sink){
+	bctbx_vfs_file_t *new_file;
+	bctbx_vfs_file_t *old_file;
+	unsigned int keep_count;
+	unsigned int i;
+
+	bctbx_mutex_lock(&sink->lock);
+	keep_count = sink->rotation.keep_count;
+	sink->rotation_requested = FALSE;
+	bctbx_mutex_unlock(&sink->lock);
+
+	if (keep_count > 0){
+		char *name = rotated_file_name(sink->path, keep_count);
+		sink->vfs->pFuncDelete(sink->vfs, name);
+		bctbx_free(name);
+		for (i = keep_count - 1; i > 0; i--){
+			char *from = rotated_file_name(sink->path, i);
+			char *to = rotated_file_name(sink->path, i + 1);
+			sink->vfs->pFuncRename(sink->vfs, from, to);
+			bctbx_free(from);
+			bctbx_free(to);
+		}
+		name = rotated_file_name(sink->path, 1);
+		/*the current file is still open: lines logged meanwhile end up in the rotated file*/
+		sink->vfs->pFuncRename(sink->vfs, sink->path, name);
+		bctbx_free(name);
+	}else{
+		sink->vfs->pFuncDelete(sink->vfs, sink->path);
+	}
+
+	new_file = bctbx_file_open2(sink->vfs, sink->path, O_WRONLY | O_CREAT | O_APPEND);
+	if (new_file == NULL) return; /*keep on writing to the old one*/
+
+	bctbx_mutex_lock(&sink->lock);
+	file_sink_flush_locked(sink);
+	old_file = sink->file;
+	sink->file = new_file;
+	sink->offset = 0;
+	sink->opened_at = bctbx_get_cur_time_ms();
+	sink->rotation_requested = FALSE;
+	bctbx_mutex_unlock(&sink->lock);
+
+	bctbx_file_close(old_file);
+}
+
+static void *file_sink_worker(void *data){
+	bctbx_log_file_sink_t *sink = (bctbx_log_file_sink_t *)data;
+	uint64_t last_flush = bctbx_get_cur_time_ms();
+
+	while (bctbx_atomic_load_int(&sink->worker_running)){
+		uint64_t now = bctbx_get_cur_time_ms();
+		bool_t rotate;
+
+		if (sink->policy.interval_ms > 0 && now - last_flush >= sink->policy.interval_ms){
+			bctbx_log_file_sink_flush(sink);
+			last_flush = now;
+		}
+		bctbx_mutex_lock(&sink->lock);
+		rotate = sink->rotation_requested
+			|| (sink->rotation.max_age_s > 0 && now - sink->opened_at >= (uint64_t)sink->rotation.max_age_s * 1000);
+		bctbx_mutex_unlock(&sink->lock);
+		if (rotate) file_sink_rotate(sink);
+
+		bctbx_sleep_ms(BCTBX_LOG_FILE_SINK_WORKER_SLICE_MS);
+	}
+	return NULL;
+}
+
+/*the lock makes the check and the creation atomic: concurrent callers start a single thread*/
+static void file_sink_start_worker(bctbx_log_file_sink_t *sink){
+	bctbx_mutex_lock(&sink->lock);
+	if (!bctbx_atomic_load_int(&sink->worker_running)){
+		bctbx_atomic_store_int(&sink->worker_running, TRUE);
+		if (bctbx_thread_create(&sink->worker_thread, NULL, file_sink_worker, sink) != 0){
+			bctbx_atomic_store_int(&sink->worker_running, FALSE);
+		}
+	}
+	bctbx_mutex_unlock(&sink->lock);
+}
+
+bctbx_log_file_sink_t *bctbx_log_file_sink_new(const char *path, size_t buffer_size, const bctbx_log_flush_policy_t *flush_policy){
+	bctbx_log_file_sink_t *sink;
+	bctbx_vfs_t *vfs = bctbx_vfs_get_default();
+	bctbx_vfs_file_t *file;
+	int64_t size;
+
+	file = bctbx_file_open2(vfs, path, O_WRONLY | O_CREAT | O_APPEND);
+	if (file == NULL) return NULL;
+	size = bctbx_file_size(file);
+
+	sink = bctbx_new0(bctbx_log_file_sink_t, 1);
+	sink->path = bctbx_strdup(path);
+	sink->vfs = vfs;
+	sink->file = file;
+	sink->offset = size > 0 ? (off_t)size : 0;
+	sink->opened_at = bctbx_get_cur_time_ms();
+	sink->buffer_size = buffer_size > 0 ? buffer_size : BCTBX_LOG_FILE_SINK_DEFAULT_BUFFER_SIZE;
+	sink->buffer = bctbx_malloc(sink->buffer_size);
+	if (flush_policy){
+		sink->policy = *flush_policy;
+	}else{
+		sink->policy.level_mask = BCTBX_LOG_ERROR | BCTBX_LOG_FATAL;
+	}
+	/*whatever the policy, the buffer must be on disk before bctoolbox aborts*/
+	sink->policy.level_mask |= BCTBX_LOG_FATAL;
+	bctbx_mutex_init(&sink->lock, NULL);
+	if (sink->policy.interval_ms > 0){
+		file_sink_start_worker(sink);
+	}
+	return sink;
+}
+
+int bctbx_log_file_sink_set_rotation(bctbx_log_file_sink_t *sink, const bctbx_log_rotation_policy_t *rotation){
+	if (rotation && !file_sink_can_rotate(sink)) return -1;
+	bctbx_mutex_lock(&sink->lock);
+	if (rotation){
+		sink->rotation = *rotation;
+	}else{
+		memset(&sink->rotation, 0, sizeof(sink->rotation));
+	}
+	sink->rotation_requested = (sink->rotation.max_size > 0 && (int64_t)sink->offset >= sink->rotation.max_size);
+	bctbx_mutex_unlock(&sink->lock);
+	if (rotation && (rotation->max_size > 0 || rotation->max_age_s > 0)){
+		file_sink_start_worker(sink);
+	}
+	return 0;
+}
+
+int bctbx_log_file_sink_rotate(bctbx_log_file_sink_t *sink){
+	if (!file_sink_can_rotate(sink)) return -1;
+	bctbx_mutex_lock(&sink->lock);
+	sink->rotation_requested = TRUE;
+	bctbx_mutex_unlock(&sink->lock);
+	file_sink_start_worker(sink);
+	return 0;
+}
+
+void bctbx_log_file_sink_destroy(bctbx_log_file_sink_t *sink){
+	_bctbx_log_file_sink_unset(sink);
+	if (bctbx_atomic_load_int(&sink->worker_running)){
+		bctbx_atomic_store_int(&sink->worker_running, FALSE);
+		bctbx_thread_join(sink->worker_thread, NULL);
+	}
+	bctbx_log_file_sink_flush(sink);
+	bctbx_file_close(sink->file);
+	bctbx_free(sink->path);
+	bctbx_mutex_destroy(&sink->lock);
+	bctbx_free(sink->buffer);
+	bctbx_free(sink);
+}
+
+int bctbx_log_file_sink_flush(bctbx_log_file_sink_t *sink){
+	int ret;
+	bctbx_mutex_lock(&sink->lock);
+	ret = file_sink_flush_locked(sink);
+	bctbx_mutex_unlock(&sink->lock);
+	return ret;
+}
+
+/*
+ * Try to format the whole line at the end of the buffer. Returns the length of the line, which did not fit
+ * if greater than or equal to the available space.
+ */
+static size_t file_sink_format(bctbx_log_file_sink_t *sink, const char *domain, BctbxLogLevel lev, const char *fmt, va_list args){
+	char *p = sink->buffer + sink->used;
+	size_t avail = sink->buffer_size - sink->used;
+	size_t len;
+	int n;
+	va_list cap;
+
+	n = bctbx_log_format_header(p, avail, domain, lev);
+	if (n < 0) return 0;
+	len = (size_t)n;
+	va_copy(cap, args);
+	n = vsnprintf(len < avail ? p + len : NULL, len < avail ? avail - len : 0, fmt, cap);
+	va_end(cap);
+	if (n < 0) return 0;
+	len += (size_t)n;
+	if (len + sizeof(ENDLINE) - 1 < avail){
+		memcpy(p + len, ENDLINE, sizeof(ENDLINE) - 1);
+	}
+	return len + sizeof(ENDLINE) - 1;
+}
+
+void bctbx_log_file_sink_logv(bctbx_log_file_sink_t *sink, const char *domain, BctbxLogLevel lev, const char *fmt, va_list args){
+	size_t len;
+
+	bctbx_mutex_lock(&sink->lock);
+	len = file_sink_format(sink, domain, lev, fmt, args);
+	if (len >= sink->buffer_size - sink->used){
+		/*did not fit: make room and retry*/
+		file_sink_flush_locked(sink);
+		len = file_sink_format(sink, domain, lev, fmt, args);
+	}
+	if (len < sink->buffer_size - sink->used){
+		sink->used += len;
+	}else{
+		/*line larger than the whole buffer, write it directly*/
+		char header[128];
+		char *msg = bctbx_strdup_vprintf(fmt, args);
+		int header_len = bctbx_log_format_header(header, sizeof(header), domain, lev);
+		if (msg){
+			file_sink_write(sink, header, (size_t)MIN(header_len, (int)sizeof(header) - 1));
+			file_sink_write(sink, msg, strlen(msg));
+			file_sink_write(sink, ENDLINE, sizeof(ENDLINE) - 1);
+			bctbx_free(msg);
+		}
+	}
+	if (lev & sink->policy.level_mask){
+		file_sink_flush_locked(sink);
+	}
+	bctbx_mutex_unlock(&sink->lock);
+	bctbx_log_stats_add_bytes(domain, lev, len);
+}
+
+void bctbx_log_file_sink_begin(bctbx_log_file_sink_t *sink){
+	bctbx_mutex_lock(&sink->lock);
+	sink->appended = 0;
+}
+
+void bctbx_log_file_sink_append(bctbx_log_file_sink_t *sink, const char *data, size_t len){
+	sink->appended += len;
+	while (len > 0){
+		size_t n;
+		if (sink->used == sink->buffer_size) file_sink_flush_locked(sink);
+		n = MIN(len, sink->buffer_size - sink->used);
+		memcpy(sink->buffer + sink->used, data, n);
+		sink->used += n;
+		data += n;
+		len -= n;
+	}
+}
+
+size_t bctbx_log_file_sink_end(bctbx_log_file_sink_t *sink, BctbxLogLevel lev){
+	size_t appended = sink->appended;
+	if (lev & sink->policy.level_mask){
+		file_sink_flush_locked(sink);
+	}
+	bctbx_mutex_unlock(&sink->lock);
+	return appended;
+}
+
+static void file_sink_log(bctbx_log_file_sink_t *sink, const char *domain, BctbxLogLevel lev, const char *fmt, ...){
+	va_list args;
+	va_start(args, fmt);
+	bctbx_log_file_sink_logv(sink, domain, lev, fmt, args);
+	va_end(args);
+}
+
+void bctbx_log_file_sink_func(void *file_sink, const char *domain, BctbxLogLevel lev, const char *msg, size_t len){
+	file_sink_log((bctbx_log_file_sink_t *)file_sink, domain, lev, "%.*s", (int)len, msg);
+}
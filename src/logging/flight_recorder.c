@@ -0,0 +1,322 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/logging.h"
+#include "logging_internal.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#ifdef _WIN32
+#include <io.h>
+#define flight_recorder_write _write
+#define flight_recorder_open _open
+#define flight_recorder_close _close
+#else
+#include <unistd.h>
+#define flight_recorder_write write
+#define flight_recorder_open open
+#define flight_recorder_close close
+#endif
+
+/*
+ * Each thread records its messages in its own ring of fixed size slots, so that recording takes no lock and a dump
+ * can walk the rings without allocating, as required from a signal handler. Messages longer than a slot are truncated.
+ */
+#define FLIGHT_RECORDER_SLOT_TEXT_SIZE 224
+
+typedef struct _flight_recorder_slot {
+	uint64_t seq; /*global sequence number, 0 while the slot is empty or being written*/
+	uint64_t time_ms; /*since the epoch*/
+	const char *domain; /*domain string from the logger registry, never freed*/
+	int level;
+	int len;
+	char text[FLIGHT_RECORDER_SLOT_TEXT_SIZE];
+} flight_recorder_slot_t;
+
+typedef struct _flight_recorder_ring {
+	struct _flight_recorder_ring *next; /*immutable once published*/
+	unsigned int id;
+	int in_use; /*owned by a running thread, accessed atomically*/
+	uint64_t written; /*number of slots written so far, accessed atomically*/
+	uint64_t dump_pos; /*cursor and end used while dumping*/
+	uint64_t dump_end;
+	size_t count;
+	flight_recorder_slot_t slots[1];
+} flight_recorder_ring_t;
+
+static int recorder_enabled = FALSE; /*accessed atomically*/
+static size_t recorder_slots_per_ring = 0;
+static uint64_t recorder_seq = 0;
+static flight_recorder_ring_t *recorder_rings = NULL; /*prepend-only list, published with release semantics*/
+static unsigned int recorder_ring_count = 0;
+static bctbx_mutex_t recorder_mutex;
+static bctbx_once_t recorder_once = BCTBX_ONCE_INIT;
+static char recorder_dump_path[1024];
+static int recorder_dumping = 0;
+static int recorder_fatal_dumped = FALSE; /*dumped for a fatal message, whose abort() then raises SIGABRT*/
+
+#ifdef _WIN32
+static DWORD recorder_key = FLS_OUT_OF_INDEXES;
+#else
+#include <pthread.h>
+static pthread_key_t recorder_key;
+static bool_t recorder_key_created = FALSE;
+#endif
+
+static void flight_recorder_mutex_init(void){
+	bctbx_mutex_init(&recorder_mutex, NULL);
+}
+
+static void flight_recorder_mutex_lock(void){
+	bctbx_once(&recorder_once, flight_recorder_mutex_init);
+	bctbx_mutex_lock(&recorder_mutex);
+}
+
+/*called when a thread exits: its ring can be reused by another thread, its content remains until then*/
+#ifdef _WIN32
+static void WINAPI flight_recorder_release_ring(void *data){
+#else
+static void flight_recorder_release_ring(void *data){
+#endif
+	flight_recorder_ring_t *ring = (flight_recorder_ring_t *)data;
+	if (ring) bctbx_atomic_store_int_release(&ring->in_use, FALSE);
+}
+
+static flight_recorder_ring_t *flight_recorder_get_ring(void){
+	flight_recorder_ring_t *ring;
+
+#ifdef _WIN32
+	ring = (flight_recorder_ring_t *)FlsGetValue(recorder_key);
+#else
+	ring = (flight_recorder_ring_t *)pthread_getspecific(recorder_key);
+#endif
+	if (ring) return ring;
+
+	flight_recorder_mutex_lock();
+	for (ring = recorder_rings; ring != NULL; ring = ring->next){
+		if (!bctbx_atomic_load_int_acquire(&ring->in_use)) break;
+	}
+	if (ring == NULL){
+		ring = (flight_recorder_ring_t *)bctbx_malloc0(sizeof(flight_recorder_ring_t)
+			+ sizeof(flight_recorder_slot_t) * (recorder_slots_per_ring - 1));
+		ring->id = ++recorder_ring_count;
+		ring->count = recorder_slots_per_ring;
+		ring->next = recorder_rings;
+		bctbx_atomic_store_ptr(&recorder_rings, ring);
+	}
+	bctbx_atomic_store_int(&ring->in_use, TRUE);
+	bctbx_mutex_unlock(&recorder_mutex);
+#ifdef _WIN32
+	FlsSetValue(recorder_key, ring);
+#else
+	pthread_setspecific(recorder_key, ring);
+#endif
+	return ring;
+}
+
+void bctbx_log_flight_recorder_enable(size_t ring_size, const char *dump_path){
+	int enabled;
+
+	flight_recorder_mutex_lock();
+	if (recorder_slots_per_ring == 0 && ring_size > 0){
+		recorder_slots_per_ring = MAX(ring_size / sizeof(flight_recorder_slot_t), 1);
+#ifdef _WIN32
+		recorder_key = FlsAlloc(flight_recorder_release_ring);
+#else
+		recorder_key_created = pthread_key_create(&recorder_key, flight_recorder_release_ring) == 0;
+#endif
+	}
+	if (dump_path){
+		snprintf(recorder_dump_path, sizeof(recorder_dump_path), "%s", dump_path);
+	}else{
+		recorder_dump_path[0] = '\0';
+	}
+#ifdef _WIN32
+	enabled = ring_size > 0 && recorder_key != FLS_OUT_OF_INDEXES;
+#else
+	enabled = ring_size > 0 && recorder_key_created;
+#endif
+	bctbx_atomic_store_int(&recorder_enabled, enabled);
+	/*every level is recorded: the statements must not be skipped because of the level masks*/
+	bctbx_log_set_capture_mask(enabled ? BCTBX_LOG_LOGLEV_END - 1 : 0);
+	bctbx_mutex_unlock(&recorder_mutex);
+}
+
+bool_t bctbx_log_flight_recorder_enabled(void){
+	return bctbx_atomic_load_int(&recorder_enabled) != 0;
+}
+
+void bctbx_log_flight_recorder_record(const char *domain, BctbxLogLevel level, const char *fmt, va_list args){
+	flight_recorder_ring_t *ring = flight_recorder_get_ring();
+	uint64_t written = bctbx_atomic_load64(&ring->written);
+	flight_recorder_slot_t *slot = &ring->slots[written % ring->count];
+	struct timeval tp;
+	va_list cap;
+	int len;
+
+	bctbx_atomic_store64(&slot->seq, 0);
+	bctbx_gettimeofday(&tp, NULL);
+	slot->time_ms = (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_usec / 1000;
+	slot->domain = domain;
+	slot->level = level;
+	va_copy(cap, args);
+	len = vsnprintf(slot->text, sizeof(slot->text), fmt, cap);
+	va_end(cap);
+	slot->len = len < 0 ? 0 : MIN(len, (int)sizeof(slot->text) - 1);
+	bctbx_atomic_store64(&slot->seq, bctbx_atomic_add64(&recorder_seq, 1) + 1);
+	bctbx_atomic_store64(&ring->written, written + 1);
+}
+
+/*
+ * Everything below is async-signal-safe: no lock, no allocation, no stdio. bctbx_log_level_name() only returns
+ * string literals.
+ */
+
+static size_t flight_recorder_append(char *buf, size_t pos, size_t size, const char *str, size_t len){
+	if (pos >= size) return pos;
+	if (len > size - pos) len = size - pos;
+	memcpy(buf + pos, str, len);
+	return pos + len;
+}
+
+static size_t flight_recorder_append_str(char *buf, size_t pos, size_t size, const char *str){
+	return flight_recorder_append(buf, pos, size, str, strlen(str));
+}
+
+static size_t flight_recorder_append_uint(char *buf, size_t pos, size_t size, uint64_t value){
+	char digits[21];
+	char *p = digits + sizeof(digits);
+	do{
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	}while (value > 0);
+	return flight_recorder_append(buf, pos, size, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+static void flight_recorder_write_all(int fd, const char *buf, size_t len){
+	while (len > 0){
+		int ret = (int)flight_recorder_write(fd, buf, (unsigned int)len);
+		if (ret <= 0) return;
+		buf += ret;
+		len -= (size_t)ret;
+	}
+}
+
+/*oldest slot not dumped yet, NULL if there is none*/
+static flight_recorder_slot_t *flight_recorder_ring_peek(flight_recorder_ring_t *ring){
+	while (ring->dump_pos < ring->dump_end){
+		flight_recorder_slot_t *slot = &ring->slots[ring->dump_pos % ring->count];
+		if (bctbx_atomic_load64(&slot->seq) != 0) return slot;
+		ring->dump_pos++;
+	}
+	return NULL;
+}
+
+int bctbx_log_flight_recorder_dump_fd(int fd){
+	flight_recorder_ring_t *first = (flight_recorder_ring_t *)bctbx_atomic_load_ptr(&recorder_rings);
+	flight_recorder_ring_t *ring;
+	int count = 0;
+
+	/*a crash while dumping must not start a second dump*/
+	if (bctbx_atomic_inc(&recorder_dumping) != 1){
+		bctbx_atomic_dec(&recorder_dumping);
+		return -1;
+	}
+	/*messages recorded during the dump are not part of it*/
+	for (ring = first; ring != NULL; ring = ring->next){
+		ring->dump_end = bctbx_atomic_load64(&ring->written);
+		ring->dump_pos = ring->dump_end > ring->count ? ring->dump_end - ring->count : 0;
+	}
+	/*merge the rings in sequence order*/
+	for (;;){
+		flight_recorder_ring_t *best_ring = NULL;
+		flight_recorder_slot_t *best = NULL;
+		char line[FLIGHT_RECORDER_SLOT_TEXT_SIZE + 128];
+		size_t size = sizeof(line) - 1; /*room for the end of line*/
+		size_t pos = 0;
+
+		for (ring = first; ring != NULL; ring = ring->next){
+			flight_recorder_slot_t *slot = flight_recorder_ring_peek(ring);
+			if (slot && (best == NULL || slot->seq < best->seq)){
+				best = slot;
+				best_ring = ring;
+			}
+		}
+		if (best == NULL) break;
+		best_ring->dump_pos++;
+
+		pos = flight_recorder_append_uint(line, pos, size, best->time_ms);
+		pos = flight_recorder_append_str(line, pos, size, " [");
+		pos = flight_recorder_append_uint(line, pos, size, best_ring->id);
+		pos = flight_recorder_append_str(line, pos, size, "] ");
+		pos = flight_recorder_append_str(line, pos, size, best->domain ? best->domain : "bctoolbox");
+		pos = flight_recorder_append_str(line, pos, size, "-");
+		pos = flight_recorder_append_str(line, pos, size, bctbx_log_level_name((BctbxLogLevel)best->level));
+		pos = flight_recorder_append_str(line, pos, size, "-");
+		pos = flight_recorder_append(line, pos, size, best->text, (size_t)best->len);
+		line[pos++] = '\n';
+		flight_recorder_write_all(fd, line, pos);
+		count++;
+	}
+	bctbx_atomic_dec(&recorder_dumping);
+	return count;
+}
+
+int bctbx_log_flight_recorder_dump(const char *path){
+	int fd;
+	int ret;
+
+	if (path == NULL) path = recorder_dump_path;
+	if (path[0] == '\0') return -1;
+	fd = flight_recorder_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	ret = bctbx_log_flight_recorder_dump_fd(fd);
+	flight_recorder_close(fd);
+	return ret;
+}
+
+void bctbx_log_flight_recorder_dump_on_fatal(void){
+	if (!bctbx_log_flight_recorder_enabled()) return;
+	bctbx_atomic_store_int(&recorder_fatal_dumped, TRUE);
+	bctbx_log_flight_recorder_dump(NULL);
+}
+
+static void flight_recorder_signal_handler(int sig){
+	/*the dump of a fatal message is not truncated by the one of the SIGABRT raised by abort()*/
+	if (!bctbx_atomic_load_int(&recorder_fatal_dumped)) bctbx_log_flight_recorder_dump(NULL);
+	/*let the default action (core dump, termination) happen*/
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+int bctbx_log_flight_recorder_install_signal_handlers(void){
+	static const int signals[] = {SIGSEGV, SIGABRT, SIGFPE, SIGILL
+#ifndef _WIN32
+		, SIGBUS
+#endif
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++){
+		if (signal(signals[i], flight_recorder_signal_handler) == SIG_ERR) return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/logging.h"
+#include "logging_internal.h"
+
+/*
+ * The JSON lines are written piece by piece directly into the buffer of the file sink: neither the numbers nor the
+ * strings go through an intermediate heap allocated string.
+ */
+
+static void json_append(bctbx_log_file_sink_t *out, const char *str, size_t len){
+	bctbx_log_file_sink_append(out, str, len);
+}
+
+#define json_append_literal(out, str) json_append(out, str, sizeof(str) - 1)
+
+static void json_append_string(bctbx_log_file_sink_t *out, const char *str){
+	static const char hex[] = "0123456789abcdef";
+	const char *run = str;
+	const char *p;
+
+	json_append_literal(out, "\"");
+	for (p = str; *p != '\0'; p++){
+		unsigned char c = (unsigned char)*p;
+		char escaped[6];
+		size_t escaped_len = 2;
+
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+		/*output the run of characters that need no escaping at once*/
+		json_append(out, run, (size_t)(p - run));
+		run = p + 1;
+		escaped[0] = '\\';
+		switch (c){
+			case '"': escaped[1] = '"'; break;
+			case '\\': escaped[1] = '\\'; break;
+			case '\n': escaped[1] = 'n'; break;
+			case '\r': escaped[1] = 'r'; break;
+			case '\t': escaped[1] = 't'; break;
+			default:
+				escaped[1] = 'u';
+				escaped[2] = '0';
+				escaped[3] = '0';
+				escaped[4] = hex[c >> 4];
+				escaped[5] = hex[c & 0xf];
+				escaped_len = 6;
+		}
+		json_append(out, escaped, escaped_len);
+	}
+	json_append(out, run, (size_t)(p - run));
+	json_append_literal(out, "\"");
+}
+
+static void json_append_uint64(bctbx_log_file_sink_t *out, uint64_t value, bool_t negative){
+	char digits[21];
+	char *p = digits + sizeof(digits);
+
+	do{
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	}while (value > 0);
+	if (negative) *--p = '-';
+	json_append(out, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+static void json_append_int64(bctbx_log_file_sink_t *out, int64_t value){
+	/*negate as unsigned so that INT64_MIN does not overflow*/
+	json_append_uint64(out, value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value, value < 0);
+}
+
+static void json_append_double(bctbx_log_file_sink_t *out, double value){
+	char number[32];
+	int n;
+
+	if (value != value || value - value != 0){
+		/*NaN and infinities are not representable in JSON*/
+		json_append_literal(out, "null");
+		return;
+	}
+	n = snprintf(number, sizeof(number), "%.17g", value);
+	if (n > 0) json_append(out, number, MIN((size_t)n, sizeof(number) - 1));
+}
+
+static void json_append_member(bctbx_log_file_sink_t *out, const char *key){
+	json_append_literal(out, ",");
+	json_append_string(out, key);
+	json_append_literal(out, ":");
+}
+
+static void json_sink_log(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, const bctbx_log_kv_t *fields, size_t count){
+	bctbx_log_file_sink_t *out = (bctbx_log_file_sink_t *)user_data;
+	struct timeval tp;
+	size_t i;
+
+	bctbx_gettimeofday(&tp, NULL);
+	bctbx_log_file_sink_begin(out);
+	json_append_literal(out, "{\"ts\":");
+	json_append_int64(out, (int64_t)tp.tv_sec * 1000 + tp.tv_usec / 1000);
+	json_append_member(out, "level");
+	json_append_string(out, bctbx_log_level_name(lev));
+	json_append_member(out, "domain");
+	json_append_string(out, domain ? domain : "bctoolbox");
+	json_append_member(out, "msg");
+	json_append_string(out, msg);
+	for (i = 0; i < count; i++){
+		const bctbx_log_kv_t *f = &fields[i];
+		json_append_member(out, f->key);
+		switch (f->type){
+			case BCTBX_LOG_KV_STRING:
+				if (f->value.s) json_append_string(out, f->value.s);
+				else json_append_literal(out, "null");
+			break;
+			case BCTBX_LOG_KV_INT:
+			case BCTBX_LOG_KV_INT64:
+				json_append_int64(out, f->value.i);
+			break;
+			case BCTBX_LOG_KV_UINT64:
+				json_append_uint64(out, f->value.u, FALSE);
+			break;
+			case BCTBX_LOG_KV_DOUBLE:
+				json_append_double(out, f->value.d);
+			break;
+			case BCTBX_LOG_KV_BOOL:
+				if (f->value.i) json_append_literal(out, "true");
+				else json_append_literal(out, "false");
+			break;
+		}
+	}
+	json_append_literal(out, "}\n");
+	bctbx_log_stats_add_bytes(domain, lev, bctbx_log_file_sink_end(out, lev));
+}
+
+static void json_sink_flush(void *user_data){
+	bctbx_log_file_sink_flush((bctbx_log_file_sink_t *)user_data);
+}
+
+bctbx_log_sink_t *bctbx_log_json_sink_new(bctbx_log_file_sink_t *file_sink){
+	bctbx_log_sink_t *sink = bctbx_log_sink_new(NULL, file_sink);
+	bctbx_log_sink_set_kv_func(sink, json_sink_log);
+	bctbx_log_sink_set_flush_func(sink, json_sink_flush);
+	return sink;
+}
@@ -0,0 +1,229 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/logging.h"
+#include "logging_internal.h"
+#include "utils.h"
+
+/*
+ * Messages logged by other threads than the log thread set with bctbx_set_log_thread_id() are stored in a buffer
+ * owned by the producing thread, so that producers never contend with each other. The log thread takes the
+ * content of all the buffers at once and outputs the messages in timestamp order.
+ */
+
+typedef struct _log_thread_entry {
+	uint64_t time; /*monotonic, in ns*/
+	const char *domain; /*interned*/
+	BctbxLogLevel level;
+	size_t msg; /*offset of the message in the text of the batch*/
+} log_thread_entry_t;
+
+/*a batch of messages of one thread: the entries and the texts of the messages are kept in two growing arrays*/
+typedef struct _log_thread_batch {
+	log_thread_entry_t *entries;
+	size_t count;
+	size_t capacity;
+	char *text;
+	size_t text_len;
+	size_t text_capacity;
+	size_t pos; /*merge cursor*/
+} log_thread_batch_t;
+
+typedef struct _log_thread_buffer {
+	struct _log_thread_buffer *next; /*immutable once published*/
+	int in_use; /*owned by a running thread, accessed atomically*/
+	bctbx_mutex_t mutex; /*protects current*/
+	log_thread_batch_t current; /*filled by the producer*/
+	log_thread_batch_t flushed; /*exchanged with current on flush, only accessed under log_thread_flush_mutex*/
+	bool_t flushing; /*the owner thread is flushing, only accessed by the owner thread*/
+} log_thread_buffer_t;
+
+static log_thread_buffer_t *log_thread_buffers = NULL; /*prepend-only list, published with release semantics*/
+static bctbx_mutex_t log_thread_mutex; /*protects the buffer list and the key creation*/
+static bctbx_mutex_t log_thread_flush_mutex; /*serializes the flushes*/
+static bctbx_once_t log_thread_once = BCTBX_ONCE_INIT;
+
+#ifdef _WIN32
+static DWORD log_thread_key = FLS_OUT_OF_INDEXES;
+#else
+#include <pthread.h>
+static pthread_key_t log_thread_key;
+static bool_t log_thread_key_created = FALSE;
+#endif
+
+static void log_thread_mutex_init(void){
+	bctbx_mutex_init(&log_thread_mutex, NULL);
+	bctbx_mutex_init(&log_thread_flush_mutex, NULL);
+}
+
+/*called when a thread exits: its buffer can be reused by another thread, its messages remain until the next flush*/
+#ifdef _WIN32
+static void WINAPI log_thread_release_buffer(void *data){
+#else
+static void log_thread_release_buffer(void *data){
+#endif
+	log_thread_buffer_t *buffer = (log_thread_buffer_t *)data;
+	if (buffer) bctbx_atomic_store_int_release(&buffer->in_use, FALSE);
+}
+
+bool_t bctbx_log_thread_init(void){
+	bool_t ret;
+
+	bctbx_once(&log_thread_once, log_thread_mutex_init);
+	bctbx_mutex_lock(&log_thread_mutex);
+#ifdef _WIN32
+	if (log_thread_key == FLS_OUT_OF_INDEXES) log_thread_key = FlsAlloc(log_thread_release_buffer);
+	ret = log_thread_key != FLS_OUT_OF_INDEXES;
+#else
+	if (!log_thread_key_created) log_thread_key_created = pthread_key_create(&log_thread_key, log_thread_release_buffer) == 0;
+	ret = log_thread_key_created;
+#endif
+	bctbx_mutex_unlock(&log_thread_mutex);
+	return ret;
+}
+
+static log_thread_buffer_t *log_thread_get_buffer(void){
+	log_thread_buffer_t *buffer;
+
+#ifdef _WIN32
+	buffer = (log_thread_buffer_t *)FlsGetValue(log_thread_key);
+#else
+	buffer = (log_thread_buffer_t *)pthread_getspecific(log_thread_key);
+#endif
+	if (buffer) return buffer;
+
+	bctbx_mutex_lock(&log_thread_mutex);
+	for (buffer = log_thread_buffers; buffer != NULL; buffer = buffer->next){
+		if (!bctbx_atomic_load_int_acquire(&buffer->in_use)) break;
+	}
+	if (buffer == NULL){
+		buffer = bctbx_new0(log_thread_buffer_t, 1);
+		bctbx_mutex_init(&buffer->mutex, NULL);
+		buffer->next = log_thread_buffers;
+		bctbx_atomic_store_ptr(&log_thread_buffers, buffer);
+	}
+	bctbx_atomic_store_int(&buffer->in_use, TRUE);
+	bctbx_mutex_unlock(&log_thread_mutex);
+#ifdef _WIN32
+	FlsSetValue(log_thread_key, buffer);
+#else
+	pthread_setspecific(log_thread_key, buffer);
+#endif
+	return buffer;
+}
+
+static bool_t log_thread_batch_append(log_thread_batch_t *batch, const char *domain, BctbxLogLevel level, const char *fmt, va_list args){
+	log_thread_entry_t *entry;
+	va_list cap;
+	int len;
+
+	if (batch->text_capacity == 0){
+		batch->text_capacity = 4096;
+		batch->text = bctbx_malloc(batch->text_capacity);
+	}
+	va_copy(cap, args);
+	len = vsnprintf(batch->text + batch->text_len, batch->text_capacity - batch->text_len, fmt, cap);
+	va_end(cap);
+	if (len < 0) return FALSE;
+	if ((size_t)len >= batch->text_capacity - batch->text_len){
+		batch->text_capacity = MAX(batch->text_capacity * 2, batch->text_len + (size_t)len + 1);
+		batch->text = bctbx_realloc(batch->text, batch->text_capacity);
+		va_copy(cap, args);
+		vsnprintf(batch->text + batch->text_len, batch->text_capacity - batch->text_len, fmt, cap);
+		va_end(cap);
+	}
+	if (batch->count == batch->capacity){
+		batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+		batch->entries = bctbx_realloc(batch->entries, batch->capacity * sizeof(log_thread_entry_t));
+	}
+	entry = &batch->entries[batch->count++];
+	/*not the wall clock, which may go backwards and break the order of the merge*/
+	entry->time = bctbx_get_monotonic_ns();
+	entry->domain = domain;
+	entry->level = level;
+	entry->msg = batch->text_len;
+	batch->text_len += (size_t)len + 1;
+	return TRUE;
+}
+
+bool_t bctbx_log_thread_store(const char *domain, BctbxLogLevel level, const char *fmt, va_list args){
+	log_thread_buffer_t *buffer = log_thread_get_buffer();
+	bool_t ret;
+
+	bctbx_mutex_lock(&buffer->mutex);
+	ret = log_thread_batch_append(&buffer->current, domain, level, fmt, args);
+	bctbx_mutex_unlock(&buffer->mutex);
+	return ret;
+}
+
+static void log_thread_output(BctoolboxLogFunc out, const char *domain, BctbxLogLevel level, const char *fmt, ...){
+	va_list args;
+	va_start(args, fmt);
+	out(domain, level, fmt, args);
+	va_end(args);
+}
+
+void bctbx_log_thread_flush(BctoolboxLogFunc out){
+	log_thread_buffer_t *first = (log_thread_buffer_t *)bctbx_atomic_load_ptr(&log_thread_buffers);
+	log_thread_buffer_t *self;
+	log_thread_buffer_t *buffer;
+
+	/*no buffer means no message was ever stored, and the thread key may not exist*/
+	if (first == NULL) return;
+	/*a message logged by the log handler while flushing is output directly, not flushed again*/
+	self = log_thread_get_buffer();
+	if (self->flushing) return;
+	self->flushing = TRUE;
+	/*concurrent flushes are serialized: each message is output once, and in order*/
+	bctbx_mutex_lock(&log_thread_flush_mutex);
+	first = (log_thread_buffer_t *)bctbx_atomic_load_ptr(&log_thread_buffers);
+	for (buffer = first; buffer != NULL; buffer = buffer->next){
+		log_thread_batch_t batch;
+		bctbx_mutex_lock(&buffer->mutex);
+		batch = buffer->current;
+		buffer->current = buffer->flushed;
+		bctbx_mutex_unlock(&buffer->mutex);
+		buffer->flushed = batch;
+	}
+	/*the messages of each batch are in timestamp order: merge the batches*/
+	for (;;){
+		log_thread_buffer_t *best = NULL;
+		log_thread_entry_t *entry;
+
+		for (buffer = first; buffer != NULL; buffer = buffer->next){
+			log_thread_batch_t *batch = &buffer->flushed;
+			if (batch->pos < batch->count
+				&& (best == NULL || batch->entries[batch->pos].time < best->flushed.entries[best->flushed.pos].time)){
+				best = buffer;
+			}
+		}
+		if (best == NULL) break;
+		entry = &best->flushed.entries[best->flushed.pos++];
+		if (out) log_thread_output(out, entry->domain, entry->level, "%s", best->flushed.text + entry->msg);
+	}
+	/*the batches are emptied but keep their memory for the next messages*/
+	for (buffer = first; buffer != NULL; buffer = buffer->next){
+		buffer->flushed.count = 0;
+		buffer->flushed.text_len = 0;
+		buffer->flushed.pos = 0;
+	}
+	bctbx_mutex_unlock(&log_thread_flush_mutex);
+	self->flushing = FALSE;
+}
@@ -19,41 +19,139 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include "bctoolbox/logging.h"
-#include "bctoolbox/list.h"
+#include "logging_internal.h"
+#include "utils.h"
 #include <time.h>
 
 
+/*number of per-callsite token buckets kept by a domain*/
+#define BCTBX_LOG_CALLSITE_BUCKETS 32
+
+/*token bucket, tokens are counted in thousandth so that refill can be done with integer arithmetic on milliseconds*/
+typedef struct{
+	uint64_t tokens;
+	uint64_t last_refill; /*in ms*/
+}BctoolboxLogTokenBucket;
+
 typedef struct{
-	char *domain;
-	unsigned int logmask;
+	const char *fmt; /*identifies the callsite*/
+	BctoolboxLogTokenBucket bucket;
+}BctoolboxLogCallsite;
+
+typedef struct _BctoolboxLogDomain{
+	struct _BctoolboxLogDomain *next; /*immutable once the domain is published in the registry*/
+	const char *domain; /*interned, so that domains are compared by pointer*/
+	unsigned int logmask; /*effective mask, resolved from the domain tree. Accessed atomically*/
+	bctbx_log_level_stats_t *stats; /*updated with atomic operations. Shared by the domains beyond the limit*/
+	bool_t shared_stats; /*TRUE if stats points to the statistics of the domains beyond the limit*/
+	int limited; /*TRUE if rate limiting or sampling is enabled, accessed atomically without lock*/
+	bctbx_mutex_t limits_mutex; /*protects the fields below*/
+	unsigned int rate; /*messages per second for the whole domain, 0 if not limited*/
+	unsigned int burst;
+	BctoolboxLogTokenBucket bucket;
+	unsigned int callsite_rate; /*messages per second for each callsite, 0 if not limited*/
+	unsigned int callsite_burst;
+	BctoolboxLogCallsite *callsites;
+	unsigned int sample_every; /*only one message out of sample_every is kept, 0 or 1 if not sampled*/
+	unsigned int sample_count;
+	unsigned int suppressed; /*number of messages dropped since the last report*/
 }BctoolboxLogDomain;
 
 static void bctbx_log_domain_destroy(BctoolboxLogDomain *obj){
-	if (obj->domain) bctbx_free(obj->domain);
+	if (obj->callsites) bctbx_free(obj->callsites);
+	if (obj->stats && !obj->shared_stats) bctbx_free(obj->stats);
+	bctbx_mutex_destroy(&obj->limits_mutex);
 	bctbx_free(obj);
 }
 
+/*
+ * Node of the tree of dotted domain names, one per name component: "app.sip.transport" is the node "transport",
+ * child of "sip", child of "app". A mask set on a node applies to all the domains below it that have no mask of
+ * their own. The tree is only accessed with the domains mutex held.
+ */
+typedef struct _BctoolboxLogDomainNode{
+	struct _BctoolboxLogDomainNode *children;
+	struct _BctoolboxLogDomainNode *sibling;
+	char *name;
+	bool_t mask_set;
+	unsigned int mask;
+	BctoolboxLogDomain *domain; /*the domain with this full name, NULL if it was not created*/
+}BctoolboxLogDomainNode;
+
+static void bctbx_log_domain_node_destroy(BctoolboxLogDomainNode *node){
+	while (node != NULL) {
+		BctoolboxLogDomainNode *sibling = node->sibling;
+		bctbx_log_domain_node_destroy(node->children);
+		bctbx_free(node->name);
+		bctbx_free(node);
+		node = sibling;
+	}
+}
+
 typedef struct _BctoolboxLogger{
 	BctoolboxLogFunc logv_out;
-	unsigned int log_mask; /*the default log mask, if no per-domain settings are found*/
+	unsigned int log_mask; /*the default log mask, if no per-domain settings are found. Accessed atomically*/
+	unsigned int capture_mask; /*levels processed whatever the masks, for the flight recorder. Accessed atomically*/
 	FILE *log_file;
+	bctbx_log_file_sink_t *file_sink;
 	unsigned long log_thread_id;
-	bctbx_list_t *log_stored_messages_list;
-	bctbx_list_t *log_domains;
-	bctbx_mutex_t log_stored_messages_mutex;
+	BctoolboxLogDomain *log_domains; /*prepend-only list, published with release semantics so that lookups need no lock*/
 	bctbx_mutex_t domains_mutex;
+	BctoolboxLogDomainNode *domain_tree; /*top level components*/
+	BctoolboxLogDomain default_domain; /*holds the rate limiting settings of messages without domain*/
+	bctbx_log_level_stats_t default_stats[BCTBX_LOG_LEVEL_COUNT]; /*of the messages without domain*/
+	bctbx_log_level_stats_t other_stats[BCTBX_LOG_LEVEL_COUNT]; /*of the domains beyond BCTBX_LOG_STATS_MAX_DOMAINS*/
+	int stats_domain_count; /*number of domains having their own statistics*/
+	unsigned int coalescing_window; /*in ms, 0 if consecutive duplicates are not coalesced*/
+	bctbx_mutex_t coalescing_mutex;
+	const char *last_domain; /*domain (interned), level and message of the last message output, for coalescing*/
+	BctbxLogLevel last_level;
+	char *last_msg;
+	size_t last_msg_size;
+	uint64_t last_time;
+	unsigned int repeat_count;
 }BctoolboxLogger;
 
 
 static BctoolboxLogger __bctbx_logger = { &bctbx_logv_out, BCTBX_LOG_WARNING|BCTBX_LOG_ERROR|BCTBX_LOG_FATAL, 0};
+static bctbx_once_t logger_once = BCTBX_ONCE_INIT;
 
-void bctbx_init_logger(void){
+/*the mutexes of the logger are initialized on first use: nothing requires bctbx_init_logger() to be called*/
+static void logger_mutex_init(void){
 	bctbx_mutex_init(&__bctbx_logger.domains_mutex, NULL);
+	bctbx_mutex_init(&__bctbx_logger.default_domain.limits_mutex, NULL);
+	bctbx_mutex_init(&__bctbx_logger.coalescing_mutex, NULL);
+}
+
+static void logger_mutex_lock(bctbx_mutex_t *mutex){
+	bctbx_once(&logger_once, logger_mutex_init);
+	bctbx_mutex_lock(mutex);
+}
+
+void bctbx_init_logger(void){
+	bctbx_once(&logger_once, logger_mutex_init);
 }
 
 void bctbx_uninit_logger(void){
+	BctoolboxLogDomain *ld = __bctbx_logger.log_domains;
+	/*domains are never removed while logging is in use, lookups hold no reference on them*/
+	__bctbx_logger.log_domains = NULL;
+	while (ld != NULL) {
+		BctoolboxLogDomain *next = ld->next;
+		bctbx_log_domain_destroy(ld);
+		ld = next;
+	}
+	bctbx_log_domain_node_destroy(__bctbx_logger.domain_tree);
+	__bctbx_logger.domain_tree = NULL;
+	__bctbx_logger.stats_domain_count = 0;
+	/*the logger cannot be used anymore: make sure the mutexes destroyed were initialized*/
+	bctbx_once(&logger_once, logger_mutex_init);
 	bctbx_mutex_destroy(&__bctbx_logger.domains_mutex);
-	__bctbx_logger.log_domains = bctbx_list_free_with_data(__bctbx_logger.log_domains, (void (*)(void*))bctbx_log_domain_destroy);
+	bctbx_mutex_destroy(&__bctbx_logger.default_domain.limits_mutex);
+	bctbx_mutex_destroy(&__bctbx_logger.coalescing_mutex);
+	if (__bctbx_logger.last_msg) bctbx_free(__bctbx_logger.last_msg);
+	__bctbx_logger.last_msg = NULL;
+	__bctbx_logger.last_msg_size = 0;
 }
 
 /**
@@ -77,13 +175,84 @@ BctoolboxLogFunc bctbx_get_log_handler(void){
 	return __bctbx_logger.logv_out;
 }
 
+static void bctbx_log_file_sink_logv_out(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args){
+	bctbx_log_file_sink_t *sink = __bctbx_logger.file_sink;
+	if (sink) bctbx_log_file_sink_logv(sink, domain, lev, fmt, args);
+}
+
+void bctbx_set_log_file_sink(bctbx_log_file_sink_t *sink){
+	if (sink){
+		__bctbx_logger.file_sink = sink;
+		__bctbx_logger.logv_out = bctbx_log_file_sink_logv_out;
+	}else{
+		if (__bctbx_logger.logv_out == bctbx_log_file_sink_logv_out) __bctbx_logger.logv_out = bctbx_logv_out;
+		__bctbx_logger.file_sink = NULL;
+	}
+}
+
+void _bctbx_log_file_sink_unset(bctbx_log_file_sink_t *sink){
+	if (__bctbx_logger.file_sink == sink) bctbx_set_log_file_sink(NULL);
+}
+
+/*
+ * Find the node of a domain in the tree, creating the missing ones if create is TRUE. *inherited is set to the mask
+ * that applies to the domain if its node has none: the one of its nearest ancestor having a mask, or the default mask.
+ * Returns NULL if the node does not exist and create is FALSE. Must be called with the domains mutex held.
+ */
+static BctoolboxLogDomainNode *log_domain_tree_find(const char *domain, bool_t create, unsigned int *inherited){
+	BctoolboxLogDomainNode **children = &__bctbx_logger.domain_tree;
+	BctoolboxLogDomainNode *node = NULL;
+	const char *component = domain;
+
+	*inherited = bctbx_atomic_load_int(&__bctbx_logger.log_mask);
+	for (;;) {
+		const char *end = strchr(component, '.');
+		size_t len = end ? (size_t)(end - component) : strlen(component);
+
+		if (node && node->mask_set) *inherited = node->mask;
+		for (node = *children; node != NULL; node = node->sibling) {
+			if (strncmp(node->name, component, len) == 0 && node->name[len] == '\0') break;
+		}
+		if (node == NULL) {
+			if (!create) return NULL;
+			node = bctbx_new0(BctoolboxLogDomainNode, 1);
+			node->name = bctbx_malloc(len + 1);
+			memcpy(node->name, component, len);
+			node->name[len] = '\0';
+			node->sibling = *children;
+			*children = node;
+		}
+		if (end == NULL) return node;
+		children = &node->children;
+		component = end + 1;
+	}
+}
+
+/*
+ * Resolve again the masks of the domains of a subtree, after a change of the masks above or in it.
+ * Must be called with the domains mutex held.
+ */
+static void log_domain_tree_update(BctoolboxLogDomainNode *node, unsigned int inherited){
+	unsigned int mask = node->mask_set ? node->mask : inherited;
+	BctoolboxLogDomainNode *child;
+
+	if (node->domain) bctbx_atomic_store_int(&node->domain->logmask, mask);
+	for (child = node->children; child != NULL; child = child->sibling) {
+		log_domain_tree_update(child, mask);
+	}
+}
+
+/*
+ * Lock-free lookup: domains are only ever prepended, fully initialized, to the registry, and never removed before
+ * bctbx_uninit_logger(). A domain name that was never interned cannot be in the registry.
+ */
 static BctoolboxLogDomain * get_log_domain(const char *domain){
-	bctbx_list_t *it;
-	
+	BctoolboxLogDomain *ld;
+
+	domain = bctbx_intern_lookup(domain);
 	if (domain == NULL) return NULL;
-	for (it = __bctbx_logger.log_domains; it != NULL; it = bctbx_list_next(it)) {
-		BctoolboxLogDomain *ld = (BctoolboxLogDomain*)bctbx_list_get_data(it);
-		if (ld->domain && strcmp(ld->domain, domain) == 0 ){
+	for (ld = (BctoolboxLogDomain *)bctbx_atomic_load_ptr(&__bctbx_logger.log_domains); ld != NULL; ld = ld->next) {
+		if (ld->domain == domain){
 			return ld;
 		}
 	}
@@ -97,13 +266,26 @@ static BctoolboxLogDomain *get_log_domain_rw(const char *domain){
 	ret = get_log_domain(domain);
 	if (ret) return ret;
 	/*it does not exist, hence create it by taking the mutex*/
-	bctbx_mutex_lock(&__bctbx_logger.domains_mutex);
+	logger_mutex_lock(&__bctbx_logger.domains_mutex);
 	ret = get_log_domain(domain);
 	if (!ret){
+		unsigned int inherited;
+		BctoolboxLogDomainNode *node = log_domain_tree_find(domain, TRUE, &inherited);
 		ret = bctbx_new0(BctoolboxLogDomain,1);
-		ret->domain = bctbx_strdup(domain);
-		ret->logmask = __bctbx_logger.log_mask;
-		__bctbx_logger.log_domains = bctbx_list_prepend(__bctbx_logger.log_domains, ret);
+		ret->domain = bctbx_intern(domain);
+		ret->logmask = node->mask_set ? node->mask : inherited;
+		node->domain = ret;
+		/*each distinct domain name gets a record: bound the memory of the statistics*/
+		if (__bctbx_logger.stats_domain_count < BCTBX_LOG_STATS_MAX_DOMAINS) {
+			ret->stats = bctbx_new0(bctbx_log_level_stats_t, BCTBX_LOG_LEVEL_COUNT);
+			__bctbx_logger.stats_domain_count++;
+		} else {
+			ret->stats = __bctbx_logger.other_stats;
+			ret->shared_stats = TRUE;
+		}
+		bctbx_mutex_init(&ret->limits_mutex, NULL);
+		ret->next = __bctbx_logger.log_domains;
+		bctbx_atomic_store_ptr(&__bctbx_logger.log_domains, ret);
 	}
 	bctbx_mutex_unlock(&__bctbx_logger.domains_mutex);
 	return ret;
@@ -114,8 +296,23 @@ static BctoolboxLogDomain *get_log_domain_rw(const char *domain){
 * BCTBX_FATAL .
 **/
 void bctbx_set_log_level_mask(const char *domain, int levelmask){
-	if (domain == NULL) __bctbx_logger.log_mask=levelmask;
-	else get_log_domain_rw(domain)->logmask = levelmask;
+	BctoolboxLogDomainNode *node;
+	unsigned int inherited;
+
+	if (domain) get_log_domain_rw(domain);
+	logger_mutex_lock(&__bctbx_logger.domains_mutex);
+	if (domain == NULL) {
+		bctbx_atomic_store_int(&__bctbx_logger.log_mask, (unsigned int)levelmask);
+		for (node = __bctbx_logger.domain_tree; node != NULL; node = node->sibling) {
+			log_domain_tree_update(node, (unsigned int)levelmask);
+		}
+	} else {
+		node = log_domain_tree_find(domain, TRUE, &inherited);
+		node->mask_set = TRUE;
+		node->mask = (unsigned int)levelmask;
+		log_domain_tree_update(node, inherited);
+	}
+	bctbx_mutex_unlock(&__bctbx_logger.domains_mutex);
 }
 
 
@@ -139,18 +336,253 @@ void bctbx_set_log_level(const char *domain, BctbxLogLevel level){
 	bctbx_set_log_level_mask(domain, levelmask);
 }
 
+/*
+ * Mask of a domain that was not created, resolved from the tree without adding anything to it, so that checking
+ * the levels of short-lived domain names does not make the registry grow.
+ */
+static unsigned int log_domain_resolve_mask(const char *domain){
+	BctoolboxLogDomainNode *node;
+	unsigned int mask;
+
+	logger_mutex_lock(&__bctbx_logger.domains_mutex);
+	node = log_domain_tree_find(domain, FALSE, &mask);
+	if (node && node->mask_set) mask = node->mask;
+	bctbx_mutex_unlock(&__bctbx_logger.domains_mutex);
+	return mask;
+}
+
 unsigned int bctbx_get_log_level_mask(const char *domain) {
 	BctoolboxLogDomain *ld;
-	if (domain == NULL || (ld = get_log_domain(domain)) == NULL) return __bctbx_logger.log_mask;
-	else return ld->logmask;
+
+	if (domain == NULL) return bctbx_atomic_load_int(&__bctbx_logger.log_mask);
+	/*lock-free for the domains already created, by a setting or by logging*/
+	ld = get_log_domain(domain);
+	if (ld) return bctbx_atomic_load_int(&ld->logmask);
+	return log_domain_resolve_mask(domain);
+}
+
+unsigned int bctbx_get_log_enabled_mask(const char *domain) {
+	return bctbx_get_log_level_mask(domain) | bctbx_atomic_load_int(&__bctbx_logger.capture_mask);
+}
+
+void bctbx_log_set_capture_mask(unsigned int mask) {
+	bctbx_atomic_store_int(&__bctbx_logger.capture_mask, mask);
+}
+
+static BctoolboxLogDomain *get_log_domain_limits_rw(const char *domain){
+	if (domain) return get_log_domain_rw(domain);
+	bctbx_once(&logger_once, logger_mutex_init);
+	return &__bctbx_logger.default_domain;
+}
+
+/*the default domain has no stats block of its own, so that it needs no initialization*/
+static bctbx_log_level_stats_t *log_domain_stats_block(BctoolboxLogDomain *ld){
+	return ld->stats ? ld->stats : __bctbx_logger.default_stats;
+}
+
+static bctbx_log_level_stats_t *log_domain_stats(BctoolboxLogDomain *ld, BctbxLogLevel level){
+	int i = 0;
+	while (i < BCTBX_LOG_LEVEL_COUNT - 1 && ((1 << i) & level) == 0) i++;
+	return &log_domain_stats_block(ld)[i];
+}
+
+/*monotonic time in microseconds, to measure the time spent in outputs whatever the changes of the wall clock*/
+static uint64_t log_time_us(void){
+	return bctbx_get_monotonic_ns() / 1000;
+}
+
+void bctbx_log_stats_add_bytes(const char *domain, BctbxLogLevel level, size_t bytes){
+	BctoolboxLogDomain *ld = domain ? get_log_domain(domain) : &__bctbx_logger.default_domain;
+	if (ld) bctbx_atomic_add64(&log_domain_stats(ld, level)->bytes, bytes);
+}
+
+void bctbx_log_stats_add_dropped(const char *domain, BctbxLogLevel level){
+	BctoolboxLogDomain *ld = domain ? get_log_domain(domain) : &__bctbx_logger.default_domain;
+	if (ld) bctbx_atomic_add64(&log_domain_stats(ld, level)->dropped, 1);
+}
+
+static void log_stats_add_output(BctoolboxLogDomain *ld, BctbxLogLevel level, uint64_t start_us){
+	bctbx_log_level_stats_t *stats = log_domain_stats(ld, level);
+	bctbx_atomic_add64(&stats->emitted, 1);
+	bctbx_atomic_add64(&stats->handler_time_us, log_time_us() - start_us);
+}
+
+static void log_domain_copy_stats(bctbx_log_domain_stats_t *dst, const char *domain, bctbx_log_level_stats_t *stats){
+	int i;
+	dst->domain = domain ? bctbx_strdup(domain) : NULL;
+	for (i = 0; i < BCTBX_LOG_LEVEL_COUNT; i++){
+		dst->levels[i].emitted = bctbx_atomic_load64(&stats[i].emitted);
+		dst->levels[i].filtered = bctbx_atomic_load64(&stats[i].filtered);
+		dst->levels[i].dropped = bctbx_atomic_load64(&stats[i].dropped);
+		dst->levels[i].bytes = bctbx_atomic_load64(&stats[i].bytes);
+		dst->levels[i].handler_time_us = bctbx_atomic_load64(&stats[i].handler_time_us);
+	}
+}
+
+static void log_domain_reset_stats(bctbx_log_level_stats_t *stats){
+	int i;
+	for (i = 0; i < BCTBX_LOG_LEVEL_COUNT; i++){
+		bctbx_atomic_store64(&stats[i].emitted, 0);
+		bctbx_atomic_store64(&stats[i].filtered, 0);
+		bctbx_atomic_store64(&stats[i].dropped, 0);
+		bctbx_atomic_store64(&stats[i].bytes, 0);
+		bctbx_atomic_store64(&stats[i].handler_time_us, 0);
+	}
+}
+
+bctbx_log_domain_stats_t *bctbx_log_get_stats(size_t *count){
+	BctoolboxLogDomain *first = (BctoolboxLogDomain *)bctbx_atomic_load_ptr(&__bctbx_logger.log_domains);
+	BctoolboxLogDomain *ld;
+	bctbx_log_domain_stats_t *stats;
+	bool_t others = FALSE;
+	size_t i = 1;
+
+	/*domains added meanwhile are not part of the snapshot*/
+	for (ld = first; ld != NULL; ld = ld->next) {
+		if (ld->shared_stats) others = TRUE;
+		else i++;
+	}
+	*count = others ? i + 1 : i;
+	stats = bctbx_new0(bctbx_log_domain_stats_t, *count);
+	log_domain_copy_stats(&stats[0], NULL, __bctbx_logger.default_stats);
+	for (i = 1, ld = first; ld != NULL; ld = ld->next) {
+		if (!ld->shared_stats) log_domain_copy_stats(&stats[i++], ld->domain, ld->stats);
+	}
+	if (others) log_domain_copy_stats(&stats[i], BCTBX_LOG_STATS_OTHER_DOMAINS, __bctbx_logger.other_stats);
+	return stats;
+}
+
+void bctbx_log_stats_free(bctbx_log_domain_stats_t *stats, size_t count){
+	size_t i;
+	for (i = 0; i < count; i++){
+		if (stats[i].domain) bctbx_free(stats[i].domain);
+	}
+	bctbx_free(stats);
+}
+
+void bctbx_log_reset_stats(void){
+	BctoolboxLogDomain *ld;
+	log_domain_reset_stats(__bctbx_logger.default_stats);
+	log_domain_reset_stats(__bctbx_logger.other_stats);
+	for (ld = (BctoolboxLogDomain *)bctbx_atomic_load_ptr(&__bctbx_logger.log_domains); ld != NULL; ld = ld->next) {
+		if (!ld->shared_stats) log_domain_reset_stats(ld->stats);
+	}
+}
+
+static void log_domain_update_limited(BctoolboxLogDomain *ld){
+	bctbx_atomic_store_int(&ld->limited, ld->rate > 0 || ld->callsite_rate > 0 || ld->sample_every > 1);
+}
+
+static void log_token_bucket_reset(BctoolboxLogTokenBucket *bucket, unsigned int burst){
+	bucket->tokens = (uint64_t)burst * 1000;
+	bucket->last_refill = bctbx_get_cur_time_ms();
+}
+
+/*refill the bucket according to the elapsed time and take one token if available*/
+static bool_t log_token_bucket_take(BctoolboxLogTokenBucket *bucket, unsigned int rate, unsigned int burst, uint64_t now){
+	uint64_t max_tokens = (uint64_t)MAX(burst, 1) * 1000;
+	if (now > bucket->last_refill){
+		bucket->tokens += (now - bucket->last_refill) * rate;
+		if (bucket->tokens > max_tokens) bucket->tokens = max_tokens;
+		bucket->last_refill = now;
+	}
+	if (bucket->tokens < 1000) return FALSE;
+	bucket->tokens -= 1000;
+	return TRUE;
+}
+
+void bctbx_set_log_rate_limit(const char *domain, unsigned int rate, unsigned int burst){
+	BctoolboxLogDomain *ld = get_log_domain_limits_rw(domain);
+	bctbx_mutex_lock(&ld->limits_mutex);
+	ld->rate = rate;
+	ld->burst = burst;
+	log_token_bucket_reset(&ld->bucket, burst);
+	log_domain_update_limited(ld);
+	bctbx_mutex_unlock(&ld->limits_mutex);
+}
+
+void bctbx_set_log_callsite_rate_limit(const char *domain, unsigned int rate, unsigned int burst){
+	BctoolboxLogDomain *ld = get_log_domain_limits_rw(domain);
+	bctbx_mutex_lock(&ld->limits_mutex);
+	ld->callsite_rate = rate;
+	ld->callsite_burst = burst;
+	if (rate > 0 && ld->callsites == NULL){
+		ld->callsites = bctbx_new0(BctoolboxLogCallsite, BCTBX_LOG_CALLSITE_BUCKETS);
+	}else if (ld->callsites){
+		memset(ld->callsites, 0, sizeof(BctoolboxLogCallsite) * BCTBX_LOG_CALLSITE_BUCKETS);
+	}
+	log_domain_update_limited(ld);
+	bctbx_mutex_unlock(&ld->limits_mutex);
+}
+
+void bctbx_set_log_sampling(const char *domain, unsigned int one_in_n){
+	BctoolboxLogDomain *ld = get_log_domain_limits_rw(domain);
+	bctbx_mutex_lock(&ld->limits_mutex);
+	ld->sample_every = one_in_n;
+	ld->sample_count = 0;
+	log_domain_update_limited(ld);
+	bctbx_mutex_unlock(&ld->limits_mutex);
+}
+
+/*
+ * The callsites are kept in a small hash table indexed by the address of the format string. When the table is full,
+ * the colliding entry is recycled: in the worst case a callsite gets a fresh bucket.
+ */
+static BctoolboxLogTokenBucket *log_domain_get_callsite_bucket(BctoolboxLogDomain *ld, const char *fmt){
+	size_t index = ((size_t)fmt >> 3) % BCTBX_LOG_CALLSITE_BUCKETS;
+	size_t i;
+	for (i = 0; i < 4; i++){
+		BctoolboxLogCallsite *cs = &ld->callsites[(index + i) % BCTBX_LOG_CALLSITE_BUCKETS];
+		if (cs->fmt == fmt) return &cs->bucket;
+		if (cs->fmt == NULL){
+			cs->fmt = fmt;
+			log_token_bucket_reset(&cs->bucket, ld->callsite_burst);
+			return &cs->bucket;
+		}
+	}
+	ld->callsites[index].fmt = fmt;
+	log_token_bucket_reset(&ld->callsites[index].bucket, ld->callsite_burst);
+	return &ld->callsites[index].bucket;
+}
+
+/*
+ * Apply sampling and rate limits of the domain to a message.
+ * Returns TRUE if the message can be output, in which case *suppressed is set to the number of messages
+ * dropped since the previous one that went through.
+ */
+static bool_t log_domain_allow(BctoolboxLogDomain *ld, const char *fmt, unsigned int *suppressed){
+	bool_t allowed = TRUE;
+	uint64_t now;
+
+	bctbx_mutex_lock(&ld->limits_mutex);
+	if (ld->sample_every > 1){
+		allowed = (ld->sample_count++ % ld->sample_every) == 0;
+	}
+	if (allowed && (ld->rate > 0 || ld->callsite_rate > 0)){
+		now = bctbx_get_cur_time_ms();
+		if (ld->callsite_rate > 0){
+			allowed = log_token_bucket_take(log_domain_get_callsite_bucket(ld, fmt), ld->callsite_rate, ld->callsite_burst, now);
+		}
+		if (allowed && ld->rate > 0){
+			allowed = log_token_bucket_take(&ld->bucket, ld->rate, ld->burst, now);
+		}
+	}
+	if (allowed){
+		*suppressed = ld->suppressed;
+		ld->suppressed = 0;
+	}else{
+		ld->suppressed++;
+	}
+	bctbx_mutex_unlock(&ld->limits_mutex);
+	return allowed;
 }
 
 void bctbx_set_log_thread_id(unsigned long thread_id) {
 	if (thread_id == 0) {
 		bctbx_logv_flush();
-		bctbx_mutex_destroy(&__bctbx_logger.log_stored_messages_mutex);
-	} else {
-		bctbx_mutex_init(&__bctbx_logger.log_stored_messages_mutex, NULL);
+	} else if (!bctbx_log_thread_init()) {
+		bctbx_error("Cannot store the logs of other threads than the log thread");
+		return;
 	}
 	__bctbx_logger.log_thread_id = thread_id;
 }
@@ -233,78 +665,350 @@ char *bctbx_strcat_printf(char* dst, const char *fmt,...){
 	return ret;
 }
 
-#if	defined(_WIN32) || defined(_WIN32_WCE)
-#define ENDLINE "\r\n"
-#else
-#define ENDLINE "\n"
-#endif
+void bctbx_logv_flush(void) {
+	bctbx_log_thread_flush(__bctbx_logger.logv_out);
+}
 
-typedef struct {
-	int level;
-	char *msg;
-	char *domain;
-} bctbx_stored_log_t;
-
-void _bctbx_logv_flush(int dummy, ...) {
-	bctbx_list_t *elem;
-	bctbx_list_t *msglist;
-	va_list empty_va_list;
-	va_start(empty_va_list, dummy);
-	bctbx_mutex_lock(&__bctbx_logger.log_stored_messages_mutex);
-	msglist = __bctbx_logger.log_stored_messages_list;
-	__bctbx_logger.log_stored_messages_list = NULL;
-	bctbx_mutex_unlock(&__bctbx_logger.log_stored_messages_mutex);
-	for (elem = msglist; elem != NULL; elem = bctbx_list_next(elem)) {
-		bctbx_stored_log_t *l = (bctbx_stored_log_t *)bctbx_list_get_data(elem);
-#ifdef _WIN32
-		__bctbx_logger.logv_out(l->domain, l->level, l->msg, empty_va_list);
-#else
-		va_list cap;
-		va_copy(cap, empty_va_list);
-		__bctbx_logger.logv_out(l->domain, l->level, l->msg, cap);
-		va_end(cap);
-#endif
-		if (l->domain) bctbx_free(l->domain);
-		bctbx_free(l->msg);
-		bctbx_free(l);
+/*the domain given to the output stages below is always interned, or NULL*/
+static void _bctbx_logv_dispatch(const char *domain, BctbxLogLevel level, const char *fmt, va_list args) {
+	if (__bctbx_logger.logv_out == NULL) return;
+	if (__bctbx_logger.log_thread_id == 0) {
+		__bctbx_logger.logv_out(domain, level, fmt, args);
+	} else if (__bctbx_logger.log_thread_id == bctbx_thread_self()) {
+		bctbx_logv_flush();
+		__bctbx_logger.logv_out(domain, level, fmt, args);
+	} else {
+		bctbx_log_thread_store(domain, level, fmt, args);
 	}
-	bctbx_list_free(msglist);
-	va_end(empty_va_list);
 }
 
-void bctbx_logv_flush(void) {
-	_bctbx_logv_flush(0);
+static void _bctbx_log_dispatch(const char *domain, BctbxLogLevel level, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_bctbx_logv_dispatch(domain, level, fmt, args);
+	va_end(args);
+}
+
+/*output an already formatted message to the log handler and to the sinks*/
+static void _bctbx_log_output_msg(const char *domain, BctbxLogLevel level, const char *msg, size_t len) {
+	_bctbx_log_dispatch(domain, level, "%s", msg);
+	if (bctbx_log_sinks_active()) bctbx_log_sinks_dispatch(domain, level, msg, len, NULL, NULL, 0);
+}
+
+/*
+ * Output a message to the log handler and to the sinks. When sinks are in use the message is formatted once here,
+ * and the same text is passed to all of them.
+ */
+static void _bctbx_logv_output(const char *domain, BctbxLogLevel level, const char *fmt, va_list args) {
+	char stack_msg[512];
+	char *msg = stack_msg;
+	int len;
+	va_list cap;
+
+	if (!bctbx_log_sinks_active()) {
+		_bctbx_logv_dispatch(domain, level, fmt, args);
+		return;
+	}
+	va_copy(cap, args);
+	len = vsnprintf(stack_msg, sizeof(stack_msg), fmt, cap);
+	va_end(cap);
+	if (len < 0) return;
+	if (len >= (int)sizeof(stack_msg)) msg = bctbx_strdup_vprintf(fmt, args);
+	_bctbx_log_output_msg(domain, level, msg, (size_t)len);
+	if (msg != stack_msg) bctbx_free(msg);
+}
+
+static void _bctbx_log_output(const char *domain, BctbxLogLevel level, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_bctbx_logv_output(domain, level, fmt, args);
+	va_end(args);
+}
+
+/*copy a string into a buffer that is only reallocated when it grows*/
+static void log_copy_to_buffer(char **buffer, size_t *size, const char *str){
+	size_t len = strlen(str) + 1;
+	if (len > *size){
+		*buffer = bctbx_realloc(*buffer, len);
+		*size = len;
+	}
+	memcpy(*buffer, str, len);
+}
+
+/*
+ * Take the pending "last message repeated" report, if any. Must be called with the coalescing mutex held.
+ */
+static unsigned int log_coalescing_take_repeats(const char **domain, BctbxLogLevel *level){
+	unsigned int count = __bctbx_logger.repeat_count;
+	if (count > 0){
+		*domain = __bctbx_logger.last_domain;
+		*level = __bctbx_logger.last_level;
+		__bctbx_logger.repeat_count = 0;
+	}
+	return count;
+}
+
+static void log_report_repeats(unsigned int count, const char *domain, BctbxLogLevel level){
+	if (count == 1){
+		_bctbx_log_output(domain, level, "last message repeated 1 time");
+	}else{
+		_bctbx_log_output(domain, level, "last message repeated %u times", count);
+	}
+}
+
+void bctbx_log_coalescing_flush(void){
+	const char *domain = NULL;
+	BctbxLogLevel level = BCTBX_LOG_MESSAGE;
+	unsigned int count;
+
+	logger_mutex_lock(&__bctbx_logger.coalescing_mutex);
+	count = log_coalescing_take_repeats(&domain, &level);
+	bctbx_mutex_unlock(&__bctbx_logger.coalescing_mutex);
+	if (count > 0) log_report_repeats(count, domain, level);
+}
+
+void bctbx_set_log_coalescing_window(unsigned int window_ms){
+	if (window_ms == 0) bctbx_log_coalescing_flush();
+	logger_mutex_lock(&__bctbx_logger.coalescing_mutex);
+	__bctbx_logger.coalescing_window = window_ms;
+	__bctbx_logger.last_time = 0;
+	bctbx_mutex_unlock(&__bctbx_logger.coalescing_mutex);
+}
+
+/*
+ * Coalescing stage: a message identical to the previous one (same domain, level and text) logged within the window
+ * that started with the output of the previous one is only counted. The count is reported by a
+ * "last message repeated N times" line before the next different message.
+ */
+static void _bctbx_logv_coalesce(const char *domain, BctbxLogLevel level, const char *fmt, va_list args) {
+	char stack_msg[512];
+	char *msg = stack_msg;
+	const char *report_domain = NULL;
+	BctbxLogLevel report_level = level;
+	unsigned int repeats = 0;
+	uint64_t now;
+	int len;
+	va_list cap;
+
+	va_copy(cap, args);
+	len = vsnprintf(stack_msg, sizeof(stack_msg), fmt, cap);
+	va_end(cap);
+	if (len < 0) return;
+	if (len >= (int)sizeof(stack_msg)) msg = bctbx_strdup_vprintf(fmt, args);
+
+	now = bctbx_get_cur_time_ms();
+	logger_mutex_lock(&__bctbx_logger.coalescing_mutex);
+	if (__bctbx_logger.last_msg && __bctbx_logger.last_level == level
+		&& now - __bctbx_logger.last_time < __bctbx_logger.coalescing_window
+		&& __bctbx_logger.last_domain == domain
+		&& strcmp(__bctbx_logger.last_msg, msg) == 0) {
+		__bctbx_logger.repeat_count++;
+		bctbx_mutex_unlock(&__bctbx_logger.coalescing_mutex);
+		if (msg != stack_msg) bctbx_free(msg);
+		return;
+	}
+	repeats = log_coalescing_take_repeats(&report_domain, &report_level);
+	__bctbx_logger.last_domain = domain;
+	log_copy_to_buffer(&__bctbx_logger.last_msg, &__bctbx_logger.last_msg_size, msg);
+	__bctbx_logger.last_level = level;
+	__bctbx_logger.last_time = now;
+	bctbx_mutex_unlock(&__bctbx_logger.coalescing_mutex);
+
+	if (repeats > 0) log_report_repeats(repeats, report_domain, report_level);
+	_bctbx_log_output_msg(domain, level, msg, (size_t)len);
+	if (msg != stack_msg) bctbx_free(msg);
+}
+
+/*
+ * Level mask and rate limiting stage, the callsite being identified by fmt. Outputs the report of suppressed messages
+ * if any, and returns TRUE if the message must be output. The domain, created on first use so that it holds
+ * the statistics, is returned in *pld.
+ */
+static bool_t log_filter(const char *domain, BctbxLogLevel level, const char *fmt, BctoolboxLogDomain **pld) {
+	BctoolboxLogDomain *ld = get_log_domain_limits_rw(domain);
+	unsigned int mask = bctbx_atomic_load_int(domain ? &ld->logmask : &__bctbx_logger.log_mask);
+	unsigned int suppressed = 0;
+
+	*pld = ld;
+	if (!(mask & level)) {
+		bctbx_atomic_add64(&log_domain_stats(ld, level)->filtered, 1);
+		return FALSE;
+	}
+	if (__bctbx_logger.logv_out == NULL && !bctbx_log_sinks_active()) return FALSE;
+	if (!bctbx_atomic_load_int(&ld->limited) || level == BCTBX_LOG_FATAL || log_domain_allow(ld, fmt, &suppressed)) {
+		if (suppressed > 0) {
+			_bctbx_log_output(ld->domain, level, "%u messages suppressed by rate limiting", suppressed);
+		}
+		return TRUE;
+	}
+	bctbx_atomic_add64(&log_domain_stats(ld, level)->dropped, 1);
+	return FALSE;
+}
+
+static void log_fatal_abort(void) {
+#if !defined(_WIN32_WCE)
+	bctbx_log_flight_recorder_dump_on_fatal();
+	bctbx_log_coalescing_flush();
+	bctbx_logv_flush();
+	bctbx_log_sinks_flush();
+	if (__bctbx_logger.file_sink) bctbx_log_file_sink_flush(__bctbx_logger.file_sink);
+	abort();
+#endif
 }
 
 void bctbx_logv(const char *domain, BctbxLogLevel level, const char *fmt, va_list args) {
-	if ((__bctbx_logger.logv_out != NULL) && bctbx_log_level_enabled(domain, level)) {
-		if (__bctbx_logger.log_thread_id == 0) {
-			__bctbx_logger.logv_out(domain, level, fmt, args);
-		} else if (__bctbx_logger.log_thread_id == bctbx_thread_self()) {
-			bctbx_logv_flush();
-			__bctbx_logger.logv_out(domain, level, fmt, args);
+	BctoolboxLogDomain *ld;
+	bool_t output = log_filter(domain, level, fmt, &ld);
+
+	if (bctbx_log_flight_recorder_enabled()) {
+		/*interned strings are never freed, hence can be kept in the ring*/
+		bctbx_log_flight_recorder_record(ld->domain, level, fmt, args);
+	}
+	if (output) {
+		uint64_t start = log_time_us();
+		if (__bctbx_logger.coalescing_window > 0 && level != BCTBX_LOG_FATAL) {
+			_bctbx_logv_coalesce(ld->domain, level, fmt, args);
 		} else {
-			bctbx_stored_log_t *l = bctbx_new(bctbx_stored_log_t, 1);
-			l->domain = domain ? bctbx_strdup(domain) : NULL;
-			l->level = level;
-			l->msg = bctbx_strdup_vprintf(fmt, args);
-			bctbx_mutex_lock(&__bctbx_logger.log_stored_messages_mutex);
-			__bctbx_logger.log_stored_messages_list = bctbx_list_append(__bctbx_logger.log_stored_messages_list, l);
-			bctbx_mutex_unlock(&__bctbx_logger.log_stored_messages_mutex);
+			_bctbx_logv_output(ld->domain, level, fmt, args);
 		}
+		log_stats_add_output(ld, level, start);
 	}
-#if !defined(_WIN32_WCE)
-	if (level == BCTBX_LOG_FATAL) {
-		bctbx_logv_flush();
-		abort();
+	if (level == BCTBX_LOG_FATAL) log_fatal_abort();
+}
+
+/*
+ * Append the fields to the message as key=value pairs. Returns the length of the text that would have been written
+ * if size had been large enough, as snprintf() does.
+ */
+static size_t log_kv_format_text(char *buf, size_t size, const char *msg, const bctbx_log_kv_t *fields, size_t count) {
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i <= count; i++) {
+		char *p = len < size ? buf + len : NULL;
+		size_t avail = len < size ? size - len : 0;
+		int n = 0;
+		if (i == 0) {
+			n = snprintf(p, avail, "%s", msg);
+		} else {
+			const bctbx_log_kv_t *f = &fields[i - 1];
+			switch (f->type) {
+				case BCTBX_LOG_KV_STRING:
+					n = snprintf(p, avail, " %s=%s", f->key, f->value.s ? f->value.s : "null");
+				break;
+				case BCTBX_LOG_KV_INT:
+				case BCTBX_LOG_KV_INT64:
+					n = snprintf(p, avail, " %s=%lld", f->key, (long long)f->value.i);
+				break;
+				case BCTBX_LOG_KV_UINT64:
+					n = snprintf(p, avail, " %s=%llu", f->key, (unsigned long long)f->value.u);
+				break;
+				case BCTBX_LOG_KV_DOUBLE:
+					n = snprintf(p, avail, " %s=%g", f->key, f->value.d);
+				break;
+				case BCTBX_LOG_KV_BOOL:
+					n = snprintf(p, avail, " %s=%s", f->key, f->value.i ? "true" : "false");
+				break;
+			}
+		}
+		if (n > 0) len += (size_t)n;
 	}
-#endif
+	return len;
 }
 
-/*This function does the default formatting and output to file*/
-void bctbx_logv_out(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args){
-	const char *lname="undef";
-	char *msg;
+static void log_flight_record(const char *domain, BctbxLogLevel level, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	bctbx_log_flight_recorder_record(domain, level, fmt, args);
+	va_end(args);
+}
+
+void bctbx_log_kv_fields(const char *domain, BctbxLogLevel level, const char *msg, const bctbx_log_kv_t *fields, size_t count) {
+	char stack_text[512];
+	char *text = stack_text;
+	BctoolboxLogDomain *ld;
+	bool_t output = log_filter(domain, level, msg, &ld);
+	bool_t record = bctbx_log_flight_recorder_enabled();
+	size_t len;
+
+	if (output || record) {
+		uint64_t start = log_time_us();
+		len = log_kv_format_text(stack_text, sizeof(stack_text), msg, fields, count);
+		if (len >= sizeof(stack_text)) {
+			text = bctbx_malloc(len + 1);
+			log_kv_format_text(text, len + 1, msg, fields, count);
+		}
+		if (record) log_flight_record(ld->domain, level, "%s", text);
+		if (output) {
+			_bctbx_log_dispatch(ld->domain, level, "%s", text);
+			if (bctbx_log_sinks_active()) bctbx_log_sinks_dispatch(ld->domain, level, text, len, msg, fields, count);
+			log_stats_add_output(ld, level, start);
+		}
+		if (text != stack_text) bctbx_free(text);
+	}
+	if (level == BCTBX_LOG_FATAL) log_fatal_abort();
+}
+
+void bctbx_log_kv(const char *domain, BctbxLogLevel level, const char *msg, ...) {
+	bctbx_log_kv_t fields[BCTBX_LOG_KV_MAX_FIELDS];
+	size_t count = 0;
+	const char *key;
+	va_list args;
+
+	va_start(args, msg);
+	while ((key = va_arg(args, const char *)) != NULL && count < BCTBX_LOG_KV_MAX_FIELDS) {
+		bctbx_log_kv_t *f = &fields[count++];
+		f->key = key;
+		f->type = (bctbx_log_kv_type_t)va_arg(args, int);
+		switch (f->type) {
+			case BCTBX_LOG_KV_STRING:
+				f->value.s = va_arg(args, const char *);
+			break;
+			case BCTBX_LOG_KV_INT:
+			case BCTBX_LOG_KV_BOOL:
+				f->value.i = va_arg(args, int);
+			break;
+			case BCTBX_LOG_KV_INT64:
+				f->value.i = va_arg(args, int64_t);
+			break;
+			case BCTBX_LOG_KV_UINT64:
+				f->value.u = va_arg(args, uint64_t);
+			break;
+			case BCTBX_LOG_KV_DOUBLE:
+				f->value.d = va_arg(args, double);
+			break;
+			default:
+				/*the remaining arguments can't be read without knowing the type of this one*/
+				count--;
+				goto end;
+		}
+	}
+end:
+	va_end(args);
+	bctbx_log_kv_fields(domain, level, msg, fields, count);
+}
+
+const char *bctbx_log_level_name(BctbxLogLevel lev){
+	switch(lev){
+		case BCTBX_LOG_DEBUG:
+			return "debug";
+		case BCTBX_LOG_TRACE:
+			return "trace";
+		case BCTBX_LOG_MESSAGE:
+			return "message";
+		case BCTBX_LOG_WARNING:
+			return "warning";
+		case BCTBX_LOG_ERROR:
+			return "error";
+		case BCTBX_LOG_FATAL:
+			return "fatal";
+		default:
+			return "badlevel";
+	}
+}
+
+int bctbx_log_format_header(char *buf, size_t size, const char *domain, BctbxLogLevel lev){
+	const char *lname;
 	struct timeval tp;
 	struct tm *lt;
 #ifndef _WIN32
@@ -320,27 +1024,26 @@ void bctbx_logv_out(const char *domain, BctbxLogLevel lev, const char *fmt, va_l
 	lt = localtime_r(&tt,&tmbuf);
 #endif
 
+	lname = bctbx_log_level_name(lev);
+	return snprintf(buf, size, "%i-%.2i-%.2i %.2i:%.2i:%.2i:%.3i %s-%s-"
+		,1900+lt->tm_year,1+lt->tm_mon,lt->tm_mday,lt->tm_hour,lt->tm_min,lt->tm_sec
+		,(int)(tp.tv_usec/1000), (domain?domain:"bctoolbox"), lname);
+}
+
+/*This function does the default formatting and output to file*/
+void bctbx_logv_out(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args){
+	char header_buf[128];
+	char *header = header_buf;
+	char *msg;
+	int header_len;
+
 	if (__bctbx_logger.log_file==NULL) __bctbx_logger.log_file=stderr;
-	switch(lev){
-		case BCTBX_LOG_DEBUG:
-			lname = "debug";
-		break;
-		case BCTBX_LOG_MESSAGE:
-			lname = "message";
-		break;
-		case BCTBX_LOG_WARNING:
-			lname = "warning";
-		break;
-		case BCTBX_LOG_ERROR:
-			lname = "error";
-		break;
-		case BCTBX_LOG_FATAL:
-			lname = "fatal";
-		break;
-		default:
-			lname = "badlevel";
+	header_len = bctbx_log_format_header(header_buf, sizeof(header_buf), domain, lev);
+	if (header_len >= (int)sizeof(header_buf)){
+		/*very long domain name*/
+		header = bctbx_malloc(header_len + 1);
+		bctbx_log_format_header(header, header_len + 1, domain, lev);
 	}
-	
 	msg=bctbx_strdup_vprintf(fmt,args);
 #if defined(_MSC_VER) && !defined(_WIN32_WCE)
 #ifndef _UNICODE
@@ -357,10 +1060,10 @@ void bctbx_logv_out(const char *domain, BctbxLogLevel lev, const char *fmt, va_l
 	}
 #endif
 #endif
-	fprintf(__bctbx_logger.log_file,"%i-%.2i-%.2i %.2i:%.2i:%.2i:%.3i %s-%s-%s" ENDLINE
-			,1900+lt->tm_year,1+lt->tm_mon,lt->tm_mday,lt->tm_hour,lt->tm_min,lt->tm_sec
-		,(int)(tp.tv_usec/1000), (domain?domain:"bctoolbox"), lname, msg);
+	fprintf(__bctbx_logger.log_file,"%s%s" ENDLINE, header, msg);
 	fflush(__bctbx_logger.log_file);
+	bctbx_log_stats_add_bytes(domain, lev, header_len + strlen(msg) + sizeof(ENDLINE) - 1);
+	if (header != header_buf) bctbx_free(header);
 	bctbx_free(msg);
 }
 
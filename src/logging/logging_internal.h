@@ -0,0 +1,105 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef BCTBX_LOGGING_INTERNAL_H
+#define BCTBX_LOGGING_INTERNAL_H
+
+#include "bctoolbox/logging.h"
+
+#if	defined(_WIN32) || defined(_WIN32_WCE)
+#define ENDLINE "\r\n"
+#else
+#define ENDLINE "\n"
+#endif
+
+/*
+ * Name of a level as output in log lines.
+ */
+const char *bctbx_log_level_name(BctbxLogLevel lev);
+
+/*
+ * Write the prefix of a log line, as output by the default handler (date, time, domain and level name), into buf.
+ * Returns the number of characters that would have been written if size had been large enough, as snprintf() does.
+ */
+int bctbx_log_format_header(char *buf, size_t size, const char *domain, BctbxLogLevel lev);
+
+/*
+ * Remove the sink from the logger if it is the one set with bctbx_set_log_file_sink().
+ */
+void _bctbx_log_file_sink_unset(bctbx_log_file_sink_t *sink);
+
+/*
+ * TRUE if at least one sink was added with bctbx_log_add_sink().
+ */
+bool_t bctbx_log_sinks_active(void);
+
+/*
+ * Pass a formatted message to all the sinks whose level mask and domain filter accept it. domain must be interned.
+ * For a structured log, msg and fields are passed to the sinks having a key/value function, text to the others.
+ * msg is NULL and field_count 0 for other logs.
+ */
+void bctbx_log_sinks_dispatch(const char *domain, BctbxLogLevel level, const char *text, size_t text_len,
+	const char *msg, const bctbx_log_kv_t *fields, size_t field_count);
+
+/*
+ * Output the messages queued by the asynchronous sinks from the calling thread, then flush all the sinks.
+ */
+void bctbx_log_sinks_flush(void);
+
+/*
+ * Append raw data to the buffer of a file sink. bctbx_log_file_sink_begin() takes the lock of the sink, which is
+ * released by bctbx_log_file_sink_end() after the flush policy has been applied for the given level.
+ */
+void bctbx_log_file_sink_begin(bctbx_log_file_sink_t *sink);
+void bctbx_log_file_sink_append(bctbx_log_file_sink_t *sink, const char *data, size_t len);
+size_t bctbx_log_file_sink_end(bctbx_log_file_sink_t *sink, BctbxLogLevel lev); /*returns the number of bytes appended*/
+
+/*
+ * Account for bytes written or a message dropped by an output, in the statistics of the domain.
+ */
+void bctbx_log_stats_add_bytes(const char *domain, BctbxLogLevel level, size_t bytes);
+void bctbx_log_stats_add_dropped(const char *domain, BctbxLogLevel level);
+
+/*
+ * Set the levels processed whatever the level masks, which bctbx_get_log_enabled_mask() adds to the mask of the
+ * domains. Used by the flight recorder, which captures all the levels.
+ */
+void bctbx_log_set_capture_mask(unsigned int mask);
+
+/*
+ * Record a message in the ring of the calling thread. domain must be a string that is never freed.
+ */
+void bctbx_log_flight_recorder_record(const char *domain, BctbxLogLevel level, const char *fmt, va_list args);
+
+/*
+ * Dump the rings to the dump path, if the flight recorder is enabled.
+ */
+void bctbx_log_flight_recorder_dump_on_fatal(void);
+
+/*
+ * Storage of the messages of other threads than the log thread. bctbx_log_thread_init() must succeed before messages
+ * are stored. domain must be interned. bctbx_log_thread_flush() is only called by the log thread, and outputs the
+ * stored messages in timestamp order with the given handler.
+ */
+bool_t bctbx_log_thread_init(void);
+bool_t bctbx_log_thread_store(const char *domain, BctbxLogLevel level, const char *fmt, va_list args);
+void bctbx_log_thread_flush(BctoolboxLogFunc out);
+
+#endif /* BCTBX_LOGGING_INTERNAL_H */
@@ -0,0 +1,420 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/logging.h"
+#include "logging_internal.h"
+#include "utils.h"
+
+/*
+ * A formatted message shared by all the asynchronous sinks it is queued into. It is allocated as a single block
+ * holding the fields followed by all the strings.
+ */
+typedef struct _log_sink_message {
+	int refcount;
+	BctbxLogLevel level;
+	size_t text_len;
+	char *text; /*the formatted message*/
+	const char *domain; /*interned, hence kept as is by the copies*/
+	char *msg; /*the message of a structured log, without its fields; text for others*/
+	bctbx_log_kv_t *fields;
+	size_t field_count;
+} log_sink_message_t;
+
+struct _bctbx_log_sink {
+	int refcount;
+	bctbx_log_sink_func_t func;
+	bctbx_log_sink_kv_func_t kv_func;
+	bctbx_log_sink_flush_func_t flush_func;
+	void *user_data;
+	unsigned int level_mask;
+	const char *domain; /*interned, only messages of this domain are accepted, all of them if NULL*/
+	/*asynchronous mode: messages are queued in a ring and output by a dedicated thread*/
+	size_t max_queued; /*0 for a synchronous sink*/
+	log_sink_message_t **queue;
+	size_t queue_head;
+	size_t queue_count;
+	unsigned int dropped;
+	bctbx_mutex_t queue_mutex;
+	bctbx_cond_t queue_cond;
+	bctbx_thread_t thread;
+	unsigned long thread_id; /*set by the thread itself*/
+	bool_t running;
+	bool_t self_released; /*the last reference was dropped by the thread of the sink, which frees it when it exits*/
+};
+
+/*
+ * Immutable set of the sinks in use. Adding or removing a sink installs a new set, under the registry lock. The
+ * dispatching of a message takes no lock: it loads the current set and takes a reference on it with atomic operations.
+ * So that a set is not freed between the load of the pointer and the increment of its reference count, the readers
+ * count themselves in one of two slots, chosen by the parity of an epoch: after installing a new set, the writer
+ * increments the epoch and waits for the readers of the previous epoch, which only run these few instructions.
+ */
+typedef struct _log_sink_set {
+	int refcount;
+	int count;
+	bctbx_log_sink_t *sinks[1];
+} log_sink_set_t;
+
+static log_sink_set_t *current_set = NULL;
+static bctbx_mutex_t registry_mutex;
+static bctbx_once_t registry_once = BCTBX_ONCE_INIT;
+static int set_epoch = 0;
+static int set_readers[2] = {0, 0};
+
+static void log_sink_registry_init(void){
+	bctbx_mutex_init(&registry_mutex, NULL);
+}
+
+static void log_sink_registry_lock(void){
+	bctbx_once(&registry_once, log_sink_registry_init);
+	bctbx_mutex_lock(&registry_mutex);
+}
+
+static char *log_sink_message_copy_str(char **p, const char *str){
+	char *copy = *p;
+	size_t len = strlen(str) + 1;
+	memcpy(copy, str, len);
+	*p += len;
+	return copy;
+}
+
+static log_sink_message_t *log_sink_message_new(const log_sink_message_t *src){
+	size_t size = sizeof(log_sink_message_t) + sizeof(bctbx_log_kv_t) * src->field_count + src->text_len + 1;
+	log_sink_message_t *m;
+	char *p;
+	size_t i;
+
+	if (src->msg != src->text) size += strlen(src->msg) + 1;
+	for (i = 0; i < src->field_count; i++){
+		size += strlen(src->fields[i].key) + 1;
+		if (src->fields[i].type == BCTBX_LOG_KV_STRING && src->fields[i].value.s) size += strlen(src->fields[i].value.s) + 1;
+	}
+	m = (log_sink_message_t *)bctbx_malloc(size);
+	*m = *src;
+	m->refcount = 1;
+	m->fields = (bctbx_log_kv_t *)(m + 1);
+	p = (char *)(m->fields + src->field_count);
+	memcpy(p, src->text, src->text_len);
+	p[src->text_len] = '\0';
+	m->text = p;
+	p += src->text_len + 1;
+	m->msg = (src->msg != src->text) ? log_sink_message_copy_str(&p, src->msg) : m->text;
+	for (i = 0; i < src->field_count; i++){
+		m->fields[i] = src->fields[i];
+		m->fields[i].key = log_sink_message_copy_str(&p, src->fields[i].key);
+		if (src->fields[i].type == BCTBX_LOG_KV_STRING && src->fields[i].value.s){
+			m->fields[i].value.s = log_sink_message_copy_str(&p, src->fields[i].value.s);
+		}
+	}
+	return m;
+}
+
+static void log_sink_output(bctbx_log_sink_t *sink, const log_sink_message_t *m){
+	if (sink->kv_func){
+		sink->kv_func(sink->user_data, m->domain, m->level, m->msg, m->fields, m->field_count);
+	}else if (sink->func){
+		sink->func(sink->user_data, m->domain, m->level, m->text, m->text_len);
+	}
+}
+
+static void log_sink_message_unref(log_sink_message_t *m){
+	if (bctbx_atomic_dec(&m->refcount) == 0) bctbx_free(m);
+}
+
+static void log_sink_free(bctbx_log_sink_t *sink){
+	bctbx_mutex_destroy(&sink->queue_mutex);
+	bctbx_cond_destroy(&sink->queue_cond);
+	if (sink->queue) bctbx_free(sink->queue);
+	bctbx_free(sink);
+}
+
+static void *log_sink_thread(void *data){
+	bctbx_log_sink_t *sink = (bctbx_log_sink_t *)data;
+
+	bctbx_mutex_lock(&sink->queue_mutex);
+	sink->thread_id = bctbx_thread_self();
+	for(;;){
+		log_sink_message_t *m;
+		while (sink->queue_count == 0 && sink->running){
+			bctbx_cond_wait(&sink->queue_cond, &sink->queue_mutex);
+		}
+		if (sink->queue_count == 0) break; /*stopped and drained*/
+		m = sink->queue[sink->queue_head];
+		sink->queue_head = (sink->queue_head + 1) % sink->max_queued;
+		sink->queue_count--;
+		bctbx_mutex_unlock(&sink->queue_mutex);
+		log_sink_output(sink, m);
+		log_sink_message_unref(m);
+		bctbx_mutex_lock(&sink->queue_mutex);
+	}
+	bctbx_mutex_unlock(&sink->queue_mutex);
+	if (sink->self_released){
+		/*nobody will join this thread*/
+#ifdef _WIN32
+		CloseHandle(sink->thread);
+#else
+		pthread_detach(pthread_self());
+#endif
+		log_sink_free(sink);
+	}
+	return NULL;
+}
+
+static void log_sink_enqueue(bctbx_log_sink_t *sink, log_sink_message_t *m){
+	bool_t dropped = FALSE;
+
+	bctbx_mutex_lock(&sink->queue_mutex);
+	if (sink->queue_count < sink->max_queued){
+		bctbx_atomic_inc(&m->refcount);
+		sink->queue[(sink->queue_head + sink->queue_count) % sink->max_queued] = m;
+		sink->queue_count++;
+		bctbx_cond_signal(&sink->queue_cond);
+	}else{
+		/*never block the logging thread on a slow sink*/
+		sink->dropped++;
+		dropped = TRUE;
+	}
+	bctbx_mutex_unlock(&sink->queue_mutex);
+	if (dropped) bctbx_log_stats_add_dropped(m->domain, m->level);
+}
+
+static void log_sink_file_flush(void *file_sink){
+	bctbx_log_file_sink_flush((bctbx_log_file_sink_t *)file_sink);
+}
+
+bctbx_log_sink_t *bctbx_log_sink_new(bctbx_log_sink_func_t func, void *user_data){
+	bctbx_log_sink_t *sink = bctbx_new0(bctbx_log_sink_t, 1);
+	sink->refcount = 1;
+	sink->func = func;
+	if (func == bctbx_log_file_sink_func) sink->flush_func = log_sink_file_flush;
+	sink->user_data = user_data;
+	sink->level_mask = BCTBX_LOG_DEBUG | BCTBX_LOG_TRACE | BCTBX_LOG_MESSAGE | BCTBX_LOG_WARNING | BCTBX_LOG_ERROR | BCTBX_LOG_FATAL;
+	bctbx_mutex_init(&sink->queue_mutex, NULL);
+	bctbx_cond_init(&sink->queue_cond, NULL);
+	return sink;
+}
+
+static void log_sink_ref(bctbx_log_sink_t *sink){
+	bctbx_atomic_inc(&sink->refcount);
+}
+
+static void log_sink_unref(bctbx_log_sink_t *sink){
+	if (bctbx_atomic_dec(&sink->refcount) != 0) return;
+	if (sink->running){
+		bool_t self;
+
+		bctbx_mutex_lock(&sink->queue_mutex);
+		sink->running = FALSE;
+		/*the thread of the sink may drop the last reference when a message it outputs is logged: it cannot join itself,
+		 * the sink is freed when the thread exits*/
+		self = sink->thread_id == bctbx_thread_self();
+		sink->self_released = self;
+		bctbx_cond_signal(&sink->queue_cond);
+		bctbx_mutex_unlock(&sink->queue_mutex);
+		if (self) return;
+		bctbx_thread_join(sink->thread, NULL);
+	}
+	log_sink_free(sink);
+}
+
+void bctbx_log_sink_destroy(bctbx_log_sink_t *sink){
+	bctbx_log_remove_sink(sink);
+	log_sink_unref(sink);
+}
+
+void bctbx_log_sink_set_level_mask(bctbx_log_sink_t *sink, unsigned int levelmask){
+	sink->level_mask = levelmask;
+}
+
+void bctbx_log_sink_set_domain(bctbx_log_sink_t *sink, const char *domain){
+	sink->domain = bctbx_intern(domain);
+}
+
+void bctbx_log_sink_set_async(bctbx_log_sink_t *sink, size_t max_queued){
+	if (sink->running || max_queued == 0) return;
+	sink->max_queued = max_queued;
+	sink->queue = bctbx_new0(log_sink_message_t *, max_queued);
+	sink->running = TRUE;
+	if (bctbx_thread_create(&sink->thread, NULL, log_sink_thread, sink) != 0){
+		sink->running = FALSE;
+		sink->max_queued = 0;
+		bctbx_free(sink->queue);
+		sink->queue = NULL;
+	}
+}
+
+void bctbx_log_sink_set_kv_func(bctbx_log_sink_t *sink, bctbx_log_sink_kv_func_t kv_func){
+	sink->kv_func = kv_func;
+}
+
+void bctbx_log_sink_set_flush_func(bctbx_log_sink_t *sink, bctbx_log_sink_flush_func_t flush_func){
+	sink->flush_func = flush_func;
+}
+
+unsigned int bctbx_log_sink_get_dropped(const bctbx_log_sink_t *sink){
+	return sink->dropped;
+}
+
+static log_sink_set_t *log_sink_set_new(int count){
+	log_sink_set_t *set = (log_sink_set_t *)bctbx_malloc0(sizeof(log_sink_set_t) + sizeof(bctbx_log_sink_t *) * MAX(count - 1, 0));
+	set->refcount = 1;
+	set->count = count;
+	return set;
+}
+
+static log_sink_set_t *log_sink_set_acquire(void){
+	log_sink_set_t *set;
+	int *readers;
+
+	for (;;){
+		int epoch = bctbx_atomic_load_seq_cst(&set_epoch);
+		readers = &set_readers[epoch & 1];
+		bctbx_atomic_inc(readers);
+		/*if the epoch changed meanwhile, the writer may not wait for this slot*/
+		if (bctbx_atomic_load_seq_cst(&set_epoch) == epoch) break;
+		bctbx_atomic_dec(readers);
+	}
+	set = (log_sink_set_t *)bctbx_atomic_load_ptr(&current_set);
+	if (set) bctbx_atomic_inc(&set->refcount);
+	bctbx_atomic_dec(readers);
+	return set;
+}
+
+static void log_sink_set_release(log_sink_set_t *set){
+	int i;
+	if (bctbx_atomic_dec(&set->refcount) != 0) return;
+	for (i = 0; i < set->count; i++) log_sink_unref(set->sinks[i]);
+	bctbx_free(set);
+}
+
+/*must be called with the registry lock held, after installing a new set*/
+static void log_sink_set_wait_readers(void){
+	int epoch = bctbx_atomic_inc(&set_epoch) - 1;
+	while (bctbx_atomic_load_seq_cst(&set_readers[epoch & 1]) != 0) bctbx_sleep_ms(0);
+}
+
+/*install a new set made of the current sinks plus added (if not NULL) minus removed (if not NULL)*/
+static void log_sink_set_replace(bctbx_log_sink_t *added, bctbx_log_sink_t *removed){
+	log_sink_set_t *old_set;
+	log_sink_set_t *new_set;
+	int count;
+	int i;
+
+	log_sink_registry_lock();
+	old_set = current_set;
+	count = (old_set ? old_set->count : 0) + (added ? 1 : 0);
+	new_set = log_sink_set_new(count);
+	new_set->count = 0;
+	for (i = 0; old_set && i < old_set->count; i++){
+		if (old_set->sinks[i] == removed || old_set->sinks[i] == added) continue;
+		log_sink_ref(old_set->sinks[i]);
+		new_set->sinks[new_set->count++] = old_set->sinks[i];
+	}
+	if (added){
+		log_sink_ref(added);
+		new_set->sinks[new_set->count++] = added;
+	}
+	if (new_set->count == 0){
+		bctbx_free(new_set);
+		new_set = NULL;
+	}
+	bctbx_atomic_store_ptr(&current_set, new_set);
+	log_sink_set_wait_readers();
+	bctbx_mutex_unlock(&registry_mutex);
+	if (old_set) log_sink_set_release(old_set);
+}
+
+void bctbx_log_add_sink(bctbx_log_sink_t *sink){
+	log_sink_set_replace(sink, NULL);
+}
+
+void bctbx_log_remove_sink(bctbx_log_sink_t *sink){
+	log_sink_set_replace(NULL, sink);
+}
+
+bool_t bctbx_log_sinks_active(void){
+	return bctbx_atomic_load_ptr(&current_set) != NULL;
+}
+
+/*
+ * Output the queued messages from the calling thread, without waiting for the sink thread which may be blocked or
+ * outputting a message, then flush the sink.
+ */
+static void log_sink_flush(bctbx_log_sink_t *sink){
+	for (;;){
+		log_sink_message_t *m = NULL;
+
+		if (sink->max_queued == 0) break;
+		bctbx_mutex_lock(&sink->queue_mutex);
+		if (sink->queue_count > 0){
+			m = sink->queue[sink->queue_head];
+			sink->queue_head = (sink->queue_head + 1) % sink->max_queued;
+			sink->queue_count--;
+		}
+		bctbx_mutex_unlock(&sink->queue_mutex);
+		if (m == NULL) break;
+		log_sink_output(sink, m);
+		log_sink_message_unref(m);
+	}
+	if (sink->flush_func) sink->flush_func(sink->user_data);
+}
+
+void bctbx_log_sinks_flush(void){
+	log_sink_set_t *set;
+	int i;
+
+	if (!bctbx_log_sinks_active()) return;
+	set = log_sink_set_acquire();
+	if (set == NULL) return;
+	for (i = 0; i < set->count; i++) log_sink_flush(set->sinks[i]);
+	log_sink_set_release(set);
+}
+
+void bctbx_log_sinks_dispatch(const char *domain, BctbxLogLevel level, const char *text, size_t text_len,
+	const char *msg, const bctbx_log_kv_t *fields, size_t field_count){
+	log_sink_set_t *set = log_sink_set_acquire();
+	log_sink_message_t *shared = NULL;
+	log_sink_message_t m;
+	int i;
+
+	if (set == NULL) return;
+	memset(&m, 0, sizeof(m));
+	m.level = level;
+	m.text = (char *)text;
+	m.text_len = text_len;
+	m.domain = domain;
+	m.msg = msg ? (char *)msg : m.text;
+	m.fields = (bctbx_log_kv_t *)fields;
+	m.field_count = field_count;
+	for (i = 0; i < set->count; i++){
+		bctbx_log_sink_t *sink = set->sinks[i];
+		if ((sink->level_mask & level) == 0) continue;
+		if (sink->domain && sink->domain != domain) continue;
+		if (sink->max_queued == 0){
+			log_sink_output(sink, &m);
+		}else{
+			/*a single copy of the message is shared by all the asynchronous sinks*/
+			if (shared == NULL) shared = log_sink_message_new(&m);
+			log_sink_enqueue(sink, shared);
+		}
+	}
+	if (shared) log_sink_message_unref(shared);
+	log_sink_set_release(set);
+}
@@ -17,4 +17,74 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
-#include "bctoolbox/port.h"
\ No newline at end of file
+#ifndef BCTBX_UTILS_H
+#define BCTBX_UTILS_H
+
+#include "bctoolbox/port.h"
+
+/*
+ * Atomic increment and decrement of int values, returning the new value. Used for reference counts shared between threads.
+ * The sequentially consistent load orders with them, for the counters that a thread increments before checking a flag
+ * that another thread sets before checking the counter.
+ */
+#ifdef _MSC_VER
+#include <intrin.h>
+#define bctbx_atomic_inc(p)                 _InterlockedIncrement((volatile long *)(p))
+#define bctbx_atomic_dec(p)                 _InterlockedDecrement((volatile long *)(p))
+#define bctbx_atomic_load_seq_cst(p)        _InterlockedOr((volatile long *)(p), 0)
+#else
+#define bctbx_atomic_inc(p)                 __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define bctbx_atomic_dec(p)                 __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define bctbx_atomic_load_seq_cst(p)        __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#endif
+
+/*
+ * Atomic loads and stores of int sized values, relaxed or acquire and release (to hand an object over to another
+ * thread with a flag), and of pointers (acquire and release, so that the pointed object is seen fully initialized by
+ * the threads loading the pointer).
+ */
+#ifdef _MSC_VER
+#define bctbx_atomic_load_int(p)            (*(volatile unsigned int *)(p))
+#define bctbx_atomic_store_int(p, v)        (*(volatile unsigned int *)(p) = (v))
+#define bctbx_atomic_load_int_acquire(p)    (*(volatile unsigned int *)(p))
+#define bctbx_atomic_store_int_release(p, v) (*(volatile unsigned int *)(p) = (v))
+#define bctbx_atomic_load_ptr(p)            (*(void * volatile *)(p))
+#define bctbx_atomic_store_ptr(p, v)        (*(void * volatile *)(p) = (v))
+#else
+#define bctbx_atomic_load_int(p)            __atomic_load_n((p), __ATOMIC_RELAXED)
+#define bctbx_atomic_store_int(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define bctbx_atomic_load_int_acquire(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define bctbx_atomic_store_int_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define bctbx_atomic_load_ptr(p)            __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define bctbx_atomic_store_ptr(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/*
+ * Relaxed atomic operations on uint64_t counters, for statistics updated concurrently without lock.
+ */
+#ifdef _MSC_VER
+#define bctbx_atomic_add64(p, v)            _InterlockedExchangeAdd64((volatile __int64 *)(p), (__int64)(v))
+#define bctbx_atomic_load64(p)              ((uint64_t)_InterlockedCompareExchange64((volatile __int64 *)(p), 0, 0))
+#define bctbx_atomic_store64(p, v)          _InterlockedExchange64((volatile __int64 *)(p), (__int64)(v))
+#else
+#define bctbx_atomic_add64(p, v)            __atomic_fetch_add((p), (uint64_t)(v), __ATOMIC_RELAXED)
+#define bctbx_atomic_load64(p)              __atomic_load_n((p), __ATOMIC_RELAXED)
+#define bctbx_atomic_store64(p, v)          __atomic_store_n((p), (uint64_t)(v), __ATOMIC_RELAXED)
+#endif
+
+/*
+ * One-time initialization, for the static objects such as mutexes that cannot be initialized statically on every
+ * platform. func is called by the first caller, the others wait until it returns.
+ */
+#ifdef _WIN32
+typedef volatile LONG bctbx_once_t;
+#define BCTBX_ONCE_INIT 0
+#else
+#include <pthread.h>
+typedef pthread_once_t bctbx_once_t;
+#define BCTBX_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+void bctbx_once(bctbx_once_t *once, void (*func)(void));
+
+#endif /* BCTBX_UTILS_H */
@@ -0,0 +1,101 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/port.h"
+#include "utils.h"
+
+/*
+ * Interned strings are stored once in a hash table and never freed. The chains of the table are only ever prepended
+ * to, with release semantics, so that lookups take no lock: only insertions are serialized.
+ */
+#define BCTBX_INTERN_BUCKETS 1024
+
+typedef struct _bctbx_interned {
+	struct _bctbx_interned *next; /*immutable once published*/
+	uint32_t hash;
+	char str[1];
+} bctbx_interned_t;
+
+static bctbx_interned_t *intern_table[BCTBX_INTERN_BUCKETS];
+static bctbx_mutex_t intern_mutex;
+static bctbx_once_t intern_once = BCTBX_ONCE_INIT;
+
+static void intern_mutex_init(void){
+	bctbx_mutex_init(&intern_mutex, NULL);
+}
+
+static void intern_lock(void){
+	bctbx_once(&intern_once, intern_mutex_init);
+	bctbx_mutex_lock(&intern_mutex);
+}
+
+/*FNV-1a*/
+static uint32_t intern_hash(const char *str){
+	uint32_t hash = 2166136261u;
+	for (; *str != '\0'; str++){
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static const char *intern_find(bctbx_interned_t *chain, const char *str, uint32_t hash){
+	bctbx_interned_t *it;
+	for (it = chain; it != NULL; it = it->next){
+		/*an interned pointer is found without comparing the characters*/
+		if (it->str == str || (it->hash == hash && strcmp(it->str, str) == 0)) return it->str;
+	}
+	return NULL;
+}
+
+const char *bctbx_intern_lookup(const char *str){
+	uint32_t hash;
+	if (str == NULL) return NULL;
+	hash = intern_hash(str);
+	return intern_find((bctbx_interned_t *)bctbx_atomic_load_ptr(&intern_table[hash % BCTBX_INTERN_BUCKETS]), str, hash);
+}
+
+const char *bctbx_intern(const char *str){
+	bctbx_interned_t **bucket;
+	bctbx_interned_t *entry;
+	const char *ret;
+	uint32_t hash;
+	size_t len;
+
+	if (str == NULL) return NULL;
+	hash = intern_hash(str);
+	bucket = &intern_table[hash % BCTBX_INTERN_BUCKETS];
+	ret = intern_find((bctbx_interned_t *)bctbx_atomic_load_ptr(bucket), str, hash);
+	if (ret) return ret;
+
+	intern_lock();
+	ret = intern_find(*bucket, str, hash);
+	if (ret == NULL){
+		len = strlen(str);
+		entry = (bctbx_interned_t *)bctbx_malloc(sizeof(bctbx_interned_t) + len);
+		entry->hash = hash;
+		memcpy(entry->str, str, len + 1);
+		entry->next = *bucket;
+		bctbx_atomic_store_ptr(bucket, entry);
+		ret = entry->str;
+	}
+	bctbx_mutex_unlock(&intern_mutex);
+	return ret;
+}
@@ -190,6 +190,10 @@ unsigned long __bctbx_thread_self(void) {
 	return (unsigned long)pthread_self();
 }
 
+void bctbx_once(bctbx_once_t *once, void (*func)(void)) {
+	pthread_once(once, func);
+}
+
 #endif
 #if	defined(_WIN32) || defined(_WIN32_WCE)
 
@@ -271,6 +275,16 @@ unsigned long __bctbx_WIN_thread_self(void) {
 	return (unsigned long)GetCurrentThreadId();
 }
 
+/*0: not done, 1: running, 2: done. InitOnceExecuteOnce() is not available on all the Windows targets*/
+void bctbx_once(bctbx_once_t *once, void (*func)(void)) {
+	if (InterlockedCompareExchange(once, 1, 0) == 0) {
+		func();
+		InterlockedExchange(once, 2);
+		return;
+	}
+	while (InterlockedCompareExchange(once, 2, 2) != 2) Sleep(0);
+}
+
 int __bctbx_WIN_cond_init(bctbx_cond_t *cond, void *attr)
 {
 #ifdef BCTBX_WINDOWS_DESKTOP
@@ -754,6 +768,29 @@ uint64_t bctbx_get_cur_time_ms(void) {
 	return (ts.tv_sec * 1000LL) + ((ts.tv_nsec + 500000LL) / 1000000LL);
 }
 
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+uint64_t bctbx_get_monotonic_ns(void) {
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ULL
+		+ (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ULL / (uint64_t)freq.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	uint64_t t = mach_absolute_time();
+	if (timebase.denom == 0) mach_timebase_info(&timebase);
+	return t / timebase.denom * timebase.numer + t % timebase.denom * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 void bctbx_sleep_ms(int ms){
 #ifdef _WIN32
 #ifdef BCTBX_WINDOWS_DESKTOP
@@ -938,6 +975,36 @@ ssize_t bctbx_write(int fd, const void *buf, size_t nbytes) {
 	return (ssize_t)_write(fd, buf, (unsigned int)nbytes);
 }
 
+/*positional I/O on the handle of the file: ReadFile() and WriteFile() take the offset in the OVERLAPPED structure*/
+static void bctbx_offset_to_overlapped(OVERLAPPED *ov, off_t offset) {
+	memset(ov, 0, sizeof(*ov));
+	ov->Offset = (DWORD)((uint64_t)offset & 0xFFFFFFFF);
+	ov->OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+}
+
+ssize_t bctbx_pread(int fd, void *buf, size_t nbytes, off_t offset) {
+	OVERLAPPED ov;
+	DWORD n = 0;
+	bctbx_offset_to_overlapped(&ov, offset);
+	if (!ReadFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)nbytes, &n, &ov)) {
+		if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+		errno = EIO;
+		return -1;
+	}
+	return (ssize_t)n;
+}
+
+ssize_t bctbx_pwrite(int fd, const void *buf, size_t nbytes, off_t offset) {
+	OVERLAPPED ov;
+	DWORD n = 0;
+	bctbx_offset_to_overlapped(&ov, offset);
+	if (!WriteFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)nbytes, &n, &ov)) {
+		errno = EIO;
+		return -1;
+	}
+	return (ssize_t)n;
+}
+
 #else
 
 int bctbx_bind(bctbx_socket_t socket, const struct sockaddr *address, socklen_t address_len) {
@@ -972,6 +1039,14 @@ ssize_t bctbx_write(int fd, const void *buf, size_t nbytes) {
 	return write(fd, buf, nbytes);
 }
 
+ssize_t bctbx_pread(int fd, void *buf, size_t nbytes, off_t offset) {
+	return pread(fd, buf, nbytes, offset);
+}
+
+ssize_t bctbx_pwrite(int fd, const void *buf, size_t nbytes, off_t offset) {
+	return pwrite(fd, buf, nbytes, offset);
+}
+
 #endif
 
 
@@ -0,0 +1,469 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/crypto.h"
+#include "bctoolbox/port.h"
+#include "bctoolbox/logging.h"
+#include <errno.h>
+
+/*
+ * Layout of an encrypted file: a header, then one record per block of plain text. A record is made of a random
+ * nonce, the tag and the cipher text of the block, which is shorter than the block size only for the last one. An
+ * empty file has one empty record.
+ * Each record authenticates the random identifier of its file, the index of its block and whether it is the last
+ * one, so that records cannot be swapped, copied from another file or removed from the end. The plain size of the
+ * file is deduced from the size of the wrapped file, and checked by decrypting the last record when opening it.
+ * An older version of a record of the same file, put back at its place, is not detected.
+ * The last decrypted block is kept, so that small sequential reads decrypt each block only once.
+ */
+
+#define AES_GCM_VFS_MAGIC "BCTBXGCM"
+#define AES_GCM_VFS_VERSION 2
+#define AES_GCM_VFS_FILE_ID_SIZE 16
+/*magic, version, 3 reserved bytes, block size on 4 bytes big endian, file identifier*/
+#define AES_GCM_VFS_HEADER_SIZE (16 + AES_GCM_VFS_FILE_ID_SIZE)
+#define AES_GCM_VFS_NONCE_SIZE 12
+#define AES_GCM_VFS_TAG_SIZE 16
+#define AES_GCM_VFS_OVERHEAD (AES_GCM_VFS_NONCE_SIZE + AES_GCM_VFS_TAG_SIZE)
+#define AES_GCM_VFS_AAD_SIZE (AES_GCM_VFS_FILE_ID_SIZE + 8 + 1) /*file identifier, block index, last block flag*/
+#define AES_GCM_VFS_DEFAULT_BLOCK_SIZE 4096
+#define AES_GCM_VFS_MAX_BLOCK_SIZE (1 << 20)
+
+typedef struct _aes_gcm_vfs {
+	bctbx_vfs_t vfs; /*must be first: the VFS given to the callers*/
+	bctbx_vfs_t *wrapped;
+	uint8_t key[32];
+	size_t key_length;
+	size_t block_size; /*for the new files, the existing ones keep the block size of their header*/
+} aes_gcm_vfs_t;
+
+typedef struct _aes_gcm_file {
+	bctbx_vfs_file_t *inner; /*the file opened with the wrapped VFS*/
+	bctbx_mutex_t mutex; /*serializes the operations on the file: the key context and the buffers are shared*/
+	bctbx_aes_gcm_key_t *key;
+	bctbx_rng_context_t *rng;
+	size_t block_size;
+	uint8_t file_id[AES_GCM_VFS_FILE_ID_SIZE];
+	int64_t size; /*plain size*/
+	uint8_t *record; /*nonce, tag and cipher text of a block*/
+	uint8_t *plain; /*plain text of block cached_block*/
+	int64_t cached_block; /*-1 if plain holds no block*/
+	bool_t readable; /*the wrapped file is always readable, but not this one if opened write only*/
+} aes_gcm_file_t;
+
+static size_t aes_gcm_record_size(const aes_gcm_file_t *f) {
+	return AES_GCM_VFS_OVERHEAD + f->block_size;
+}
+
+static off_t aes_gcm_record_offset(const aes_gcm_file_t *f, uint64_t index) {
+	return (off_t)(AES_GCM_VFS_HEADER_SIZE + index * aes_gcm_record_size(f));
+}
+
+/*the index of the last block of a file of the given plain size, which is an empty block for an empty file*/
+static uint64_t aes_gcm_last_block(const aes_gcm_file_t *f, int64_t size) {
+	return size > 0 ? (uint64_t)(size - 1) / f->block_size : 0;
+}
+
+/*the additional authenticated data of a record*/
+static void aes_gcm_block_aad(const aes_gcm_file_t *f, uint64_t index, bool_t last, uint8_t aad[AES_GCM_VFS_AAD_SIZE]) {
+	int i;
+
+	memcpy(aad, f->file_id, AES_GCM_VFS_FILE_ID_SIZE);
+	for (i = 7; i >= 0; i--) {
+		aad[AES_GCM_VFS_FILE_ID_SIZE + i] = (uint8_t)(index & 0xFF);
+		index >>= 8;
+	}
+	aad[AES_GCM_VFS_FILE_ID_SIZE + 8] = last ? 1 : 0;
+}
+
+static size_t aes_gcm_block_len(const aes_gcm_file_t *f, uint64_t index, int64_t size) {
+	uint64_t start = index * f->block_size;
+	if ((uint64_t)size <= start) return 0;
+	return (size_t)MIN((uint64_t)f->block_size, (uint64_t)size - start);
+}
+
+/*decrypt block index into f->plain*/
+static int aes_gcm_load_block(aes_gcm_file_t *f, uint64_t index) {
+	size_t len = aes_gcm_block_len(f, index, f->size);
+	uint8_t aad[AES_GCM_VFS_AAD_SIZE];
+	ssize_t ret;
+	int32_t err;
+
+	if (f->cached_block == (int64_t)index) return BCTBX_VFS_OK;
+	f->cached_block = -1;
+	ret = f->inner->pMethods->pFuncRead(f->inner, f->record, AES_GCM_VFS_OVERHEAD + len, aes_gcm_record_offset(f, index));
+	if (ret < 0) return (int)ret;
+	if ((size_t)ret != AES_GCM_VFS_OVERHEAD + len) return BCTBX_VFS_ERROR;
+	aes_gcm_block_aad(f, index, index == aes_gcm_last_block(f, f->size), aad);
+	err = bctbx_aes_gcm_key_decrypt_and_auth(f->key, f->record + AES_GCM_VFS_OVERHEAD, len, aad, sizeof(aad),
+		f->record, AES_GCM_VFS_NONCE_SIZE, f->record + AES_GCM_VFS_NONCE_SIZE, AES_GCM_VFS_TAG_SIZE, f->plain);
+	if (err != 0) {
+		bctbx_error("bctbx_vfs_aes_gcm: block %llu cannot be decrypted: error %x", (unsigned long long)index, (unsigned int)-err);
+		return BCTBX_VFS_ERROR;
+	}
+	f->cached_block = (int64_t)index;
+	return BCTBX_VFS_OK;
+}
+
+/*encrypt the len bytes of f->plain, holding block index, with a new nonce and write them*/
+static int aes_gcm_store_block(aes_gcm_file_t *f, uint64_t index, size_t len, bool_t last) {
+	uint8_t aad[AES_GCM_VFS_AAD_SIZE];
+	ssize_t ret;
+
+	if (bctbx_rng_get(f->rng, f->record, AES_GCM_VFS_NONCE_SIZE) != 0) return BCTBX_VFS_ERROR;
+	aes_gcm_block_aad(f, index, last, aad);
+	if (bctbx_aes_gcm_key_encrypt_and_tag(f->key, f->plain, len, aad, sizeof(aad), f->record, AES_GCM_VFS_NONCE_SIZE,
+		f->record + AES_GCM_VFS_NONCE_SIZE, AES_GCM_VFS_TAG_SIZE, f->record + AES_GCM_VFS_OVERHEAD) != 0) {
+		return BCTBX_VFS_ERROR;
+	}
+	ret = f->inner->pMethods->pFuncWrite(f->inner, f->record, AES_GCM_VFS_OVERHEAD + len, aes_gcm_record_offset(f, index));
+	if (ret < 0) return (int)ret;
+	if ((size_t)ret != AES_GCM_VFS_OVERHEAD + len) return BCTBX_VFS_ERROR;
+	f->size = MAX(f->size, (int64_t)(index * f->block_size + len));
+	return BCTBX_VFS_OK;
+}
+
+static ssize_t aesGcmRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	size_t done = 0;
+	int err = BCTBX_VFS_OK;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	if (!f->readable) return -EBADF;
+	bctbx_mutex_lock(&f->mutex);
+	if ((int64_t)offset < f->size) count = (size_t)MIN((uint64_t)count, (uint64_t)(f->size - offset));
+	else count = 0;
+	while (done < count) {
+		uint64_t pos = (uint64_t)offset + done;
+		uint64_t index = pos / f->block_size;
+		size_t in_block = (size_t)(pos - index * f->block_size);
+		size_t n = MIN(count - done, f->block_size - in_block);
+
+		if ((err = aes_gcm_load_block(f, index)) != BCTBX_VFS_OK) break;
+		memcpy((char *)buf + done, f->plain + in_block, n);
+		done += n;
+	}
+	bctbx_mutex_unlock(&f->mutex);
+	if (err != BCTBX_VFS_OK && done == 0) return err;
+	return (ssize_t)done;
+}
+
+/*write count bytes at offset, called with the file mutex held*/
+static int aes_gcm_write(aes_gcm_file_t *f, const void *buf, size_t count, off_t offset) {
+	uint64_t end = (uint64_t)offset + count;
+	uint64_t index, last, new_last_block;
+	int64_t new_size;
+	int err = BCTBX_VFS_OK;
+
+	new_size = MAX(f->size, (int64_t)end);
+	new_last_block = aes_gcm_last_block(f, new_size);
+	/*a write past the end also rewrites the blocks from the end of the file, filled with zeros, starting with the
+	 * last one which is no longer the last*/
+	index = (uint64_t)MIN((int64_t)offset, f->size) / f->block_size;
+	if (new_size > f->size) index = MIN(index, aes_gcm_last_block(f, f->size));
+	last = (end - 1) / f->block_size;
+	for (; index <= last; index++) {
+		uint64_t start = index * f->block_size;
+		size_t old_len = aes_gcm_block_len(f, index, f->size);
+		size_t new_len = aes_gcm_block_len(f, index, new_size);
+		uint64_t from = MAX((uint64_t)offset, start);
+		uint64_t to = MIN(end, start + new_len);
+
+		if (old_len > 0 && !(from == start && to == start + new_len)) {
+			/*partly written: the rest of the block is kept*/
+			if ((err = aes_gcm_load_block(f, index)) != BCTBX_VFS_OK) break;
+			memset(f->plain + old_len, 0, new_len - old_len);
+		} else {
+			memset(f->plain, 0, new_len);
+		}
+		f->cached_block = (int64_t)index;
+		if (from < to) memcpy(f->plain + (from - start), (const char *)buf + (from - (uint64_t)offset), (size_t)(to - from));
+		if ((err = aes_gcm_store_block(f, index, new_len, index == new_last_block)) != BCTBX_VFS_OK) {
+			f->cached_block = -1;
+			break;
+		}
+	}
+	return err;
+}
+
+static ssize_t aesGcmWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	int err;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	if (count == 0) return 0;
+	bctbx_mutex_lock(&f->mutex);
+	err = aes_gcm_write(f, buf, count, offset);
+	bctbx_mutex_unlock(&f->mutex);
+	return err == BCTBX_VFS_OK ? (ssize_t)count : err;
+}
+
+/**
+ * Growing the file writes zeros up to the new size. Shrinking it cuts the records, the new last one being encrypted
+ * again as the last one.
+ */
+static int aesGcmTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	uint64_t index = aes_gcm_last_block(f, (int64_t)size);
+	size_t len = aes_gcm_block_len(f, index, (int64_t)size);
+	off_t inner_size = aes_gcm_record_offset(f, index) + (off_t)(AES_GCM_VFS_OVERHEAD + len);
+	int err = BCTBX_VFS_OK;
+
+	if (f->inner->pMethods->pFuncTruncate == NULL) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&f->mutex);
+	if ((int64_t)size > f->size) {
+		const char zero = 0;
+		err = aes_gcm_write(f, &zero, 1, size - 1);
+	} else if ((int64_t)size < f->size) {
+		err = aes_gcm_load_block(f, index);
+		if (err == BCTBX_VFS_OK) err = aes_gcm_store_block(f, index, len, TRUE);
+		if (err == BCTBX_VFS_OK) err = f->inner->pMethods->pFuncTruncate(f->inner, inner_size);
+		if (err == BCTBX_VFS_OK) f->size = (int64_t)size;
+		f->cached_block = -1;
+	}
+	bctbx_mutex_unlock(&f->mutex);
+	return err;
+}
+
+static int64_t aesGcmFileSize(bctbx_vfs_file_t *pFile) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	int64_t ret;
+
+	bctbx_mutex_lock(&f->mutex);
+	ret = f->size;
+	bctbx_mutex_unlock(&f->mutex);
+	return ret;
+}
+
+/**
+ * The offset of the wrapped file has no meaning for the callers: the position is computed on the plain size.
+ */
+static off_t aesGcmSeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
+	off_t base;
+
+	switch (whence) {
+		case SEEK_SET:
+			base = 0;
+			break;
+		case SEEK_CUR:
+			base = pFile->offset;
+			break;
+		case SEEK_END:
+			base = (off_t)aesGcmFileSize(pFile);
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (base + offset < 0) return -EINVAL;
+	return base + offset;
+}
+
+static int aesGcmSync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	if (f->inner->pMethods->pFuncSync == NULL) return BCTBX_VFS_ERROR;
+	return f->inner->pMethods->pFuncSync(f->inner, data_only);
+}
+
+static void aes_gcm_file_free(aes_gcm_file_t *f) {
+	if (f->key) bctbx_aes_gcm_key_free(f->key);
+	if (f->rng) bctbx_rng_context_free(f->rng);
+	if (f->plain) {
+		/*do not leave plain text in the freed memory*/
+		memset(f->plain, 0, f->block_size);
+		bctbx_free(f->plain);
+	}
+	bctbx_free(f->record);
+	bctbx_mutex_destroy(&f->mutex);
+	bctbx_free(f);
+}
+
+static int aesGcmClose(bctbx_vfs_file_t *pFile) {
+	aes_gcm_file_t *f = (aes_gcm_file_t *)pFile->pUserData;
+	int ret = f->inner->pMethods->pFuncClose(f->inner);
+
+	bctbx_free(f->inner);
+	aes_gcm_file_free(f);
+	pFile->pUserData = NULL;
+	return ret;
+}
+
+static const bctbx_io_methods_t aes_gcm_io = {
+	aesGcmClose,                /* pFuncClose */
+	aesGcmRead,                 /* pFuncRead */
+	aesGcmWrite,                /* pFuncWrite */
+	aesGcmFileSize,             /* pFuncFileSize */
+	bctbx_vfs_get_line_from_read, /* pFuncGetLineFromFd */
+	aesGcmSeek,                 /* pFuncSeek */
+	NULL,                       /* pFuncMapRegion */
+	NULL,                       /* pFuncReadv */
+	NULL,                       /* pFuncWritev */
+	aesGcmSync,                 /* pFuncSync */
+	aesGcmTruncate,             /* pFuncTruncate */
+};
+
+static void aes_gcm_alloc_buffers(aes_gcm_file_t *f) {
+	f->record = (uint8_t *)bctbx_malloc(aes_gcm_record_size(f));
+	f->plain = (uint8_t *)bctbx_malloc(f->block_size);
+}
+
+/*write the header and the empty record of a new file*/
+static int aes_gcm_file_create(aes_gcm_file_t *f) {
+	uint8_t header[AES_GCM_VFS_HEADER_SIZE];
+	ssize_t ret;
+
+	if (bctbx_rng_get(f->rng, f->file_id, sizeof(f->file_id)) != 0) return BCTBX_VFS_ERROR;
+	memset(header, 0, sizeof(header));
+	memcpy(header, AES_GCM_VFS_MAGIC, 8);
+	header[8] = AES_GCM_VFS_VERSION;
+	header[12] = (uint8_t)(f->block_size >> 24);
+	header[13] = (uint8_t)(f->block_size >> 16);
+	header[14] = (uint8_t)(f->block_size >> 8);
+	header[15] = (uint8_t)f->block_size;
+	memcpy(header + 16, f->file_id, sizeof(f->file_id));
+	ret = f->inner->pMethods->pFuncWrite(f->inner, header, sizeof(header), 0);
+	if (ret < 0) return (int)ret;
+	if (ret != sizeof(header)) return BCTBX_VFS_ERROR;
+	return aes_gcm_store_block(f, 0, 0, TRUE);
+}
+
+/*read the header of an existing file or write the one of a new file, and deduce the plain size*/
+static int aes_gcm_file_setup(aes_gcm_file_t *f, size_t block_size, int openFlags) {
+	uint8_t header[AES_GCM_VFS_HEADER_SIZE];
+	int64_t size = f->inner->pMethods->pFuncFileSize(f->inner);
+	uint64_t records, last;
+	ssize_t ret;
+
+	if (size < 0) return (int)size;
+	if (size == 0) {
+		f->block_size = block_size;
+		f->size = 0;
+		aes_gcm_alloc_buffers(f);
+		if ((openFlags & (O_WRONLY | O_RDWR)) == 0) return BCTBX_VFS_OK;
+		return aes_gcm_file_create(f);
+	}
+
+	ret = f->inner->pMethods->pFuncRead(f->inner, header, sizeof(header), 0);
+	if (ret < 0) return (int)ret;
+	if (ret != sizeof(header) || memcmp(header, AES_GCM_VFS_MAGIC, 8) != 0 || header[8] != AES_GCM_VFS_VERSION) {
+		bctbx_error("bctbx_vfs_aes_gcm: not an encrypted file");
+		return BCTBX_VFS_ERROR;
+	}
+	f->block_size = ((size_t)header[12] << 24) | ((size_t)header[13] << 16) | ((size_t)header[14] << 8) | header[15];
+	if (f->block_size == 0 || f->block_size > AES_GCM_VFS_MAX_BLOCK_SIZE) {
+		bctbx_error("bctbx_vfs_aes_gcm: invalid block size %u", (unsigned int)f->block_size);
+		return BCTBX_VFS_ERROR;
+	}
+	memcpy(f->file_id, header + 16, sizeof(f->file_id));
+	size -= AES_GCM_VFS_HEADER_SIZE;
+	records = (uint64_t)size / aes_gcm_record_size(f);
+	last = (uint64_t)size % aes_gcm_record_size(f);
+	/*only an empty file has an empty record*/
+	if ((last > 0 && last < AES_GCM_VFS_OVERHEAD) || (last == AES_GCM_VFS_OVERHEAD && records > 0)
+		|| (last == 0 && records == 0)) {
+		bctbx_error("bctbx_vfs_aes_gcm: truncated file");
+		return BCTBX_VFS_ERROR;
+	}
+	f->size = (int64_t)(records * f->block_size + (last > 0 ? last - AES_GCM_VFS_OVERHEAD : 0));
+	aes_gcm_alloc_buffers(f);
+	/*the last record must be authenticated as the last one: records removed from the end are detected*/
+	if (aes_gcm_load_block(f, aes_gcm_last_block(f, f->size)) != BCTBX_VFS_OK) {
+		bctbx_error("bctbx_vfs_aes_gcm: truncated or altered file");
+		return BCTBX_VFS_ERROR;
+	}
+	return BCTBX_VFS_OK;
+}
+
+static int aesGcmOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	aes_gcm_vfs_t *vfs = (aes_gcm_vfs_t *)pVfs;
+	bctbx_vfs_file_t *inner = bctbx_new0(bctbx_vfs_file_t, 1);
+	aes_gcm_file_t *f;
+	int innerFlags = openFlags;
+	int ret;
+
+	/*the header and the blocks partly written are read, even when the caller only writes; the records are written at
+	 * their own offsets*/
+	if (openFlags & O_WRONLY) innerFlags = (openFlags & ~O_WRONLY) | O_RDWR;
+	innerFlags &= ~O_APPEND;
+	ret = vfs->wrapped->pFuncOpen(vfs->wrapped, inner, fName, innerFlags);
+	if (ret != BCTBX_VFS_OK) {
+		bctbx_free(inner);
+		return ret;
+	}
+	f = bctbx_new0(aes_gcm_file_t, 1);
+	bctbx_mutex_init(&f->mutex, NULL);
+	f->inner = inner;
+	f->cached_block = -1;
+	f->readable = (openFlags & O_WRONLY) == 0;
+	f->key = bctbx_aes_gcm_key_new(vfs->key, vfs->key_length);
+	f->rng = bctbx_rng_context_new();
+	if (f->key == NULL || f->rng == NULL) ret = BCTBX_VFS_ERROR;
+	else ret = aes_gcm_file_setup(f, vfs->block_size, openFlags);
+	if (ret != BCTBX_VFS_OK) {
+		inner->pMethods->pFuncClose(inner);
+		bctbx_free(inner);
+		aes_gcm_file_free(f);
+		return ret;
+	}
+
+	pFile->pUserData = f;
+	pFile->pMethods = &aes_gcm_io;
+	pFile->fd = inner->fd;
+	return BCTBX_VFS_OK;
+}
+
+/*the records are bound to the identifier stored in the header, not to the name of the file*/
+static int aesGcmRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+	aes_gcm_vfs_t *vfs = (aes_gcm_vfs_t *)pVfs;
+	if (vfs->wrapped->pFuncRename == NULL) return BCTBX_VFS_ERROR;
+	return vfs->wrapped->pFuncRename(vfs->wrapped, oldName, newName);
+}
+
+static int aesGcmDelete(bctbx_vfs_t *pVfs, const char *fName) {
+	aes_gcm_vfs_t *vfs = (aes_gcm_vfs_t *)pVfs;
+	if (vfs->wrapped->pFuncDelete == NULL) return BCTBX_VFS_ERROR;
+	return vfs->wrapped->pFuncDelete(vfs->wrapped, fName);
+}
+
+bctbx_vfs_t *bctbx_vfs_aes_gcm_new(bctbx_vfs_t *wrapped, const uint8_t *key, size_t key_length, size_t block_size) {
+	aes_gcm_vfs_t *vfs;
+
+	if (wrapped == NULL || key == NULL || (key_length != 16 && key_length != 24 && key_length != 32)) return NULL;
+	if (block_size == 0) block_size = AES_GCM_VFS_DEFAULT_BLOCK_SIZE;
+	if (block_size > AES_GCM_VFS_MAX_BLOCK_SIZE) return NULL;
+	vfs = bctbx_new0(aes_gcm_vfs_t, 1);
+	vfs->vfs.vfsName = "bctbx_aes_gcm_vfs";
+	vfs->vfs.pFuncOpen = aesGcmOpen;
+	vfs->vfs.pFuncRename = aesGcmRename;
+	vfs->vfs.pFuncDelete = aesGcmDelete;
+	vfs->wrapped = wrapped;
+	memcpy(vfs->key, key, key_length);
+	vfs->key_length = key_length;
+	vfs->block_size = block_size;
+	return &vfs->vfs;
+}
+
+void bctbx_vfs_aes_gcm_destroy(bctbx_vfs_t *pVfs) {
+	aes_gcm_vfs_t *vfs = (aes_gcm_vfs_t *)pVfs;
+
+	if (vfs == NULL) return;
+	memset(vfs->key, 0, sizeof(vfs->key));
+	bctbx_free(vfs);
+}
@@ -0,0 +1,400 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+#include "bctoolbox/logging.h"
+#include "utils.h"
+
+/*
+ * The requests on a file wait in its own FIFO list and are executed one at a time, so that they are executed in order
+ * while the files are processed in parallel. The files having requests waiting and none executing are in a FIFO list
+ * of ready files: a worker takes the first request of the first ready file. The files having requests are found by
+ * their handle in a hash table.
+ */
+
+#define VFS_ASYNC_DEFAULT_THREADS 4
+#define VFS_ASYNC_MAX_THREADS 64
+#define VFS_ASYNC_MIN_BUCKETS 16
+
+typedef enum _vfs_async_op {
+	VFS_ASYNC_READ,
+	VFS_ASYNC_WRITE,
+	VFS_ASYNC_SYNC
+} vfs_async_op_t;
+
+typedef struct _vfs_async_request {
+	struct _vfs_async_request *next;
+	vfs_async_op_t op;
+	bctbx_vfs_file_t *pFile;
+	void *buf;
+	size_t count;
+	off_t offset;
+	bool_t data_only;
+	bctbx_vfs_completion_queue_t *queue;
+	bctbx_file_async_cb cb;
+	void *user_data;
+	ssize_t result;
+} vfs_async_request_t;
+
+struct _bctbx_vfs_completion_queue {
+	bctbx_mutex_t mutex;
+	bctbx_cond_t cond;
+	vfs_async_request_t *head; /*completed requests, in completion order*/
+	vfs_async_request_t *tail;
+};
+
+typedef struct _vfs_async_file {
+	struct _vfs_async_file *hash_next;
+	struct _vfs_async_file *ready_next;
+	bctbx_vfs_file_t *pFile;
+	vfs_async_request_t *head; /*requests not taken by a worker yet*/
+	vfs_async_request_t *tail;
+	bool_t running; /*a worker is executing a request of this file*/
+} vfs_async_file_t;
+
+typedef struct _vfs_async_pool {
+	bctbx_mutex_t mutex; /*protects everything below*/
+	bctbx_cond_t cond;
+	vfs_async_file_t **buckets; /*files having requests waiting or executing*/
+	size_t bucket_count; /*power of 2*/
+	size_t file_count;
+	vfs_async_file_t *ready_head; /*files having requests waiting and none executing*/
+	vfs_async_file_t *ready_tail;
+	bctbx_thread_t threads[VFS_ASYNC_MAX_THREADS];
+	int thread_count; /*wanted number of workers*/
+	int started; /*number of running workers*/
+	bool_t stopping;
+} vfs_async_pool_t;
+
+static vfs_async_pool_t vfs_async_pool = {0};
+static bctbx_once_t vfs_async_once = BCTBX_ONCE_INIT;
+
+static void vfs_async_mutex_init(void) {
+	bctbx_mutex_init(&vfs_async_pool.mutex, NULL);
+}
+
+/*the workers lock the pool mutex directly: it is initialized before they are started*/
+static void vfs_async_lock(vfs_async_pool_t *pool) {
+	bctbx_once(&vfs_async_once, vfs_async_mutex_init);
+	bctbx_mutex_lock(&pool->mutex);
+}
+
+static size_t vfs_async_hash(const vfs_async_pool_t *pool, const bctbx_vfs_file_t *pFile) {
+	/*Fibonacci hashing of the address, whose low bits are always zero*/
+	return (size_t)(((uint64_t)(uintptr_t)pFile * 0x9E3779B97F4A7C15ULL) >> 32) & (pool->bucket_count - 1);
+}
+
+static void vfs_async_rehash(vfs_async_pool_t *pool, size_t bucket_count) {
+	vfs_async_file_t **old_buckets = pool->buckets;
+	size_t old_count = pool->bucket_count;
+	size_t i;
+
+	pool->buckets = bctbx_new0(vfs_async_file_t *, bucket_count);
+	pool->bucket_count = bucket_count;
+	for (i = 0; i < old_count; i++) {
+		vfs_async_file_t *file = old_buckets[i];
+		while (file) {
+			vfs_async_file_t *next = file->hash_next;
+			size_t h = vfs_async_hash(pool, file->pFile);
+			file->hash_next = pool->buckets[h];
+			pool->buckets[h] = file;
+			file = next;
+		}
+	}
+	if (old_buckets) bctbx_free(old_buckets);
+}
+
+/*find the entry of a file, creating it if it has no request yet, called with the pool mutex held*/
+static vfs_async_file_t *vfs_async_get_file(vfs_async_pool_t *pool, bctbx_vfs_file_t *pFile) {
+	vfs_async_file_t *file;
+	size_t h;
+
+	if (pool->bucket_count == 0) vfs_async_rehash(pool, VFS_ASYNC_MIN_BUCKETS);
+	h = vfs_async_hash(pool, pFile);
+	for (file = pool->buckets[h]; file != NULL; file = file->hash_next) {
+		if (file->pFile == pFile) return file;
+	}
+	if (pool->file_count >= pool->bucket_count) {
+		vfs_async_rehash(pool, pool->bucket_count * 2);
+		h = vfs_async_hash(pool, pFile);
+	}
+	file = bctbx_new0(vfs_async_file_t, 1);
+	file->pFile = pFile;
+	file->hash_next = pool->buckets[h];
+	pool->buckets[h] = file;
+	pool->file_count++;
+	return file;
+}
+
+/*remove the entry of a file having no more request, called with the pool mutex held*/
+static void vfs_async_remove_file(vfs_async_pool_t *pool, vfs_async_file_t *file) {
+	vfs_async_file_t **link = &pool->buckets[vfs_async_hash(pool, file->pFile)];
+
+	while (*link != file) link = &(*link)->hash_next;
+	*link = file->hash_next;
+	pool->file_count--;
+	bctbx_free(file);
+}
+
+static void vfs_async_push_ready(vfs_async_pool_t *pool, vfs_async_file_t *file) {
+	file->ready_next = NULL;
+	if (pool->ready_tail) pool->ready_tail->ready_next = file;
+	else pool->ready_head = file;
+	pool->ready_tail = file;
+}
+
+/*take the first request of the first ready file, called with the pool mutex held*/
+static vfs_async_request_t *vfs_async_take(vfs_async_pool_t *pool, vfs_async_file_t **file) {
+	vfs_async_file_t *ready = pool->ready_head;
+	vfs_async_request_t *request;
+
+	if (ready == NULL) return NULL;
+	pool->ready_head = ready->ready_next;
+	if (pool->ready_head == NULL) pool->ready_tail = NULL;
+	ready->ready_next = NULL;
+	request = ready->head;
+	ready->head = request->next;
+	if (ready->head == NULL) ready->tail = NULL;
+	request->next = NULL;
+	ready->running = TRUE;
+	*file = ready;
+	return request;
+}
+
+static void vfs_async_execute(vfs_async_request_t *request) {
+	switch (request->op) {
+		case VFS_ASYNC_READ:
+			request->result = bctbx_file_read(request->pFile, request->buf, request->count, request->offset);
+			break;
+		case VFS_ASYNC_WRITE:
+			request->result = bctbx_file_write(request->pFile, request->buf, request->count, request->offset);
+			break;
+		case VFS_ASYNC_SYNC:
+			request->result = bctbx_file_sync(request->pFile, request->data_only);
+			break;
+	}
+}
+
+static void vfs_async_complete(vfs_async_request_t *request) {
+	bctbx_vfs_completion_queue_t *queue = request->queue;
+
+	if (queue == NULL) {
+		if (request->cb) request->cb(request->pFile, request->result, request->user_data);
+		bctbx_free(request);
+		return;
+	}
+	bctbx_mutex_lock(&queue->mutex);
+	if (queue->tail) queue->tail->next = request;
+	else queue->head = request;
+	queue->tail = request;
+	bctbx_cond_signal(&queue->cond);
+	bctbx_mutex_unlock(&queue->mutex);
+}
+
+static void *vfs_async_worker_run(void *data) {
+	vfs_async_pool_t *pool = &vfs_async_pool;
+
+	bctbx_mutex_lock(&pool->mutex);
+	for (;;) {
+		vfs_async_file_t *file;
+		vfs_async_request_t *request = vfs_async_take(pool, &file);
+		if (request == NULL) {
+			if (pool->stopping) break;
+			bctbx_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		bctbx_mutex_unlock(&pool->mutex);
+
+		vfs_async_execute(request);
+		/*completed before the file is released, so that the completions of a file are reported in order*/
+		vfs_async_complete(request);
+
+		bctbx_mutex_lock(&pool->mutex);
+		file->running = FALSE;
+		/*no need to wake another worker: this one takes a ready file on its next iteration*/
+		if (file->head) vfs_async_push_ready(pool, file);
+		else vfs_async_remove_file(pool, file);
+	}
+	bctbx_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/*start the workers if needed, called with the pool mutex held*/
+static bool_t vfs_async_start(vfs_async_pool_t *pool) {
+	int count = pool->thread_count > 0 ? pool->thread_count : VFS_ASYNC_DEFAULT_THREADS;
+
+	if (pool->started > 0) return TRUE;
+	if (pool->stopping) return FALSE;
+	bctbx_cond_init(&pool->cond, NULL);
+	while (pool->started < count) {
+		if (bctbx_thread_create(&pool->threads[pool->started], NULL, vfs_async_worker_run, NULL) != 0) break;
+		pool->started++;
+	}
+	if (pool->started == 0) {
+		bctbx_error("bctbx_vfs_async: cannot start worker threads");
+		bctbx_cond_destroy(&pool->cond);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int vfs_async_submit(vfs_async_op_t op, bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset, bool_t data_only,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data) {
+	vfs_async_pool_t *pool = &vfs_async_pool;
+	vfs_async_request_t *request;
+	vfs_async_file_t *file;
+
+	if (pFile == NULL) return BCTBX_VFS_ERROR;
+	request = bctbx_new0(vfs_async_request_t, 1);
+	request->op = op;
+	request->pFile = pFile;
+	request->buf = buf;
+	request->count = count;
+	request->offset = offset;
+	request->data_only = data_only;
+	request->queue = queue;
+	request->cb = cb;
+	request->user_data = user_data;
+
+	vfs_async_lock(pool);
+	if (!vfs_async_start(pool)) {
+		bctbx_mutex_unlock(&pool->mutex);
+		bctbx_free(request);
+		return BCTBX_VFS_ERROR;
+	}
+	file = vfs_async_get_file(pool, pFile);
+	if (file->tail) file->tail->next = request;
+	else file->head = request;
+	file->tail = request;
+	/*a file already having requests is ready or executing: it is taken again without a new wake up*/
+	if (file->head == request && !file->running) {
+		vfs_async_push_ready(pool, file);
+		bctbx_cond_signal(&pool->cond);
+	}
+	bctbx_mutex_unlock(&pool->mutex);
+	return BCTBX_VFS_OK;
+}
+
+int bctbx_file_read_async(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data) {
+	return vfs_async_submit(VFS_ASYNC_READ, pFile, buf, count, offset, FALSE, queue, cb, user_data);
+}
+
+int bctbx_file_write_async(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data) {
+	/*the buffer is only read*/
+	return vfs_async_submit(VFS_ASYNC_WRITE, pFile, (void *)buf, count, offset, FALSE, queue, cb, user_data);
+}
+
+int bctbx_file_fsync_async(bctbx_vfs_file_t *pFile, bool_t data_only,
+	bctbx_vfs_completion_queue_t *queue, bctbx_file_async_cb cb, void *user_data) {
+	return vfs_async_submit(VFS_ASYNC_SYNC, pFile, NULL, 0, 0, data_only, queue, cb, user_data);
+}
+
+void bctbx_vfs_async_set_thread_count(int count) {
+	vfs_async_lock(&vfs_async_pool);
+	vfs_async_pool.thread_count = MAX(1, MIN(count, VFS_ASYNC_MAX_THREADS));
+	bctbx_mutex_unlock(&vfs_async_pool.mutex);
+}
+
+void bctbx_vfs_async_shutdown(void) {
+	vfs_async_pool_t *pool = &vfs_async_pool;
+	int started;
+	int i;
+
+	vfs_async_lock(pool);
+	started = pool->started;
+	if (started == 0 || pool->stopping) {
+		bctbx_mutex_unlock(&pool->mutex);
+		return;
+	}
+	pool->stopping = TRUE;
+	bctbx_cond_broadcast(&pool->cond);
+	bctbx_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < started; i++) bctbx_thread_join(pool->threads[i], NULL);
+
+	bctbx_mutex_lock(&pool->mutex);
+	bctbx_cond_destroy(&pool->cond);
+	if (pool->buckets) bctbx_free(pool->buckets);
+	pool->buckets = NULL;
+	pool->bucket_count = 0;
+	pool->started = 0;
+	pool->stopping = FALSE;
+	bctbx_mutex_unlock(&pool->mutex);
+}
+
+bctbx_vfs_completion_queue_t *bctbx_vfs_completion_queue_new(void) {
+	bctbx_vfs_completion_queue_t *queue = bctbx_new0(bctbx_vfs_completion_queue_t, 1);
+	bctbx_mutex_init(&queue->mutex, NULL);
+	bctbx_cond_init(&queue->cond, NULL);
+	return queue;
+}
+
+void bctbx_vfs_completion_queue_destroy(bctbx_vfs_completion_queue_t *queue) {
+	vfs_async_request_t *request;
+
+	if (queue == NULL) return;
+	request = queue->head;
+	while (request) {
+		vfs_async_request_t *next = request->next;
+		bctbx_free(request);
+		request = next;
+	}
+	bctbx_cond_destroy(&queue->cond);
+	bctbx_mutex_destroy(&queue->mutex);
+	bctbx_free(queue);
+}
+
+/*call the callbacks of the completed requests taken from the queue, outside of its lock*/
+static int vfs_completion_queue_dispatch(vfs_async_request_t *request) {
+	int count = 0;
+
+	while (request) {
+		vfs_async_request_t *next = request->next;
+		if (request->cb) request->cb(request->pFile, request->result, request->user_data);
+		bctbx_free(request);
+		request = next;
+		count++;
+	}
+	return count;
+}
+
+int bctbx_vfs_completion_queue_process(bctbx_vfs_completion_queue_t *queue) {
+	vfs_async_request_t *completed;
+
+	bctbx_mutex_lock(&queue->mutex);
+	completed = queue->head;
+	queue->head = queue->tail = NULL;
+	bctbx_mutex_unlock(&queue->mutex);
+	return vfs_completion_queue_dispatch(completed);
+}
+
+int bctbx_vfs_completion_queue_wait(bctbx_vfs_completion_queue_t *queue) {
+	vfs_async_request_t *completed;
+
+	bctbx_mutex_lock(&queue->mutex);
+	while (queue->head == NULL) bctbx_cond_wait(&queue->cond, &queue->mutex);
+	completed = queue->head;
+	queue->head = queue->tail = NULL;
+	bctbx_mutex_unlock(&queue->mutex);
+	return vfs_completion_queue_dispatch(completed);
+}
@@ -0,0 +1,512 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+#include "utils.h"
+#include <errno.h>
+
+/*
+ * Page cache over the files of another VFS. The pages of a file are indexed by a hash table and ordered in a list
+ * from the most to the least recently used. A page holds the bytes of the file it covers, len being less than the
+ * page size only for the last page of the file. Written bytes are marked by the dirty range of the page.
+ * All the operations on a file are serialized by its mutex.
+ */
+
+typedef struct _cache_page {
+	struct _cache_page *hash_next;
+	struct _cache_page *lru_prev; /*more recently used*/
+	struct _cache_page *lru_next; /*less recently used*/
+	uint64_t index;
+	size_t len;
+	size_t dirty_start; /*dirty range in the page, empty if the page is clean*/
+	size_t dirty_end;
+	char data[1];
+} cache_page_t;
+
+typedef struct _cache_vfs {
+	bctbx_vfs_t vfs; /*must be first: the VFS given to the callers*/
+	bctbx_vfs_t *wrapped;
+	size_t page_size;
+	size_t capacity;
+	bctbx_vfs_cache_stats_t stats; /*updated atomically*/
+} cache_vfs_t;
+
+typedef struct _cache_file {
+	cache_vfs_t *cache;
+	bctbx_vfs_file_t *inner; /*the file opened with the wrapped VFS*/
+	bctbx_mutex_t mutex;
+	cache_page_t **buckets;
+	size_t bucket_count; /*a power of 2*/
+	cache_page_t *lru_head;
+	cache_page_t *lru_tail;
+	size_t page_count;
+	size_t dirty_count;
+	int64_t size; /*size of the file including the data not written back yet*/
+	uint64_t next_sequential; /*where a read continuing the previous one would start*/
+	size_t readahead; /*number of pages read in advance on a miss, 0 while reads are not sequential*/
+} cache_file_t;
+
+static cache_page_t **cache_bucket(cache_file_t *cf, uint64_t index) {
+	return &cf->buckets[(size_t)(index * 2654435761u) & (cf->bucket_count - 1)];
+}
+
+static cache_page_t *cache_lookup(cache_file_t *cf, uint64_t index) {
+	cache_page_t *page;
+	for (page = *cache_bucket(cf, index); page != NULL; page = page->hash_next) {
+		if (page->index == index) return page;
+	}
+	return NULL;
+}
+
+static void cache_lru_unlink(cache_file_t *cf, cache_page_t *page) {
+	if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+	else cf->lru_head = page->lru_next;
+	if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+	else cf->lru_tail = page->lru_prev;
+}
+
+static void cache_lru_push(cache_file_t *cf, cache_page_t *page) {
+	page->lru_prev = NULL;
+	page->lru_next = cf->lru_head;
+	if (cf->lru_head) cf->lru_head->lru_prev = page;
+	else cf->lru_tail = page;
+	cf->lru_head = page;
+}
+
+static void cache_touch(cache_file_t *cf, cache_page_t *page) {
+	if (cf->lru_head == page) return;
+	cache_lru_unlink(cf, page);
+	cache_lru_push(cf, page);
+}
+
+static bool_t cache_page_dirty(const cache_page_t *page) {
+	return page->dirty_end > page->dirty_start;
+}
+
+static int cache_compare_pages(const void *a, const void *b) {
+	uint64_t ia = (*(cache_page_t *const *)a)->index;
+	uint64_t ib = (*(cache_page_t *const *)b)->index;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static int cache_write_back(cache_file_t *cf, const char *data, size_t len, uint64_t offset) {
+	ssize_t ret = cf->inner->pMethods->pFuncWrite(cf->inner, data, len, (off_t)offset);
+	bctbx_atomic_add64(&cf->cache->stats.writes, 1);
+	if (ret < 0) return (int)ret;
+	return (size_t)ret == len ? BCTBX_VFS_OK : BCTBX_VFS_ERROR;
+}
+
+/*
+ * Write all the dirty pages back. Runs of consecutive pages are written in a single call: the bytes between the dirty
+ * ranges of a run are clean copies of the file, which can be written again. On error, the pages not written back stay
+ * dirty, so that a later flush retries them.
+ */
+static int cache_flush(cache_file_t *cf) {
+	size_t page_size = cf->cache->page_size;
+	cache_page_t **dirty;
+	cache_page_t *page;
+	char *run = NULL;
+	size_t count = 0;
+	size_t i, j;
+	int ret = BCTBX_VFS_OK;
+
+	if (cf->dirty_count == 0) return BCTBX_VFS_OK;
+	dirty = bctbx_new(cache_page_t *, cf->dirty_count);
+	for (page = cf->lru_head; page != NULL; page = page->lru_next) {
+		if (cache_page_dirty(page)) dirty[count++] = page;
+	}
+	qsort(dirty, count, sizeof(cache_page_t *), cache_compare_pages);
+	for (i = 0; i < count && ret == BCTBX_VFS_OK; i = j) {
+		uint64_t start;
+		size_t len;
+
+		for (j = i + 1; j < count && dirty[j]->index == dirty[j - 1]->index + 1 && dirty[j - 1]->len == page_size; j++);
+		start = dirty[i]->index * page_size + dirty[i]->dirty_start;
+		if (j == i + 1) {
+			len = dirty[i]->dirty_end - dirty[i]->dirty_start;
+			ret = cache_write_back(cf, dirty[i]->data + dirty[i]->dirty_start, len, start);
+		} else {
+			size_t k, pos = 0;
+			len = (size_t)((dirty[j - 1]->index * page_size + dirty[j - 1]->dirty_end) - start);
+			run = bctbx_realloc(run, len);
+			for (k = i; k < j; k++) {
+				size_t from = (k == i) ? dirty[k]->dirty_start : 0;
+				size_t to = (k == j - 1) ? dirty[k]->dirty_end : page_size;
+				memcpy(run + pos, dirty[k]->data + from, to - from);
+				pos += to - from;
+			}
+			ret = cache_write_back(cf, run, len, start);
+		}
+		if (ret != BCTBX_VFS_OK) break;
+		for (; i < j; i++) {
+			dirty[i]->dirty_start = dirty[i]->dirty_end = 0;
+			cf->dirty_count--;
+		}
+	}
+	if (run) bctbx_free(run);
+	bctbx_free(dirty);
+	return ret;
+}
+
+/*make room for a new page: the least recently used one is dropped, after writing back the dirty pages if needed*/
+static int cache_evict(cache_file_t *cf) {
+	int ret = BCTBX_VFS_OK;
+
+	while (cf->page_count >= cf->cache->capacity) {
+		cache_page_t *page = cf->lru_tail;
+		cache_page_t **p;
+
+		if (cache_page_dirty(page)) {
+			ret = cache_flush(cf);
+			if (ret != BCTBX_VFS_OK) return ret;
+		}
+		for (p = cache_bucket(cf, page->index); *p != page; p = &(*p)->hash_next);
+		*p = page->hash_next;
+		cache_lru_unlink(cf, page);
+		cf->page_count--;
+		bctbx_free(page);
+		bctbx_atomic_add64(&cf->cache->stats.evictions, 1);
+	}
+	return ret;
+}
+
+static cache_page_t *cache_insert(cache_file_t *cf, uint64_t index, int *err) {
+	cache_page_t *page;
+	cache_page_t **bucket;
+
+	*err = cache_evict(cf);
+	if (*err != BCTBX_VFS_OK) return NULL;
+	page = (cache_page_t *)bctbx_malloc0(sizeof(cache_page_t) + cf->cache->page_size - 1);
+	page->index = index;
+	bucket = cache_bucket(cf, index);
+	page->hash_next = *bucket;
+	*bucket = page;
+	cache_lru_push(cf, page);
+	cf->page_count++;
+	return page;
+}
+
+/*
+ * Read the page at index from the file, and up to count - 1 following pages if they are not cached yet,
+ * in a single call. Returns the page at index.
+ */
+static cache_page_t *cache_load(cache_file_t *cf, uint64_t index, size_t count, int *err) {
+	size_t page_size = cf->cache->page_size;
+	cache_page_t *first = NULL;
+	char *buf;
+	ssize_t ret;
+	size_t i;
+
+	for (i = 1; i < count && cache_lookup(cf, index + i) == NULL; i++);
+	count = i;
+	buf = bctbx_malloc(count * page_size);
+	ret = cf->inner->pMethods->pFuncRead(cf->inner, buf, count * page_size, (off_t)(index * page_size));
+	if (ret < 0) {
+		*err = (int)ret;
+		bctbx_free(buf);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		uint64_t start = (index + i) * page_size;
+		size_t len = (size_t)ret > i * page_size ? MIN((size_t)ret - i * page_size, page_size) : 0;
+		/*bytes before the end of the file that were not read are a hole left by a write not written back yet*/
+		size_t len_in_file = (uint64_t)cf->size > start ? (size_t)MIN((uint64_t)cf->size - start, (uint64_t)page_size) : 0;
+		cache_page_t *page;
+
+		/*nothing to read in advance past the end of the file*/
+		if (i > 0 && len_in_file == 0) break;
+		page = cache_insert(cf, index + i, err);
+		if (page == NULL) break;
+		memcpy(page->data, buf + i * page_size, len);
+		page->len = MAX(len, len_in_file);
+		if (i == 0) first = page;
+		else bctbx_atomic_add64(&cf->cache->stats.readahead_pages, 1);
+	}
+	bctbx_free(buf);
+	/*the first page may have been evicted to load the last ones if the capacity is tiny*/
+	if (first && count > 1) first = cache_lookup(cf, index);
+	if (first) cache_touch(cf, first);
+	return first;
+}
+
+static ssize_t cacheRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	size_t page_size = cf->cache->page_size;
+	uint64_t pos = (uint64_t)offset;
+	uint64_t end;
+	int err = BCTBX_VFS_OK;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&cf->mutex);
+	if (pos == cf->next_sequential && pos != 0) {
+		cf->readahead = cf->readahead ? MIN(cf->readahead * 2, cf->cache->capacity / 2) : 2;
+	} else {
+		cf->readahead = 0;
+	}
+	end = MIN(pos + count, (uint64_t)cf->size);
+	while (pos < end) {
+		uint64_t index = pos / page_size;
+		size_t in_page = (size_t)(pos % page_size);
+		cache_page_t *page = cache_lookup(cf, index);
+		size_t n;
+
+		if (page) {
+			bctbx_atomic_add64(&cf->cache->stats.hits, 1);
+			cache_touch(cf, page);
+		} else {
+			bctbx_atomic_add64(&cf->cache->stats.misses, 1);
+			page = cache_load(cf, index, MAX(cf->readahead, 1), &err);
+			if (page == NULL) break;
+		}
+		if (page->len <= in_page) break;
+		n = (size_t)MIN(end - pos, (uint64_t)(page->len - in_page));
+		memcpy((char *)buf + (pos - (uint64_t)offset), page->data + in_page, n);
+		pos += n;
+	}
+	cf->next_sequential = pos;
+	bctbx_mutex_unlock(&cf->mutex);
+	if (pos == (uint64_t)offset && err != BCTBX_VFS_OK) return err;
+	return (ssize_t)(pos - (uint64_t)offset);
+}
+
+static ssize_t cacheWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	size_t page_size = cf->cache->page_size;
+	uint64_t pos = (uint64_t)offset;
+	uint64_t end = pos + count;
+	int err = BCTBX_VFS_OK;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&cf->mutex);
+	while (pos < end) {
+		uint64_t index = pos / page_size;
+		size_t in_page = (size_t)(pos % page_size);
+		size_t n = (size_t)MIN(end - pos, (uint64_t)(page_size - in_page));
+		cache_page_t *page = cache_lookup(cf, index);
+		size_t dirty_start = in_page;
+
+		if (page) {
+			cache_touch(cf, page);
+		} else if ((in_page == 0 && n == page_size) || index * page_size >= (uint64_t)cf->size) {
+			/*the previous content of the page is not needed*/
+			page = cache_insert(cf, index, &err);
+		} else {
+			bctbx_atomic_add64(&cf->cache->stats.misses, 1);
+			page = cache_load(cf, index, 1, &err);
+		}
+		if (page == NULL) break;
+		if (page->len < in_page) {
+			/*a hole in the file, which must be written back as well*/
+			memset(page->data + page->len, 0, in_page - page->len);
+			dirty_start = page->len;
+		}
+		memcpy(page->data + in_page, (const char *)buf + (pos - (uint64_t)offset), n);
+		page->len = MAX(page->len, in_page + n);
+		if (cache_page_dirty(page)) {
+			page->dirty_start = MIN(page->dirty_start, dirty_start);
+			page->dirty_end = MAX(page->dirty_end, in_page + n);
+		} else {
+			page->dirty_start = dirty_start;
+			page->dirty_end = in_page + n;
+			cf->dirty_count++;
+		}
+		pos += n;
+	}
+	if (pos > (uint64_t)cf->size) cf->size = (int64_t)pos;
+	if (err == BCTBX_VFS_OK && cf->dirty_count > cf->cache->capacity / 2) err = cache_flush(cf);
+	bctbx_mutex_unlock(&cf->mutex);
+	if (pos == (uint64_t)offset && err != BCTBX_VFS_OK) return err;
+	return (ssize_t)(pos - (uint64_t)offset);
+}
+
+static int64_t cacheFileSize(bctbx_vfs_file_t *pFile) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	int64_t ret;
+
+	bctbx_mutex_lock(&cf->mutex);
+	ret = cf->size;
+	bctbx_mutex_unlock(&cf->mutex);
+	return ret;
+}
+
+static off_t cacheSeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	return cf->inner->pMethods->pFuncSeek(cf->inner, offset, whence);
+}
+
+/**
+ * Write back the dirty pages, then sync the wrapped file.
+ */
+static int cacheSync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	int ret;
+
+	bctbx_mutex_lock(&cf->mutex);
+	ret = cache_flush(cf);
+	bctbx_mutex_unlock(&cf->mutex);
+	if (ret != BCTBX_VFS_OK) return ret;
+	if (cf->inner->pMethods->pFuncSync == NULL) return BCTBX_VFS_ERROR;
+	return cf->inner->pMethods->pFuncSync(cf->inner, data_only);
+}
+
+/*drop all the pages, which must be clean*/
+static void cache_drop_pages(cache_file_t *cf) {
+	cache_page_t *page = cf->lru_head;
+
+	while (page) {
+		cache_page_t *next = page->lru_next;
+		bctbx_free(page);
+		page = next;
+	}
+	cf->lru_head = cf->lru_tail = NULL;
+	cf->page_count = 0;
+	memset(cf->buckets, 0, cf->bucket_count * sizeof(cache_page_t *));
+}
+
+/**
+ * Write back the dirty pages and drop all the pages, then truncate the wrapped file.
+ */
+static int cacheTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	int ret;
+
+	if (cf->inner->pMethods->pFuncTruncate == NULL) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&cf->mutex);
+	ret = cache_flush(cf);
+	if (ret == BCTBX_VFS_OK) {
+		cache_drop_pages(cf);
+		ret = cf->inner->pMethods->pFuncTruncate(cf->inner, size);
+		if (ret == BCTBX_VFS_OK) cf->size = (int64_t)size;
+	}
+	bctbx_mutex_unlock(&cf->mutex);
+	return ret;
+}
+
+static int cacheClose(bctbx_vfs_file_t *pFile) {
+	cache_file_t *cf = (cache_file_t *)pFile->pUserData;
+	int ret = cache_flush(cf);
+	int close_ret;
+
+	cache_drop_pages(cf);
+	close_ret = cf->inner->pMethods->pFuncClose(cf->inner);
+	if (ret == BCTBX_VFS_OK) ret = close_ret;
+	bctbx_free(cf->inner);
+	bctbx_free(cf->buckets);
+	bctbx_mutex_destroy(&cf->mutex);
+	bctbx_free(cf);
+	pFile->pUserData = NULL;
+	return ret;
+}
+
+static const bctbx_io_methods_t cache_io = {
+	cacheClose,                 /* pFuncClose */
+	cacheRead,                  /* pFuncRead */
+	cacheWrite,                 /* pFuncWrite */
+	cacheFileSize,              /* pFuncFileSize */
+	bctbx_vfs_get_line_from_read, /* pFuncGetLineFromFd */
+	cacheSeek,                  /* pFuncSeek */
+	NULL,                       /* pFuncMapRegion */
+	NULL,                       /* pFuncReadv */
+	NULL,                       /* pFuncWritev */
+	cacheSync,                  /* pFuncSync */
+	cacheTruncate,              /* pFuncTruncate */
+};
+
+static int cacheOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	cache_vfs_t *cache = (cache_vfs_t *)pVfs;
+	bctbx_vfs_file_t *inner = bctbx_new0(bctbx_vfs_file_t, 1);
+	cache_file_t *cf;
+	int64_t size;
+	int ret;
+
+	ret = cache->wrapped->pFuncOpen(cache->wrapped, inner, fName, openFlags);
+	if (ret != BCTBX_VFS_OK) {
+		bctbx_free(inner);
+		return ret;
+	}
+	size = inner->pMethods->pFuncFileSize(inner);
+	if (size < 0) {
+		inner->pMethods->pFuncClose(inner);
+		bctbx_free(inner);
+		return (int)size;
+	}
+	cf = bctbx_new0(cache_file_t, 1);
+	cf->cache = cache;
+	cf->inner = inner;
+	cf->size = size;
+	for (cf->bucket_count = 16; cf->bucket_count < cache->capacity * 2; cf->bucket_count *= 2);
+	cf->buckets = bctbx_new0(cache_page_t *, cf->bucket_count);
+	bctbx_mutex_init(&cf->mutex, NULL);
+	pFile->fd = inner->fd;
+	pFile->pUserData = cf;
+	pFile->pMethods = &cache_io;
+	return BCTBX_VFS_OK;
+}
+
+/*the files are cached while open only: renames and deletions go to the wrapped VFS*/
+static int cacheRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+	cache_vfs_t *cache = (cache_vfs_t *)pVfs;
+	if (cache->wrapped->pFuncRename == NULL) return BCTBX_VFS_ERROR;
+	return cache->wrapped->pFuncRename(cache->wrapped, oldName, newName);
+}
+
+static int cacheDelete(bctbx_vfs_t *pVfs, const char *fName) {
+	cache_vfs_t *cache = (cache_vfs_t *)pVfs;
+	if (cache->wrapped->pFuncDelete == NULL) return BCTBX_VFS_ERROR;
+	return cache->wrapped->pFuncDelete(cache->wrapped, fName);
+}
+
+bctbx_vfs_t *bctbx_vfs_cache_new(bctbx_vfs_t *wrapped, size_t page_size, size_t capacity) {
+	cache_vfs_t *cache;
+
+	if (wrapped == NULL || page_size == 0) return NULL;
+	cache = bctbx_new0(cache_vfs_t, 1);
+	cache->vfs.vfsName = "bctbx_cache_vfs";
+	cache->vfs.pFuncOpen = cacheOpen;
+	cache->vfs.pFuncRename = cacheRename;
+	cache->vfs.pFuncDelete = cacheDelete;
+	cache->wrapped = wrapped;
+	cache->page_size = page_size;
+	cache->capacity = MAX(capacity, 2);
+	return &cache->vfs;
+}
+
+void bctbx_vfs_cache_destroy(bctbx_vfs_t *cache) {
+	bctbx_free(cache);
+}
+
+void bctbx_vfs_cache_get_stats(bctbx_vfs_t *vfs, bctbx_vfs_cache_stats_t *stats) {
+	cache_vfs_t *cache = (cache_vfs_t *)vfs;
+	stats->hits = bctbx_atomic_load64(&cache->stats.hits);
+	stats->misses = bctbx_atomic_load64(&cache->stats.misses);
+	stats->readahead_pages = bctbx_atomic_load64(&cache->stats.readahead_pages);
+	stats->evictions = bctbx_atomic_load64(&cache->stats.evictions);
+	stats->writes = bctbx_atomic_load64(&cache->stats.writes);
+}
+
+void bctbx_vfs_cache_reset_stats(bctbx_vfs_t *vfs) {
+	cache_vfs_t *cache = (cache_vfs_t *)vfs;
+	bctbx_atomic_store64(&cache->stats.hits, 0);
+	bctbx_atomic_store64(&cache->stats.misses, 0);
+	bctbx_atomic_store64(&cache->stats.readahead_pages, 0);
+	bctbx_atomic_store64(&cache->stats.evictions, 0);
+	bctbx_atomic_store64(&cache->stats.writes, 0);
+}
@@ -0,0 +1,105 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+
+/*
+ * Each call takes a ticket. The caller finding no sync in progress becomes the leader: it waits for the window, then
+ * syncs the file for all the tickets taken so far. The other callers wait until a sync covering their ticket is done,
+ * or become the leader of the next sync when the current one started before they arrived.
+ */
+
+struct _bctbx_vfs_group_commit {
+	bctbx_vfs_file_t *pFile;
+	int window_ms;
+	bool_t data_only;
+	bctbx_mutex_t mutex; /*protects everything below*/
+	bctbx_cond_t cond;
+	uint64_t requested; /*last ticket given*/
+	uint64_t synced; /*last ticket covered by a sync done*/
+	bool_t syncing; /*a leader is waiting for the window or syncing*/
+	bool_t failed; /*a sync failed: the following calls fail too*/
+	uint64_t sync_count;
+};
+
+bctbx_vfs_group_commit_t *bctbx_vfs_group_commit_new(bctbx_vfs_file_t *pFile, int window_ms, bool_t data_only) {
+	bctbx_vfs_group_commit_t *gc;
+
+	if (pFile == NULL) return NULL;
+	gc = bctbx_new0(bctbx_vfs_group_commit_t, 1);
+	gc->pFile = pFile;
+	gc->window_ms = MAX(window_ms, 0);
+	gc->data_only = data_only;
+	bctbx_mutex_init(&gc->mutex, NULL);
+	bctbx_cond_init(&gc->cond, NULL);
+	return gc;
+}
+
+void bctbx_vfs_group_commit_destroy(bctbx_vfs_group_commit_t *gc) {
+	if (gc == NULL) return;
+	bctbx_cond_destroy(&gc->cond);
+	bctbx_mutex_destroy(&gc->mutex);
+	bctbx_free(gc);
+}
+
+int bctbx_vfs_group_commit_sync(bctbx_vfs_group_commit_t *gc) {
+	uint64_t ticket;
+	int ret;
+
+	bctbx_mutex_lock(&gc->mutex);
+	ticket = ++gc->requested;
+	while (gc->synced < ticket && !gc->failed) {
+		uint64_t covered;
+
+		if (gc->syncing) {
+			bctbx_cond_wait(&gc->cond, &gc->mutex);
+			continue;
+		}
+		gc->syncing = TRUE;
+		bctbx_mutex_unlock(&gc->mutex);
+		/*let the other writers join this sync*/
+		if (gc->window_ms > 0) bctbx_sleep_ms(gc->window_ms);
+		bctbx_mutex_lock(&gc->mutex);
+		covered = gc->requested;
+		bctbx_mutex_unlock(&gc->mutex);
+
+		ret = bctbx_file_sync(gc->pFile, gc->data_only);
+
+		bctbx_mutex_lock(&gc->mutex);
+		gc->sync_count++;
+		if (ret == BCTBX_VFS_OK) gc->synced = covered;
+		else gc->failed = TRUE;
+		gc->syncing = FALSE;
+		bctbx_cond_broadcast(&gc->cond);
+	}
+	ret = gc->failed ? BCTBX_VFS_ERROR : BCTBX_VFS_OK;
+	bctbx_mutex_unlock(&gc->mutex);
+	return ret;
+}
+
+uint64_t bctbx_vfs_group_commit_get_sync_count(bctbx_vfs_group_commit_t *gc) {
+	uint64_t ret;
+
+	bctbx_mutex_lock(&gc->mutex);
+	ret = gc->sync_count;
+	bctbx_mutex_unlock(&gc->mutex);
+	return ret;
+}
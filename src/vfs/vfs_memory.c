@@ -0,0 +1,405 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+#include <errno.h>
+
+/*
+ * The files are kept in a hash table indexed by name. The content of a file is an array of chunks of fixed size,
+ * allocated when first written: holes are not allocated and read as zeros. A chunk is never moved, and only freed
+ * when the file is released or truncated, so that the pointers given by pFuncMapRegion remain valid.
+ * The table, the open counts and the memory used are protected by the mutex of the VFS, the content of a file by
+ * its own mutex, always taken before the one of the VFS.
+ */
+
+#define MEMORY_VFS_CHUNK_SIZE 65536
+
+typedef struct _memory_vfs_node {
+	struct _memory_vfs_node *next; /*in the hash bucket*/
+	char *name;
+	bctbx_mutex_t mutex;
+	char **chunks; /*NULL for the chunks never written*/
+	size_t chunk_count;
+	uint64_t size;
+	int open_count;
+	bool_t unlinked; /*removed from the table, freed on the last close*/
+} memory_vfs_node_t;
+
+typedef struct _memory_vfs {
+	bctbx_vfs_t vfs; /*must be first: the VFS given to the callers*/
+	bctbx_mutex_t mutex;
+	memory_vfs_node_t **buckets;
+	size_t bucket_count; /*a power of 2*/
+	size_t file_count;
+	uint64_t max_size; /*0 for no limit*/
+	uint64_t used; /*bytes of allocated chunks*/
+} memory_vfs_t;
+
+typedef struct _memory_vfs_handle {
+	memory_vfs_t *mvfs;
+	memory_vfs_node_t *node;
+	int access; /*O_RDONLY, O_WRONLY or O_RDWR*/
+} memory_vfs_handle_t;
+
+static size_t memory_vfs_hash(const char *name) {
+	size_t hash = 2166136261u;
+	for (; *name; name++) hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+/*called with the VFS mutex held*/
+static memory_vfs_node_t **memory_vfs_find(memory_vfs_t *mvfs, const char *name) {
+	memory_vfs_node_t **node = &mvfs->buckets[memory_vfs_hash(name) & (mvfs->bucket_count - 1)];
+	while (*node && strcmp((*node)->name, name) != 0) node = &(*node)->next;
+	return node;
+}
+
+/*called with the VFS mutex held*/
+static void memory_vfs_grow_table(memory_vfs_t *mvfs) {
+	size_t count = mvfs->bucket_count * 2;
+	memory_vfs_node_t **buckets = bctbx_new0(memory_vfs_node_t *, count);
+	size_t i;
+
+	for (i = 0; i < mvfs->bucket_count; i++) {
+		memory_vfs_node_t *node = mvfs->buckets[i];
+		while (node) {
+			memory_vfs_node_t *next = node->next;
+			size_t b = memory_vfs_hash(node->name) & (count - 1);
+			node->next = buckets[b];
+			buckets[b] = node;
+			node = next;
+		}
+	}
+	bctbx_free(mvfs->buckets);
+	mvfs->buckets = buckets;
+	mvfs->bucket_count = count;
+}
+
+/*free the chunks from index first on, called with the node mutex held*/
+static void memory_vfs_free_chunks(memory_vfs_t *mvfs, memory_vfs_node_t *node, size_t first) {
+	uint64_t freed = 0;
+	size_t i;
+
+	for (i = first; i < node->chunk_count; i++) {
+		if (node->chunks[i] == NULL) continue;
+		bctbx_free(node->chunks[i]);
+		node->chunks[i] = NULL;
+		freed += MEMORY_VFS_CHUNK_SIZE;
+	}
+	bctbx_mutex_lock(&mvfs->mutex);
+	mvfs->used -= freed;
+	bctbx_mutex_unlock(&mvfs->mutex);
+}
+
+static void memory_vfs_node_free(memory_vfs_t *mvfs, memory_vfs_node_t *node) {
+	memory_vfs_free_chunks(mvfs, node, 0);
+	bctbx_free(node->chunks);
+	bctbx_free(node->name);
+	bctbx_mutex_destroy(&node->mutex);
+	bctbx_free(node);
+}
+
+/*get the chunk of the given index, allocating it if needed, called with the node mutex held*/
+static char *memory_vfs_get_chunk(memory_vfs_t *mvfs, memory_vfs_node_t *node, size_t index, int *err) {
+	bool_t full;
+
+	if (index < node->chunk_count && node->chunks[index]) return node->chunks[index];
+	bctbx_mutex_lock(&mvfs->mutex);
+	full = mvfs->max_size > 0 && mvfs->used + MEMORY_VFS_CHUNK_SIZE > mvfs->max_size;
+	if (!full) mvfs->used += MEMORY_VFS_CHUNK_SIZE;
+	bctbx_mutex_unlock(&mvfs->mutex);
+	if (full) {
+		*err = -ENOSPC;
+		return NULL;
+	}
+	if (index >= node->chunk_count) {
+		size_t count = MAX(index + 1, node->chunk_count * 2);
+		node->chunks = (char **)bctbx_realloc(node->chunks, count * sizeof(char *));
+		memset(node->chunks + node->chunk_count, 0, (count - node->chunk_count) * sizeof(char *));
+		node->chunk_count = count;
+	}
+	node->chunks[index] = (char *)bctbx_malloc0(MEMORY_VFS_CHUNK_SIZE);
+	return node->chunks[index];
+}
+
+static ssize_t memoryRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
+	memory_vfs_handle_t *handle = (memory_vfs_handle_t *)pFile->pUserData;
+	memory_vfs_node_t *node = handle->node;
+	size_t done = 0;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	if (handle->access == O_WRONLY) return -EBADF;
+	bctbx_mutex_lock(&node->mutex);
+	if ((uint64_t)offset < node->size) count = (size_t)MIN((uint64_t)count, node->size - (uint64_t)offset);
+	else count = 0;
+	while (done < count) {
+		uint64_t pos = (uint64_t)offset + done;
+		size_t index = (size_t)(pos / MEMORY_VFS_CHUNK_SIZE);
+		size_t in_chunk = (size_t)(pos % MEMORY_VFS_CHUNK_SIZE);
+		size_t n = MIN(count - done, MEMORY_VFS_CHUNK_SIZE - in_chunk);
+
+		if (index < node->chunk_count && node->chunks[index]) memcpy((char *)buf + done, node->chunks[index] + in_chunk, n);
+		else memset((char *)buf + done, 0, n);
+		done += n;
+	}
+	bctbx_mutex_unlock(&node->mutex);
+	return (ssize_t)done;
+}
+
+static ssize_t memoryWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	memory_vfs_handle_t *handle = (memory_vfs_handle_t *)pFile->pUserData;
+	memory_vfs_node_t *node = handle->node;
+	size_t done = 0;
+	int err = 0;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	if (handle->access == O_RDONLY) return -EBADF;
+	bctbx_mutex_lock(&node->mutex);
+	while (done < count) {
+		uint64_t pos = (uint64_t)offset + done;
+		size_t index = (size_t)(pos / MEMORY_VFS_CHUNK_SIZE);
+		size_t in_chunk = (size_t)(pos % MEMORY_VFS_CHUNK_SIZE);
+		size_t n = MIN(count - done, MEMORY_VFS_CHUNK_SIZE - in_chunk);
+		char *chunk = memory_vfs_get_chunk(handle->mvfs, node, index, &err);
+
+		if (chunk == NULL) break;
+		memcpy(chunk + in_chunk, (const char *)buf + done, n);
+		done += n;
+	}
+	if (done > 0) node->size = MAX(node->size, (uint64_t)offset + done);
+	bctbx_mutex_unlock(&node->mutex);
+	if (done == 0 && err) return err;
+	return (ssize_t)done;
+}
+
+static int64_t memoryFileSize(bctbx_vfs_file_t *pFile) {
+	memory_vfs_node_t *node = ((memory_vfs_handle_t *)pFile->pUserData)->node;
+	int64_t ret;
+
+	bctbx_mutex_lock(&node->mutex);
+	ret = (int64_t)node->size;
+	bctbx_mutex_unlock(&node->mutex);
+	return ret;
+}
+
+/**
+ * There is no file descriptor: the position is only computed.
+ */
+static off_t memorySeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
+	off_t base;
+
+	switch (whence) {
+		case SEEK_SET:
+			base = 0;
+			break;
+		case SEEK_CUR:
+			base = pFile->offset;
+			break;
+		case SEEK_END:
+			base = (off_t)memoryFileSize(pFile);
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (base + offset < 0) return -EINVAL;
+	return base + offset;
+}
+
+/**
+ * A region can be mapped if it lies in a single chunk. Its chunk is allocated if it was not.
+ */
+static int memoryMapRegion(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr) {
+	memory_vfs_handle_t *handle = (memory_vfs_handle_t *)pFile->pUserData;
+	memory_vfs_node_t *node = handle->node;
+	size_t in_chunk;
+	char *chunk = NULL;
+	int err = BCTBX_VFS_ERROR;
+
+	if (offset < 0 || handle->access == O_WRONLY) return BCTBX_VFS_ERROR;
+	in_chunk = (size_t)((uint64_t)offset % MEMORY_VFS_CHUNK_SIZE);
+	bctbx_mutex_lock(&node->mutex);
+	if ((uint64_t)offset + count <= node->size && in_chunk + count <= MEMORY_VFS_CHUNK_SIZE) {
+		chunk = memory_vfs_get_chunk(handle->mvfs, node, (size_t)((uint64_t)offset / MEMORY_VFS_CHUNK_SIZE), &err);
+	}
+	bctbx_mutex_unlock(&node->mutex);
+	if (chunk == NULL) return err;
+	*ptr = chunk + in_chunk;
+	return BCTBX_VFS_OK;
+}
+
+/**
+ * The chunks past the new size are released, and the end of the last one is cleared so that it reads as zeros
+ * if the file grows again.
+ */
+static int memoryTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+	memory_vfs_handle_t *handle = (memory_vfs_handle_t *)pFile->pUserData;
+	memory_vfs_node_t *node = handle->node;
+	uint64_t new_size = (uint64_t)size;
+	size_t index = (size_t)(new_size / MEMORY_VFS_CHUNK_SIZE);
+	size_t in_chunk = (size_t)(new_size % MEMORY_VFS_CHUNK_SIZE);
+
+	if (size < 0) return -EINVAL;
+	if (handle->access == O_RDONLY) return -EBADF;
+	bctbx_mutex_lock(&node->mutex);
+	if (new_size < node->size) {
+		if (in_chunk > 0 && index < node->chunk_count && node->chunks[index]) {
+			memset(node->chunks[index] + in_chunk, 0, MEMORY_VFS_CHUNK_SIZE - in_chunk);
+			index++;
+		}
+		memory_vfs_free_chunks(handle->mvfs, node, index);
+	}
+	node->size = new_size;
+	bctbx_mutex_unlock(&node->mutex);
+	return BCTBX_VFS_OK;
+}
+
+static int memorySync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	return BCTBX_VFS_OK;
+}
+
+static int memoryClose(bctbx_vfs_file_t *pFile) {
+	memory_vfs_handle_t *handle = (memory_vfs_handle_t *)pFile->pUserData;
+	memory_vfs_t *mvfs = handle->mvfs;
+	memory_vfs_node_t *node = handle->node;
+	bool_t release;
+
+	bctbx_mutex_lock(&mvfs->mutex);
+	release = --node->open_count == 0 && node->unlinked;
+	bctbx_mutex_unlock(&mvfs->mutex);
+	if (release) memory_vfs_node_free(mvfs, node);
+	bctbx_free(handle);
+	pFile->pUserData = NULL;
+	return BCTBX_VFS_OK;
+}
+
+static const bctbx_io_methods_t memory_io = {
+	memoryClose,                /* pFuncClose */
+	memoryRead,                 /* pFuncRead */
+	memoryWrite,                /* pFuncWrite */
+	memoryFileSize,             /* pFuncFileSize */
+	bctbx_vfs_get_line_from_read, /* pFuncGetLineFromFd */
+	memorySeek,                 /* pFuncSeek */
+	memoryMapRegion,            /* pFuncMapRegion */
+	NULL,                       /* pFuncReadv */
+	NULL,                       /* pFuncWritev */
+	memorySync,                 /* pFuncSync */
+	memoryTruncate,             /* pFuncTruncate */
+};
+
+static int memoryOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	memory_vfs_t *mvfs = (memory_vfs_t *)pVfs;
+	memory_vfs_node_t **slot;
+	memory_vfs_node_t *node;
+	memory_vfs_handle_t *handle;
+	int access = openFlags & (O_RDONLY | O_WRONLY | O_RDWR);
+
+	if (fName == NULL) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&mvfs->mutex);
+	slot = memory_vfs_find(mvfs, fName);
+	node = *slot;
+	if (node && (openFlags & O_CREAT) && (openFlags & O_EXCL)) {
+		bctbx_mutex_unlock(&mvfs->mutex);
+		return -EEXIST;
+	}
+	if (node == NULL) {
+		if ((openFlags & O_CREAT) == 0) {
+			bctbx_mutex_unlock(&mvfs->mutex);
+			return -ENOENT;
+		}
+		node = bctbx_new0(memory_vfs_node_t, 1);
+		node->name = bctbx_strdup(fName);
+		bctbx_mutex_init(&node->mutex, NULL);
+		*slot = node;
+		if (++mvfs->file_count > mvfs->bucket_count) memory_vfs_grow_table(mvfs);
+	}
+	node->open_count++;
+	bctbx_mutex_unlock(&mvfs->mutex);
+
+	if ((openFlags & O_TRUNC) && access != O_RDONLY) {
+		bctbx_mutex_lock(&node->mutex);
+		memory_vfs_free_chunks(mvfs, node, 0);
+		node->size = 0;
+		bctbx_mutex_unlock(&node->mutex);
+	}
+	handle = bctbx_new0(memory_vfs_handle_t, 1);
+	handle->mvfs = mvfs;
+	handle->node = node;
+	handle->access = access;
+	pFile->pUserData = handle;
+	pFile->pMethods = &memory_io;
+	pFile->fd = -1;
+	return BCTBX_VFS_OK;
+}
+
+bctbx_vfs_t *bctbx_vfs_memory_new(uint64_t max_size) {
+	memory_vfs_t *mvfs = bctbx_new0(memory_vfs_t, 1);
+
+	mvfs->vfs.vfsName = "bctbx_memory_vfs";
+	mvfs->vfs.pFuncOpen = memoryOpen;
+	mvfs->vfs.pFuncDelete = bctbx_vfs_memory_unlink;
+	bctbx_mutex_init(&mvfs->mutex, NULL);
+	mvfs->bucket_count = 16;
+	mvfs->buckets = bctbx_new0(memory_vfs_node_t *, mvfs->bucket_count);
+	mvfs->max_size = max_size;
+	return &mvfs->vfs;
+}
+
+int bctbx_vfs_memory_unlink(bctbx_vfs_t *pVfs, const char *fName) {
+	memory_vfs_t *mvfs = (memory_vfs_t *)pVfs;
+	memory_vfs_node_t **slot;
+	memory_vfs_node_t *node;
+	bool_t release;
+
+	if (mvfs == NULL || fName == NULL) return BCTBX_VFS_ERROR;
+	bctbx_mutex_lock(&mvfs->mutex);
+	slot = memory_vfs_find(mvfs, fName);
+	node = *slot;
+	if (node == NULL) {
+		bctbx_mutex_unlock(&mvfs->mutex);
+		return BCTBX_VFS_ERROR;
+	}
+	*slot = node->next;
+	mvfs->file_count--;
+	node->unlinked = TRUE;
+	release = node->open_count == 0;
+	bctbx_mutex_unlock(&mvfs->mutex);
+	/*an open file keeps its content until it is closed*/
+	if (release) memory_vfs_node_free(mvfs, node);
+	return BCTBX_VFS_OK;
+}
+
+void bctbx_vfs_memory_destroy(bctbx_vfs_t *pVfs) {
+	memory_vfs_t *mvfs = (memory_vfs_t *)pVfs;
+	size_t i;
+
+	if (mvfs == NULL) return;
+	for (i = 0; i < mvfs->bucket_count; i++) {
+		memory_vfs_node_t *node = mvfs->buckets[i];
+		while (node) {
+			memory_vfs_node_t *next = node->next;
+			memory_vfs_node_free(mvfs, node);
+			node = next;
+		}
+	}
+	bctbx_free(mvfs->buckets);
+	bctbx_mutex_destroy(&mvfs->mutex);
+	bctbx_free(mvfs);
+}
@@ -0,0 +1,325 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+#include "utils.h"
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/*
+ * The file is opened, written and sized with the standard VFS. Reads are served from a read-only shared mapping of
+ * the file. The mapping extends past the end of the file, at least doubling at each remapping, so that a growing
+ * file is read through the same view until it outgrows it: the view only records how much of it is valid.
+ * The views replaced by a larger one are only unmapped when the file is closed, so that the pointers given by
+ * bctbx_file_map_region() remain valid and readers never need a lock. Thanks to the doubling, there are at most a
+ * few tens of them, using less address space than twice the current one.
+ * On Windows, a read-only mapping cannot extend past the end of the file: each growth read maps a new view.
+ */
+
+#define MMAP_VFS_MAP_ALIGN (64 * 1024)
+
+typedef struct _mmap_vfs_view {
+	struct _mmap_vfs_view *previous;
+	const char *addr;
+	size_t size; /*mapped length*/
+	uint64_t valid; /*length of the file that can be read through the view, at most size. Accessed atomically*/
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+} mmap_vfs_view_t;
+
+typedef struct _mmap_vfs_data {
+	const bctbx_io_methods_t *std; /*methods of the standard VFS, used for everything but reading*/
+	mmap_vfs_view_t *view; /*current view, NULL while the file is empty. Published with release semantics*/
+	bctbx_mutex_t mutex; /*serializes the remapping*/
+} mmap_vfs_data_t;
+
+/*map a view of the file of the given size, made larger than the previous view if there is one*/
+static mmap_vfs_view_t *mmap_vfs_map(bctbx_vfs_file_t *pFile, size_t size, const mmap_vfs_view_t *previous) {
+	mmap_vfs_view_t *view = bctbx_new0(mmap_vfs_view_t, 1);
+#ifdef _WIN32
+	HANDLE file = (HANDLE)_get_osfhandle(pFile->fd);
+	view->mapping = CreateFileMapping(file, NULL, PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+	if (view->mapping != NULL) view->addr = (const char *)MapViewOfFile(view->mapping, FILE_MAP_READ, 0, 0, size);
+	if (view->addr == NULL) {
+		if (view->mapping != NULL) CloseHandle(view->mapping);
+		bctbx_free(view);
+		return NULL;
+	}
+	view->size = size;
+#else
+	size_t capacity = size;
+	void *addr = MAP_FAILED;
+
+	if (previous && previous->size <= ((size_t)-1 - MMAP_VFS_MAP_ALIGN) / 2) capacity = MAX(size, previous->size * 2);
+	if (capacity <= (size_t)-1 - MMAP_VFS_MAP_ALIGN) {
+		capacity = (capacity + MMAP_VFS_MAP_ALIGN - 1) / MMAP_VFS_MAP_ALIGN * MMAP_VFS_MAP_ALIGN;
+		addr = mmap(NULL, capacity, PROT_READ, MAP_SHARED, pFile->fd, 0);
+	}
+	/*short of address space, map the file only*/
+	if (addr == MAP_FAILED) {
+		capacity = size;
+		addr = mmap(NULL, capacity, PROT_READ, MAP_SHARED, pFile->fd, 0);
+	}
+	if (addr == MAP_FAILED) {
+		bctbx_free(view);
+		return NULL;
+	}
+	view->addr = (const char *)addr;
+	view->size = capacity;
+#endif
+	view->valid = size;
+	return view;
+}
+
+static void mmap_vfs_unmap(mmap_vfs_view_t *view) {
+#ifdef _WIN32
+	UnmapViewOfFile(view->addr);
+	CloseHandle(view->mapping);
+#else
+	munmap((void *)view->addr, view->size);
+#endif
+	bctbx_free(view);
+}
+
+/**
+ * Return a view whose valid part covers end bytes of the file, or all of it if the file is shorter. The valid
+ * length must be loaded from the view after this call.
+ * Returns NULL if the file has always been empty or cannot be mapped, with the error in *err.
+ */
+static mmap_vfs_view_t *mmap_vfs_get_view(bctbx_vfs_file_t *pFile, uint64_t end, int *err) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	mmap_vfs_view_t *view = (mmap_vfs_view_t *)bctbx_atomic_load_ptr(&data->view);
+	int64_t size;
+
+	*err = 0;
+	if (view && end <= bctbx_atomic_load64(&view->valid)) return view;
+
+	bctbx_mutex_lock(&data->mutex);
+	view = data->view;
+	size = data->std->pFuncFileSize(pFile);
+	if (size < 0) {
+		*err = (int)size;
+	} else if ((size_t)size != (uint64_t)size) {
+		*err = -EFBIG;
+	} else if (view && (uint64_t)size <= view->size) {
+		/*the file grew within the view, or was truncated*/
+		bctbx_atomic_store64(&view->valid, size);
+	} else if (size > 0) {
+		mmap_vfs_view_t *grown = mmap_vfs_map(pFile, (size_t)size, view);
+		if (grown) {
+			grown->previous = view;
+			bctbx_atomic_store_ptr(&data->view, grown);
+			view = grown;
+		} else {
+			*err = errno ? -errno : BCTBX_VFS_ERROR;
+		}
+	}
+	bctbx_mutex_unlock(&data->mutex);
+	return view;
+}
+
+static ssize_t mmapRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
+	mmap_vfs_view_t *view;
+	uint64_t valid;
+	int err;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	view = mmap_vfs_get_view(pFile, (uint64_t)offset + count, &err);
+	if (err) return err;
+	valid = view ? bctbx_atomic_load64(&view->valid) : 0;
+	if ((uint64_t)offset >= valid) return 0;
+	count = (size_t)MIN((uint64_t)count, valid - (uint64_t)offset);
+	memcpy(buf, view->addr + offset, count);
+	return (ssize_t)count;
+}
+
+static int mmapMapRegion(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr) {
+	mmap_vfs_view_t *view;
+	int err;
+
+	if (offset < 0) return BCTBX_VFS_ERROR;
+	view = mmap_vfs_get_view(pFile, (uint64_t)offset + count, &err);
+	if (err) return err;
+	if (view == NULL || (uint64_t)offset + count > bctbx_atomic_load64(&view->valid)) return BCTBX_VFS_ERROR;
+	*ptr = view->addr + offset;
+	return BCTBX_VFS_OK;
+}
+
+/**
+ * Same behavior as the getline of the standard VFS, but the line is searched directly in the mapping.
+ */
+static int mmapGetLine(bctbx_vfs_file_t *pFile, char *s, int max_len) {
+	mmap_vfs_view_t *view;
+	const char *start;
+	const char *end;
+	uint64_t valid;
+	size_t avail;
+	int err;
+
+	if (s == NULL || max_len < 1 || pFile->offset < 0) return BCTBX_VFS_ERROR;
+	s[0] = '\0';
+	view = mmap_vfs_get_view(pFile, (uint64_t)pFile->offset + (size_t)max_len - 1, &err);
+	if (err) return BCTBX_VFS_ERROR;
+	valid = view ? bctbx_atomic_load64(&view->valid) : 0;
+	if ((uint64_t)pFile->offset >= valid) return 0;
+
+	start = view->addr + pFile->offset;
+	avail = (size_t)MIN((uint64_t)max_len - 1, valid - (uint64_t)pFile->offset);
+	end = (const char *)memchr(start, '\n', avail);
+	if (end) {
+		const char *cr = (const char *)memchr(start, '\r', (size_t)(end - start));
+		size_t len = (size_t)((cr ? cr : end) - start);
+		size_t consumed = len + 1;
+		/*take into account the \r\n case*/
+		if (cr && len + 1 < avail && start[len + 1] == '\n') consumed++;
+		memcpy(s, start, len);
+		s[len] = '\0';
+		pFile->offset += consumed;
+		return (int)consumed;
+	}
+	end = (const char *)memchr(start, '\r', avail);
+	if (end) {
+		size_t len = (size_t)(end - start);
+		memcpy(s, start, len);
+		s[len] = '\0';
+		pFile->offset += len + 1;
+		return (int)len + 1;
+	}
+	/*no end of line found, is EOF?*/
+	memcpy(s, start, avail);
+	s[avail] = '\0';
+	pFile->offset += avail;
+	return (int)avail;
+}
+
+static ssize_t mmapWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	/*the mapping is shared: written data is visible through it, and a growth is mapped on the next read*/
+	return data->std->pFuncWrite(pFile, buf, count, offset);
+}
+
+static ssize_t mmapWritev(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	return data->std->pFuncWritev(pFile, iov, iovcnt, offset);
+}
+
+static int mmapSync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	return data->std->pFuncSync(pFile, data_only);
+}
+
+/**
+ * The current view is kept, only its valid length is reduced. The regions mapped before remain valid up to the new
+ * size.
+ */
+static int mmapTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	int ret;
+
+	bctbx_mutex_lock(&data->mutex);
+	ret = data->std->pFuncTruncate(pFile, size);
+	if (ret == BCTBX_VFS_OK && data->view && (uint64_t)size < bctbx_atomic_load64(&data->view->valid)) {
+		bctbx_atomic_store64(&data->view->valid, size);
+	}
+	bctbx_mutex_unlock(&data->mutex);
+	return ret;
+}
+
+static int64_t mmapFileSize(bctbx_vfs_file_t *pFile) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	return data->std->pFuncFileSize(pFile);
+}
+
+static off_t mmapSeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	return data->std->pFuncSeek(pFile, offset, whence);
+}
+
+static int mmapClose(bctbx_vfs_file_t *pFile) {
+	mmap_vfs_data_t *data = (mmap_vfs_data_t *)pFile->pUserData;
+	mmap_vfs_view_t *view = data->view;
+	int ret;
+
+	while (view) {
+		mmap_vfs_view_t *previous = view->previous;
+		mmap_vfs_unmap(view);
+		view = previous;
+	}
+	pFile->pUserData = NULL;
+	ret = data->std->pFuncClose(pFile);
+	bctbx_mutex_destroy(&data->mutex);
+	bctbx_free(data);
+	return ret;
+}
+
+static const bctbx_io_methods_t mmap_io = {
+	mmapClose,                  /* pFuncClose */
+	mmapRead,                   /* pFuncRead */
+	mmapWrite,                  /* pFuncWrite */
+	mmapFileSize,               /* pFuncFileSize */
+	mmapGetLine,                /* pFuncGetLineFromFd */
+	mmapSeek,                   /* pFuncSeek */
+	mmapMapRegion,              /* pFuncMapRegion */
+	NULL,                       /* pFuncReadv */
+	mmapWritev,                 /* pFuncWritev */
+	mmapSync,                   /* pFuncSync */
+	mmapTruncate,               /* pFuncTruncate */
+};
+
+static int mmapOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	bctbx_vfs_t *std = bctbx_vfs_get_standard();
+	mmap_vfs_data_t *data;
+	int ret;
+
+	ret = std->pFuncOpen(std, pFile, fName, openFlags);
+	if (ret != BCTBX_VFS_OK) return ret;
+	data = bctbx_new0(mmap_vfs_data_t, 1);
+	data->std = pFile->pMethods;
+	bctbx_mutex_init(&data->mutex, NULL);
+	pFile->pUserData = data;
+	pFile->pMethods = &mmap_io;
+	return BCTBX_VFS_OK;
+}
+
+static int mmapRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+	bctbx_vfs_t *std = bctbx_vfs_get_standard();
+	return std->pFuncRename(std, oldName, newName);
+}
+
+static int mmapDelete(bctbx_vfs_t *pVfs, const char *fName) {
+	bctbx_vfs_t *std = bctbx_vfs_get_standard();
+	return std->pFuncDelete(std, fName);
+}
+
+static bctbx_vfs_t mmapVfs = {
+	"bctbx_mmap_vfs",           /* vfsName */
+	mmapOpen,                   /* xOpen */
+	mmapRename,                 /* pFuncRename */
+	mmapDelete,                 /* pFuncDelete */
+};
+
+bctbx_vfs_t *bctbx_vfs_get_mmap(void) {
+	return &mmapVfs;
+}
@@ -0,0 +1,461 @@
+/*
+bctoolbox
+Copyright (C) 2016  Belledonne Communications SARL
+
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "bctoolbox/bc_vfs.h"
+#include "bctoolbox/port.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/*
+ * Each thread updates its own block of counters, found through a thread key, so that counting takes no lock and no
+ * atomic read-modify-write. The blocks are kept in a prepend-only list walked to sum them; the block of a thread
+ * that exited is reused by the next new thread, its counts remaining. A reset records the current sums, which are
+ * subtracted from the following ones.
+ */
+
+typedef struct _stats_vfs_counters {
+	struct _stats_vfs_counters *next; /*immutable once published*/
+	int in_use; /*owned by a running thread, accessed atomically*/
+	bctbx_vfs_op_stats_t ops[1]; /*BCTBX_VFS_OP_COUNT per group of files, written only by the owner thread*/
+} stats_vfs_counters_t;
+
+typedef struct _stats_vfs {
+	bctbx_vfs_t vfs; /*must be first: the VFS given to the callers*/
+	bctbx_vfs_t *wrapped;
+	char **prefixes;
+	int prefix_count; /*the files matching no prefix are in the group prefix_count*/
+	bctbx_mutex_t mutex; /*protects the creation of blocks and the baseline*/
+	stats_vfs_counters_t *counters; /*published with release semantics*/
+	bctbx_vfs_op_stats_t *baseline; /*sums at the last reset, BCTBX_VFS_OP_COUNT per group*/
+#ifdef _WIN32
+	DWORD key;
+#else
+	pthread_key_t key;
+#endif
+} stats_vfs_t;
+
+typedef struct _stats_vfs_file {
+	stats_vfs_t *svfs;
+	bctbx_vfs_file_t *inner; /*the file opened with the wrapped VFS*/
+	int group;
+} stats_vfs_file_t;
+
+static const char *stats_vfs_op_names[BCTBX_VFS_OP_COUNT] = {
+	"open", "close", "read", "write", "file_size", "get_line", "seek", "map_region", "readv", "writev", "sync", "truncate"
+};
+
+static size_t stats_vfs_group_count(const stats_vfs_t *svfs) {
+	return (size_t)svfs->prefix_count + 1;
+}
+
+/*called when a thread exits: its block can be reused by another thread*/
+#ifdef _WIN32
+static void WINAPI stats_vfs_release_counters(void *data) {
+#else
+static void stats_vfs_release_counters(void *data) {
+#endif
+	stats_vfs_counters_t *counters = (stats_vfs_counters_t *)data;
+	if (counters) bctbx_atomic_store_int_release(&counters->in_use, FALSE);
+}
+
+static stats_vfs_counters_t *stats_vfs_get_counters(stats_vfs_t *svfs) {
+	stats_vfs_counters_t *counters;
+
+#ifdef _WIN32
+	counters = (stats_vfs_counters_t *)FlsGetValue(svfs->key);
+#else
+	counters = (stats_vfs_counters_t *)pthread_getspecific(svfs->key);
+#endif
+	if (counters) return counters;
+
+	bctbx_mutex_lock(&svfs->mutex);
+	for (counters = svfs->counters; counters != NULL; counters = counters->next) {
+		if (!bctbx_atomic_load_int_acquire(&counters->in_use)) break;
+	}
+	if (counters == NULL) {
+		counters = (stats_vfs_counters_t *)bctbx_malloc0(sizeof(stats_vfs_counters_t)
+			+ sizeof(bctbx_vfs_op_stats_t) * (stats_vfs_group_count(svfs) * BCTBX_VFS_OP_COUNT - 1));
+		counters->next = svfs->counters;
+		bctbx_atomic_store_ptr(&svfs->counters, counters);
+	}
+	bctbx_atomic_store_int(&counters->in_use, TRUE);
+	bctbx_mutex_unlock(&svfs->mutex);
+#ifdef _WIN32
+	FlsSetValue(svfs->key, counters);
+#else
+	pthread_setspecific(svfs->key, counters);
+#endif
+	return counters;
+}
+
+/*only the owner thread writes a counter: a load and a store are enough for the readers to see whole values*/
+static void stats_vfs_add(uint64_t *counter, uint64_t value) {
+	bctbx_atomic_store64(counter, bctbx_atomic_load64(counter) + value);
+}
+
+static void stats_vfs_record(stats_vfs_t *svfs, int group, bctbx_vfs_op_t op, uint64_t start, bool_t error, uint64_t bytes) {
+	stats_vfs_counters_t *counters;
+	bctbx_vfs_op_stats_t *c;
+	uint64_t end = bctbx_get_monotonic_ns();
+	uint64_t ns, rest;
+	int bucket = 0;
+
+	/*the counters of some processors are not synchronized: an operation moved to another one may seem to go back*/
+	ns = end > start ? end - start : 0;
+	for (rest = ns >> 1; rest != 0 && bucket < BCTBX_VFS_LATENCY_BUCKETS - 1; rest >>= 1) bucket++;
+
+	counters = stats_vfs_get_counters(svfs);
+	c = &counters->ops[(size_t)group * BCTBX_VFS_OP_COUNT + op];
+	stats_vfs_add(&c->calls, 1);
+	if (error) stats_vfs_add(&c->errors, 1);
+	if (bytes) stats_vfs_add(&c->bytes, bytes);
+	stats_vfs_add(&c->total_ns, ns);
+	stats_vfs_add(&c->latency[bucket], 1);
+}
+
+static void stats_vfs_op_add(bctbx_vfs_op_stats_t *to, const bctbx_vfs_op_stats_t *from) {
+	int i;
+
+	to->calls += bctbx_atomic_load64(&from->calls);
+	to->errors += bctbx_atomic_load64(&from->errors);
+	to->bytes += bctbx_atomic_load64(&from->bytes);
+	to->total_ns += bctbx_atomic_load64(&from->total_ns);
+	for (i = 0; i < BCTBX_VFS_LATENCY_BUCKETS; i++) to->latency[i] += bctbx_atomic_load64(&from->latency[i]);
+}
+
+static void stats_vfs_op_sub(bctbx_vfs_op_stats_t *to, const bctbx_vfs_op_stats_t *from) {
+	int i;
+
+	to->calls -= from->calls;
+	to->errors -= from->errors;
+	to->bytes -= from->bytes;
+	to->total_ns -= from->total_ns;
+	for (i = 0; i < BCTBX_VFS_LATENCY_BUCKETS; i++) to->latency[i] -= from->latency[i];
+}
+
+/*sum the blocks of all the threads into sums, BCTBX_VFS_OP_COUNT per group, called with the VFS mutex held*/
+static void stats_vfs_sum(stats_vfs_t *svfs, bctbx_vfs_op_stats_t *sums) {
+	size_t count = stats_vfs_group_count(svfs) * BCTBX_VFS_OP_COUNT;
+	stats_vfs_counters_t *counters;
+	size_t i;
+
+	memset(sums, 0, count * sizeof(bctbx_vfs_op_stats_t));
+	for (counters = svfs->counters; counters != NULL; counters = counters->next) {
+		for (i = 0; i < count; i++) stats_vfs_op_add(&sums[i], &counters->ops[i]);
+	}
+}
+
+static int statsClose(bctbx_vfs_file_t *pFile) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int ret;
+
+	start = bctbx_get_monotonic_ns();
+	ret = sf->inner->pMethods->pFuncClose(sf->inner);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_CLOSE, start, ret < 0, 0);
+	bctbx_free(sf->inner);
+	bctbx_free(sf);
+	pFile->pUserData = NULL;
+	return ret;
+}
+
+static ssize_t statsRead(bctbx_vfs_file_t *pFile, void *buf, size_t count, off_t offset) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	ssize_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	ret = sf->inner->pMethods->pFuncRead(sf->inner, buf, count, offset);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_READ, start, ret < 0, ret > 0 ? (uint64_t)ret : 0);
+	return ret;
+}
+
+static ssize_t statsWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	ssize_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	ret = sf->inner->pMethods->pFuncWrite(sf->inner, buf, count, offset);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_WRITE, start, ret < 0, ret > 0 ? (uint64_t)ret : 0);
+	return ret;
+}
+
+static int64_t statsFileSize(bctbx_vfs_file_t *pFile) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int64_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	ret = sf->inner->pMethods->pFuncFileSize(sf->inner);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_FILE_SIZE, start, ret < 0, 0);
+	return ret;
+}
+
+/**
+ * The position is kept in the offset of the handle given to the callers: it is passed to the wrapped file.
+ */
+static int statsGetLine(bctbx_vfs_file_t *pFile, char *s, int max_len) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int ret;
+
+	start = bctbx_get_monotonic_ns();
+	sf->inner->offset = pFile->offset;
+	ret = sf->inner->pMethods->pFuncGetLineFromFd(sf->inner, s, max_len);
+	pFile->offset = sf->inner->offset;
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_GET_LINE, start, ret < 0, ret > 0 ? (uint64_t)ret : 0);
+	return ret;
+}
+
+static off_t statsSeek(bctbx_vfs_file_t *pFile, off_t offset, int whence) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	off_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	sf->inner->offset = pFile->offset;
+	ret = sf->inner->pMethods->pFuncSeek(sf->inner, offset, whence);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_SEEK, start, ret < 0, 0);
+	return ret;
+}
+
+static int statsMapRegion(bctbx_vfs_file_t *pFile, off_t offset, size_t count, const void **ptr) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int ret = BCTBX_VFS_ERROR;
+
+	start = bctbx_get_monotonic_ns();
+	if (sf->inner->pMethods->pFuncMapRegion) ret = sf->inner->pMethods->pFuncMapRegion(sf->inner, offset, count, ptr);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_MAP_REGION, start, ret < 0, 0);
+	return ret;
+}
+
+/*the wrapped VFS may not provide vectored I/O: bctbx_file_readv() and bctbx_file_writev() emulate it*/
+static ssize_t statsReadv(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	ssize_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	if (sf->inner->pMethods->pFuncReadv) ret = sf->inner->pMethods->pFuncReadv(sf->inner, iov, iovcnt, offset);
+	else ret = bctbx_file_readv(sf->inner, iov, iovcnt, offset);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_READV, start, ret < 0, ret > 0 ? (uint64_t)ret : 0);
+	return ret;
+}
+
+static ssize_t statsWritev(bctbx_vfs_file_t *pFile, const bctbx_iovec_t *iov, int iovcnt, off_t offset) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	ssize_t ret;
+
+	start = bctbx_get_monotonic_ns();
+	if (sf->inner->pMethods->pFuncWritev) ret = sf->inner->pMethods->pFuncWritev(sf->inner, iov, iovcnt, offset);
+	else ret = bctbx_file_writev(sf->inner, iov, iovcnt, offset);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_WRITEV, start, ret < 0, ret > 0 ? (uint64_t)ret : 0);
+	return ret;
+}
+
+static int statsSync(bctbx_vfs_file_t *pFile, bool_t data_only) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int ret = BCTBX_VFS_ERROR;
+
+	start = bctbx_get_monotonic_ns();
+	if (sf->inner->pMethods->pFuncSync) ret = sf->inner->pMethods->pFuncSync(sf->inner, data_only);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_SYNC, start, ret < 0, 0);
+	return ret;
+}
+
+static int statsTruncate(bctbx_vfs_file_t *pFile, off_t size) {
+	stats_vfs_file_t *sf = (stats_vfs_file_t *)pFile->pUserData;
+	uint64_t start;
+	int ret = BCTBX_VFS_ERROR;
+
+	start = bctbx_get_monotonic_ns();
+	if (sf->inner->pMethods->pFuncTruncate) ret = sf->inner->pMethods->pFuncTruncate(sf->inner, size);
+	stats_vfs_record(sf->svfs, sf->group, BCTBX_VFS_OP_TRUNCATE, start, ret < 0, 0);
+	return ret;
+}
+
+static const bctbx_io_methods_t stats_io = {
+	statsClose,                 /* pFuncClose */
+	statsRead,                  /* pFuncRead */
+	statsWrite,                 /* pFuncWrite */
+	statsFileSize,              /* pFuncFileSize */
+	statsGetLine,               /* pFuncGetLineFromFd */
+	statsSeek,                  /* pFuncSeek */
+	statsMapRegion,             /* pFuncMapRegion */
+	statsReadv,                 /* pFuncReadv */
+	statsWritev,                /* pFuncWritev */
+	statsSync,                  /* pFuncSync */
+	statsTruncate,              /* pFuncTruncate */
+};
+
+/*the group of the longest prefix matching the path*/
+static int stats_vfs_group_of(const stats_vfs_t *svfs, const char *fName) {
+	int group = svfs->prefix_count;
+	size_t best = 0;
+	int i;
+
+	if (fName == NULL) return group;
+	for (i = 0; i < svfs->prefix_count; i++) {
+		size_t len = strlen(svfs->prefixes[i]);
+		if (len >= best && strncmp(fName, svfs->prefixes[i], len) == 0) {
+			group = i;
+			best = len;
+		}
+	}
+	return group;
+}
+
+static int statsOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	stats_vfs_t *svfs = (stats_vfs_t *)pVfs;
+	bctbx_vfs_file_t *inner = bctbx_new0(bctbx_vfs_file_t, 1);
+	int group = stats_vfs_group_of(svfs, fName);
+	stats_vfs_file_t *sf;
+	uint64_t start;
+	int ret;
+
+	start = bctbx_get_monotonic_ns();
+	ret = svfs->wrapped->pFuncOpen(svfs->wrapped, inner, fName, openFlags);
+	stats_vfs_record(svfs, group, BCTBX_VFS_OP_OPEN, start, ret != BCTBX_VFS_OK, 0);
+	if (ret != BCTBX_VFS_OK) {
+		bctbx_free(inner);
+		return ret;
+	}
+	sf = bctbx_new0(stats_vfs_file_t, 1);
+	sf->svfs = svfs;
+	sf->inner = inner;
+	sf->group = group;
+	pFile->pUserData = sf;
+	pFile->pMethods = &stats_io;
+	pFile->fd = inner->fd;
+	return BCTBX_VFS_OK;
+}
+
+/*the renames and deletions are not counted: they are forwarded to the wrapped VFS*/
+static int statsRename(bctbx_vfs_t *pVfs, const char *oldName, const char *newName) {
+	stats_vfs_t *svfs = (stats_vfs_t *)pVfs;
+	if (svfs->wrapped->pFuncRename == NULL) return BCTBX_VFS_ERROR;
+	return svfs->wrapped->pFuncRename(svfs->wrapped, oldName, newName);
+}
+
+static int statsDelete(bctbx_vfs_t *pVfs, const char *fName) {
+	stats_vfs_t *svfs = (stats_vfs_t *)pVfs;
+	if (svfs->wrapped->pFuncDelete == NULL) return BCTBX_VFS_ERROR;
+	return svfs->wrapped->pFuncDelete(svfs->wrapped, fName);
+}
+
+bctbx_vfs_t *bctbx_vfs_stats_new(bctbx_vfs_t *wrapped, const char *const *prefixes, int prefix_count) {
+	stats_vfs_t *svfs;
+	int i;
+
+	if (wrapped == NULL || prefix_count < 0 || (prefix_count > 0 && prefixes == NULL)) return NULL;
+	svfs = bctbx_new0(stats_vfs_t, 1);
+#ifdef _WIN32
+	svfs->key = FlsAlloc(stats_vfs_release_counters);
+	if (svfs->key == FLS_OUT_OF_INDEXES) {
+#else
+	if (pthread_key_create(&svfs->key, stats_vfs_release_counters) != 0) {
+#endif
+		bctbx_free(svfs);
+		return NULL;
+	}
+	svfs->vfs.vfsName = "bctbx_stats_vfs";
+	svfs->vfs.pFuncOpen = statsOpen;
+	svfs->vfs.pFuncRename = statsRename;
+	svfs->vfs.pFuncDelete = statsDelete;
+	svfs->wrapped = wrapped;
+	svfs->prefix_count = prefix_count;
+	if (prefix_count > 0) svfs->prefixes = bctbx_new0(char *, (size_t)prefix_count);
+	for (i = 0; i < prefix_count; i++) svfs->prefixes[i] = bctbx_strdup(prefixes[i]);
+	svfs->baseline = bctbx_new0(bctbx_vfs_op_stats_t, stats_vfs_group_count(svfs) * BCTBX_VFS_OP_COUNT);
+	bctbx_mutex_init(&svfs->mutex, NULL);
+	return &svfs->vfs;
+}
+
+void bctbx_vfs_stats_destroy(bctbx_vfs_t *vfs) {
+	stats_vfs_t *svfs = (stats_vfs_t *)vfs;
+	stats_vfs_counters_t *counters;
+	int i;
+
+	if (svfs == NULL) return;
+#ifdef _WIN32
+	FlsFree(svfs->key);
+#else
+	pthread_key_delete(svfs->key);
+#endif
+	counters = svfs->counters;
+	while (counters) {
+		stats_vfs_counters_t *next = counters->next;
+		bctbx_free(counters);
+		counters = next;
+	}
+	for (i = 0; i < svfs->prefix_count; i++) bctbx_free(svfs->prefixes[i]);
+	if (svfs->prefixes) bctbx_free(svfs->prefixes);
+	bctbx_free(svfs->baseline);
+	bctbx_mutex_destroy(&svfs->mutex);
+	bctbx_free(svfs);
+}
+
+int bctbx_vfs_stats_get(bctbx_vfs_t *vfs, const char *prefix, bctbx_vfs_stats_t *stats) {
+	stats_vfs_t *svfs = (stats_vfs_t *)vfs;
+	size_t group_count = stats_vfs_group_count(svfs);
+	bctbx_vfs_op_stats_t *sums;
+	int first = 0, last = (int)group_count - 1;
+	int group, op;
+
+	if (prefix) {
+		for (first = 0; first < svfs->prefix_count && strcmp(svfs->prefixes[first], prefix) != 0; first++);
+		if (first == svfs->prefix_count) return BCTBX_VFS_ERROR;
+		last = first;
+	}
+	sums = bctbx_new(bctbx_vfs_op_stats_t, group_count * BCTBX_VFS_OP_COUNT);
+	memset(stats, 0, sizeof(*stats));
+	bctbx_mutex_lock(&svfs->mutex);
+	stats_vfs_sum(svfs, sums);
+	for (group = first; group <= last; group++) {
+		for (op = 0; op < BCTBX_VFS_OP_COUNT; op++) {
+			size_t i = (size_t)group * BCTBX_VFS_OP_COUNT + (size_t)op;
+			stats_vfs_op_sub(&sums[i], &svfs->baseline[i]);
+			stats_vfs_op_add(&stats->ops[op], &sums[i]);
+		}
+	}
+	bctbx_mutex_unlock(&svfs->mutex);
+	bctbx_free(sums);
+	return BCTBX_VFS_OK;
+}
+
+void bctbx_vfs_stats_reset(bctbx_vfs_t *vfs) {
+	stats_vfs_t *svfs = (stats_vfs_t *)vfs;
+
+	bctbx_mutex_lock(&svfs->mutex);
+	stats_vfs_sum(svfs, svfs->baseline);
+	bctbx_mutex_unlock(&svfs->mutex);
+}
+
+const char *bctbx_vfs_op_name(bctbx_vfs_op_t op) {
+	if ((int)op < 0 || op >= BCTBX_VFS_OP_COUNT) return "unknown";
+	return stats_vfs_op_names[op];
+}
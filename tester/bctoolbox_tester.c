@@ -44,6 +44,10 @@ static void log_handler(int lev, const char *fmt, va_list args) {
 void bctoolbox_tester_init(void(*ftester_printf)(int level, const char *fmt, va_list args)) {
 	bc_tester_init(log_handler,BCTBX_LOG_ERROR, 0,NULL);
 	bc_tester_add_suite(&containers_test_suite);
+	bc_tester_add_suite(&logging_test_suite);
+	bc_tester_add_suite(&log_stream_test_suite);
+	bc_tester_add_suite(&log_min_level_test_suite);
+	bc_tester_add_suite(&vfs_test_suite);
 }
 
 void bctoolbox_tester_uninit(void) {
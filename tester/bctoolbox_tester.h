@@ -33,6 +33,10 @@ extern "C" {
 #endif
 
 extern test_suite_t containers_test_suite;
+extern test_suite_t logging_test_suite;
+extern test_suite_t log_stream_test_suite;
+extern test_suite_t log_min_level_test_suite;
+extern test_suite_t vfs_test_suite;
 
 #ifdef __cplusplus
 };
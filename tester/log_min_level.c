@@ -0,0 +1,92 @@
+/*
+	bctoolbox
+    Copyright (C) 2016  Belledonne Communications SARL
+
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*this file is compiled with -DBCTBX_LOG_MIN_LEVEL=BCTBX_LOG_WARNING, see CMakeLists.txt*/
+#ifndef BCTBX_LOG_MIN_LEVEL
+#error "log_min_level.c must be compiled with BCTBX_LOG_MIN_LEVEL defined"
+#endif
+
+#define BCTBX_LOG_DOMAIN "bctoolbox-tester-min-level"
+#include "bctoolbox_tester.h"
+#include "bctoolbox/logging.h"
+
+static int captured_count = 0;
+static char captured[256];
+
+static void capture_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	vsnprintf(captured, sizeof(captured), fmt, args);
+	captured_count++;
+}
+
+static BctoolboxLogFunc saved_handler;
+static unsigned int saved_mask;
+
+static int min_level_init(void) {
+	saved_handler = bctbx_get_log_handler();
+	saved_mask = bctbx_get_log_level_mask(BCTBX_LOG_DOMAIN);
+	bctbx_set_log_handler(capture_handler);
+	/*the levels below BCTBX_LOG_MIN_LEVEL are enabled at run time, but not compiled in*/
+	bctbx_set_log_level(BCTBX_LOG_DOMAIN, BCTBX_LOG_DEBUG);
+	return 0;
+}
+
+static int min_level_cleanup(void) {
+	bctbx_set_log_level_mask(BCTBX_LOG_DOMAIN, (int)saved_mask);
+	bctbx_set_log_handler(saved_handler);
+	return 0;
+}
+
+static void arguments_not_evaluated(void) {
+	int evaluated = 0;
+
+	captured_count = 0;
+	bctbx_debug("debug %i", evaluated++);
+	bctbx_message("message %i", evaluated++);
+	BC_ASSERT_EQUAL(evaluated, 0, int, "%i");
+	BC_ASSERT_EQUAL(captured_count, 0, int, "%i");
+
+	bctbx_warning("warning %i", evaluated++);
+	bctbx_error("error %i", evaluated++);
+	BC_ASSERT_EQUAL(evaluated, 2, int, "%i");
+	BC_ASSERT_EQUAL(captured_count, 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured, "error 1");
+}
+
+static void functions_still_available(void) {
+	void (*message)(const char *fmt, ...) = bctbx_message;
+
+	captured_count = 0;
+	/*neither a call through a pointer nor a call with a parenthesized name is removed*/
+	message("through a pointer %i", 1);
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured, "through a pointer 1");
+	(bctbx_message)("parenthesized %i", 2);
+	BC_ASSERT_EQUAL(captured_count, 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured, "parenthesized 2");
+	bctbx_log(BCTBX_LOG_DOMAIN, BCTBX_LOG_MESSAGE, "not removed %i", 3);
+	BC_ASSERT_EQUAL(captured_count, 3, int, "%i");
+}
+
+static test_t min_level_tests[] = {
+	TEST_NO_TAG("Arguments not evaluated", arguments_not_evaluated),
+	TEST_NO_TAG("Functions still available", functions_still_available),
+};
+
+test_suite_t log_min_level_test_suite = {"Log minimum level", min_level_init, min_level_cleanup, NULL, NULL,
+							   sizeof(min_level_tests) / sizeof(min_level_tests[0]), min_level_tests};
@@ -0,0 +1,268 @@
+/*
+	bctoolbox
+    Copyright (C) 2016  Belledonne Communications SARL
+
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bctoolbox_tester.h"
+#include "bctoolbox/logging.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char *stream_domain = "bctoolbox-tester-log-stream";
+static std::string captured;
+static int captured_count = 0;
+
+static void capture_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	char buf[4096];
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	captured = buf;
+	captured_count++;
+}
+
+static BctoolboxLogFunc saved_handler;
+static unsigned int saved_mask;
+
+static int log_stream_init(void) {
+	saved_handler = bctbx_get_log_handler();
+	saved_mask = bctbx_get_log_level_mask(stream_domain);
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(stream_domain, BCTBX_LOG_MESSAGE);
+	return 0;
+}
+
+static int log_stream_cleanup(void) {
+	bctbx_set_log_level_mask(stream_domain, (int)saved_mask);
+	bctbx_set_log_handler(saved_handler);
+	return 0;
+}
+
+static void short_line(void) {
+	captured_count = 0;
+	BCTBX_SLOGI(stream_domain) << "value " << 42 << ' ' << 1.5;
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured.c_str(), "value 42 1.5");
+	/*disabled level: nothing is formatted nor output*/
+	BCTBX_SLOGD(stream_domain) << "not output";
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+}
+
+static void full_buffer(void) {
+	/*511 characters fill the fixed buffer, which keeps one byte for the terminating null character*/
+	std::string line(511, 'a');
+
+	BCTBX_SLOGI(stream_domain) << line;
+	BC_ASSERT_EQUAL((int)captured.size(), 511, int, "%i");
+	BC_ASSERT_TRUE(captured == line);
+
+	/*the same, character by character*/
+	{
+		pumpstream stream(stream_domain, BCTBX_LOG_MESSAGE);
+		for (size_t i = 0; i < line.size(); i++) stream << 'a';
+	}
+	BC_ASSERT_TRUE(captured == line);
+}
+
+static void spilled_buffer(void) {
+	std::string expected;
+	std::string part(100, 'b');
+
+	/*one character beyond the buffer goes through overflow()*/
+	expected.assign(511, 'a');
+	expected.push_back('z');
+	{
+		pumpstream stream(stream_domain, BCTBX_LOG_MESSAGE);
+		for (size_t i = 0; i < 511; i++) stream << 'a';
+		stream << 'z';
+	}
+	BC_ASSERT_TRUE(captured == expected);
+
+	/*writes that do not fit in what remains of the buffer go through xsputn(), before and after the spill*/
+	expected.clear();
+	{
+		pumpstream stream(stream_domain, BCTBX_LOG_MESSAGE);
+		for (int i = 0; i < 12; i++) {
+			char num[16];
+			snprintf(num, sizeof(num), "%i", i);
+			stream << part << i;
+			expected += part + num;
+		}
+	}
+	BC_ASSERT_EQUAL((int)captured.size(), (int)expected.size(), int, "%i");
+	BC_ASSERT_TRUE(captured == expected);
+}
+
+struct NestedLog {};
+
+static std::ostream &operator<<(std::ostream &os, const NestedLog &) {
+	BCTBX_SLOGI(stream_domain) << "nested";
+	return os << "outer";
+}
+
+static void nested_statement(void) {
+	std::string long_part(600, 'c');
+
+	captured_count = 0;
+	BCTBX_SLOGI(stream_domain) << "before " << NestedLog() << " after";
+	BC_ASSERT_EQUAL(captured_count, 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured.c_str(), "before outer after");
+	/*the nested statement does not disturb a stream that spilled over*/
+	BCTBX_SLOGI(stream_domain) << long_part << NestedLog();
+	BC_ASSERT_TRUE(captured == long_part + "outer");
+}
+
+static void string_domain(void) {
+	std::string domain(stream_domain);
+
+	captured_count = 0;
+	BCTBX_SLOGI(domain) << "with a std::string domain";
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured.c_str(), "with a std::string domain");
+	BCTBX_SLOGD(domain) << "not output";
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+}
+
+/*
+ * Members of a JSON object without nesting, as written by the JSON sink: strings are unescaped, other values are
+ * kept as written. Returns false if the line is not such an object.
+ */
+static bool parse_json_line(const std::string &line, std::map<std::string, std::string> &members) {
+	size_t i = 0;
+
+	if (line.empty() || line[i++] != '{') return false;
+	while (i < line.size() && line[i] != '}') {
+		std::string key, value;
+		bool quoted;
+
+		if (!members.empty()) {
+			if (line[i++] != ',') return false;
+		}
+		for (int part = 0; part < 2; part++) {
+			std::string &out = part == 0 ? key : value;
+			quoted = line[i] == '"';
+			if (quoted) {
+				for (i++; i < line.size() && line[i] != '"'; i++) {
+					char c = line[i];
+					if (c == '\\') {
+						c = line[++i];
+						if (c == 'n') c = '\n';
+						else if (c == 't') c = '\t';
+						else if (c == 'r') c = '\r';
+						else if (c == 'u') {
+							c = (char)strtol(line.substr(i + 1, 4).c_str(), NULL, 16);
+							i += 4;
+						}
+					}
+					out.push_back(c);
+				}
+				if (i++ == line.size()) return false;
+			} else {
+				while (i < line.size() && line[i] != ',' && line[i] != '}') out.push_back(line[i++]);
+			}
+			if (part == 0 && (!quoted || line[i++] != ':')) return false;
+		}
+		members[key] = value;
+	}
+	return i == line.size() - 1;
+}
+
+static void structured_log_builder(void) {
+	char *path = bc_tester_file("kvlog.log");
+	bctbx_log_file_sink_t *file_sink;
+	bctbx_log_sink_t *json_sink;
+	std::map<std::string, std::string> members;
+	std::vector<std::string> lines, keys;
+	std::string line;
+	std::string reason("line\nbreak \"quoted\"");
+
+	std::remove(path);
+	file_sink = bctbx_log_file_sink_new(path, 0, NULL);
+	BC_ASSERT_PTR_NOT_NULL(file_sink);
+	if (file_sink == NULL) {
+		bc_free(path);
+		return;
+	}
+	json_sink = bctbx_log_json_sink_new(file_sink);
+	bctbx_log_add_sink(json_sink);
+
+	bctoolbox::log::kvlog(stream_domain, BCTBX_LOG_WARNING, "call ended")
+		("duration", 2.5)("count", -42)("big", 18446744073709551615ULL)("small", -9223372036854775807LL)
+		("ok", true)("reason", reason)("tab", "a\tb");
+	/*disabled level: no field is stored and nothing is output*/
+	bctoolbox::log::kvlog(stream_domain, BCTBX_LOG_DEBUG, "filtered")("a", 1);
+	/*the keys must outlive the builder*/
+	for (int i = 0; i < BCTBX_LOG_KV_MAX_FIELDS + 8; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "k%i", i);
+		keys.push_back(key);
+	}
+	{
+		/*the fields beyond the limit are ignored*/
+		bctoolbox::log::kvlog many(stream_domain, BCTBX_LOG_MESSAGE, "many");
+		for (size_t i = 0; i < keys.size(); i++) many(keys[i].c_str(), (int)i);
+	}
+	bctbx_log_file_sink_flush(file_sink);
+
+	{
+		std::ifstream in(path);
+		while (std::getline(in, line)) lines.push_back(line);
+	}
+	BC_ASSERT_EQUAL((int)lines.size(), 2, int, "%i");
+	if (lines.size() != 2) goto end;
+	BC_ASSERT_TRUE(parse_json_line(lines[0], members));
+	BC_ASSERT_STRING_EQUAL(members["level"].c_str(), "warning");
+	BC_ASSERT_STRING_EQUAL(members["domain"].c_str(), stream_domain);
+	BC_ASSERT_STRING_EQUAL(members["msg"].c_str(), "call ended");
+	BC_ASSERT_STRING_EQUAL(members["duration"].c_str(), "2.5");
+	BC_ASSERT_STRING_EQUAL(members["count"].c_str(), "-42");
+	BC_ASSERT_STRING_EQUAL(members["big"].c_str(), "18446744073709551615");
+	BC_ASSERT_STRING_EQUAL(members["small"].c_str(), "-9223372036854775807");
+	BC_ASSERT_STRING_EQUAL(members["ok"].c_str(), "true");
+	BC_ASSERT_TRUE(members["reason"] == reason);
+	BC_ASSERT_STRING_EQUAL(members["tab"].c_str(), "a\tb");
+	BC_ASSERT_TRUE(members.count("ts") == 1 && atoll(members["ts"].c_str()) > 0);
+	BC_ASSERT_EQUAL((int)members.size(), 11, int, "%i");
+
+	members.clear();
+	BC_ASSERT_TRUE(parse_json_line(lines[1], members));
+	BC_ASSERT_STRING_EQUAL(members["msg"].c_str(), "many");
+	/*"ts", "level", "domain", "msg" and the fields up to the limit*/
+	BC_ASSERT_EQUAL((int)members.size(), 4 + BCTBX_LOG_KV_MAX_FIELDS, int, "%i");
+	BC_ASSERT_EQUAL((int)members.count(keys[BCTBX_LOG_KV_MAX_FIELDS - 1]), 1, int, "%i");
+	BC_ASSERT_EQUAL((int)members.count(keys[BCTBX_LOG_KV_MAX_FIELDS]), 0, int, "%i");
+
+end:
+	bctbx_log_sink_destroy(json_sink);
+	bctbx_log_file_sink_destroy(file_sink);
+	std::remove(path);
+	bc_free(path);
+}
+
+static test_t log_stream_tests[] = {
+	TEST_NO_TAG("Short line", short_line),
+	TEST_NO_TAG("Full buffer", full_buffer),
+	TEST_NO_TAG("Spilled buffer", spilled_buffer),
+	TEST_NO_TAG("Nested statement", nested_statement),
+	TEST_NO_TAG("String domain", string_domain),
+	TEST_NO_TAG("Structured log builder", structured_log_builder),
+};
+
+test_suite_t log_stream_test_suite = {"Log stream", log_stream_init, log_stream_cleanup, NULL, NULL,
+							   sizeof(log_stream_tests) / sizeof(log_stream_tests[0]), log_stream_tests};
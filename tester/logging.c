@@ -0,0 +1,846 @@
+/*
+	bctoolbox
+	Copyright (C) 2016  Belledonne Communications SARL
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bctoolbox_tester.h"
+#include "bctoolbox/logging.h"
+#include "bctoolbox/bc_vfs.h"
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+static const char *test_domain = "bctoolbox-tester-logging";
+
+/*read a whole file into a newly allocated null terminated string*/
+static char *read_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	char *content;
+	long size;
+
+	if (f == NULL) return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	content = bctbx_malloc(size + 1);
+	content[fread(content, 1, size, f)] = '\0';
+	fclose(f);
+	return content;
+}
+
+/*size of a file, -1 if it does not exist*/
+static long file_size(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) return -1;
+	return (long)st.st_size;
+}
+
+static void file_sink_buffering(void) {
+	char *path = bc_tester_file("file_sink.log");
+	bctbx_log_flush_policy_t policy = {BCTBX_LOG_ERROR, 0};
+	bctbx_log_file_sink_t *sink;
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	char *content;
+
+	unlink(path);
+	sink = bctbx_log_file_sink_new(path, 4096, &policy);
+	BC_ASSERT_PTR_NOT_NULL(sink);
+	if (sink == NULL) goto end;
+	bctbx_set_log_file_sink(sink);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+
+	bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "buffered %i", 1);
+	/*nothing must have reached the file yet*/
+	content = read_file(path);
+	BC_ASSERT_PTR_NOT_NULL(content);
+	if (content) {
+		BC_ASSERT_EQUAL((int)strlen(content), 0, int, "%i");
+		bctbx_free(content);
+	}
+
+	/*an error is in the flush policy: the whole buffer is written*/
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "flushed %i", 2);
+	content = read_file(path);
+	BC_ASSERT_PTR_NOT_NULL(content);
+	if (content) {
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "bctoolbox-tester-logging-message-buffered 1"));
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "bctoolbox-tester-logging-error-flushed 2"));
+		bctbx_free(content);
+	}
+
+	/*explicit flush*/
+	bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "explicit %i", 3);
+	BC_ASSERT_EQUAL(bctbx_log_file_sink_flush(sink), 0, int, "%i");
+	content = read_file(path);
+	if (content) {
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "explicit 3"));
+		bctbx_free(content);
+	}
+
+	bctbx_log_file_sink_destroy(sink);
+	BC_ASSERT_PTR_NOT_EQUAL((void*)bctbx_get_log_handler(), NULL);
+end:
+	bctbx_set_log_level_mask(test_domain, mask);
+	unlink(path);
+	bc_free(path);
+}
+
+static void file_sink_rotation(void) {
+	char *path = bc_tester_file("file_sink_rotation.log");
+	char *rotated1 = bctbx_strdup_printf("%s.1", path);
+	char *rotated2 = bctbx_strdup_printf("%s.2", path);
+	char *rotated3 = bctbx_strdup_printf("%s.3", path);
+	bctbx_log_flush_policy_t policy = {BCTBX_LOG_MESSAGE, 0};
+	bctbx_log_rotation_policy_t rotation = {100, 0, 2};
+	bctbx_log_file_sink_t *sink;
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	int i, j;
+
+	unlink(path);
+	unlink(rotated1);
+	unlink(rotated2);
+	unlink(rotated3);
+	sink = bctbx_log_file_sink_new(path, 0, &policy);
+	BC_ASSERT_PTR_NOT_NULL(sink);
+	if (sink == NULL) goto end;
+	BC_ASSERT_EQUAL(bctbx_log_file_sink_set_rotation(sink, &rotation), 0, int, "%i");
+	bctbx_set_log_file_sink(sink);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+
+	for (i = 0; i < 4; i++) {
+		/*each line is larger than the maximum size, hence triggers a rotation*/
+		bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "line %i to be rotated, long enough to exceed the maximum size of the log file", i);
+		/*rotation is asynchronous: wait for the fresh file*/
+		for (j = 0; j < 100 && file_size(path) != 0; j++) bctbx_sleep_ms(10);
+		BC_ASSERT_EQUAL(file_size(path), 0, long, "%li");
+		BC_ASSERT_EQUAL(bctbx_file_exist(rotated1), 0, int, "%i");
+	}
+	BC_ASSERT_EQUAL(bctbx_file_exist(rotated2), 0, int, "%i");
+	/*only keep_count rotated files are kept*/
+	BC_ASSERT_NOT_EQUAL(bctbx_file_exist(rotated3), 0, int, "%i");
+
+	bctbx_log_file_sink_destroy(sink);
+end:
+	bctbx_set_log_level_mask(test_domain, mask);
+	unlink(path);
+	unlink(rotated1);
+	unlink(rotated2);
+	bctbx_free(rotated1);
+	bctbx_free(rotated2);
+	bctbx_free(rotated3);
+	bc_free(path);
+}
+
+static void file_sink_rotation_refused(void) {
+	bctbx_vfs_t *memory = bctbx_vfs_memory_new(0);
+	bctbx_vfs_t *previous = bctbx_vfs_get_default();
+	bctbx_log_rotation_policy_t rotation = {100, 0, 2};
+	bctbx_log_file_sink_t *sink;
+
+	/*the memory VFS cannot rename the files*/
+	bctbx_vfs_set_default(memory);
+	sink = bctbx_log_file_sink_new("file_sink_rotation_refused.log", 0, NULL);
+	bctbx_vfs_set_default(previous);
+	BC_ASSERT_PTR_NOT_NULL(sink);
+	if (sink) {
+		BC_ASSERT_EQUAL(bctbx_log_file_sink_set_rotation(sink, &rotation), -1, int, "%i");
+		BC_ASSERT_EQUAL(bctbx_log_file_sink_rotate(sink), -1, int, "%i");
+		BC_ASSERT_EQUAL(bctbx_log_file_sink_set_rotation(sink, NULL), 0, int, "%i");
+		bctbx_log_file_sink_destroy(sink);
+	}
+	bctbx_vfs_memory_destroy(memory);
+}
+
+static int captured_count = 0;
+static char captured_last[256];
+
+static void capture_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	captured_count++;
+	vsnprintf(captured_last, sizeof(captured_last), fmt, args);
+}
+
+static void rate_limit(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	int i;
+
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+	captured_count = 0;
+
+	bctbx_set_log_rate_limit(test_domain, 1, 5);
+	for (i = 0; i < 100; i++) bctbx_log(test_domain, BCTBX_LOG_WARNING, "flood %i", i);
+	BC_ASSERT_EQUAL(captured_count, 5, int, "%i");
+	/*after a refill the next message goes through, preceded by the report*/
+	bctbx_sleep_ms(1100);
+	captured_count = 0;
+	bctbx_log(test_domain, BCTBX_LOG_WARNING, "after flood");
+	BC_ASSERT_EQUAL(captured_count, 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured_last, "after flood");
+	bctbx_set_log_rate_limit(test_domain, 0, 0);
+
+	captured_count = 0;
+	bctbx_set_log_sampling(test_domain, 10);
+	for (i = 0; i < 100; i++) bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "sampled %i", i);
+	/*10 messages and 9 reports*/
+	BC_ASSERT_EQUAL(captured_count, 19, int, "%i");
+	bctbx_set_log_sampling(test_domain, 0);
+
+	captured_count = 0;
+	for (i = 0; i < 10; i++) bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "not limited %i", i);
+	BC_ASSERT_EQUAL(captured_count, 10, int, "%i");
+
+	bctbx_set_log_handler(handler);
+	bctbx_set_log_level_mask(test_domain, mask);
+}
+
+static void coalescing(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	int i;
+
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+	bctbx_set_log_coalescing_window(10000);
+	captured_count = 0;
+
+	for (i = 0; i < 50; i++) bctbx_log(test_domain, BCTBX_LOG_WARNING, "same %s", "message");
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured_last, "same message");
+	/*a different level breaks the run*/
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "same %s", "message");
+	BC_ASSERT_EQUAL(captured_count, 3, int, "%i");
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "same %s", "message");
+	BC_ASSERT_EQUAL(captured_count, 3, int, "%i");
+	bctbx_log_coalescing_flush();
+	BC_ASSERT_EQUAL(captured_count, 4, int, "%i");
+	BC_ASSERT_STRING_EQUAL(captured_last, "last message repeated 1 time");
+
+	bctbx_set_log_coalescing_window(0);
+	captured_count = 0;
+	for (i = 0; i < 5; i++) bctbx_log(test_domain, BCTBX_LOG_WARNING, "same %s", "message");
+	BC_ASSERT_EQUAL(captured_count, 5, int, "%i");
+
+	bctbx_set_log_handler(handler);
+	bctbx_set_log_level_mask(test_domain, mask);
+}
+
+typedef struct {
+	int count;
+	char last[256];
+	bctbx_mutex_t lock;
+} sink_capture_t;
+
+static void capture_sink(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, size_t len) {
+	sink_capture_t *capture = (sink_capture_t *)user_data;
+	bctbx_mutex_lock(&capture->lock);
+	capture->count++;
+	snprintf(capture->last, sizeof(capture->last), "%.*s", (int)len, msg);
+	bctbx_mutex_unlock(&capture->lock);
+}
+
+static int sink_capture_count(sink_capture_t *capture) {
+	int count;
+	bctbx_mutex_lock(&capture->lock);
+	count = capture->count;
+	bctbx_mutex_unlock(&capture->lock);
+	return count;
+}
+
+static void multiple_sinks(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	sink_capture_t all, errors, async;
+	bctbx_log_sink_t *all_sink, *errors_sink, *async_sink;
+	int i;
+
+	memset(&all, 0, sizeof(all));
+	memset(&errors, 0, sizeof(errors));
+	memset(&async, 0, sizeof(async));
+	bctbx_mutex_init(&all.lock, NULL);
+	bctbx_mutex_init(&errors.lock, NULL);
+	bctbx_mutex_init(&async.lock, NULL);
+
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+	captured_count = 0;
+
+	all_sink = bctbx_log_sink_new(capture_sink, &all);
+	bctbx_log_sink_set_domain(all_sink, test_domain);
+	errors_sink = bctbx_log_sink_new(capture_sink, &errors);
+	bctbx_log_sink_set_level_mask(errors_sink, BCTBX_LOG_ERROR);
+	async_sink = bctbx_log_sink_new(capture_sink, &async);
+	bctbx_log_sink_set_domain(async_sink, test_domain);
+	bctbx_log_sink_set_async(async_sink, 100);
+	bctbx_log_add_sink(all_sink);
+	bctbx_log_add_sink(errors_sink);
+	bctbx_log_add_sink(async_sink);
+
+	bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "to all %i", 1);
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "to errors %i", 2);
+	/*filtered by the domain mask: no sink receives it*/
+	bctbx_log(test_domain, BCTBX_LOG_DEBUG, "filtered");
+	BC_ASSERT_EQUAL(captured_count, 2, int, "%i");
+	BC_ASSERT_EQUAL(all.count, 2, int, "%i");
+	BC_ASSERT_EQUAL(errors.count, 1, int, "%i");
+	BC_ASSERT_STRING_EQUAL(errors.last, "to errors 2");
+
+	/*removed sinks receive nothing more*/
+	bctbx_log_remove_sink(all_sink);
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "after removal");
+	BC_ASSERT_EQUAL(all.count, 2, int, "%i");
+	BC_ASSERT_EQUAL(errors.count, 2, int, "%i");
+
+	/*the asynchronous sink gets everything once drained*/
+	for (i = 0; i < 50 && sink_capture_count(&async) < 3; i++) bctbx_sleep_ms(10);
+	BC_ASSERT_EQUAL(sink_capture_count(&async), 3, int, "%i");
+	bctbx_log_sink_destroy(async_sink);
+	BC_ASSERT_STRING_EQUAL(async.last, "after removal");
+	BC_ASSERT_EQUAL(bctbx_log_sink_get_dropped(errors_sink), 0, unsigned int, "%u");
+
+	bctbx_log_sink_destroy(all_sink);
+	bctbx_log_sink_destroy(errors_sink);
+	bctbx_mutex_destroy(&all.lock);
+	bctbx_mutex_destroy(&errors.lock);
+	bctbx_mutex_destroy(&async.lock);
+	bctbx_set_log_handler(handler);
+	bctbx_set_log_level_mask(test_domain, mask);
+}
+
+static void structured_logging(void) {
+	char *path = bc_tester_file("json_sink.log");
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	bctbx_log_file_sink_t *file_sink;
+	bctbx_log_sink_t *json_sink;
+	char *content;
+
+	unlink(path);
+	file_sink = bctbx_log_file_sink_new(path, 0, NULL);
+	BC_ASSERT_PTR_NOT_NULL(file_sink);
+	if (file_sink == NULL) goto end;
+	json_sink = bctbx_log_json_sink_new(file_sink);
+	bctbx_log_add_sink(json_sink);
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+
+	bctbx_log_kv(test_domain, BCTBX_LOG_WARNING, "call \"ended\"",
+		"duration", BCTBX_LOG_KV_DOUBLE, 2.5,
+		"count", BCTBX_LOG_KV_INT, -42,
+		"bytes", BCTBX_LOG_KV_UINT64, (uint64_t)18446744073709551615ULL,
+		"ok", BCTBX_LOG_KV_BOOL, TRUE,
+		"reason", BCTBX_LOG_KV_STRING, "line\nbreak",
+		NULL);
+	BC_ASSERT_STRING_EQUAL(captured_last, "call \"ended\" duration=2.5 count=-42 bytes=18446744073709551615 ok=true reason=line\nbreak");
+	bctbx_log(test_domain, BCTBX_LOG_MESSAGE, "plain %i", 1);
+	/*filtered by the level mask*/
+	bctbx_log_kv(test_domain, BCTBX_LOG_DEBUG, "filtered", "a", BCTBX_LOG_KV_INT, 1, NULL);
+	bctbx_log_file_sink_flush(file_sink);
+
+	content = read_file(path);
+	BC_ASSERT_PTR_NOT_NULL(content);
+	if (content) {
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "\"level\":\"warning\",\"domain\":\"bctoolbox-tester-logging\",\"msg\":\"call \\\"ended\\\"\",\"duration\":2.5,\"count\":-42,\"bytes\":18446744073709551615,\"ok\":true,\"reason\":\"line\\nbreak\"}\n"));
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "\"level\":\"message\",\"domain\":\"bctoolbox-tester-logging\",\"msg\":\"plain 1\"}\n"));
+		BC_ASSERT_PTR_NULL(strstr(content, "filtered"));
+		bctbx_free(content);
+	}
+
+	bctbx_log_sink_destroy(json_sink);
+	bctbx_log_file_sink_destroy(file_sink);
+	bctbx_set_log_handler(handler);
+end:
+	bctbx_set_log_level_mask(test_domain, mask);
+	unlink(path);
+	bc_free(path);
+}
+
+static const bctbx_log_level_stats_t *find_level_stats(const bctbx_log_domain_stats_t *stats, size_t count, const char *domain, BctbxLogLevel level) {
+	size_t i;
+	int index = 0;
+	while ((1 << index) != level) index++;
+	for (i = 0; i < count; i++) {
+		if (stats[i].domain && strcmp(stats[i].domain, domain) == 0) return &stats[i].levels[index];
+	}
+	return NULL;
+}
+
+static void statistics(void) {
+	char *path = bc_tester_file("stats.log");
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	bctbx_log_file_sink_t *sink;
+	bctbx_log_domain_stats_t *stats;
+	const bctbx_log_level_stats_t *level_stats;
+	size_t count;
+	int i;
+
+	unlink(path);
+	sink = bctbx_log_file_sink_new(path, 0, NULL);
+	BC_ASSERT_PTR_NOT_NULL(sink);
+	if (sink == NULL) goto end;
+	bctbx_set_log_file_sink(sink);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_MESSAGE);
+	bctbx_log_reset_stats();
+
+	for (i = 0; i < 3; i++) bctbx_log(test_domain, BCTBX_LOG_WARNING, "counted %i", i);
+	for (i = 0; i < 2; i++) bctbx_log(test_domain, BCTBX_LOG_DEBUG, "filtered %i", i);
+	bctbx_set_log_sampling(test_domain, 2);
+	for (i = 0; i < 4; i++) bctbx_log(test_domain, BCTBX_LOG_ERROR, "sampled %i", i);
+	bctbx_set_log_sampling(test_domain, 0);
+
+	stats = bctbx_log_get_stats(&count);
+	BC_ASSERT_TRUE(count >= 2);
+	BC_ASSERT_PTR_NULL(stats[0].domain);
+	level_stats = find_level_stats(stats, count, test_domain, BCTBX_LOG_WARNING);
+	BC_ASSERT_PTR_NOT_NULL(level_stats);
+	if (level_stats) {
+		BC_ASSERT_EQUAL((int)level_stats->emitted, 3, int, "%i");
+		BC_ASSERT_EQUAL((int)level_stats->filtered, 0, int, "%i");
+		/*"xxxx-xx-xx xx:xx:xx:xxx bctoolbox-tester-logging-warning-counted 0\n" and so on*/
+		BC_ASSERT_EQUAL((int)level_stats->bytes, 3 * (24 + (int)strlen(test_domain) + 9 + 9 + 1), int, "%i");
+	}
+	level_stats = find_level_stats(stats, count, test_domain, BCTBX_LOG_DEBUG);
+	BC_ASSERT_PTR_NOT_NULL(level_stats);
+	if (level_stats) {
+		BC_ASSERT_EQUAL((int)level_stats->emitted, 0, int, "%i");
+		BC_ASSERT_EQUAL((int)level_stats->filtered, 2, int, "%i");
+	}
+	level_stats = find_level_stats(stats, count, test_domain, BCTBX_LOG_ERROR);
+	BC_ASSERT_PTR_NOT_NULL(level_stats);
+	if (level_stats) {
+		/*2 sampled messages, and a report of the suppressed ones after the first*/
+		BC_ASSERT_EQUAL((int)level_stats->emitted, 2, int, "%i");
+		BC_ASSERT_EQUAL((int)level_stats->dropped, 2, int, "%i");
+	}
+	bctbx_log_stats_free(stats, count);
+
+	bctbx_log_reset_stats();
+	stats = bctbx_log_get_stats(&count);
+	level_stats = find_level_stats(stats, count, test_domain, BCTBX_LOG_WARNING);
+	if (level_stats) BC_ASSERT_EQUAL((int)level_stats->emitted, 0, int, "%i");
+	bctbx_log_stats_free(stats, count);
+
+	bctbx_log_file_sink_destroy(sink);
+end:
+	bctbx_set_log_level_mask(test_domain, mask);
+	unlink(path);
+	bc_free(path);
+}
+
+static void null_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+}
+
+static void logging_stats_limit(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	const bctbx_log_level_stats_t *level_stats;
+	bctbx_log_domain_stats_t *stats;
+	char domain[64];
+	size_t count;
+	int i;
+
+	bctbx_set_log_handler(null_handler);
+	bctbx_log_reset_stats();
+	for (i = 0; i < BCTBX_LOG_STATS_MAX_DOMAINS + 10; i++) {
+		snprintf(domain, sizeof(domain), "bctoolbox-tester-stats-%i", i);
+		bctbx_log(domain, BCTBX_LOG_ERROR, "counted");
+	}
+	stats = bctbx_log_get_stats(&count);
+	/*the messages without domain, the domains up to the limit and the others*/
+	BC_ASSERT_EQUAL((int)count, BCTBX_LOG_STATS_MAX_DOMAINS + 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(stats[count - 1].domain, BCTBX_LOG_STATS_OTHER_DOMAINS);
+	level_stats = find_level_stats(stats, count, BCTBX_LOG_STATS_OTHER_DOMAINS, BCTBX_LOG_ERROR);
+	BC_ASSERT_PTR_NOT_NULL(level_stats);
+	if (level_stats) BC_ASSERT_TRUE(level_stats->emitted >= 10);
+	bctbx_log_stats_free(stats, count);
+	bctbx_set_log_handler(handler);
+}
+
+static bctbx_log_sink_t *self_destroyed_sink = NULL;
+
+/*run by the thread of the sink, which logs then drops the last reference on its own sink*/
+static void self_destroying_sink(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, size_t len) {
+	sink_capture_t *capture = (sink_capture_t *)user_data;
+	bctbx_log_sink_t *sink = self_destroyed_sink;
+
+	if (sink == NULL) return;
+	self_destroyed_sink = NULL;
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "logged by the sink thread");
+	bctbx_log_sink_destroy(sink);
+	capture_sink(capture, domain, lev, msg, len);
+}
+
+static void sink_destroyed_by_its_thread(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	sink_capture_t capture;
+	bctbx_log_sink_t *sink;
+	int i;
+
+	memset(&capture, 0, sizeof(capture));
+	bctbx_mutex_init(&capture.lock, NULL);
+	bctbx_set_log_handler(null_handler);
+	sink = bctbx_log_sink_new(self_destroying_sink, &capture);
+	bctbx_log_sink_set_domain(sink, test_domain);
+	bctbx_log_sink_set_async(sink, 10);
+	self_destroyed_sink = sink;
+	bctbx_log_add_sink(sink);
+
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "destroy the sink");
+	/*the thread cannot join itself: it frees the sink when it exits*/
+	for (i = 0; i < 100 && sink_capture_count(&capture) < 1; i++) bctbx_sleep_ms(10);
+	BC_ASSERT_EQUAL(sink_capture_count(&capture), 1, int, "%i");
+	bctbx_sleep_ms(50);
+	/*the sink is no longer registered*/
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "after destruction");
+	BC_ASSERT_EQUAL(sink_capture_count(&capture), 1, int, "%i");
+	bctbx_mutex_destroy(&capture.lock);
+	bctbx_set_log_handler(handler);
+}
+
+static void *concurrent_logger(void *data) {
+	int id = *(int *)data;
+	char domain[64];
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		snprintf(domain, sizeof(domain), "bctoolbox-tester-concurrent-%i", i % 20);
+		if (i % 4 == id) bctbx_set_log_level(domain, (i % 20) < 10 ? BCTBX_LOG_DEBUG : BCTBX_LOG_ERROR);
+		bctbx_log(domain, BCTBX_LOG_MESSAGE, "thread %i message %i", id, i);
+	}
+	return NULL;
+}
+
+static void concurrent_configuration(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	bctbx_thread_t threads[4];
+	int ids[4];
+	char domain[64];
+	int i;
+
+	bctbx_set_log_handler(null_handler);
+	for (i = 0; i < 4; i++) {
+		ids[i] = i;
+		bctbx_thread_create(&threads[i], NULL, concurrent_logger, &ids[i]);
+	}
+	for (i = 0; i < 4; i++) bctbx_thread_join(threads[i], NULL);
+	bctbx_set_log_handler(handler);
+
+	/*every domain was created once and holds the last mask set*/
+	for (i = 0; i < 20; i++) {
+		snprintf(domain, sizeof(domain), "bctoolbox-tester-concurrent-%i", i);
+		BC_ASSERT_EQUAL(bctbx_log_level_enabled(domain, BCTBX_LOG_DEBUG) != 0, i < 10, int, "%i");
+		BC_ASSERT_TRUE(bctbx_log_level_enabled(domain, BCTBX_LOG_ERROR) != 0);
+	}
+}
+
+static void *flight_recorder_thread(void *data) {
+	bctbx_log(test_domain, BCTBX_LOG_DEBUG, "from thread %i", 2);
+	return NULL;
+}
+
+static void flight_recorder(void) {
+	char *path = bc_tester_file("flight_recorder.log");
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(test_domain);
+	bctbx_thread_t thread;
+	char *content;
+	int i;
+
+	unlink(path);
+	bctbx_set_log_handler(capture_handler);
+	bctbx_set_log_level(test_domain, BCTBX_LOG_WARNING);
+	captured_count = 0;
+	BC_ASSERT_FALSE(bctbx_log_level_enabled(test_domain, BCTBX_LOG_DEBUG));
+	bctbx_log_flight_recorder_enable(16 * 1024, NULL);
+	BC_ASSERT_TRUE(bctbx_log_flight_recorder_enabled());
+	/*all the levels are recorded, without changing the level mask*/
+	BC_ASSERT_TRUE(bctbx_log_level_enabled(test_domain, BCTBX_LOG_DEBUG));
+	BC_ASSERT_EQUAL(bctbx_get_log_level_mask(test_domain) & BCTBX_LOG_DEBUG, 0, unsigned int, "%u");
+
+	bctbx_log(test_domain, BCTBX_LOG_DEBUG, "overwritten %i", 1);
+	/*the ring wraps: only the most recent messages are kept*/
+	for (i = 0; i < 200; i++) bctbx_log(test_domain, BCTBX_LOG_DEBUG, "wrapping %i", i);
+	bctbx_thread_create(&thread, NULL, flight_recorder_thread, NULL);
+	bctbx_thread_join(thread, NULL);
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "recorded and output %i", 3);
+	BC_ASSERT_EQUAL(captured_count, 1, int, "%i");
+
+	BC_ASSERT_TRUE(bctbx_log_flight_recorder_dump(path) > 0);
+	content = read_file(path);
+	BC_ASSERT_PTR_NOT_NULL(content);
+	if (content) {
+		char *other_thread = strstr(content, "bctoolbox-tester-logging-debug-from thread 2\n");
+		char *last_wrapping = strstr(content, "bctoolbox-tester-logging-debug-wrapping 199\n");
+		BC_ASSERT_PTR_NULL(strstr(content, "overwritten 1"));
+		BC_ASSERT_PTR_NULL(strstr(content, "wrapping 0\n"));
+		BC_ASSERT_PTR_NOT_NULL(last_wrapping);
+		BC_ASSERT_PTR_NOT_NULL(other_thread);
+		/*messages of all threads are merged in order*/
+		if (last_wrapping && other_thread) BC_ASSERT_TRUE(last_wrapping < other_thread);
+		if (other_thread) BC_ASSERT_PTR_NOT_NULL(strstr(other_thread, "bctoolbox-tester-logging-error-recorded and output 3\n"));
+		bctbx_free(content);
+	}
+
+	bctbx_log_flight_recorder_enable(0, NULL);
+	BC_ASSERT_FALSE(bctbx_log_flight_recorder_enabled());
+	BC_ASSERT_FALSE(bctbx_log_level_enabled(test_domain, BCTBX_LOG_DEBUG));
+	bctbx_set_log_handler(handler);
+	bctbx_set_log_level_mask(test_domain, mask);
+	unlink(path);
+	bc_free(path);
+}
+
+#ifndef _WIN32
+static void null_sink(void *user_data, const char *domain, BctbxLogLevel lev, const char *msg, size_t len) {
+}
+
+static void log_after_dump(void *user_data) {
+	bctbx_log(test_domain, BCTBX_LOG_ERROR, "logged after the fatal dump");
+}
+
+static void flight_recorder_fatal(void) {
+	char *path = bc_tester_file("flight_recorder_fatal.log");
+	char *content;
+	pid_t pid;
+	int status = 0;
+
+	unlink(path);
+	/*a fatal message aborts the process: it is logged by a child*/
+	pid = fork();
+	if (pid == 0) {
+		struct rlimit no_core = {0, 0};
+		bctbx_log_sink_t *sink;
+
+		setrlimit(RLIMIT_CORE, &no_core);
+		bctbx_set_log_handler(null_handler);
+		bctbx_log_flight_recorder_enable(16 * 1024, path);
+		bctbx_log_flight_recorder_install_signal_handlers();
+		/*the flush function of a sink runs after the dump of the fatal message, before abort()*/
+		sink = bctbx_log_sink_new(null_sink, NULL);
+		bctbx_log_sink_set_flush_func(sink, log_after_dump);
+		bctbx_log_add_sink(sink);
+		bctbx_log(test_domain, BCTBX_LOG_ERROR, "before the fatal message");
+		bctbx_log(test_domain, BCTBX_LOG_FATAL, "fatal message");
+		_exit(0);
+	}
+	BC_ASSERT_TRUE(pid > 0);
+	if (pid > 0) {
+		waitpid(pid, &status, 0);
+		BC_ASSERT_TRUE(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+	}
+	content = read_file(path);
+	BC_ASSERT_PTR_NOT_NULL(content);
+	if (content) {
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "before the fatal message\n"));
+		BC_ASSERT_PTR_NOT_NULL(strstr(content, "fatal message\n"));
+		/*the handler of the SIGABRT raised by abort() did not dump again over the first dump*/
+		BC_ASSERT_PTR_NULL(strstr(content, "logged after the fatal dump"));
+		bctbx_free(content);
+	}
+	unlink(path);
+	bc_free(path);
+}
+#endif
+
+static const char *intern_results[4][50];
+
+static void *intern_thread(void *data) {
+	int id = *(int *)data;
+	char str[64];
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		snprintf(str, sizeof(str), "bctoolbox-tester-intern-%i", i);
+		intern_results[id][i] = bctbx_intern(str);
+	}
+	return NULL;
+}
+
+static const char *interned_handler_domain = NULL;
+
+static void interned_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	interned_handler_domain = domain;
+}
+
+static void interning(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	bctbx_thread_t threads[4];
+	int ids[4];
+	char copy[64];
+	const char *interned;
+	int i;
+
+	BC_ASSERT_PTR_NULL(bctbx_intern_lookup("bctoolbox-tester-never-interned"));
+	BC_ASSERT_PTR_NULL(bctbx_intern(NULL));
+	interned = bctbx_intern("bctoolbox-tester-interned");
+	snprintf(copy, sizeof(copy), "%s", "bctoolbox-tester-interned");
+	BC_ASSERT_PTR_EQUAL(bctbx_intern(copy), interned);
+	BC_ASSERT_PTR_EQUAL(bctbx_intern_lookup(copy), interned);
+	BC_ASSERT_PTR_EQUAL(bctbx_intern(interned), interned);
+	BC_ASSERT_STRING_EQUAL(interned, "bctoolbox-tester-interned");
+
+	/*concurrent insertions of the same strings yield a single copy of each*/
+	for (i = 0; i < 4; i++) {
+		ids[i] = i;
+		bctbx_thread_create(&threads[i], NULL, intern_thread, &ids[i]);
+	}
+	for (i = 0; i < 4; i++) bctbx_thread_join(threads[i], NULL);
+	for (i = 0; i < 50; i++) {
+		snprintf(copy, sizeof(copy), "bctoolbox-tester-intern-%i", i);
+		BC_ASSERT_PTR_EQUAL(intern_results[0][i], bctbx_intern_lookup(copy));
+		BC_ASSERT_PTR_EQUAL(intern_results[1][i], intern_results[0][i]);
+		BC_ASSERT_PTR_EQUAL(intern_results[2][i], intern_results[0][i]);
+		BC_ASSERT_PTR_EQUAL(intern_results[3][i], intern_results[0][i]);
+	}
+
+	/*the handler is given the interned domain, whatever the buffer the caller used*/
+	bctbx_set_log_handler(interned_handler);
+	snprintf(copy, sizeof(copy), "%s", test_domain);
+	bctbx_log(copy, BCTBX_LOG_ERROR, "interned domain");
+	BC_ASSERT_PTR_EQUAL(interned_handler_domain, bctbx_intern_lookup(test_domain));
+	bctbx_set_log_handler(handler);
+}
+
+static void hierarchical_domains(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	unsigned int mask = bctbx_get_log_level_mask(NULL);
+
+	bctbx_set_log_handler(null_handler);
+	/*created before the levels are set on its parent*/
+	bctbx_log("bctoolbox-tester-tree.sip.transport", BCTBX_LOG_DEBUG, "created");
+	bctbx_set_log_level("bctoolbox-tester-tree.sip", BCTBX_LOG_DEBUG);
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-tree.sip.transport", BCTBX_LOG_DEBUG));
+	/*created after, or never created*/
+	bctbx_log("bctoolbox-tester-tree.sip.dialog", BCTBX_LOG_DEBUG, "created");
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-tree.sip.dialog", BCTBX_LOG_DEBUG));
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-tree.sip.never.logged", BCTBX_LOG_DEBUG));
+	/*checking the levels does not create the domain*/
+	BC_ASSERT_PTR_NULL(bctbx_intern_lookup("bctoolbox-tester-tree.sip.never.logged"));
+	/*siblings and prefixes that are not a whole component are not affected*/
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree.rtp", BCTBX_LOG_DEBUG));
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree.sipx", BCTBX_LOG_DEBUG));
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree", BCTBX_LOG_DEBUG));
+
+	/*the levels of a domain take precedence over the ones of its parents*/
+	bctbx_set_log_level("bctoolbox-tester-tree.sip.transport", BCTBX_LOG_ERROR);
+	bctbx_set_log_level("bctoolbox-tester-tree", BCTBX_LOG_MESSAGE);
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree.sip.transport", BCTBX_LOG_WARNING));
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-tree.sip.dialog", BCTBX_LOG_DEBUG));
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-tree.rtp", BCTBX_LOG_MESSAGE));
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree.rtp", BCTBX_LOG_DEBUG));
+
+	/*the default levels apply to the domains without levels in their hierarchy*/
+	bctbx_log("bctoolbox-tester-other.sip", BCTBX_LOG_DEBUG, "created");
+	bctbx_set_log_level_mask(NULL, BCTBX_LOG_DEBUG | BCTBX_LOG_ERROR | BCTBX_LOG_FATAL);
+	BC_ASSERT_TRUE(bctbx_log_level_enabled("bctoolbox-tester-other.sip", BCTBX_LOG_DEBUG));
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-tree.rtp", BCTBX_LOG_DEBUG));
+	bctbx_set_log_level_mask(NULL, (int)mask);
+	BC_ASSERT_FALSE(bctbx_log_level_enabled("bctoolbox-tester-other.sip", BCTBX_LOG_DEBUG));
+	bctbx_set_log_handler(handler);
+}
+
+static int log_thread_last[4];
+static bool_t log_thread_in_order;
+
+static void log_thread_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	char msg[64];
+	int id, i;
+
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	if (sscanf(msg, "thread %i message %i 100%%", &id, &i) != 2 || id < 0 || id >= 4) return;
+	captured_count++;
+	/*the messages of a thread are output in the order they were logged*/
+	if (i != log_thread_last[id] + 1) log_thread_in_order = FALSE;
+	log_thread_last[id] = i;
+}
+
+static void *log_thread_producer(void *data) {
+	int id = *(int *)data;
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		bctbx_log(test_domain, BCTBX_LOG_ERROR, "thread %i message %i 100%%", id, i);
+		/*the producers flush too, concurrently with the log thread*/
+		if (i % 50 == 49) bctbx_logv_flush();
+	}
+	return NULL;
+}
+
+static void log_thread(void) {
+	BctoolboxLogFunc handler = bctbx_get_log_handler();
+	bctbx_thread_t threads[4];
+	int ids[4];
+	int i;
+
+	bctbx_set_log_handler(log_thread_handler);
+	bctbx_set_log_thread_id(bctbx_thread_self());
+	captured_count = 0;
+	log_thread_in_order = TRUE;
+	for (i = 0; i < 4; i++) {
+		ids[i] = i;
+		log_thread_last[i] = -1;
+		bctbx_thread_create(&threads[i], NULL, log_thread_producer, &ids[i]);
+	}
+	/*flush while the producers are running, then once they are done*/
+	for (i = 0; i < 10; i++) {
+		bctbx_logv_flush();
+		bctbx_sleep_ms(1);
+	}
+	for (i = 0; i < 4; i++) bctbx_thread_join(threads[i], NULL);
+	bctbx_logv_flush();
+	BC_ASSERT_EQUAL(captured_count, 2000, int, "%i");
+	BC_ASSERT_TRUE(log_thread_in_order);
+	for (i = 0; i < 4; i++) BC_ASSERT_EQUAL(log_thread_last[i], 499, int, "%i");
+
+	/*nothing is left to flush, and the buffers are reused*/
+	captured_count = 0;
+	bctbx_logv_flush();
+	BC_ASSERT_EQUAL(captured_count, 0, int, "%i");
+	ids[0] = 0;
+	log_thread_last[0] = -1;
+	bctbx_thread_create(&threads[0], NULL, log_thread_producer, &ids[0]);
+	bctbx_thread_join(threads[0], NULL);
+	bctbx_set_log_thread_id(0);
+	BC_ASSERT_EQUAL(captured_count, 500, int, "%i");
+	BC_ASSERT_TRUE(log_thread_in_order);
+	bctbx_set_log_handler(handler);
+}
+
+static test_t logging_tests[] = {
+	TEST_NO_TAG("File sink buffering", file_sink_buffering),
+	TEST_NO_TAG("File sink rotation", file_sink_rotation),
+	TEST_NO_TAG("File sink rotation refused", file_sink_rotation_refused),
+	TEST_NO_TAG("Rate limit", rate_limit),
+	TEST_NO_TAG("Coalescing", coalescing),
+	TEST_NO_TAG("Multiple sinks", multiple_sinks),
+	TEST_NO_TAG("Sink destroyed by its thread", sink_destroyed_by_its_thread),
+	TEST_NO_TAG("Structured logging", structured_logging),
+	TEST_NO_TAG("Statistics", statistics),
+	TEST_NO_TAG("Statistics limit", logging_stats_limit),
+	TEST_NO_TAG("Concurrent configuration", concurrent_configuration),
+	TEST_NO_TAG("Flight recorder", flight_recorder),
+#ifndef _WIN32
+	TEST_NO_TAG("Flight recorder fatal dump", flight_recorder_fatal),
+#endif
+	TEST_NO_TAG("Interning", interning),
+	TEST_NO_TAG("Hierarchical domains", hierarchical_domains),
+	TEST_NO_TAG("Log thread", log_thread),
+};
+
+test_suite_t logging_test_suite = {"Logging", NULL, NULL, NULL, NULL,
+							   sizeof(logging_tests) / sizeof(logging_tests[0]), logging_tests};
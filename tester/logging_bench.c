@@ -0,0 +1,231 @@
+/*
+	bctoolbox
+	Copyright (C) 2016  Belledonne Communications SARL
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Logging throughput benchmark.
+ * Every configuration (log thread mode or not, disabled or enabled domain, number of threads) is run once and
+ * reported as a JSON object on its own line of the standard output:
+ * {"mode":"direct","domain":"enabled","threads":4,"messages":80000,"seconds":0.0123,"msgs_per_sec":6504065,
+ *  "p50_ns":310,"p99_ns":1200,"allocs_per_msg":0.000}
+ * The latency of a call includes the reading of the clock. Allocations are the ones made through bctbx_malloc()
+ * and bctbx_realloc(), the message being formatted by the handler into a stack buffer so that no I/O is measured.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "bctoolbox/logging.h"
+#include "bctoolbox/port.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#define bench_atomic_inc(ptr) InterlockedIncrement64((volatile LONGLONG *)(ptr))
+#else
+#define bench_atomic_inc(ptr) __atomic_fetch_add((ptr), 1, __ATOMIC_RELAXED)
+#endif
+
+static const char *bench_enabled_domain = "bctoolbox-bench.enabled";
+static const char *bench_disabled_domain = "bctoolbox-bench.disabled";
+
+static int64_t bench_allocs = 0;
+
+static void *bench_malloc(size_t sz) {
+	bench_atomic_inc(&bench_allocs);
+	return malloc(sz);
+}
+
+static void *bench_realloc(void *ptr, size_t sz) {
+	bench_atomic_inc(&bench_allocs);
+	return realloc(ptr, sz);
+}
+
+static void bench_free(void *ptr) {
+	free(ptr);
+}
+
+static void bench_handler(const char *domain, BctbxLogLevel lev, const char *fmt, va_list args) {
+	char buf[256];
+	vsnprintf(buf, sizeof(buf), fmt, args);
+}
+
+typedef struct _bench_config {
+	bool_t log_thread; /*output through the thread given to bctbx_set_log_thread_id()*/
+	const char *domain;
+	int threads;
+	int messages; /*per thread*/
+} bench_config_t;
+
+typedef struct _bench_thread {
+	const bench_config_t *config;
+	int id;
+	uint64_t *latencies; /*in ns, one per message*/
+} bench_thread_t;
+
+/*the producers start together, and the log thread stops flushing once they are all finished*/
+static bctbx_mutex_t bench_mutex;
+static bctbx_cond_t bench_cond;
+static bool_t bench_started;
+static int bench_finished;
+
+static uint64_t bench_time_ns(void) {
+	return bctbx_get_monotonic_ns();
+}
+
+static void *bench_producer(void *data) {
+	bench_thread_t *t = (bench_thread_t *)data;
+	int i;
+
+	bctbx_mutex_lock(&bench_mutex);
+	while (!bench_started) bctbx_cond_wait(&bench_cond, &bench_mutex);
+	bctbx_mutex_unlock(&bench_mutex);
+
+	for (i = 0; i < t->config->messages; i++) {
+		uint64_t start = bench_time_ns();
+		bctbx_log(t->config->domain, BCTBX_LOG_MESSAGE, "bench thread %i message %i payload %s", t->id, i, "0123456789abcdef");
+		t->latencies[i] = bench_time_ns() - start;
+	}
+
+	bctbx_mutex_lock(&bench_mutex);
+	bench_finished++;
+	bctbx_mutex_unlock(&bench_mutex);
+	return NULL;
+}
+
+static int bench_compare_latencies(const void *a, const void *b) {
+	uint64_t la = *(const uint64_t *)a;
+	uint64_t lb = *(const uint64_t *)b;
+	return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static bool_t bench_all_finished(int threads) {
+	bool_t ret;
+	bctbx_mutex_lock(&bench_mutex);
+	ret = bench_finished == threads;
+	bctbx_mutex_unlock(&bench_mutex);
+	return ret;
+}
+
+static void bench_run(const bench_config_t *config) {
+	size_t total = (size_t)config->threads * (size_t)config->messages;
+	uint64_t *latencies = bctbx_new(uint64_t, total);
+	bctbx_thread_t *threads = bctbx_new(bctbx_thread_t, config->threads);
+	bench_thread_t *contexts = bctbx_new(bench_thread_t, config->threads);
+	int64_t allocs;
+	uint64_t start, elapsed;
+	double seconds;
+	int i;
+
+	bench_started = FALSE;
+	bench_finished = 0;
+	if (config->log_thread) bctbx_set_log_thread_id(bctbx_thread_self());
+	for (i = 0; i < config->threads; i++) {
+		contexts[i].config = config;
+		contexts[i].id = i;
+		contexts[i].latencies = latencies + (size_t)i * (size_t)config->messages;
+		bctbx_thread_create(&threads[i], NULL, bench_producer, &contexts[i]);
+	}
+
+	allocs = bench_allocs;
+	start = bench_time_ns();
+	bctbx_mutex_lock(&bench_mutex);
+	bench_started = TRUE;
+	bctbx_cond_broadcast(&bench_cond);
+	bctbx_mutex_unlock(&bench_mutex);
+	if (config->log_thread) {
+		/*the owner thread drains the stored messages while the producers run*/
+		while (!bench_all_finished(config->threads)) {
+			bctbx_logv_flush();
+			bctbx_sleep_ms(1);
+		}
+	}
+	for (i = 0; i < config->threads; i++) bctbx_thread_join(threads[i], NULL);
+	if (config->log_thread) bctbx_logv_flush();
+	elapsed = bench_time_ns() - start;
+	allocs = bench_allocs - allocs;
+	if (config->log_thread) bctbx_set_log_thread_id(0);
+
+	qsort(latencies, total, sizeof(uint64_t), bench_compare_latencies);
+	seconds = (double)elapsed / 1e9;
+	printf("{\"mode\":\"%s\",\"domain\":\"%s\",\"threads\":%i,\"messages\":%lu,\"seconds\":%.6f,\"msgs_per_sec\":%.0f,"
+		"\"p50_ns\":%llu,\"p99_ns\":%llu,\"allocs_per_msg\":%.3f}\n",
+		config->log_thread ? "log_thread" : "direct",
+		config->domain == bench_enabled_domain ? "enabled" : "disabled",
+		config->threads, (unsigned long)total, seconds, seconds > 0 ? (double)total / seconds : 0.0,
+		(unsigned long long)latencies[total / 2], (unsigned long long)latencies[total * 99 / 100],
+		(double)allocs / (double)total);
+	fflush(stdout);
+
+	bctbx_free(contexts);
+	bctbx_free(threads);
+	bctbx_free(latencies);
+}
+
+static const char *bench_helper =
+	"Usage: %s [--max-threads <1-64>] [--messages <per thread>]\n"
+	"Prints one JSON object per line and configuration.\n";
+
+int main(int argc, char *argv[]) {
+	BctoolboxMemoryFunctions functions = {bench_malloc, bench_realloc, bench_free};
+	bench_config_t config;
+	int max_threads = 64;
+	int messages = 10000;
+	int log_thread;
+	int enabled;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+			max_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--messages") == 0 && i + 1 < argc) {
+			messages = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, bench_helper, argv[0]);
+			return -1;
+		}
+	}
+	if (max_threads < 1 || max_threads > 64 || messages < 1) {
+		fprintf(stderr, bench_helper, argv[0]);
+		return -1;
+	}
+
+	/*must be installed before the first allocation made by bctoolbox*/
+	bctbx_set_memory_functions(&functions);
+	bctbx_mutex_init(&bench_mutex, NULL);
+	bctbx_cond_init(&bench_cond, NULL);
+	bctbx_set_log_handler(bench_handler);
+	bctbx_set_log_level(bench_enabled_domain, BCTBX_LOG_MESSAGE);
+	bctbx_set_log_level(bench_disabled_domain, BCTBX_LOG_ERROR);
+
+	for (log_thread = 0; log_thread <= 1; log_thread++) {
+		for (enabled = 0; enabled <= 1; enabled++) {
+			for (i = 1; i <= max_threads; i *= 2) {
+				config.log_thread = (bool_t)log_thread;
+				config.domain = enabled ? bench_enabled_domain : bench_disabled_domain;
+				config.threads = i;
+				config.messages = messages;
+				bench_run(&config);
+			}
+		}
+	}
+
+	bctbx_cond_destroy(&bench_cond);
+	bctbx_mutex_destroy(&bench_mutex);
+	return 0;
+}
@@ -0,0 +1,1067 @@
+/*
+	bctoolbox
+	Copyright (C) 2016  Belledonne Communications SARL
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "bctoolbox_tester.h"
+#include "bctoolbox/bc_vfs.h"
+#ifdef HAVE_CRYPTO
+#include "bctoolbox/crypto.h"
+#endif
+
+static const char *test_content = "line one\nline two\r\nlast";
+
+/*create a file holding test_content with the standard VFS*/
+static char *create_test_file(const char *name) {
+	char *path = bc_tester_file(name);
+	bctbx_vfs_file_t *f;
+
+	unlink(path);
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f) {
+		BC_ASSERT_EQUAL((int)bctbx_file_write(f, test_content, strlen(test_content), 0), (int)strlen(test_content), int, "%i");
+		bctbx_file_close(f);
+	}
+	return path;
+}
+
+static void mmap_vfs(void) {
+	char *path = create_test_file("vfs_mmap.txt");
+	bctbx_vfs_file_t *f = bctbx_file_open2(bctbx_vfs_get_mmap(), path, O_RDWR);
+	const void *region = NULL;
+	const void *grown_region = NULL;
+	char block[8192];
+	char buf[64];
+	int i;
+
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 3, 5), 3, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "one", 3), 0, int, "%i");
+	/*short read at the end of the file*/
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 19), 4, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 100), 0, int, "%i");
+
+	/*regions are only given inside the file*/
+	BC_ASSERT_EQUAL(bctbx_file_map_region(f, 9, 8, &region), BCTBX_VFS_OK, int, "%i");
+	if (region) BC_ASSERT_EQUAL(memcmp(region, "line two", 8), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_map_region(f, 20, 8, &grown_region), BCTBX_VFS_ERROR, int, "%i");
+
+	/*growing the file extends the mapping, the previous regions remain valid*/
+	for (i = 0; i < (int)sizeof(block); i++) block[i] = (char)('a' + i % 26);
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, block, sizeof(block), (off_t)strlen(test_content)), (int)sizeof(block), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), (int)(strlen(test_content) + sizeof(block)), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 26, (off_t)strlen(test_content) + 26), 26, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, block, 26), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_map_region(f, (off_t)strlen(test_content), sizeof(block), &grown_region), BCTBX_VFS_OK, int, "%i");
+	if (grown_region) BC_ASSERT_EQUAL(memcmp(grown_region, block, sizeof(block)), 0, int, "%i");
+	if (region) BC_ASSERT_EQUAL(memcmp(region, "line two", 8), 0, int, "%i");
+
+	/*lines are found in the mapping*/
+	f->offset = 0;
+	BC_ASSERT_EQUAL(bctbx_file_get_nxtline(f, buf, sizeof(buf)), 9, int, "%i");
+	BC_ASSERT_STRING_EQUAL(buf, "line one");
+	BC_ASSERT_EQUAL(bctbx_file_get_nxtline(f, buf, sizeof(buf)), 10, int, "%i");
+	BC_ASSERT_STRING_EQUAL(buf, "line two");
+	BC_ASSERT_EQUAL(bctbx_file_get_nxtline(f, buf, 5), 4, int, "%i");
+	BC_ASSERT_STRING_EQUAL(buf, "last");
+
+	/*many small appends, each one read back, do not map the file again each time*/
+	for (i = 0; i < 1000; i++) {
+		off_t end = (off_t)bctbx_file_size(f);
+		BC_ASSERT_EQUAL((int)bctbx_file_write(f, block, 100, end), 100, int, "%i");
+		BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 26, end), 26, int, "%i");
+	}
+	BC_ASSERT_EQUAL(memcmp(buf, block, 26), 0, int, "%i");
+	if (region) BC_ASSERT_EQUAL(memcmp(region, "line two", 8), 0, int, "%i");
+#ifdef __linux__
+	{
+		FILE *maps = fopen("/proc/self/maps", "r");
+		char line[1024];
+		int views = 0;
+		if (maps) {
+			while (fgets(line, sizeof(line), maps)) {
+				if (strstr(line, "vfs_mmap.txt")) views++;
+			}
+			fclose(maps);
+		}
+		BC_ASSERT_TRUE(views < 10);
+	}
+#endif
+
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+
+	/*the standard VFS has no mapping*/
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDONLY);
+	if (f) {
+		BC_ASSERT_EQUAL(bctbx_file_map_region(f, 0, 4, &region), BCTBX_VFS_ERROR, int, "%i");
+		bctbx_file_close(f);
+	}
+end:
+	unlink(path);
+	bc_free(path);
+}
+
+#define PARALLEL_READERS_BLOCKS 256
+#define PARALLEL_READERS_BLOCK_SIZE 4096
+
+typedef struct _parallel_reader {
+	bctbx_vfs_file_t *file;
+	int id;
+	int errors;
+} parallel_reader_t;
+
+/*every 32 bits word of the file holds its own index*/
+static void *parallel_reader_thread(void *data) {
+	parallel_reader_t *reader = (parallel_reader_t *)data;
+	uint32_t block[PARALLEL_READERS_BLOCK_SIZE / 4];
+	int i, j;
+
+	for (i = 0; i < PARALLEL_READERS_BLOCKS; i++) {
+		/*each reader walks the blocks in a different order*/
+		int b = (i * 7 + reader->id * 31) % PARALLEL_READERS_BLOCKS;
+		ssize_t ret = bctbx_file_read(reader->file, block, sizeof(block), (off_t)b * PARALLEL_READERS_BLOCK_SIZE);
+		if (ret != (ssize_t)sizeof(block)) {
+			reader->errors++;
+			continue;
+		}
+		for (j = 0; j < PARALLEL_READERS_BLOCK_SIZE / 4; j++) {
+			if (block[j] != (uint32_t)(b * PARALLEL_READERS_BLOCK_SIZE / 4 + j)) {
+				reader->errors++;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void parallel_readers(void) {
+	char *path = bc_tester_file("vfs_parallel.bin");
+	size_t words = PARALLEL_READERS_BLOCKS * PARALLEL_READERS_BLOCK_SIZE / 4;
+	uint32_t *content = bctbx_new(uint32_t, words);
+	parallel_reader_t readers[4];
+	bctbx_thread_t threads[4];
+	bctbx_vfs_file_t *f;
+	size_t i;
+
+	unlink(path);
+	for (i = 0; i < words; i++) content[i] = (uint32_t)i;
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	/*written in a single call, the short writes being retried*/
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, content, words * 4, 0), (int)(words * 4), int, "%i");
+
+	/*a single handle shared by all the readers*/
+	for (i = 0; i < 4; i++) {
+		readers[i].file = f;
+		readers[i].id = (int)i;
+		readers[i].errors = 0;
+		bctbx_thread_create(&threads[i], NULL, parallel_reader_thread, &readers[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		bctbx_thread_join(threads[i], NULL);
+		BC_ASSERT_EQUAL(readers[i].errors, 0, int, "%i");
+	}
+	/*reads past the end are short*/
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, content, 16, (off_t)(words * 4 - 8)), 8, int, "%i");
+	bctbx_file_close(f);
+end:
+	bctbx_free(content);
+	unlink(path);
+	bc_free(path);
+}
+
+static void caching_vfs(void) {
+	char *path = bc_tester_file("vfs_cache.bin");
+	bctbx_vfs_t *cache = bctbx_vfs_cache_new(bctbx_vfs_get_standard(), 64, 8);
+	bctbx_vfs_cache_stats_t stats;
+	bctbx_vfs_file_t *f;
+	char content[1024];
+	char buf[256];
+	int i;
+	bool_t same = TRUE;
+
+	unlink(path);
+	for (i = 0; i < (int)sizeof(content); i++) content[i] = (char)(i % 251);
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	bctbx_file_write(f, content, sizeof(content), 0);
+	bctbx_file_close(f);
+
+	f = bctbx_file_open2(cache, path, O_RDWR);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), (int)sizeof(content), int, "%i");
+
+	/*sequential small reads: the following pages are read in advance*/
+	for (i = 0; i < (int)sizeof(content); i += 16) {
+		if (bctbx_file_read(f, buf, 16, i) != 16 || memcmp(buf, content + i, 16) != 0) same = FALSE;
+	}
+	BC_ASSERT_TRUE(same);
+	bctbx_vfs_cache_get_stats(cache, &stats);
+	BC_ASSERT_TRUE(stats.misses < sizeof(content) / 64);
+	BC_ASSERT_TRUE(stats.readahead_pages > 0);
+	BC_ASSERT_TRUE(stats.hits > 0);
+	BC_ASSERT_TRUE(stats.evictions > 0);
+	/*the last pages are still cached*/
+	bctbx_vfs_cache_reset_stats(cache);
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 100, sizeof(content) - 100), 100, int, "%i");
+	bctbx_vfs_cache_get_stats(cache, &stats);
+	BC_ASSERT_EQUAL((int)stats.misses, 0, int, "%i");
+
+	/*small writes to consecutive pages are written back in a single call*/
+	bctbx_vfs_cache_reset_stats(cache);
+	for (i = 0; i < 3; i++) {
+		memset(content + i * 64 + 10, 'x', 54);
+		memset(content + i * 64 + 64, 'x', 10);
+		bctbx_file_write(f, content + i * 64 + 10, 64, i * 64 + 10);
+	}
+	bctbx_vfs_cache_get_stats(cache, &stats);
+	BC_ASSERT_EQUAL((int)stats.writes, 0, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 64, 64), 64, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, content + 64, 64), 0, int, "%i");
+
+	/*a write past the end leaves a hole of zeros*/
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, "end", 3, 2000), 3, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 2003, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 8, 1500), 8, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "\0\0\0\0\0\0\0\0", 8), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+	bctbx_vfs_cache_get_stats(cache, &stats);
+	BC_ASSERT_EQUAL((int)stats.writes, 2, int, "%i");
+
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 2003, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 256, 0), 256, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, content, 256), 0, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 3, 2000), 3, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "end", 3), 0, int, "%i");
+	bctbx_file_close(f);
+end:
+	bctbx_vfs_cache_destroy(cache);
+	unlink(path);
+	bc_free(path);
+}
+
+/*VFS over the standard one, whose writes fail while failing_writes is set*/
+static bool_t failing_writes = FALSE;
+static const bctbx_io_methods_t *failing_std_io = NULL;
+static bctbx_io_methods_t failing_io;
+
+static ssize_t failingWrite(bctbx_vfs_file_t *pFile, const void *buf, size_t count, off_t offset) {
+	if (failing_writes) return -EIO;
+	return failing_std_io->pFuncWrite(pFile, buf, count, offset);
+}
+
+static int failingOpen(bctbx_vfs_t *pVfs, bctbx_vfs_file_t *pFile, const char *fName, int openFlags) {
+	bctbx_vfs_t *std = bctbx_vfs_get_standard();
+	int ret = std->pFuncOpen(std, pFile, fName, openFlags);
+
+	if (ret != BCTBX_VFS_OK) return ret;
+	failing_std_io = pFile->pMethods;
+	failing_io = *pFile->pMethods;
+	failing_io.pFuncWrite = failingWrite;
+	pFile->pMethods = &failing_io;
+	return BCTBX_VFS_OK;
+}
+
+static bctbx_vfs_t failing_vfs = {
+	"failing_vfs",              /* vfsName */
+	failingOpen,                /* xOpen */
+};
+
+static void caching_vfs_write_error(void) {
+	char *path = bc_tester_file("vfs_cache_error.bin");
+	bctbx_vfs_t *cache = bctbx_vfs_cache_new(&failing_vfs, 64, 8);
+	bctbx_vfs_file_t *f;
+	char buf[200];
+
+	unlink(path);
+	f = bctbx_file_open2(cache, path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	/*two runs of dirty pages, the second one not written back because of the failure of the first one*/
+	memset(buf, 'a', sizeof(buf));
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, buf, 10, 0), 10, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, buf, 10, 150), 10, int, "%i");
+	failing_writes = TRUE;
+	BC_ASSERT_EQUAL(bctbx_file_sync(f, TRUE), BCTBX_VFS_ERROR, int, "%i");
+	/*the pages not written back are still dirty*/
+	BC_ASSERT_EQUAL(bctbx_file_sync(f, TRUE), BCTBX_VFS_ERROR, int, "%i");
+	failing_writes = FALSE;
+	BC_ASSERT_EQUAL(bctbx_file_sync(f, TRUE), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 160, int, "%i");
+	memset(buf, 0, sizeof(buf));
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 0), 10, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf + 10, 10, 150), 10, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "aaaaaaaaaaaaaaaaaaaa", 20), 0, int, "%i");
+	bctbx_file_close(f);
+end:
+	failing_writes = FALSE;
+	bctbx_vfs_cache_destroy(cache);
+	unlink(path);
+	bc_free(path);
+}
+
+static void line_reader(void) {
+	char *path = bc_tester_file("vfs_lines.txt");
+	const char *content = "first\nsecond\r\n\nthis line is longer than the buffer\rcr only\r\nlast";
+	const char *expected[] = {"first", "second", "", "this line is longer than the buffer", "cr only", "last"};
+	bctbx_vfs_line_reader_t *reader;
+	bctbx_vfs_file_t *f;
+	const char *line;
+	size_t len;
+	char buf[64];
+	int i = 0;
+
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	bctbx_file_write(f, content, strlen(content), 0);
+
+	/*a small buffer, so that it is refilled in the middle of lines and of the "\r\n"*/
+	f->offset = 0;
+	reader = bctbx_vfs_line_reader_new(f, 7);
+	while (bctbx_vfs_line_reader_next(reader, &line, &len) == 1) {
+		if (BC_ASSERT_TRUE(i < 6)) {
+			BC_ASSERT_EQUAL((int)len, (int)strlen(expected[i]), int, "%i");
+			BC_ASSERT_STRING_EQUAL(line, expected[i]);
+		}
+		i++;
+		/*the file offset follows the reader*/
+		if (i == 2) BC_ASSERT_EQUAL((int)f->offset, 14, int, "%i");
+	}
+	BC_ASSERT_EQUAL(i, 6, int, "%i");
+	BC_ASSERT_EQUAL((int)f->offset, (int)strlen(content), int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_line_reader_next(reader, &line, &len), 0, int, "%i");
+	bctbx_vfs_line_reader_destroy(reader);
+
+	/*the standard getline gives the same lines*/
+	f->offset = 0;
+	for (i = 0; i < 6; i++) {
+		BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+		BC_ASSERT_STRING_EQUAL(buf, expected[i]);
+	}
+	BC_ASSERT_EQUAL(bctbx_file_get_nxtline(f, buf, sizeof(buf)), 0, int, "%i");
+	bctbx_file_close(f);
+end:
+	unlink(path);
+	bc_free(path);
+}
+
+static void vectored_io_on(bctbx_vfs_t *vfs, const char *path) {
+	char header[4] = {'H', 'D', 'R', ':'};
+	char payload[300];
+	char single[100];
+	char small[3][5];
+	char readback[sizeof(header) + sizeof(payload)];
+	bctbx_iovec_t iov[100];
+	bctbx_vfs_file_t *f;
+	int i;
+
+	for (i = 0; i < (int)sizeof(payload); i++) payload[i] = (char)('a' + i % 26);
+	f = bctbx_file_open2(vfs, path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) return;
+
+	/*a record made of a header and a payload, written at once*/
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = sizeof(payload);
+	BC_ASSERT_EQUAL((int)bctbx_file_writev(f, iov, 2, 0), (int)sizeof(readback), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, readback, sizeof(readback), 0), (int)sizeof(readback), int, "%i");
+	BC_ASSERT_EQUAL(memcmp(readback, header, sizeof(header)), 0, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(readback + sizeof(header), payload, sizeof(payload)), 0, int, "%i");
+
+	/*more buffers than given to a single system call, some of them empty*/
+	for (i = 0; i < 100; i++) {
+		iov[i].iov_base = single + i;
+		iov[i].iov_len = i % 10 == 5 ? 0 : 1;
+		single[i] = (char)('A' + i % 26);
+	}
+	BC_ASSERT_EQUAL((int)bctbx_file_writev(f, iov, 100, 1000), 90, int, "%i");
+	memset(single, 0, sizeof(single));
+	BC_ASSERT_EQUAL((int)bctbx_file_readv(f, iov, 100, 1000), 90, int, "%i");
+	BC_ASSERT_EQUAL(single[0], 'A', char, "%c");
+	BC_ASSERT_EQUAL(single[99], 'V', char, "%c");
+	BC_ASSERT_EQUAL(single[5], 0, char, "%c");
+
+	/*a read reaching the end of the file stops in the middle of the buffers*/
+	for (i = 0; i < 3; i++) {
+		iov[i].iov_base = small[i];
+		iov[i].iov_len = sizeof(small[i]);
+	}
+	BC_ASSERT_EQUAL((int)bctbx_file_readv(f, iov, 3, 1082), 8, int, "%i");
+	BC_ASSERT_EQUAL(small[1][2], 'V', char, "%c");
+	bctbx_file_close(f);
+}
+
+static void vectored_io(void) {
+	char *path = bc_tester_file("vfs_vectored.bin");
+	bctbx_vfs_t *cache = bctbx_vfs_cache_new(bctbx_vfs_get_standard(), 64, 8);
+
+	vectored_io_on(bctbx_vfs_get_standard(), path);
+	/*the caching VFS uses the generic implementation*/
+	vectored_io_on(cache, path);
+	bctbx_vfs_cache_destroy(cache);
+	unlink(path);
+	bc_free(path);
+}
+
+typedef struct _async_test_context {
+	bctbx_mutex_t mutex;
+	int completed;
+	int order[32]; /*index given to each completion, in completion order*/
+	ssize_t results[32];
+} async_test_context_t;
+
+static async_test_context_t async_context;
+
+static void async_completed(bctbx_vfs_file_t *pFile, ssize_t result, void *user_data) {
+	int index = (int)(intptr_t)user_data;
+	bctbx_mutex_lock(&async_context.mutex);
+	async_context.order[async_context.completed] = index;
+	async_context.results[index] = result;
+	async_context.completed++;
+	bctbx_mutex_unlock(&async_context.mutex);
+}
+
+static void async_operations(void) {
+	char *path = bc_tester_file("vfs_async.bin");
+	char *other_path = bc_tester_file("vfs_async_other.bin");
+	bctbx_vfs_completion_queue_t *queue = bctbx_vfs_completion_queue_new();
+	bctbx_vfs_file_t *f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	bctbx_vfs_file_t *other = bctbx_file_open2(bctbx_vfs_get_standard(), other_path, O_RDWR | O_CREAT | O_TRUNC);
+	char records[20][10];
+	char readback[200];
+	int completed = 0;
+	int i;
+
+	memset(&async_context, 0, sizeof(async_context));
+	bctbx_mutex_init(&async_context.mutex, NULL);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	BC_ASSERT_PTR_NOT_NULL(other);
+	if (f == NULL || other == NULL) goto end;
+
+	/*appends, then a sync and a read that must see them all*/
+	for (i = 0; i < 20; i++) {
+		memset(records[i], 'a' + i, sizeof(records[i]));
+		BC_ASSERT_EQUAL(bctbx_file_write_async(f, records[i], sizeof(records[i]), i * 10, queue, async_completed, (void *)(intptr_t)i), BCTBX_VFS_OK, int, "%i");
+	}
+	BC_ASSERT_EQUAL(bctbx_file_fsync_async(f, TRUE, queue, async_completed, (void *)(intptr_t)20), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_read_async(f, readback, sizeof(readback), 0, queue, async_completed, (void *)(intptr_t)21), BCTBX_VFS_OK, int, "%i");
+	/*without queue, the callback is called from a worker thread*/
+	BC_ASSERT_EQUAL(bctbx_file_write_async(other, "other", 5, 0, NULL, async_completed, (void *)(intptr_t)22), BCTBX_VFS_OK, int, "%i");
+
+	while (completed < 22) completed += bctbx_vfs_completion_queue_wait(queue);
+	BC_ASSERT_EQUAL(completed, 22, int, "%i");
+	bctbx_vfs_async_shutdown();
+	BC_ASSERT_EQUAL(bctbx_vfs_completion_queue_process(queue), 0, int, "%i");
+	BC_ASSERT_EQUAL(async_context.completed, 23, int, "%i");
+
+	/*the operations on a file complete in the order of the requests*/
+	completed = 0;
+	for (i = 0; i < 23; i++) {
+		if (async_context.order[i] == 22) continue;
+		BC_ASSERT_EQUAL(async_context.order[i], completed, int, "%i");
+		completed++;
+	}
+	for (i = 0; i < 20; i++) BC_ASSERT_EQUAL((int)async_context.results[i], 10, int, "%i");
+	BC_ASSERT_EQUAL((int)async_context.results[20], BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)async_context.results[21], 200, int, "%i");
+	BC_ASSERT_EQUAL((int)async_context.results[22], 5, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(readback, records, sizeof(readback)), 0, int, "%i");
+
+end:
+	if (f) bctbx_file_close(f);
+	if (other) bctbx_file_close(other);
+	bctbx_vfs_completion_queue_destroy(queue);
+	bctbx_mutex_destroy(&async_context.mutex);
+	unlink(path);
+	unlink(other_path);
+	bc_free(path);
+	bc_free(other_path);
+}
+
+static void memory_vfs(void) {
+	bctbx_vfs_t *vfs = bctbx_vfs_memory_new(4 * 65536);
+	bctbx_vfs_file_t *f;
+	bctbx_vfs_file_t *other;
+	const void *region = NULL;
+	char buf[64];
+	char *big;
+	int i;
+
+	/*a missing file is created only when asked*/
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, "notes.txt", O_RDONLY));
+	f = bctbx_file_open2(vfs, "notes.txt", O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, test_content, strlen(test_content), 0), (int)strlen(test_content), int, "%i");
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, "notes.txt", O_RDWR | O_CREAT | O_EXCL));
+	bctbx_file_close(f);
+
+	/*opened again by name, read line by line*/
+	f = bctbx_file_open2(vfs, "notes.txt", O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), (int)strlen(test_content), int, "%i");
+	BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+	BC_ASSERT_STRING_EQUAL(buf, "line one");
+	BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+	BC_ASSERT_STRING_EQUAL(buf, "line two");
+	BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+	BC_ASSERT_STRING_EQUAL(buf, "last");
+	BC_ASSERT_EQUAL(bctbx_file_get_nxtline(f, buf, sizeof(buf)), 0, int, "%i");
+	/*the access mode is enforced*/
+	BC_ASSERT_TRUE(bctbx_file_write(f, "x", 1, 0) < 0);
+	BC_ASSERT_EQUAL(bctbx_file_map_region(f, 5, 3, &region), BCTBX_VFS_OK, int, "%i");
+	if (region) BC_ASSERT_EQUAL(memcmp(region, "one", 3), 0, int, "%i");
+	bctbx_file_close(f);
+
+	/*a write far from the end leaves a hole read as zeros, and spans two chunks*/
+	f = bctbx_file_open2(vfs, "sparse.bin", O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, "0123456789", 10, 2 * 65536 - 5), 10, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 2 * 65536 + 5, int, "%i");
+	memset(buf, 'x', sizeof(buf));
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 2 * 65536 - 20), 25, int, "%i");
+	BC_ASSERT_EQUAL(buf[0], 0, char, "%c");
+	BC_ASSERT_EQUAL(memcmp(buf + 15, "0123456789", 10), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_map_region(f, 2 * 65536 - 5, 10, &region), BCTBX_VFS_ERROR, int, "%i");
+
+	/*the size limit: three chunks are used, only one more can be allocated*/
+	big = bctbx_malloc0(3 * 65536);
+	other = bctbx_file_open2(vfs, "big.bin", O_WRONLY | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(other);
+	if (other) {
+		BC_ASSERT_EQUAL((int)bctbx_file_write(other, big, 3 * 65536, 0), 65536, int, "%i");
+		BC_ASSERT_TRUE(bctbx_file_write(other, big, 10, 65536) < 0);
+		BC_ASSERT_TRUE(bctbx_file_read(other, buf, 10, 0) < 0);
+		bctbx_file_close(other);
+	}
+	bctbx_free(big);
+
+	/*unlinking an open file keeps its content until it is closed, and releases its memory*/
+	BC_ASSERT_EQUAL(bctbx_vfs_memory_unlink(vfs, "sparse.bin"), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_memory_unlink(vfs, "sparse.bin"), BCTBX_VFS_ERROR, int, "%i");
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, "sparse.bin", O_RDONLY));
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 2 * 65536 - 5), 10, int, "%i");
+	bctbx_file_close(f);
+	other = bctbx_file_open2(vfs, "big.bin", O_WRONLY);
+	BC_ASSERT_PTR_NOT_NULL(other);
+	if (other) {
+		BC_ASSERT_EQUAL((int)bctbx_file_write(other, buf, 10, 2 * 65536), 10, int, "%i");
+		bctbx_file_close(other);
+	}
+
+	/*many files, to grow the table*/
+	for (i = 0; i < 40; i++) {
+		snprintf(buf, sizeof(buf), "file%i", i);
+		other = bctbx_file_open2(vfs, buf, O_RDWR | O_CREAT | O_EXCL);
+		BC_ASSERT_PTR_NOT_NULL(other);
+		if (other) bctbx_file_close(other);
+	}
+	for (i = 0; i < 40; i++) {
+		snprintf(buf, sizeof(buf), "file%i", i);
+		BC_ASSERT_EQUAL(bctbx_vfs_memory_unlink(vfs, buf), BCTBX_VFS_OK, int, "%i");
+	}
+	vectored_io_on(vfs, "vectored.bin");
+end:
+	bctbx_vfs_memory_destroy(vfs);
+}
+
+static void truncate_on(bctbx_vfs_t *vfs, const char *path) {
+	char content[200];
+	char buf[100];
+	bctbx_vfs_file_t *f;
+	int i;
+
+	for (i = 0; i < (int)sizeof(content); i++) content[i] = (char)('a' + i % 26);
+	f = bctbx_file_open2(vfs, path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) return;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, content, sizeof(content), 0), (int)sizeof(content), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 150), 10, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_truncate(f, 50), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 50, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 20, 40), 10, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, content + 40, 10), 0, int, "%i");
+	/*growing again: the bytes cut before read as zeros*/
+	BC_ASSERT_EQUAL(bctbx_file_truncate(f, 100), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 100, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 0), 100, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, content, 50), 0, int, "%i");
+	BC_ASSERT_EQUAL(buf[50], 0, char, "%c");
+	BC_ASSERT_EQUAL(buf[99], 0, char, "%c");
+	BC_ASSERT_EQUAL(bctbx_file_sync(f, TRUE), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_truncate(f, 0), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 0), 0, int, "%i");
+	bctbx_file_close(f);
+}
+
+static void truncate_file(void) {
+	char *path = bc_tester_file("vfs_truncate.bin");
+	bctbx_vfs_t *cache = bctbx_vfs_cache_new(bctbx_vfs_get_standard(), 64, 8);
+	bctbx_vfs_t *memory = bctbx_vfs_memory_new(0);
+#ifdef HAVE_CRYPTO
+	const uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+	bctbx_vfs_t *encrypted = bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), key, sizeof(key), 64);
+#endif
+
+	truncate_on(bctbx_vfs_get_standard(), path);
+	truncate_on(bctbx_vfs_get_mmap(), path);
+	truncate_on(cache, path);
+	truncate_on(memory, path);
+#ifdef HAVE_CRYPTO
+	unlink(path);
+	truncate_on(encrypted, path);
+	bctbx_vfs_aes_gcm_destroy(encrypted);
+#endif
+	bctbx_vfs_memory_destroy(memory);
+	bctbx_vfs_cache_destroy(cache);
+	unlink(path);
+	bc_free(path);
+}
+
+static void rename_delete_on(bctbx_vfs_t *vfs, const char *path, const char *other_path) {
+	bctbx_vfs_file_t *pFile = bctbx_file_open2(vfs, path, O_RDWR | O_CREAT | O_TRUNC);
+	char buf[4];
+
+	BC_ASSERT_PTR_NOT_NULL(pFile);
+	if (pFile == NULL) return;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(pFile, "abc", 3, 0), 3, int, "%i");
+	bctbx_file_close(pFile);
+
+	BC_ASSERT_EQUAL(bctbx_vfs_rename(vfs, path, other_path), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, path, O_RDONLY));
+	pFile = bctbx_file_open2(vfs, other_path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(pFile);
+	if (pFile) {
+		memset(buf, 0, sizeof(buf));
+		BC_ASSERT_EQUAL((int)bctbx_file_read(pFile, buf, 3, 0), 3, int, "%i");
+		BC_ASSERT_STRING_EQUAL(buf, "abc");
+		bctbx_file_close(pFile);
+	}
+	BC_ASSERT_EQUAL(bctbx_vfs_delete(vfs, other_path), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, other_path, O_RDONLY));
+	BC_ASSERT_EQUAL(bctbx_vfs_delete(vfs, other_path), BCTBX_VFS_ERROR, int, "%i");
+}
+
+static void rename_delete(void) {
+	char *path = bc_tester_file("vfs_rename.bin");
+	char *other_path = bc_tester_file("vfs_renamed.bin");
+	bctbx_vfs_t *cache = bctbx_vfs_cache_new(bctbx_vfs_get_standard(), 64, 8);
+	bctbx_vfs_t *memory = bctbx_vfs_memory_new(0);
+	bctbx_vfs_file_t *pFile;
+#ifdef HAVE_CRYPTO
+	const uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+	bctbx_vfs_t *encrypted = bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), key, sizeof(key), 64);
+#endif
+
+	rename_delete_on(bctbx_vfs_get_standard(), path, other_path);
+	rename_delete_on(bctbx_vfs_get_mmap(), path, other_path);
+	rename_delete_on(cache, path, other_path);
+#ifdef HAVE_CRYPTO
+	rename_delete_on(encrypted, path, other_path);
+	bctbx_vfs_aes_gcm_destroy(encrypted);
+#endif
+
+	/*the memory VFS deletes but does not rename*/
+	pFile = bctbx_file_open2(memory, path, O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(pFile);
+	if (pFile) bctbx_file_close(pFile);
+	BC_ASSERT_EQUAL(bctbx_vfs_rename(memory, path, other_path), BCTBX_VFS_ERROR, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_delete(memory, path), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(memory, path, O_RDONLY));
+
+	bctbx_vfs_memory_destroy(memory);
+	bctbx_vfs_cache_destroy(cache);
+	unlink(path);
+	unlink(other_path);
+	bc_free(path);
+	bc_free(other_path);
+}
+
+static void buffered_writer(void) {
+	bctbx_vfs_t *vfs = bctbx_vfs_memory_new(0);
+	bctbx_vfs_buffered_writer_t *writer;
+	bctbx_vfs_file_t *f = bctbx_file_open2(vfs, "log", O_RDWR | O_CREAT);
+	char big[100];
+	char buf[200];
+
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, "head:", 5, 0), 5, int, "%i");
+	writer = bctbx_vfs_buffered_writer_new(f, 32);
+
+	/*appends go after the existing content, and are kept until the buffer is full or flushed*/
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_append(writer, "one,", 4), 4, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_append(writer, "two,", 4), 4, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 5, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_buffered_writer_flush(writer), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 13, int, "%i");
+
+	/*a write elsewhere flushes the buffer first*/
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_append(writer, "three", 5), 5, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_write(writer, "HEAD", 4, 0), 4, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 18, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_buffered_writer_sync(writer, TRUE), BCTBX_VFS_OK, int, "%i");
+	memset(buf, 0, sizeof(buf));
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 0), 18, int, "%i");
+	BC_ASSERT_STRING_EQUAL(buf, "HEAD:one,two,three");
+
+	/*appends continue after the last write, a write larger than the buffer goes directly*/
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_append(writer, "!", 1), 1, int, "%i");
+	memset(big, 'z', sizeof(big));
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_write(writer, big, sizeof(big), 18), (int)sizeof(big), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 118, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_vfs_buffered_writer_append(writer, "end", 3), 3, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_buffered_writer_destroy(writer), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 121, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 4, 117), 4, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "zend", 4), 0, int, "%i");
+	bctbx_file_close(f);
+end:
+	bctbx_vfs_memory_destroy(vfs);
+}
+
+#define GROUP_COMMIT_WRITERS 8
+#define GROUP_COMMIT_RECORDS 5
+
+typedef struct _group_commit_writer {
+	bctbx_vfs_file_t *file;
+	bctbx_vfs_group_commit_t *gc;
+	int id;
+	int errors;
+} group_commit_writer_t;
+
+static void *group_commit_writer_thread(void *data) {
+	group_commit_writer_t *writer = (group_commit_writer_t *)data;
+	char record[16];
+	int i;
+
+	for (i = 0; i < GROUP_COMMIT_RECORDS; i++) {
+		off_t offset = (off_t)(writer->id * GROUP_COMMIT_RECORDS + i) * sizeof(record);
+		memset(record, 'a' + writer->id, sizeof(record));
+		if (bctbx_file_write(writer->file, record, sizeof(record), offset) != (ssize_t)sizeof(record)) writer->errors++;
+		if (bctbx_vfs_group_commit_sync(writer->gc) != BCTBX_VFS_OK) writer->errors++;
+	}
+	return NULL;
+}
+
+static void group_commit(void) {
+	char *path = bc_tester_file("vfs_group_commit.bin");
+	group_commit_writer_t writers[GROUP_COMMIT_WRITERS];
+	bctbx_thread_t threads[GROUP_COMMIT_WRITERS];
+	bctbx_vfs_group_commit_t *gc;
+	bctbx_vfs_file_t *f;
+	uint64_t syncs;
+	int i;
+
+	unlink(path);
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	gc = bctbx_vfs_group_commit_new(f, 5, TRUE);
+	for (i = 0; i < GROUP_COMMIT_WRITERS; i++) {
+		writers[i].file = f;
+		writers[i].gc = gc;
+		writers[i].id = i;
+		writers[i].errors = 0;
+		bctbx_thread_create(&threads[i], NULL, group_commit_writer_thread, &writers[i]);
+	}
+	for (i = 0; i < GROUP_COMMIT_WRITERS; i++) {
+		bctbx_thread_join(threads[i], NULL);
+		BC_ASSERT_EQUAL(writers[i].errors, 0, int, "%i");
+	}
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), GROUP_COMMIT_WRITERS * GROUP_COMMIT_RECORDS * 16, int, "%i");
+	/*the writers waiting at the same time shared their syncs*/
+	syncs = bctbx_vfs_group_commit_get_sync_count(gc);
+	BC_ASSERT_TRUE(syncs > 0);
+	BC_ASSERT_TRUE(syncs < GROUP_COMMIT_WRITERS * GROUP_COMMIT_RECORDS);
+	bctbx_vfs_group_commit_destroy(gc);
+	bctbx_file_close(f);
+end:
+	unlink(path);
+	bc_free(path);
+}
+
+static void *stats_vfs_reader_thread(void *data) {
+	bctbx_vfs_file_t *f = (bctbx_vfs_file_t *)data;
+	char buf[4];
+	int i;
+
+	for (i = 0; i < 3; i++) bctbx_file_read(f, buf, sizeof(buf), 0);
+	return NULL;
+}
+
+static void stats_vfs(void) {
+	const char *prefixes[] = {"/data/", "/data/cache/", "/log/"};
+	bctbx_vfs_t *memory = bctbx_vfs_memory_new(0);
+	bctbx_vfs_t *vfs = bctbx_vfs_stats_new(memory, prefixes, 3);
+	bctbx_vfs_stats_t stats;
+	bctbx_vfs_file_t *f;
+	bctbx_thread_t thread;
+	char buf[32];
+	char a[4], b[4];
+	bctbx_iovec_t iov[2];
+	uint64_t total;
+	int i;
+
+	BC_ASSERT_PTR_NOT_NULL(vfs);
+	if (vfs == NULL) goto end;
+	f = bctbx_file_open2(vfs, "/data/notes", O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, test_content, strlen(test_content), 0), (int)strlen(test_content), int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 4, 5), 4, int, "%i");
+	BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+	BC_ASSERT_STRING_EQUAL(buf, "line one");
+	BC_ASSERT_TRUE(bctbx_file_get_nxtline(f, buf, sizeof(buf)) > 0);
+	BC_ASSERT_STRING_EQUAL(buf, "line two");
+	iov[0].iov_base = a;
+	iov[0].iov_len = sizeof(a);
+	iov[1].iov_base = b;
+	iov[1].iov_len = sizeof(b);
+	BC_ASSERT_EQUAL((int)bctbx_file_readv(f, iov, 2, 0), 8, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(b, " one", 4), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_sync(f, FALSE), BCTBX_VFS_OK, int, "%i");
+	bctbx_file_close(f);
+	f = bctbx_file_open2(vfs, "/data/cache/page", O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f) {
+		BC_ASSERT_EQUAL((int)bctbx_file_write(f, "12345", 5, 0), 5, int, "%i");
+		bctbx_file_close(f);
+	}
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, "/missing", O_RDONLY));
+
+	/*all the files*/
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, NULL, &stats), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_OPEN].calls, 3, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_OPEN].errors, 1, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_CLOSE].calls, 2, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_WRITE].calls, 2, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_WRITE].bytes, (int)strlen(test_content) + 5, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_READ].bytes, 4, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_GET_LINE].calls, 2, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_GET_LINE].bytes, 19, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_READV].bytes, 8, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_SYNC].calls, 1, int, "%i");
+	for (total = 0, i = 0; i < BCTBX_VFS_LATENCY_BUCKETS; i++) total += stats.ops[BCTBX_VFS_OP_WRITE].latency[i];
+	BC_ASSERT_EQUAL((int)total, 2, int, "%i");
+	BC_ASSERT_STRING_EQUAL(bctbx_vfs_op_name(BCTBX_VFS_OP_GET_LINE), "get_line");
+
+	/*the files are counted under their longest prefix*/
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, "/data/", &stats), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_WRITE].bytes, (int)strlen(test_content), int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, "/data/cache/", &stats), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_WRITE].bytes, 5, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_OPEN].calls, 1, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, "/log/", &stats), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_OPEN].calls, 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, "/other/", &stats), BCTBX_VFS_ERROR, int, "%i");
+
+	/*after a reset, the counts of another thread are merged*/
+	bctbx_vfs_stats_reset(vfs);
+	f = bctbx_file_open2(vfs, "/data/notes", O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	bctbx_thread_create(&thread, NULL, stats_vfs_reader_thread, f);
+	bctbx_thread_join(thread, NULL);
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 4, 0), 4, int, "%i");
+	bctbx_file_close(f);
+	BC_ASSERT_EQUAL(bctbx_vfs_stats_get(vfs, NULL, &stats), BCTBX_VFS_OK, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_OPEN].calls, 1, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_READ].calls, 4, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_READ].bytes, 16, int, "%i");
+	BC_ASSERT_EQUAL((int)stats.ops[BCTBX_VFS_OP_WRITE].calls, 0, int, "%i");
+end:
+	bctbx_vfs_stats_destroy(vfs);
+	bctbx_vfs_memory_destroy(memory);
+}
+
+#ifdef HAVE_CRYPTO
+static void encrypted_vfs(void) {
+	char *path = bc_tester_file("vfs_aes_gcm.bin");
+	char *other_path = bc_tester_file("vfs_aes_gcm_other.bin");
+	const uint8_t key[32] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+	const uint8_t other_key[16] = {0};
+	bctbx_vfs_t *vfs = bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), key, sizeof(key), 64);
+	bctbx_vfs_t *reopen_vfs = bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), key, sizeof(key), 128);
+	bctbx_vfs_t *wrong_vfs = bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), other_key, sizeof(other_key), 64);
+	char expected[1200];
+	char buf[1200];
+	char raw[2048];
+	bctbx_vfs_file_t *f;
+	int64_t raw_size;
+	int i;
+
+	unlink(path);
+	BC_ASSERT_PTR_NOT_NULL(vfs);
+	BC_ASSERT_PTR_NULL(bctbx_vfs_aes_gcm_new(bctbx_vfs_get_standard(), key, 20, 64));
+	f = bctbx_file_open2(vfs, path, O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+
+	/*writes of various sizes, overlapping blocks and partly rewriting previous ones*/
+	memset(expected, 0, sizeof(expected));
+	for (i = 0; i < 1000; i++) expected[i] = (char)('a' + i % 26);
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, expected, 1000, 0), 1000, int, "%i");
+	for (i = 0; i < 30; i++) expected[100 + i] = 'X';
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, expected + 100, 30, 100), 30, int, "%i");
+	/*past the end: the hole reads as zeros*/
+	memcpy(expected + 1150, "tail", 4);
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, "tail", 4, 1150), 4, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 1154, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 0), 1154, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, expected, 1154), 0, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 95), 10, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, expected + 95, 10), 0, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+
+	/*19 blocks of 64 bytes, each one stored with a 12 bytes nonce and a 16 bytes tag, after a 32 bytes header*/
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR);
+	raw_size = bctbx_file_size(f);
+	BC_ASSERT_EQUAL((int)raw_size, 32 + 18 * (28 + 64) + 28 + 2, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, raw, sizeof(raw), 0), (int)raw_size, int, "%i");
+	for (i = 0; i + 26 <= (int)raw_size; i++) {
+		if (memcmp(raw + i, "abcdefghijklmnopqrstuvwxyz", 26) == 0) break;
+	}
+	BC_ASSERT_TRUE(i + 26 > (int)raw_size);
+	/*alter the cipher text of the third block*/
+	raw[32 + 2 * (28 + 64) + 28 + 5] ^= 1;
+	bctbx_file_write(f, raw + 32 + 2 * (28 + 64) + 28 + 5, 1, 32 + 2 * (28 + 64) + 28 + 5);
+	bctbx_file_close(f);
+
+	/*the block size of an existing file is kept, the altered block cannot be read*/
+	f = bctbx_file_open2(reopen_vfs, path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_size(f), 1154, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 128, 0), 128, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, expected, 128), 0, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 130), BCTBX_VFS_ERROR, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 4, 1150), 4, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, "tail", 4), 0, int, "%i");
+	bctbx_file_close(f);
+
+	/*the last block is authenticated when opening*/
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(wrong_vfs, path, O_RDONLY));
+
+	/*a record copied from another file encrypted with the same key, at the same place, cannot be read*/
+	unlink(path);
+	f = bctbx_file_open2(vfs, path, O_RDWR | O_CREAT);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, expected, 1000, 0), 1000, int, "%i");
+	bctbx_file_close(f);
+	f = bctbx_file_open2(vfs, other_path, O_RDWR | O_CREAT | O_TRUNC);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	memset(buf, 'z', 1000);
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, buf, 1000, 0), 1000, int, "%i");
+	bctbx_file_close(f);
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), other_path, O_RDONLY);
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, raw, 28 + 64, 32 + (28 + 64)), 28 + 64, int, "%i");
+	bctbx_file_close(f);
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR);
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, raw, 28 + 64, 32 + (28 + 64)), 28 + 64, int, "%i");
+	bctbx_file_close(f);
+	f = bctbx_file_open2(vfs, path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 64, 0), 64, int, "%i");
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, 10, 64), BCTBX_VFS_ERROR, int, "%i");
+	bctbx_file_close(f);
+
+	/*removing records from the end, at a record boundary or up to the header, is detected when opening*/
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR);
+	BC_ASSERT_EQUAL(bctbx_file_truncate(f, 32 + 10 * (28 + 64)), BCTBX_VFS_OK, int, "%i");
+	bctbx_file_close(f);
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, path, O_RDONLY));
+	f = bctbx_file_open2(bctbx_vfs_get_standard(), path, O_RDWR);
+	BC_ASSERT_EQUAL(bctbx_file_truncate(f, 32), BCTBX_VFS_OK, int, "%i");
+	bctbx_file_close(f);
+	BC_ASSERT_PTR_NULL(bctbx_file_open2(vfs, path, O_RDONLY));
+
+	/*opened write only, as with the "w" mode: the blocks partly written are still read and kept*/
+	unlink(path);
+	f = bctbx_file_open(vfs, path, "w");
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, expected, 100, 0), 100, int, "%i");
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+	f = bctbx_file_open2(vfs, path, O_WRONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_write(f, "XY", 2, 70), 2, int, "%i");
+	BC_ASSERT_TRUE(bctbx_file_read(f, buf, 10, 0) < 0);
+	BC_ASSERT_EQUAL(bctbx_file_close(f), BCTBX_VFS_OK, int, "%i");
+	memcpy(expected + 70, "XY", 2);
+	f = bctbx_file_open2(vfs, path, O_RDONLY);
+	BC_ASSERT_PTR_NOT_NULL(f);
+	if (f == NULL) goto end;
+	BC_ASSERT_EQUAL((int)bctbx_file_read(f, buf, sizeof(buf), 0), 100, int, "%i");
+	BC_ASSERT_EQUAL(memcmp(buf, expected, 100), 0, int, "%i");
+	bctbx_file_close(f);
+end:
+	bctbx_vfs_aes_gcm_destroy(vfs);
+	bctbx_vfs_aes_gcm_destroy(reopen_vfs);
+	bctbx_vfs_aes_gcm_destroy(wrong_vfs);
+	unlink(path);
+	unlink(other_path);
+	bc_free(path);
+	bc_free(other_path);
+}
+#endif
+
+static test_t vfs_tests[] = {
+	TEST_NO_TAG("Memory-mapped VFS", mmap_vfs),
+	TEST_NO_TAG("Parallel readers", parallel_readers),
+	TEST_NO_TAG("Caching VFS", caching_vfs),
+	TEST_NO_TAG("Caching VFS write error", caching_vfs_write_error),
+	TEST_NO_TAG("Line reader", line_reader),
+	TEST_NO_TAG("Vectored I/O", vectored_io),
+	TEST_NO_TAG("Asynchronous operations", async_operations),
+	TEST_NO_TAG("Memory VFS", memory_vfs),
+	TEST_NO_TAG("Truncate", truncate_file),
+	TEST_NO_TAG("Rename and delete", rename_delete),
+	TEST_NO_TAG("Buffered writer", buffered_writer),
+	TEST_NO_TAG("Group commit", group_commit),
+	TEST_NO_TAG("Instrumented VFS", stats_vfs),
+#ifdef HAVE_CRYPTO
+	TEST_NO_TAG("Encrypted VFS", encrypted_vfs),
+#endif
+};
+
+test_suite_t vfs_test_suite = {"VFS", NULL, NULL, NULL, NULL, sizeof(vfs_tests) / sizeof(vfs_tests[0]), vfs_tests};